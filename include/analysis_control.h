@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// Return value of the analyses stopped through a cancellation token (or
+// cancelled before they started).
+constexpr int kAnalysisCancelled = -2;
+// Return value of the analyses stopped at their deadline.
+constexpr int kAnalysisTimeout = -3;
+// Return value of the analyses stopped because the file is over their
+// resource budget.
+constexpr int kAnalysisOverBudget = -4;
+
+// Number of iterations of a per-sample loop between stop checks.
+constexpr uint64_t kAnalysisCheckInterval = 64 * 1024;
+
+// Estimated heap use of an analysis per byte of metadata (moov and moof
+// boxes): the raw moov bytes, the ISOBMFF box tree, and the sample tables.
+constexpr uint64_t kAnalysisBytesPerMetadataByte = 3;
+// Estimated heap use of an analysis per video sample: the per-sample
+// timing lists, plus the temporary copies used to sort them and to derive
+// their statistics.
+constexpr uint64_t kAnalysisBytesPerSample = 160;
+
+// Resource budget of an analysis. Each limit is 0 for no limit. The limits
+// are checked from the box headers and table entry counts before the
+// matching allocations, so a corrupt or hostile file fails cleanly instead
+// of exhausting the memory.
+struct AnalysisBudget {
+  // max_samples: Largest number of video samples (sum of the stts and
+  // ctts sample counts of a track).
+  uint64_t max_samples = 0;
+  // max_table_entries: Largest number of timing table entries (stts, ctts,
+  // and stss) of a track.
+  uint64_t max_table_entries = 0;
+  // max_moov_size: Largest size of the metadata boxes (moov and moof).
+  uint64_t max_moov_size = 0;
+  // max_memory_bytes: Largest estimated heap use of the analysis (see
+  // kAnalysisBytesPerMetadataByte and kAnalysisBytesPerSample).
+  uint64_t max_memory_bytes = 0;
+
+  bool is_limited() const {
+    return max_samples > 0 || max_table_entries > 0 || max_moov_size > 0 ||
+           max_memory_bytes > 0;
+  }
+};
+
+// Cancellation token. It is shared between the caller and the analyses it
+// starts (see LiblcvmConfig::cancellation_token), and can be cancelled
+// from any thread.
+class CancellationToken {
+ public:
+  void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+  bool is_cancelled() const {
+    return cancelled.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<bool> cancelled{false};
+};
+
+// Cooperative stop control of an analysis.
+//
+// parse() checks it between stages, and every kAnalysisCheckInterval
+// samples in the per-sample loops, so a corrupt file (e.g. with huge stts
+// sample counts) cannot keep a thread busy past the deadline. It also
+// enforces the resource budget of the analysis. Once an analysis must
+// stop, it keeps stopping (the stop code is sticky).
+class AnalysisControl {
+ public:
+  AnalysisControl() = default;
+
+  // @brief Start controlling an analysis.
+  //
+  // @param[in] cancellation_token: Cancellation token (or nullptr).
+  // @param[in] timeout_ms: Analysis timeout, from now (0 for no deadline).
+  AnalysisControl(std::shared_ptr<const CancellationToken> cancellation_token,
+                  int timeout_ms)
+      : token(std::move(cancellation_token)), has_deadline(timeout_ms > 0) {
+    if (has_deadline) {
+      deadline = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(timeout_ms);
+    }
+  }
+
+  // @brief Check whether the analysis must stop.
+  //
+  // @return int: 0 to continue, kAnalysisCancelled or kAnalysisTimeout to
+  // stop.
+  int check() {
+    if (stop_code == 0) {
+      if (token != nullptr && token->is_cancelled()) {
+        stop_code = kAnalysisCancelled;
+      } else if (has_deadline && std::chrono::steady_clock::now() >= deadline) {
+        stop_code = kAnalysisTimeout;
+      }
+    }
+    return stop_code;
+  }
+
+  // @brief Same as check(), but only checks every kAnalysisCheckInterval
+  // iterations of a per-sample loop.
+  //
+  // @param[in] iteration: Loop iteration.
+  // @return int: 0 to continue, kAnalysisCancelled or kAnalysisTimeout to
+  // stop.
+  int check(uint64_t iteration) {
+    return (iteration % kAnalysisCheckInterval == 0) ? check() : stop_code;
+  }
+
+  // @brief Stop the analysis (e.g. when it is over its budget).
+  //
+  // @param[in] code: Stop code (kept only if the analysis was not already
+  // stopped).
+  void stop(int code) {
+    if (stop_code == 0) {
+      stop_code = code;
+    }
+  }
+
+  int get_stop_code() const { return stop_code; }
+
+  void set_budget(const AnalysisBudget& analysis_budget) {
+    budget = analysis_budget;
+  }
+  const AnalysisBudget& get_budget() const { return budget; }
+
+  // @brief Check the size of the metadata boxes against the budget, before
+  // reading them. The metadata also counts toward the heap budget. An
+  // analysis over this budget must stop.
+  //
+  // @param[in] size: Size of the moov and moof boxes (bytes).
+  // @return int: 0 to continue, kAnalysisOverBudget (or another stop code)
+  // to stop.
+  int check_metadata_size(uint64_t size) {
+    metadata_size = size;
+    if ((budget.max_moov_size > 0 && size > budget.max_moov_size) ||
+        (budget.max_memory_bytes > 0 &&
+         size > budget.max_memory_bytes / kAnalysisBytesPerMetadataByte)) {
+      stop(kAnalysisOverBudget);
+    }
+    return stop_code;
+  }
+
+  // @brief Check the timing tables of a track against the budget, before
+  // decoding them.
+  //
+  // @param[in] num_entries: Number of timing table entries.
+  // @param[in] num_samples: Number of samples.
+  // @return int: 0 if within the budget, kAnalysisOverBudget otherwise (the
+  // caller either stops the analysis, or skips the per-sample stages).
+  int check_tables(uint64_t num_entries, uint64_t num_samples) const {
+    uint64_t metadata_bytes = metadata_size * kAnalysisBytesPerMetadataByte;
+    if ((budget.max_table_entries > 0 &&
+         num_entries > budget.max_table_entries) ||
+        (budget.max_samples > 0 && num_samples > budget.max_samples) ||
+        (budget.max_memory_bytes > 0 &&
+         (metadata_bytes > budget.max_memory_bytes ||
+          num_samples > (budget.max_memory_bytes - metadata_bytes) /
+                            kAnalysisBytesPerSample))) {
+      return kAnalysisOverBudget;
+    }
+    return 0;
+  }
+
+ private:
+  // token: Cancellation token (nullptr if none).
+  std::shared_ptr<const CancellationToken> token;
+  // has_deadline: Whether the analysis has a deadline.
+  bool has_deadline = false;
+  std::chrono::steady_clock::time_point deadline;
+  // stop_code: Why the analysis must stop (0 if it must not).
+  int stop_code = 0;
+  // budget: Resource budget.
+  AnalysisBudget budget;
+  // metadata_size: Size of the metadata boxes (bytes, 0 if unknown).
+  uint64_t metadata_size = 0;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "async_analyzer.h"
+#include "liblcvm.h"
+
+// Analysis server protocol (lcvm --serve).
+//
+// Requests and responses are sent over a Unix domain (stream) socket as
+// frames: a 4-byte big-endian payload length, followed by the payload.
+// * request: the name of a file to analyze. A request can instead pass an
+//   open file descriptor (SCM_RIGHTS), e.g. for files the server cannot
+//   open by name. The name is then only used as the "infile" value (and
+//   can be empty).
+// * response: one per request, in completion order. The payload is text:
+//   a "<request number>,<error code>" line (requests are numbered from 0 in
+//   each connection), followed, if the analysis succeeded, by a CSV header
+//   line and a CSV value line.
+// The server answers all the requests of a connection before closing it,
+// so a client can shut down its write side after the last request, and
+// read responses until the end of the stream.
+
+// Largest frame payload size.
+constexpr uint32_t kServerMaxFrameSize = 1024 * 1024;
+// Largest number of unanswered requests of a connection. The server stops
+// reading requests past it, which pushes back on the client.
+constexpr size_t kServerMaxInFlight = 64;
+
+// @brief Write a frame.
+//
+// @param[in] fd: Socket.
+// @param[in] payload: Frame payload.
+// @param[in] passed_fd: File descriptor to pass with the frame (-1 if
+// none).
+// @return int: Error code (0 if ok, !=0 otherwise).
+int write_frame(int fd, const std::string& payload, int passed_fd = -1);
+
+// @brief Read a frame.
+//
+// @param[in] fd: Socket.
+// @param[out] payload: Frame payload.
+// @param[out] passed_fd: File descriptor passed with the frame (-1 if
+// none), or nullptr to close any passed file descriptor.
+// @return int: Error code (0 if ok, 1 at the end of the stream, -1
+// otherwise, e.g. a truncated or oversized frame).
+int read_frame(int fd, std::string* payload, int* passed_fd);
+
+// Analysis server. It keeps its warm state (analysis threads, compiled
+// policy, moov and result caches) across the requests of all the
+// connections.
+class AnalysisServer {
+ public:
+  // @brief Start the analysis threads.
+  //
+  // @param[in] server_config: Parsing configuration (of all the requests).
+  // @param[in] num_threads: Number of analysis threads.
+  AnalysisServer(const LiblcvmConfig& server_config, int num_threads);
+  // @brief Wait for the running analyses. serve() must have returned.
+  ~AnalysisServer();
+  AnalysisServer(const AnalysisServer&) = delete;
+  AnalysisServer& operator=(const AnalysisServer&) = delete;
+
+  // @brief Serve requests on a Unix domain socket until stop() is called. A
+  // stale socket file is replaced, but any other file at the socket path
+  // makes it fail.
+  //
+  // @param[in] socket_path: Socket path.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. cannot listen, or
+  // the socket path is not a socket).
+  int serve(const char* socket_path);
+
+  // @brief Stop serving. It can be called from any thread, and from a
+  // signal handler. serve() returns once the open connections got their
+  // pending responses.
+  void stop();
+
+ private:
+  // @brief Serve the requests of a connection.
+  void serve_connection(int fd);
+
+  // @brief Run a request.
+  //
+  // @param[in] name: Request name.
+  // @param[in] passed_fd: Passed file descriptor (-1 if none, closed when
+  // the analysis completes).
+  // @param[in] callback: Completion callback.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. stopping).
+  int submit(const std::string& name, int passed_fd,
+             AsyncAnalyzer::Callback callback);
+
+  // liblcvm_config: Parsing configuration.
+  const LiblcvmConfig liblcvm_config;
+  // analyzer: Analysis thread pool (shared by all the connections).
+  AsyncAnalyzer analyzer;
+  // wake_pipe: Pipe through which stop() wakes serve() up.
+  int wake_pipe[2] = {-1, -1};
+  // stopping: Whether stop() was called.
+  std::atomic<bool> stopping{false};
+  std::mutex mutex;
+  std::condition_variable connections_done;
+  // connection_fds: Open connection sockets.
+  std::vector<int> connection_fds;
+  // num_connections: Number of connection threads.
+  size_t num_connections = 0;
+};
+
+// @brief Send requests to an analysis server, and get the responses.
+//
+// @param[in] socket_path: Server socket path.
+// @param[in] infile_list: Names of the files.
+// @param[in] pass_fds: Whether to open the files, and pass their file
+// descriptors (instead of their names).
+// @param[in] callback: Called with each response payload (from the
+// calling thread, in completion order).
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. cannot connect, or
+// missing responses).
+int analysis_client(const char* socket_path,
+                    const std::vector<std::string>& infile_list, bool pass_fds,
+                    const std::function<void(const std::string&)>& callback);
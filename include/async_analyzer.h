@@ -0,0 +1,112 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_pipeline.h"
+#include "liblcvm.h"
+
+// Asynchronous analyzer.
+//
+// Analyses are submitted without blocking, and run on a pool of threads
+// owned by the analyzer. Each submitted analysis completes exactly once,
+// either through a completion callback (called from a pool thread), or
+// through a future. The number of queued (not started) analyses is
+// bounded: submit() fails instead of blocking when the queue is full, so
+// an event-driven caller never waits on the analyzer. Analyses can be
+// cancelled, whether queued or running (they complete with ret =
+// kAnalysisCancelled).
+class AsyncAnalyzer {
+ public:
+  // Completion callback. The result index is the analysis id.
+  using Callback = std::function<void(BatchResult&)>;
+
+  // @brief Start the thread pool.
+  //
+  // @param[in] num_threads: Number of analysis threads.
+  // @param[in] max_depth: Largest number of queued analyses.
+  AsyncAnalyzer(int num_threads, size_t max_depth);
+  // @brief Cancel the queued analyses, and wait for the running ones.
+  ~AsyncAnalyzer();
+  AsyncAnalyzer(const AsyncAnalyzer&) = delete;
+  AsyncAnalyzer& operator=(const AsyncAnalyzer&) = delete;
+
+  // @brief Submit an analysis, with a completion callback.
+  //
+  // @param[in] infile: Name of the file.
+  // @param[in] liblcvm_config: Parsing configuration.
+  // @param[in] calculate_timestamps: Whether to get the timing lists.
+  // @param[in] callback: Completion callback (called from a pool thread).
+  // @param[out] id: Analysis id (for cancel()), or nullptr.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the queue is
+  // full). The callback is only called when the analysis was submitted.
+  int submit(const std::string& infile, const LiblcvmConfig& liblcvm_config,
+             bool calculate_timestamps, Callback callback,
+             uint64_t* id = nullptr);
+
+  // @brief Submit an analysis, with a future.
+  //
+  // @param[in] infile: Name of the file.
+  // @param[in] liblcvm_config: Parsing configuration.
+  // @param[in] calculate_timestamps: Whether to get the timing lists.
+  // @param[out] future: Result of the analysis.
+  // @param[out] id: Analysis id (for cancel()), or nullptr.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the queue is
+  // full).
+  int submit(const std::string& infile, const LiblcvmConfig& liblcvm_config,
+             bool calculate_timestamps, std::future<BatchResult>* future,
+             uint64_t* id = nullptr);
+
+  // @brief Cancel an analysis. A queued analysis completes (with ret =
+  // kAnalysisCancelled) from the calling thread. A running analysis is
+  // stopped at its next stop check (see AnalysisControl), and completes
+  // from its pool thread. Analyses submitted with their own cancellation token
+  // (LiblcvmConfig::cancellation_token) can only be cancelled while queued.
+  //
+  // @param[in] id: Analysis id.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the analysis
+  // already completed).
+  int cancel(uint64_t id);
+
+  // @brief Get the number of queued analyses.
+  size_t get_queue_depth();
+
+ private:
+  struct Request {
+    uint64_t id;
+    std::string infile;
+    LiblcvmConfig liblcvm_config;
+    bool calculate_timestamps;
+    Callback callback;
+    // token: Cancellation token owned by the analyzer (nullptr if the
+    // caller set one in the configuration).
+    std::shared_ptr<CancellationToken> token;
+  };
+
+  // @brief Pool thread loop.
+  void run();
+
+  // max_queue_depth: Largest number of queued analyses.
+  const size_t max_queue_depth;
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  // queue: Queued analyses (in submission order).
+  std::deque<Request> queue;
+  // running: Cancellation tokens of the running analyses (by id).
+  std::map<uint64_t, std::shared_ptr<CancellationToken>> running;
+  // next_id: Id of the next analysis.
+  uint64_t next_id = 1;
+  // stopping: Whether the analyzer is being destroyed.
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "liblcvm.h"
+
+// Bounded multi-producer multi-consumer queue. push() blocks while the
+// queue is full (back-pressure), and pop() blocks while it is empty. Once
+// closed, push() fails, and pop() drains the remaining items.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t max_size)
+      : capacity(max_size > 0 ? max_size : 1) {}
+
+  // @brief Add an item (blocks while the queue is full).
+  //
+  // @return bool: Whether the item was added (false if closed).
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // @brief Remove the oldest item (blocks while the queue is empty).
+  //
+  // @return bool: Whether an item was removed (false if closed and empty).
+  bool pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty()) {
+      return false;
+    }
+    *item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // @brief Close the queue (wakes up all the waiting threads).
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+ private:
+  // capacity: Largest number of items in the queue.
+  const size_t capacity;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> items;
+  bool closed = false;
+};
+
+// Result of a file in a batch.
+struct BatchResult {
+  // index: Position of the file in the input list.
+  size_t index = 0;
+  std::string infile;
+  // ret: parse_to_lists() return value (0 if ok).
+  int ret = 0;
+  LiblcvmKeyList keys;
+  LiblcvmValList vals;
+  LiblcvmKeyList keys_timing;
+  LiblcvmTimingList vals_timing;
+};
+
+// Sizes of the batch pipeline stages.
+struct BatchPipelineConfig {
+  // prefetch_threads: Number of threads reading the moov boxes ahead.
+  int prefetch_threads = 1;
+  // prefetch_depth: Number of prefetched files waiting for a compute
+  // thread.
+  int prefetch_depth = 8;
+  // compute_threads: Number of threads running the analysis.
+  int compute_threads = 1;
+  // reorder_depth: Largest distance (in files) between the file being
+  // written and the files being prefetched or analyzed (bounds the number
+  // of finished files waiting for an earlier, slower file). The pipeline
+  // raises it to the number of files its stages can hold (see
+  // get_reorder_window()).
+  int reorder_depth = 16;
+  // largest_first: Whether to analyze the files of the reorder window in
+  // decreasing order of estimated cost (see get_batch_cost()) instead of
+  // in input order. The costs are read as the files enter the window, so
+  // the order only applies within it: a large file near the end of the
+  // list still starts near the end. The results are still written in
+  // input order as they complete.
+  bool largest_first = false;
+};
+
+// @brief Get the reorder window of a batch pipeline: reorder_depth, but at
+// least the number of files its stages can hold (compute_threads +
+// prefetch_threads + prefetch_depth), so that a slow file being waited for
+// does not leave the other compute threads idle.
+//
+// @param[in] pipeline_config: Stage sizes.
+// @return size_t: Largest number of files in the pipeline.
+size_t get_reorder_window(const BatchPipelineConfig& pipeline_config);
+
+// @brief Get the estimated analysis cost of a file: the size of its
+// metadata boxes (see get_metadata_box_size()), or its file size if they
+// cannot be found (0 if the file cannot be read). It only reads the box
+// headers.
+//
+// @param[in] infile: Input file.
+// @return uint64_t: Estimated cost.
+uint64_t get_batch_cost(const std::string& infile);
+
+// @brief Analyze a batch of files with a 3-stage pipeline:
+// 1. prefetch: read the moov box of the next files ahead (so the compute
+//    stage finds them in the page cache), through a bounded queue.
+// 2. compute: run parse_to_lists() (timing, SPS, and policy work).
+// 3. write: call the writer with the results, in input order, from the
+//    calling thread.
+// Each stage is sized independently (BatchPipelineConfig), and a full
+// queue blocks the stage that feeds it. The files enter the pipeline in
+// input order, or largest-first (get_batch_cost()) within the reorder
+// window, and the compute threads share a single queue, so a thread is
+// never idle while files are waiting.
+//
+// @param[in] infile_list: Input files.
+// @param[in] liblcvm_config: Parsing configuration.
+// @param[in] calculate_timestamps: Whether to get the timing lists.
+// @param[in] pipeline_config: Stage sizes.
+// @param[in] writer: Result consumer (called once per file, in order).
+// @return int: Number of files that could not be parsed.
+int run_batch_pipeline(const std::vector<std::string>& infile_list,
+                       const LiblcvmConfig& liblcvm_config,
+                       bool calculate_timestamps,
+                       const BatchPipelineConfig& pipeline_config,
+                       const std::function<void(BatchResult&)>& writer);
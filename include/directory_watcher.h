@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Directory watcher (lcvm --watch).
+//
+// Reports the media files of a directory once their writers are done with
+// them: files closed after being written (IN_CLOSE_WRITE), and files moved
+// into the directory (IN_MOVED_TO, e.g. by tools that write a temporary
+// file, and rename it when complete). Events are debounced: a file is only
+// reported once it got no event for the debounce delay, so a file that is
+// closed several times while being written is reported once. Files that
+// were in the directory before start() are not reported. If the inotify
+// queue overflows (e.g. the callback is too slow to keep up), the events
+// are lost: the directory is rescanned for the media files written since
+// the last read, and a warning is printed.
+
+// @brief Check whether a file name is a media file name (by extension).
+// Hidden files (e.g. temporary files being written) are not.
+//
+// @param[in] name: File name.
+// @return bool: Whether the file name is a media file name.
+bool is_media_file_name(const std::string& name);
+
+class DirectoryWatcher {
+ public:
+  // Called with the path of each reported file.
+  using Callback = std::function<void(const std::string&)>;
+
+  // @param[in] watch_dir: Directory to watch.
+  // @param[in] debounce_ms: Debounce delay (in milliseconds).
+  DirectoryWatcher(const std::string& watch_dir, int debounce_ms);
+  ~DirectoryWatcher();
+  DirectoryWatcher(const DirectoryWatcher&) = delete;
+  DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+  // @brief Start watching the directory. Files closed or moved into the
+  // directory from now on are reported by run().
+  //
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. not a directory,
+  // or inotify is not supported).
+  int start();
+
+  // @brief Report the files (from the calling thread) until stop() is
+  // called. The files closed or moved before stop() that were not reported
+  // yet (e.g. during their debounce delay) are reported when stopping.
+  //
+  // @param[in] callback: Called with each file path.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the directory
+  // was removed).
+  int run(Callback callback);
+
+  // @brief Stop run(). It can be called from any thread, and from a signal
+  // handler.
+  void stop();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  using FileClock = std::filesystem::file_time_type::clock;
+
+  // @brief Read the pending inotify events.
+  //
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the directory
+  // was removed).
+  int read_events();
+
+  // @brief Add the media files written since the previous read of the
+  // events to the pending files (after a queue overflow).
+  void scan_files();
+
+  // @brief Report the files whose debounce delay is over.
+  //
+  // @param[in] all: Whether to report all the pending files.
+  // @param[in] callback: Called with each file path.
+  void report_files(bool all, const Callback& callback);
+
+  // dir: Watched directory.
+  const std::string dir;
+  // debounce: Debounce delay.
+  const std::chrono::milliseconds debounce;
+  // inotify_fd: inotify instance (-1 until start()).
+  int inotify_fd = -1;
+  // wake_pipe: Pipe through which stop() wakes run() up.
+  int wake_pipe[2] = {-1, -1};
+  // stopping: Whether stop() was called.
+  std::atomic<bool> stopping{false};
+  // pending: Files not reported yet, with the time of their last event.
+  std::map<std::string, Clock::time_point> pending;
+  // scan_time: Time of the previous read of the events (or of start()).
+  FileClock::time_point scan_time;
+};
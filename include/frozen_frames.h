@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "analysis_control.h"
+#include "sample_table.h"
+
+// Frozen (repeated) frame detector.
+//
+// Encoders fed with a frozen source keep producing frames, but the frames
+// repeat the previous one: non-keyframes that are near-zero size, and whose
+// slices are inter-coded (P/B) with every block skipped. The detector works
+// in the compressed domain, and without decoding any pixels:
+// * candidates are the non-keyframes that are a small fraction of the
+//   median non-keyframe size (sample size column, no reads).
+// * each candidate is confirmed by reading the first bytes of the sample
+//   (chunk offset index), and checking the type of its first slice: a
+//   frame that small with an inter-coded slice has (almost) no residual or
+//   motion information left, so it repeats the reference frame.
+// * runs of at least kFrozenFrameMinCount confirmed frames (in decode order)
+//   are reported as frozen segments.
+// Only the candidates are read, and only their first kFrozenFrameReadSize
+// bytes, in a single batch of coalesced reads (see range_reader.h).
+
+// Candidates are the non-keyframes smaller than kFrozenFrameSizeRatio times
+// the median non-keyframe size, and than kFrozenFrameMaxSize bytes.
+constexpr double kFrozenFrameSizeRatio = 0.05;
+constexpr uint32_t kFrozenFrameMaxSize = 1024;
+constexpr uint32_t kFrozenFrameReadSize = 256;
+constexpr uint32_t kFrozenFrameMinCount = 3;
+
+// Run of frozen frames.
+struct FrozenFrameSegment {
+  // first_sample: Index of the first frozen sample (0-based, decode order).
+  uint32_t first_sample;
+  // num_samples: Number of frozen samples.
+  uint32_t num_samples;
+};
+
+// @brief Detect the frozen frames of the video track of an ISOBMFF file.
+//
+// @param[in] infile: Name of the file.
+// @param[in] table: Video track sample tables.
+// @param[in] keyframe_sample_number_list: Keyframes (stss sample numbers,
+// starting at 1).
+// @param[out] segments: Frozen frame segments.
+// @param[in] debug: Debug level.
+// @param[in] control: Stop control of the analysis (or nullptr), checked
+// every kAnalysisCheckInterval samples.
+// @return int: Error code (0 if ok, the stop code if the analysis must
+// stop, -1 otherwise, e.g. the codec is not H.264 or H.265).
+int detect_frozen_frames(
+    const char* infile, SampleTable* table,
+    const std::vector<uint32_t>& keyframe_sample_number_list,
+    std::vector<FrozenFrameSegment>* segments, int debug,
+    AnalysisControl* control = nullptr);
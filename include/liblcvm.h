@@ -4,6 +4,8 @@
 // A show case of using [ISOBMFF](https://github.com/DigiDNA/ISOBMFF) to
 // detect frame dups and video freezes in ISOBMFF files.
 
+#pragma once
+
 #include <stdlib.h>
 
 #include <ISOBMFF.hpp>
@@ -16,10 +18,15 @@
 #include <list>
 #include <map>
 #include <numeric>
+#include <set>
 #include <tuple>
 #include <variant>
 #include <vector>
 
+#include "analysis_control.h"
+#include "frozen_frames.h"
+#include "sample_table.h"
+
 #define DECL_GETTER(name, type) \
   type get_##name() const { return this->name; }
 
@@ -78,6 +85,17 @@ class TimingInformation {
   double audio_video_ratio;
   // video_freeze: Whether there is a video freeze.
   bool video_freeze;
+  // frozen_segment_list: Frozen (repeated) frame segments (only with
+  // LiblcvmConfig::frozen_frames).
+  std::vector<FrozenFrameSegment> frozen_segment_list;
+  // frozen_frame_count: Number of frozen frames (in frozen segments, -1 if
+  // the frozen frame detector is disabled).
+  int frozen_frame_count;
+  // frozen_segment_count: Number of frozen segments (-1 if disabled).
+  int frozen_segment_count;
+  // frozen_duration_sec: Total length of the frozen segments (seconds, -1
+  // if disabled).
+  double frozen_duration_sec;
   // frame_rate_fps_list: Vector of per-frame frame rates (fps).
   std::vector<double> frame_rate_fps_list;
   // frame_rate_fps_median: Frame rate (median, fps).
@@ -123,6 +141,10 @@ class TimingInformation {
   DECL_GETTER(key_frame_ratio, double)
   DECL_GETTER(audio_video_ratio, double)
   DECL_GETTER(video_freeze, bool)
+  DECL_GETTER(frozen_segment_list, std::vector<FrozenFrameSegment>)
+  DECL_GETTER(frozen_frame_count, int)
+  DECL_GETTER(frozen_segment_count, int)
+  DECL_GETTER(frozen_duration_sec, double)
   DECL_GETTER(frame_rate_fps_list, std::vector<double>)
   DECL_GETTER(frame_rate_fps_median, double)
   DECL_GETTER(frame_rate_fps_average, double)
@@ -141,8 +163,40 @@ class TimingInformation {
       std::shared_ptr<ISOBMFF::ContainerBox> stbl,
       std::shared_ptr<IsobmffFileInformation> ptr, int debug);
 
+  // @brief Same as parse_timing_information(), but decoding the stts and
+  // ctts entries in place from the raw moov box bytes.
+  static int parse_raw_timing_information(
+      const TimingTableView& tables, uint32_t timescale_track_hz,
+      std::shared_ptr<IsobmffFileInformation> ptr, int debug);
+
+  // @brief Same as parse_keyframe_information(), but decoding the stss
+  // entries in place from the raw moov box bytes.
+  static int parse_raw_keyframe_information(
+      const TimingTableView& tables,
+      std::shared_ptr<IsobmffFileInformation> ptr, int debug);
+
+  // @brief Derive the timing statistics. With more than 1 thread, the
+  // sort, sums, medians, and drop scan run in parallel (see
+  // parallel_stats.h).
   static int derive_timing_info(std::shared_ptr<IsobmffFileInformation> ptr,
-                                bool sort_by_pts, int debug);
+                                bool sort_by_pts, int debug,
+                                int num_threads = 1);
+
+  // @brief Derive the audio/video ratio and video freeze info (only needs
+  // the track durations).
+  static void derive_audio_video_info(
+      std::shared_ptr<IsobmffFileInformation> ptr, int debug);
+
+  // @brief Detect the frozen (repeated) frames (needs the video sample
+  // tables, and the timing and keyframe info).
+  static int derive_frozen_frame_info(
+      std::shared_ptr<IsobmffFileInformation> ptr, int debug);
+
+  // @brief Get the DTS list in decode order (dts_sec_list follows the PTS
+  // order when the frames are sorted by PTS).
+  //
+  // @param[out] dts_decode_sec_list: DTS list (decode order).
+  void get_dts_decode_sec_list(std::vector<double>* dts_decode_sec_list) const;
 
   // @param[in] percentile_list: Percentile list.
   // @param[out] frame_drop_length_percentile_list: Frame drop length percentile
@@ -158,6 +212,7 @@ class TimingInformation {
       std::vector<long int>& frame_drop_length_consecutive, int debug);
 
   friend class IsobmffFileInformation;
+  friend class FrameInformation;
 };
 
 class AudioInformation {
@@ -188,6 +243,26 @@ class FrameInformation {
   int filesize;
   // bitrate_bps: Video bitrate (bps).
   double bitrate_bps;
+  // sample_table: Video sample tables (from stsz/stz2).
+  SampleTable sample_table;
+  // video_bitrate_bps: Video bitrate (bps), from the video sample sizes
+  // (excludes audio and container overhead).
+  double video_bitrate_bps;
+  // video_bitrate_bps_peak: Peak video bitrate (bps), over a sliding window
+  // of BITRATE_WINDOW_SEC (in decode order).
+  double video_bitrate_bps_peak;
+  // video_bitrate_bps_window_list: Video bitrate (bps) of consecutive
+  // windows of BITRATE_WINDOW_SEC (in decode order, at most the video
+  // duration).
+  std::vector<double> video_bitrate_bps_window_list;
+  // keyframe_size_bytes_average: Average size of the keyframes (bytes).
+  double keyframe_size_bytes_average;
+  // non_keyframe_size_bytes_average: Average size of the non-keyframes
+  // (P/B frames) (bytes).
+  double non_keyframe_size_bytes_average;
+  // keyframe_size_ratio: Average keyframe size over average non-keyframe
+  // size.
+  double keyframe_size_ratio;
   // width: Video width.
   double width;
   // height: Video height.
@@ -233,6 +308,13 @@ class FrameInformation {
  public:
   DECL_GETTER(filesize, int)
   DECL_GETTER(bitrate_bps, double)
+  DECL_GETTER(sample_table, SampleTable)
+  DECL_GETTER(video_bitrate_bps, double)
+  DECL_GETTER(video_bitrate_bps_peak, double)
+  DECL_GETTER(video_bitrate_bps_window_list, std::vector<double>)
+  DECL_GETTER(keyframe_size_bytes_average, double)
+  DECL_GETTER(non_keyframe_size_bytes_average, double)
+  DECL_GETTER(keyframe_size_ratio, double)
   DECL_GETTER(width, double)
   DECL_GETTER(height, double)
   DECL_GETTER(video_codec_type, std::string)
@@ -259,7 +341,14 @@ class FrameInformation {
   static int derive_frame_info(std::shared_ptr<IsobmffFileInformation> ptr,
                                bool sort_by_pts, int debug);
 
+  // @brief Derive the video bitrate values from the video sample sizes
+  // (read from the moov box bytes, or from the file if moov is nullptr).
+  static int derive_bitrate_info(std::shared_ptr<IsobmffFileInformation> ptr,
+                                 const uint8_t* moov, size_t moov_size,
+                                 int debug);
+
   friend class IsobmffFileInformation;
+  friend class TimingInformation;
 };
 
 using LiblcvmValue =
@@ -275,6 +364,24 @@ using LiblcvmTimingList = std::vector<LiblcvmTiming>;
 
 int liblcvmvalue_to_double(const LiblcvmValue& value, double* result);
 int liblcvmvalue_to_string(const LiblcvmValue& value, std::string* result);
+// @brief Escape a value as a CSV field (quoted if it contains a comma, a
+// quote, or a newline).
+std::string csv_escape(const std::string& value);
+// @brief Escape a value as a (quoted) JSON string.
+std::string json_escape(const std::string& value);
+// @brief Convert a value to JSON (a string, a number, or null for the
+// non-finite numbers).
+int liblcvmvalue_to_json(const LiblcvmValue& value, std::string* result);
+// @brief Map the columns of a CSV header to a key list, by name (e.g. to
+// combine CSV files whose columns are in a different order).
+//
+// @param[in] keys: Key list.
+// @param[in] header: Column names of the CSV header.
+// @param[out] columns: Index of the header column of every key.
+// @return int: Error code (0 if ok, !=0 if the header does not have
+// exactly the same columns as the key list).
+int get_column_map(const LiblcvmKeyList& keys, const LiblcvmKeyList& header,
+                   std::vector<size_t>* columns);
 
 class LiblcvmConfig {
  private:
@@ -282,6 +389,65 @@ class LiblcvmConfig {
   bool sort_by_pts;
   // policy: Warn/Error policy.
   std::string policy;
+  // policy_only: Whether the caller only needs the policy results. When set
+  // (and a policy is provided), parse() only runs the analysis stages the
+  // policy columns depend on, and leaves the other values unset (zero).
+  bool policy_only;
+  // policy_first_error: Whether to only run the policy error rules, and stop
+  // at the first match (warn_list stays empty, and error_list has at most
+  // one message).
+  bool policy_first_error;
+  // cache_dir: Result cache directory (empty to disable the cache). Cached
+  // results are reused while the file identity (device, inode, size, and
+  // mtime), the library version, and the configuration stay the same.
+  std::string cache_dir;
+  // cache_hash_moov: Whether the cache key also includes a hash of the moov
+  // box (catches in-place rewrites that keep size and mtime).
+  bool cache_hash_moov;
+  // moov_cache: Whether to reuse the analysis of previous files with a
+  // byte-identical moov box (in-process). Only the file size and bitrate
+  // (and the frozen frames) are derived again.
+  bool moov_cache;
+  // frozen_frames: Whether to run the frozen (repeated) frame detector. It
+  // reads the first bytes of the near-zero size non-keyframes (see
+  // frozen_frames.h).
+  bool frozen_frames;
+  // mmap_input: Whether the raw moov box readers (moov cache hash, sample
+  // tables) read from a memory mapping of the file instead of through stdio
+  // (see mapped_file.h).
+  bool mmap_input;
+  // parallel_timing_threshold: Number of video frames from which the timing
+  // statistics are derived in parallel (0 to disable). The parallel results
+  // are deterministic, but the averages may differ from the serial ones in
+  // the last bits.
+  int parallel_timing_threshold;
+  // parallel_timing_threads: Number of threads for the parallel timing
+  // statistics (0 for the number of hardware threads).
+  int parallel_timing_threads;
+  // cancellation_token: Token to stop the analyses from another thread
+  // (nullptr if none). Cancelled analyses return kAnalysisCancelled.
+  std::shared_ptr<CancellationToken> cancellation_token;
+  // timeout_ms: Per-analysis timeout (0 for no timeout). Analyses that run
+  // past it return kAnalysisTimeout.
+  int timeout_ms;
+  // max_samples: Largest number of video samples of an analysis (0 for no
+  // limit).
+  uint64_t max_samples;
+  // max_table_entries: Largest number of timing table entries (stts, ctts,
+  // and stss) of an analysis (0 for no limit).
+  uint64_t max_table_entries;
+  // max_moov_size: Largest size of the metadata boxes (moov and moof) of an
+  // analysis (bytes, 0 for no limit).
+  uint64_t max_moov_size;
+  // max_memory_bytes: Largest estimated heap use of an analysis (bytes, 0
+  // for no limit).
+  uint64_t max_memory_bytes;
+  // budget_summary_only: Whether analyses whose sample tables are over the
+  // budget (max_samples, max_table_entries, max_memory_bytes) only derive
+  // the summary (track-level) values, instead of returning
+  // kAnalysisOverBudget. Files whose metadata is over the budget always
+  // fail.
+  bool budget_summary_only;
   // debug: Debug level.
   int debug;
 
@@ -289,6 +455,22 @@ class LiblcvmConfig {
   LiblcvmConfig() {
     sort_by_pts = true;
     policy = "";
+    policy_only = false;
+    policy_first_error = false;
+    cache_dir = "";
+    cache_hash_moov = false;
+    moov_cache = false;
+    frozen_frames = false;
+    mmap_input = false;
+    parallel_timing_threshold = 0;
+    parallel_timing_threads = 0;
+    cancellation_token = nullptr;
+    timeout_ms = 0;
+    max_samples = 0;
+    max_table_entries = 0;
+    max_moov_size = 0;
+    max_memory_bytes = 0;
+    budget_summary_only = false;
     debug = 0;
   }
 
@@ -296,6 +478,38 @@ class LiblcvmConfig {
   DECL_SETTER(sort_by_pts, bool)
   DECL_GETTER(policy, std::string)
   DECL_SETTER(policy, std::string)
+  DECL_GETTER(policy_only, bool)
+  DECL_SETTER(policy_only, bool)
+  DECL_GETTER(policy_first_error, bool)
+  DECL_SETTER(policy_first_error, bool)
+  DECL_GETTER(cache_dir, std::string)
+  DECL_SETTER(cache_dir, std::string)
+  DECL_GETTER(cache_hash_moov, bool)
+  DECL_SETTER(cache_hash_moov, bool)
+  DECL_GETTER(moov_cache, bool)
+  DECL_SETTER(moov_cache, bool)
+  DECL_GETTER(frozen_frames, bool)
+  DECL_SETTER(frozen_frames, bool)
+  DECL_GETTER(mmap_input, bool)
+  DECL_SETTER(mmap_input, bool)
+  DECL_GETTER(parallel_timing_threshold, int)
+  DECL_SETTER(parallel_timing_threshold, int)
+  DECL_GETTER(parallel_timing_threads, int)
+  DECL_SETTER(parallel_timing_threads, int)
+  DECL_GETTER(cancellation_token, std::shared_ptr<CancellationToken>)
+  DECL_SETTER(cancellation_token, std::shared_ptr<CancellationToken>)
+  DECL_GETTER(timeout_ms, int)
+  DECL_SETTER(timeout_ms, int)
+  DECL_GETTER(max_samples, uint64_t)
+  DECL_SETTER(max_samples, uint64_t)
+  DECL_GETTER(max_table_entries, uint64_t)
+  DECL_SETTER(max_table_entries, uint64_t)
+  DECL_GETTER(max_moov_size, uint64_t)
+  DECL_SETTER(max_moov_size, uint64_t)
+  DECL_GETTER(max_memory_bytes, uint64_t)
+  DECL_SETTER(max_memory_bytes, uint64_t)
+  DECL_GETTER(budget_summary_only, bool)
+  DECL_SETTER(budget_summary_only, bool)
   DECL_GETTER(debug, int)
   DECL_SETTER(debug, int)
 };
@@ -306,16 +520,49 @@ class IsobmffFileInformation {
  private:
   std::string filename;
   std::string policy;
+  bool policy_first_error = false;
   TimingInformation timing;
   FrameInformation frame;
   AudioInformation audio;
+  // summary_only: Whether the sample tables were over the analysis budget,
+  // so only the summary (track-level) values were derived (see
+  // LiblcvmConfig::budget_summary_only).
+  bool summary_only = false;
+  // control: Stop control of the analysis (only set while parse() runs).
+  AnalysisControl* control = nullptr;
+
+  // @brief Check whether the analysis must stop (see AnalysisControl).
+  //
+  // @return int: 0 to continue, the stop code (e.g. kAnalysisTimeout) to
+  // stop.
+  int check_stop() { return (control != nullptr) ? control->check() : 0; }
+  int check_stop(uint64_t iteration) {
+    return (control != nullptr) ? control->check(iteration) : 0;
+  }
+
+  // @brief Check the timing tables of a video track against the analysis
+  // budget, before decoding them (see AnalysisControl::check_tables()).
+  //
+  // @param[in] stbl: Video track stbl box.
+  // @param[in] timing_table: Raw timing tables of the track (nullptr to
+  // count the stbl box tables).
+  // @return int: 0 if within the budget, kAnalysisOverBudget otherwise.
+  int check_table_budget(std::shared_ptr<ISOBMFF::ContainerBox> stbl,
+                         const TimingTableView* timing_table);
+
+  // @brief Parse an ISOBMFF file (see parse()), under a stop control.
+  static std::shared_ptr<IsobmffFileInformation> parse_file(
+      const char* infile, const LiblcvmConfig& liblcvm_config,
+      AnalysisControl* control);
 
  public:
   DECL_GETTER(filename, std::string)
   DECL_GETTER(policy, std::string)
+  DECL_GETTER(policy_first_error, bool)
   DECL_GETTER(timing, TimingInformation)
   DECL_GETTER(frame, FrameInformation)
   DECL_GETTER(audio, AudioInformation)
+  DECL_GETTER(summary_only, bool)
 
   // @brief Get the library version.
   //
@@ -326,9 +573,13 @@ class IsobmffFileInformation {
   //
   // @param[in] infile: Name of the file to be parsed.
   // @param[in] liblcvm_config: Parsing configuration.
-  // @return ptr: Full ISOBMFF information.
+  // @param[out] error: Error code when the parsing fails (kAnalysisCancelled,
+  // kAnalysisTimeout, or kAnalysisOverBudget if the analysis was stopped, -1
+  // otherwise), or nullptr.
+  // @return ptr: Full ISOBMFF information (nullptr if the parsing fails).
   static std::shared_ptr<IsobmffFileInformation> parse(
-      const char* infile, const LiblcvmConfig& liblcvm_config);
+      const char* infile, const LiblcvmConfig& liblcvm_config,
+      int* error = nullptr);
 
   // @brief Converts IsobmffFileInformation to 2 generic lists.
   //
@@ -345,6 +596,13 @@ class IsobmffFileInformation {
       LiblcvmValList* pvals, bool calculate_timestamps,
       LiblcvmKeyList* pkeys_timing, LiblcvmTimingList* pvals_timing, int debug);
 
+  // @brief Get the keys of LiblcvmConfig_to_lists() (without a policy).
+  //
+  // @param[out] pkeys: List of keys (in-order).
+  // @param[out] pkeys_timing: List of timing keys (in-order).
+  static void get_key_lists(LiblcvmKeyList* pkeys,
+                            LiblcvmKeyList* pkeys_timing);
+
   // @brief Parse an ISOBMFF file into 2 lists.
   //
   // @param[in] infile: Name of the file to be parsed.
@@ -354,7 +612,8 @@ class IsobmffFileInformation {
   // @param[in] calculate_timestamps: Whether to calculate the timing lists.
   // @param[out] pkeys_timing: List of timing keys (in-order).
   // @param[out] pvals_timing: List of timing values (in-order).
-  // @return int: Error code (0 if ok, !=0 otherwise).
+  // @return int: Error code (0 if ok, kAnalysisCancelled, kAnalysisTimeout,
+  // or kAnalysisOverBudget if the analysis was stopped, !=0 otherwise).
   static int parse_to_lists(const char* infile,
                             const LiblcvmConfig& liblcvm_config,
                             std::vector<std::string>* pkeys,
@@ -375,4 +634,59 @@ class IsobmffFileInformation {
 int policy_runner(const std::string& policy_str, LiblcvmKeyList* pkeys,
                   LiblcvmValList* pvals, std::list<std::string>* warn_list,
                   std::list<std::string>* error_list, std::string* version);
+
+// @brief Check a value list against the error rules of a policy (e.g. for
+// upload gating). Warn rules are not evaluated, and evaluation stops at the
+// first matching error rule.
+//
+// @param[in] policy_str: Policy string.
+// @param[in] keys: Keys.
+// @param[in] vals: Values, in the order of the keys.
+// @param[out] passed: Whether no error rule matches.
+// @param[out] first_error: Message of the first matching error rule (if any).
+// @param[out] version: Policy version.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int policy_check(const std::string& policy_str, const LiblcvmKeyList& keys,
+                 const LiblcvmValList& vals, bool* passed,
+                 std::string* first_error, std::string* version);
+
+// @brief Run a policy over a batch of value lists (e.g. to re-score old
+// results against a new policy version).
+//
+// @param[in] policy_str: Policy string.
+// @param[in] keys: Key list (shared by all the value lists).
+// @param[in] vals_list: Value lists (one per file).
+// @param[out] warn_lists: Warn messages (one list per file).
+// @param[out] error_lists: Error messages (one list per file).
+// @param[out] version: Policy version.
+// @param[out] row_errors: Error code of every file (0 if ok, !=0 if its
+// values cannot be evaluated, e.g. a string value in an ordered
+// comparison), or nullptr to fail the whole batch on such a file.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int policy_runner_batch(const std::string& policy_str,
+                        const LiblcvmKeyList& keys,
+                        const std::vector<LiblcvmValList>& vals_list,
+                        std::vector<std::list<std::string>>* warn_lists,
+                        std::vector<std::list<std::string>>* error_lists,
+                        std::string* version,
+                        std::vector<int>* row_errors = nullptr);
+
+// @brief Validate a policy, and convert it into a binary policy artifact.
+//
+// Binary policy artifacts can be used anywhere a policy string is accepted
+// (e.g. LiblcvmConfig::set_policy()), and are loaded without text parsing.
+//
+// @param[in] policy_str: Policy string.
+// @param[out] policy_binary: Binary policy artifact.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int policy_compile(const std::string& policy_str, std::string* policy_binary);
+
+// @brief Get the keys a policy references.
+//
+// @param[in] policy_str: Policy string.
+// @param[in] keys: Key list the policy will be run against.
+// @param[out] columns: Keys referenced by the policy rules.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int policy_columns(const std::string& policy_str, const LiblcvmKeyList& keys,
+                   std::set<std::string>* columns);
 #endif
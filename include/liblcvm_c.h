@@ -36,7 +36,8 @@ typedef enum {
   LIBLCVM_ERROR_PARSE_FAILED = -3,
   LIBLCVM_ERROR_EXCEPTION = -4,
   LIBLCVM_ERROR_UNKNOWN = -5,
-  LIBLCVM_ERROR_OUT_OF_MEMORY = -6
+  LIBLCVM_ERROR_OUT_OF_MEMORY = -6,
+  LIBLCVM_ERROR_TIMEOUT = -7
 } liblcvm_error_t;
 
 // Forward declaration of opaque handle
@@ -49,6 +50,22 @@ typedef struct {
   char policy[256];
 } liblcvm_config_t;
 
+// Analysis limits structure. Its layout can grow, so it carries its own
+// size: callers set it with liblcvm_limits_init(&limits, sizeof(limits)),
+// and the library only touches the fields that fit in it. New fields are
+// only ever appended.
+typedef struct {
+  // size of the structure in the caller (sizeof(liblcvm_limits_t)).
+  size_t struct_size;
+  // per-analysis timeout in milliseconds (0 for no timeout). Analyses that
+  // run past it fail with LIBLCVM_ERROR_TIMEOUT.
+  int timeout_ms;
+  // largest estimated heap use of an analysis in bytes (0 for no limit).
+  // Files over it fail with LIBLCVM_ERROR_OUT_OF_MEMORY before the large
+  // allocations.
+  uint64_t max_memory_bytes;
+} liblcvm_limits_t;
+
 // Timing information structure
 typedef struct {
   int num_video_frames;
@@ -134,6 +151,11 @@ typedef struct {
 // Initialize configuration with default values
 LIBLCVM_C_API void liblcvm_config_init(liblcvm_config_t* config);
 
+// Initialize analysis limits with default values (no limits). struct_size
+// must be sizeof(liblcvm_limits_t) as seen by the caller
+LIBLCVM_C_API void liblcvm_limits_init(liblcvm_limits_t* limits,
+                                       size_t struct_size);
+
 // ====================
 // Main Analysis API
 // ====================
@@ -144,6 +166,13 @@ LIBLCVM_C_API liblcvm_error_t liblcvm_parse_file(const char* filename,
                                                  const liblcvm_config_t* config,
                                                  liblcvm_file_info_t* handle);
 
+// Parse video file under analysis limits (or NULL for no limits), and
+// return opaque handle
+// Returns LIBLCVM_SUCCESS on success, error code otherwise
+LIBLCVM_C_API liblcvm_error_t liblcvm_parse_file_with_limits(
+    const char* filename, const liblcvm_config_t* config,
+    const liblcvm_limits_t* limits, liblcvm_file_info_t* handle);
+
 // Free the file info handle
 LIBLCVM_C_API void liblcvm_free_file_info(liblcvm_file_info_t handle);
 
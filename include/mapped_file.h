@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Memory-mapped (read-only) input file.
+//
+// The raw moov box readers (moov hash, sample tables) can work straight
+// from the mapping instead of copying the moov box through stdio. The
+// access pattern is passed to the kernel:
+// * the whole mapping is advised as random (MADV_RANDOM): the top-level
+//   box walk only touches the box headers, so readahead into the media
+//   data (mdat) would be wasted.
+// * the moov box range is prefetched (MADV_WILLNEED).
+// * on close, the mapped pages are released (MADV_DONTNEED), and the moov
+//   box pages are dropped from the page cache (POSIX_FADV_DONTNEED, where
+//   available), so that large sweeps do not pollute the page cache. The
+//   rest of the file (e.g. the media data that other readers may be
+//   streaming) is left alone.
+// Without mmap() support, open() fails, and the callers fall back to the
+// stdio readers.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // @brief Map a file.
+  //
+  // @param[in] infile: Name of the file.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int open(const char* infile);
+
+  // @brief Unmap the file (also done by the destructor).
+  void close();
+
+  // @brief Find the (first top-level) moov box, and prefetch it.
+  //
+  // @param[out] moov: moov box bytes (header included).
+  // @param[out] moov_size: moov box size.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. no moov box).
+  int get_moov_box(const uint8_t** moov, size_t* moov_size);
+
+  const uint8_t* get_data() const { return data; }
+  size_t get_size() const { return size; }
+
+ private:
+  // fd: File descriptor (-1 if not open).
+  int fd = -1;
+  // data: Mapped file contents (nullptr if not mapped).
+  const uint8_t* data = nullptr;
+  // size: File size.
+  size_t size = 0;
+  // touched_offset, touched_size: File range read by the analysis (the
+  // moov box, once it has been prefetched), dropped from the page cache on
+  // close.
+  uint64_t touched_offset = 0;
+  uint64_t touched_size = 0;
+};
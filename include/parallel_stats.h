@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Parallel versions of the timing statistics, for files with a very large
+// number of frames (e.g. long timelapse or security recordings).
+//
+// The work is split in fixed-size chunks (kParallelChunkSize elements),
+// which are handed dynamically to the threads. The chunk boundaries do not
+// depend on the number of threads, and the per-chunk results are merged in
+// chunk order, so the results are deterministic: they are the same for any
+// number of threads. The sorts, medians, and threshold scans return the
+// same values as the serial versions. The sums are added up per chunk (in
+// double precision), so they may differ from the serial sums in the last
+// bits.
+
+// Number of elements per chunk.
+constexpr size_t kParallelChunkSize = 64 * 1024;
+
+// @brief Run a function over all the chunks of a range, in parallel.
+//
+// @param[in] size: Number of elements.
+// @param[in] num_threads: Number of threads (the calling thread included).
+// @param[in] fn: Function called with (chunk index, begin, end) for each
+// chunk. Calls with different chunks may run concurrently.
+void parallel_for_chunks(
+    size_t size, int num_threads,
+    const std::function<void(size_t chunk, size_t begin, size_t end)>& fn);
+
+// @brief Get the permutation that stable-sorts a list of keys, in
+// parallel (chunks are sorted first, and then merged pairwise).
+//
+// @param[in] key_list: Sort keys.
+// @param[in] num_threads: Number of threads.
+// @param[out] index_list: Indices of the keys, in increasing key order
+// (ties in index order).
+void parallel_stable_sort_index(const std::vector<double>& key_list,
+                                int num_threads,
+                                std::vector<uint32_t>* index_list);
+
+// @brief Reorder a list following a permutation, in parallel.
+//
+// @param[in,out] list: List to reorder (list[i] becomes
+// list[index_list[i]]).
+// @param[in] index_list: Permutation.
+// @param[in] num_threads: Number of threads.
+template <typename T>
+void parallel_permute(std::vector<T>* list,
+                      const std::vector<uint32_t>& index_list,
+                      int num_threads) {
+  std::vector<T> list_alt(list->size());
+  parallel_for_chunks(list->size(), num_threads,
+                      [&](size_t, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; ++i) {
+                          list_alt[i] = (*list)[index_list[i]];
+                        }
+                      });
+  list->swap(list_alt);
+}
+
+// @brief Add up a list, in parallel.
+//
+// @param[in] vec: Values.
+// @param[in] num_threads: Number of threads.
+// @return double: Sum of the values.
+double parallel_sum(const std::vector<double>& vec, int num_threads);
+
+// @brief Parallel version of calculate_average().
+double parallel_average(const std::vector<double>& vec, int num_threads);
+
+// @brief Parallel version of calculate_median(). The values are sorted in
+// chunks, and the chunks are merged pairwise, all in parallel.
+double parallel_median(const std::vector<double>& vec, int num_threads);
+
+// @brief Parallel version of calculate_standard_deviation() (sample
+// standard deviation, from a parallel sum of squares).
+double parallel_standard_deviation(const std::vector<double>& vec,
+                                   int num_threads);
+
+// @brief Parallel version of calculate_median_absolute_deviation().
+double parallel_median_absolute_deviation(const std::vector<double>& vec,
+                                          int num_threads);
+
+// @brief Get the values over a threshold, in parallel (in list order).
+//
+// @param[in] vec: Values.
+// @param[in] threshold: Threshold (exclusive).
+// @param[in] num_threads: Number of threads.
+// @param[out] out: Values over the threshold (appended).
+void parallel_select_over(const std::vector<double>& vec, double threshold,
+                          int num_threads, std::vector<double>* out);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "sps_reader.h"
+
+// Parameter-set cache. Devices produce a small number of distinct parameter
+// sets, so the SPS fields are memoized by the raw bytes of all the
+// parameter sets of the configuration record, and most files skip the
+// bitstream parsing. The cache keeps the kParameterSetCacheSize most
+// recently used entries, and is safe to use from several threads.
+constexpr size_t kParameterSetCacheSize = 256;
+
+class ParameterSetCache {
+ public:
+  // @brief Look up the SPS fields of a parameter-set key, and mark the
+  // entry as the most recently used.
+  //
+  // @param[in] key: Parameter-set key.
+  // @param[out] info: SPS fields (only set on a hit).
+  // @return bool: Whether the key was in the cache.
+  bool lookup(const std::string& key, SpsInfo* info);
+
+  // @brief Insert the SPS fields of a parameter-set key (a no-op if the key
+  // is already in the cache). Evicts the least recently used entry when
+  // the cache is full.
+  //
+  // @param[in] key: Parameter-set key.
+  // @param[in] info: SPS fields.
+  void insert(const std::string& key, const SpsInfo& info);
+
+  // @brief Get the number of entries in the cache.
+  //
+  // @return size_t: Number of entries (at most kParameterSetCacheSize).
+  size_t size();
+
+ private:
+  std::mutex mutex;
+  // order: Entries in use order (most recently used first).
+  std::list<std::pair<std::string, SpsInfo>> order;
+  std::map<std::string, std::list<std::pair<std::string, SpsInfo>>::iterator>
+      entries;
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "liblcvm.h"
+#include "rules.pb.h"
+
+// Parse a policy string (DSL text, or a binary policy artifact) into its
+// protobuf representation (see policy_parser.h).
+dsl::RuleSet parse_policy_string(const std::string& policy_str);
+
+// Compiled policy bytecode.
+//
+// A dsl::RuleSet is lowered into a flat instruction array. Every column
+// reference is resolved at compile time into an index ("slot") in the
+// LiblcvmValList produced by IsobmffFileInformation::LiblcvmConfig_to_lists(),
+// and every literal is parsed once. Rules are evaluated by a single loop
+// over the array that keeps the result in a boolean accumulator. and/or
+// are lowered into conditional jumps, so they keep their short-circuit
+// semantics.
+//
+// The and/or operands are scheduled by a planner: operands that cannot fail
+// (everything but ordered comparisons, which throw on strings) are sorted by
+// their expected cost to short-circuit, using a static cost estimate and
+// the selectivity observed in previous evaluations. Leaf predicates that
+// appear more than once in the policy are evaluated once per value list.
+enum class PolicyOpcode : uint8_t {
+  // acc = false
+  kFalse,
+  // acc = true
+  kTrue,
+  // acc = (vals[slot] op rhs)
+  kCompare,
+  // acc = (low <= vals[slot] <= high)
+  kRange,
+  // acc = !acc
+  kNot,
+  // if (!acc) pc = target
+  kJumpIfFalse,
+  // if (acc) pc = target
+  kJumpIfTrue,
+};
+
+struct PolicyInstruction {
+  PolicyOpcode opcode = PolicyOpcode::kFalse;
+  // op: comparison operator (kCompare only).
+  dsl::ComparisonOpType op = dsl::ComparisonOpType::UNSPECIFIED;
+  // slot: index of the LHS column in the value list.
+  int32_t slot = -1;
+  // rhs_slot: index of the RHS column, or -1 if the RHS is a literal.
+  int32_t rhs_slot = -1;
+  // rhs_number_valid: whether the RHS literal parses as a number.
+  bool rhs_number_valid = false;
+  // rhs_number: numeric RHS literal (kCompare) or range low (kRange).
+  double rhs_number = 0.0;
+  // high: range high (kRange only).
+  double high = 0.0;
+  // rhs_string: index of the RHS literal in the string table.
+  uint32_t rhs_string = 0;
+  // target: jump target (kJumpIfFalse/kJumpIfTrue only).
+  uint32_t target = 0;
+  // operand: stats index of the and/or operand the jump closes (jumps only).
+  int32_t operand = -1;
+  // memo: index of the shared predicate result, or -1 if the predicate is
+  // not shared (kCompare/kRange only).
+  int32_t memo = -1;
+};
+
+struct PolicyCompiledRule {
+  dsl::SeverityType severity;
+  std::string label;
+  // [begin, end): instruction range of the rule condition.
+  uint32_t begin;
+  uint32_t end;
+  // message_slots: slots of the columns listed in the rule message.
+  std::vector<int32_t> message_slots;
+};
+
+// Running statistics of an and/or operand. Single-row evaluations are
+// sampled once the policy has been evaluated a few times, so the counts
+// estimate the operand probabilities, not the number of evaluations.
+struct PolicyOperandStats {
+  // evaluations: Number of times the operand was evaluated.
+  std::atomic<uint64_t> evaluations{0};
+  // matches: Number of times the operand evaluated to true.
+  std::atomic<uint64_t> matches{0};
+};
+
+// Column-wise view of a batch of value lists (see
+// CompiledPolicy::evaluate_batch()).
+struct PolicyColumn;
+
+class CompiledPolicy {
+ public:
+  // @brief Compile a rule set against a key list.
+  //
+  // @param[in] rule_set: Policy rules.
+  // @param[in] keys: Key list the values will be provided in.
+  // @return ptr: Compiled policy (throws on invalid rules).
+  static std::shared_ptr<CompiledPolicy> compile(const dsl::RuleSet& rule_set,
+                                                 const LiblcvmKeyList& keys);
+
+  // @brief Parse and compile a policy string against a key list.
+  static std::shared_ptr<CompiledPolicy> compile(const std::string& policy_str,
+                                                 const LiblcvmKeyList& keys);
+
+  // @brief Whether enough evaluations happened since the policy was compiled
+  // to re-plan the operand order.
+  bool needs_replan() const;
+
+  // @brief Re-compile the policy, ordering the and/or operands using the
+  // statistics collected so far (which carry over to the new policy).
+  std::shared_ptr<CompiledPolicy> replan() const;
+
+  // @brief Whether the policy was compiled against this key list.
+  bool matches_keys(const LiblcvmKeyList& keys) const;
+
+  // @brief Evaluate all the rules against a value list.
+  //
+  // @param[in] vals: Values, in the order of the compile-time keys.
+  // @param[out] warn_list: Messages of the matching warn rules.
+  // @param[out] error_list: Messages of the matching error rules.
+  void evaluate(const LiblcvmValList& vals, std::list<std::string>* warn_list,
+                std::list<std::string>* error_list) const;
+
+  // @brief Evaluate all the rules against a batch of value lists.
+  //
+  // Values are loaded as columns, and every rule is evaluated column-wise
+  // into a bitmask (one bit per row), with and/or/not as mask operations.
+  // Messages are only formatted for the matching rows.
+  //
+  // @param[in] vals_list: Value lists, in the order of the compile-time keys.
+  // @param[out] warn_lists: Messages of the matching warn rules (per row).
+  // @param[out] error_lists: Messages of the matching error rules (per row).
+  // @param[out] row_errors: Error code of every row (0 if ok, !=0 if the
+  // row cannot be evaluated, e.g. an ordered comparison of a string value,
+  // which throws in evaluate()). The messages of those rows are empty. If
+  // nullptr, a row that cannot be evaluated throws for the whole batch.
+  void evaluate_batch(const std::vector<LiblcvmValList>& vals_list,
+                      std::vector<std::list<std::string>>* warn_lists,
+                      std::vector<std::list<std::string>>* error_lists,
+                      std::vector<int>* row_errors = nullptr) const;
+
+  // @brief Evaluate the error rules, stopping at the first match (no warn
+  // rule is evaluated, and no message is formatted).
+  //
+  // @param[in] vals: Values, in the order of the compile-time keys.
+  // @return int: Index of the first matching error rule (-1 if none).
+  int first_error(const LiblcvmValList& vals) const;
+
+  // @brief Evaluate the condition of a single rule (does not allocate).
+  bool evaluate_rule(size_t rule_index, const LiblcvmValList& vals) const;
+
+  // @brief Format the message of a rule ("label (col: val, ...)").
+  std::string format_rule_message(size_t rule_index,
+                                  const LiblcvmValList& vals) const;
+
+  DECL_GETTER(version, std::string)
+  DECL_GETTER(keys, LiblcvmKeyList)
+  // referenced_columns: Keys referenced by the rules (either side of a
+  // comparison).
+  DECL_GETTER(referenced_columns, std::set<std::string>)
+  const std::vector<PolicyCompiledRule>& get_rules() const { return rules; }
+  const std::vector<PolicyInstruction>& get_code() const { return code; }
+  // num_operands: Number of and/or operands (size of the stats array).
+  DECL_GETTER(num_operands, size_t)
+  const PolicyOperandStats& get_operand_stats(size_t operand) const {
+    return operand_stats[operand];
+  }
+  uint64_t get_evaluations() const {
+    return evaluations.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::string version;
+  LiblcvmKeyList keys;
+  std::set<std::string> referenced_columns;
+  std::vector<PolicyCompiledRule> rules;
+  std::vector<PolicyInstruction> code;
+  std::vector<std::string> string_table;
+  // rule_set: Source rules (kept to re-plan the policy).
+  dsl::RuleSet rule_set;
+  // num_memos: Number of shared predicates.
+  int32_t num_memos = 0;
+  size_t num_operands = 0;
+  std::unique_ptr<PolicyOperandStats[]> operand_stats;
+  // evaluations: Number of value lists evaluated (including the ones
+  // evaluated by the policies this one was re-planned from).
+  mutable std::atomic<uint64_t> evaluations{0};
+  // next_replan: Value of evaluations at which needs_replan() triggers.
+  uint64_t next_replan = 0;
+
+  static std::shared_ptr<CompiledPolicy> compile(
+      const dsl::RuleSet& rule_set, const LiblcvmKeyList& keys,
+      const CompiledPolicy* previous);
+  void share_predicates();
+  void check_vals(const LiblcvmValList& vals) const;
+  // @brief Count a single-row evaluation, and decide whether it updates the
+  // operand statistics.
+  bool sample_stats() const;
+  void record_operand(const PolicyInstruction& ins, uint64_t evaluated,
+                      uint64_t matched) const;
+  bool eval_predicate(const PolicyInstruction& ins, const LiblcvmValList& vals,
+                      int8_t* memo) const;
+  bool evaluate_rule(size_t rule_index, const LiblcvmValList& vals,
+                     int8_t* memo, bool record_stats) const;
+  bool eval_compare(const PolicyInstruction& ins,
+                    const LiblcvmValList& vals) const;
+  bool eval_range(const PolicyInstruction& ins,
+                  const LiblcvmValList& vals) const;
+  uint64_t eval_compare_word(const PolicyInstruction& ins,
+                             const std::vector<PolicyColumn>& columns,
+                             size_t word, uint64_t active,
+                             uint64_t* failed) const;
+  uint64_t eval_range_word(const PolicyInstruction& ins,
+                           const std::vector<PolicyColumn>& columns,
+                           size_t word, uint64_t active) const;
+  void evaluate_rule_batch(size_t rule_index,
+                           const std::vector<PolicyColumn>& columns,
+                           size_t num_rows, std::vector<uint64_t>* result,
+                           std::vector<uint64_t>* failed) const;
+
+  friend class PolicyCompiler;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+#include "rules.pb.h"
+
+// Hand-written recursive-descent parser for the policy language
+// (policy/rules.g4). It produces the same dsl::RuleSet as the
+// ANTLR-generated parser, without depending on the ANTLR runtime.
+//
+// @param[in] policy_str: Policy string (DSL text).
+// @return rule_set: Policy rules (throws std::runtime_error on invalid
+// input).
+dsl::RuleSet parse_policy_string_handwritten(const std::string& policy_str);
+
+// Binary policy artifacts: a pre-validated policy, stored as a header
+// (magic plus format version) followed by the serialized dsl::RuleSet.
+// parse_policy_string() accepts them anywhere a policy string is accepted,
+// and loads them without any text parsing.
+constexpr char kPolicyBinaryMagic[] = "LCVMPOL";
+constexpr char kPolicyBinaryFormatVersion = 1;
+
+// @brief Whether a policy string is a binary policy artifact.
+bool is_policy_binary(const std::string& policy_str);
+
+// @brief Serialize a rule set into a binary policy artifact.
+std::string serialize_policy_binary(const dsl::RuleSet& rule_set);
+
+// @brief Load a binary policy artifact.
+//
+// @param[in] policy_str: Binary policy artifact.
+// @return rule_set: Policy rules (throws std::runtime_error on invalid
+// input).
+dsl::RuleSet parse_policy_binary(const std::string& policy_str);
+
+#if ADD_POLICY_ANTLR
+// ANTLR-generated parser for the policy language. Kept as the reference
+// implementation of policy/rules.g4.
+//
+// @param[in] policy_str: Policy string (DSL text).
+// @return rule_set: Policy rules (throws std::runtime_error on invalid
+// input).
+dsl::RuleSet parse_policy_string_antlr(const std::string& policy_str);
+#endif
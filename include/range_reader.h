@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Batched reader for sparse byte ranges of a file.
+//
+// Payload-level analyses (e.g. slice header peeks) need a few bytes from
+// many samples. Instead of a seek and a read per range, the ranges are
+// gathered first, sorted by offset, and the ranges that are closer than a
+// gap threshold are coalesced into a single span. Each span is read with a
+// single preadv() call that scatters the bytes straight into the range
+// buffers (the gap bytes go to a scratch buffer). Without preadv() (e.g.
+// non-POSIX systems), each span is read with fseeko()/fread(), and copied
+// to the range buffers.
+
+// Ranges closer than kRangeReaderMaxGap bytes are read together.
+constexpr uint64_t kRangeReaderMaxGap = 4096;
+
+class RangeReader {
+ public:
+  // @brief Add a range to the batch.
+  //
+  // @param[in] offset: File offset of the range.
+  // @param[in] size: Range size (bytes).
+  // @return size_t: Range index (for get_data()).
+  size_t add(uint64_t offset, uint32_t size);
+
+  // @brief Read all the ranges of the batch.
+  //
+  // @param[in] infile: Name of the file.
+  // @param[in] max_gap: Largest gap (bytes) between coalesced ranges.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the file cannot
+  // be opened). Ranges past the end of the file are not an error (see
+  // get_data()).
+  int read(const char* infile, uint64_t max_gap = kRangeReaderMaxGap);
+
+  // @brief Get the data of a range.
+  //
+  // @param[in] index: Range index (from add()).
+  // @return const uint8_t*: Range data (nullptr if the range was not read
+  // completely, e.g. it goes past the end of the file).
+  const uint8_t* get_data(size_t index) const;
+
+  // @brief Remove all the ranges (the read counters are kept).
+  void clear();
+
+  // get_num_reads: Number of read calls (preadv() or fread()).
+  uint64_t get_num_reads() const { return num_reads; }
+  // get_read_bytes: Number of bytes read (gaps included).
+  uint64_t get_read_bytes() const { return read_bytes; }
+
+ private:
+  struct Range {
+    // offset: File offset of the range.
+    uint64_t offset;
+    // size: Range size (bytes).
+    uint32_t size;
+    // buffer_offset: Offset of the range data in buffer.
+    size_t buffer_offset;
+    // complete: Whether the range was read completely.
+    bool complete;
+  };
+  std::vector<Range> ranges;
+  // buffer: Data of all the ranges (in add() order).
+  std::vector<uint8_t> buffer;
+  // num_reads: Number of read calls.
+  uint64_t num_reads = 0;
+  // read_bytes: Number of bytes read (gaps included).
+  uint64_t read_bytes = 0;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "liblcvm.h"
+
+// Identity of an input file. A cached result stays valid while the identity
+// of the file (and the parsing configuration) does not change.
+struct FileIdentity {
+  uint64_t device = 0;
+  uint64_t inode = 0;
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+  // moov_hash: Hash of the raw moov box (0 if not requested).
+  uint64_t moov_hash = 0;
+};
+
+// @brief Hash the raw bytes of the (first top-level) moov box of an ISOBMFF
+// file (64-bit FNV-1a).
+//
+// @param[in] infile: Name of the file to be hashed.
+// @param[out] hash: Hash of the moov box.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. no moov box).
+int hash_moov_box(const char* infile, uint64_t* hash);
+
+// @brief Hash the raw bytes of a moov box already in memory (e.g. in a
+// memory-mapped file). Same hash as hash_moov_box().
+//
+// @param[in] moov: moov box bytes (header included).
+// @param[in] moov_size: moov box size.
+// @return uint64_t: Hash of the moov box.
+uint64_t hash_moov_data(const uint8_t* moov, size_t moov_size);
+
+// @brief Get the identity of a file.
+//
+// @param[in] infile: Name of the file.
+// @param[in] hash_moov: Whether to also hash the moov box.
+// @param[out] identity: File identity.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int get_file_identity(const char* infile, bool hash_moov,
+                      FileIdentity* identity);
+
+// @brief Get the result cache key of a file: its identity, the library
+// version, a hash of the result schema (record format version and
+// parse_to_lists() keys), and a hash of the configuration fields that
+// change the results.
+//
+// @param[in] infile: Name of the file.
+// @param[in] liblcvm_config: Parsing configuration.
+// @param[out] key: Cache key.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int get_result_cache_key(const char* infile,
+                         const LiblcvmConfig& liblcvm_config,
+                         std::string* key);
+
+// Persistent result cache.
+//
+// Results (the parse_to_lists() key/value lists, and optionally the timing
+// lists) are stored in an append-only log in the cache directory. Every
+// record carries its key and a checksum. The log is indexed when the cache
+// is opened (only the record headers and keys are read), and a torn record
+// at the end of the log (e.g. after a crash) is dropped. Appends are done
+// with a single write under an exclusive lock, so several processes can
+// share a cache directory.
+class ResultCache {
+ public:
+  ~ResultCache();
+
+  // @brief Get the result cache of a directory (opened once per process).
+  //
+  // @param[in] cache_dir: Cache directory (created if needed).
+  // @return ptr: Result cache (nullptr if the directory cannot be used).
+  static std::shared_ptr<ResultCache> get(const std::string& cache_dir);
+
+  // @brief Look up a result.
+  //
+  // @param[in] key: Cache key.
+  // @param[in] need_timing: Whether the result must include the timing lists.
+  // @param[out] pkeys: List of keys (in-order).
+  // @param[out] pvals: List of values (in-order).
+  // @param[out] pkeys_timing: List of timing keys (in-order).
+  // @param[out] pvals_timing: List of timing values (in-order).
+  // @return bool: Whether the result was found.
+  bool lookup(const std::string& key, bool need_timing, LiblcvmKeyList* pkeys,
+              LiblcvmValList* pvals, LiblcvmKeyList* pkeys_timing,
+              LiblcvmTimingList* pvals_timing);
+
+  // @brief Store a result.
+  //
+  // @param[in] key: Cache key.
+  // @param[in] has_timing: Whether the timing lists are valid.
+  // @param[in] keys: List of keys (in-order).
+  // @param[in] vals: List of values (in-order).
+  // @param[in] keys_timing: List of timing keys (in-order).
+  // @param[in] vals_timing: List of timing values (in-order).
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int insert(const std::string& key, bool has_timing,
+             const LiblcvmKeyList& keys, const LiblcvmValList& vals,
+             const LiblcvmKeyList& keys_timing,
+             const LiblcvmTimingList& vals_timing);
+
+  // @brief Number of results in the cache.
+  size_t size();
+
+ private:
+  struct IndexEntry {
+    uint64_t offset;
+    uint32_t payload_size;
+    bool has_timing;
+  };
+
+  ResultCache() = default;
+  int open(const std::string& path);
+  int read_index();
+
+  std::mutex mutex;
+  int fd = -1;
+  std::map<std::string, IndexEntry> index;
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "analysis_control.h"
+
+// Raw sample-table reader.
+//
+// The ISOBMFF parser does not expose the per-sample tables of a track, so
+// liblcvm reads them straight from the bytes of the moov box. Only the
+// boxes on the path to the video track sample table (moov/trak/mdia/hdlr,
+// and moov/trak/mdia/minf/stbl) are walked, and no media data (mdat) is
+// ever read.
+
+// Sample sizes of a track (stsz/stz2), stored as a column. When all the
+// samples have the same size (stsz with a non-zero sample_size), only that
+// size is stored.
+class SampleSizeTable {
+ public:
+  // @brief Parse the payload of a stsz box.
+  //
+  // @param[in] data: Box payload (after the box header).
+  // @param[in] size: Box payload size.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int parse_stsz(const uint8_t* data, size_t size);
+
+  // @brief Parse the payload of a stz2 (compact sample size) box.
+  //
+  // @param[in] data: Box payload (after the box header).
+  // @param[in] size: Box payload size.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int parse_stz2(const uint8_t* data, size_t size);
+
+  uint32_t get_sample_count() const { return sample_count; }
+  // get_uniform_size: Size of every sample (0 if the sizes differ).
+  uint32_t get_uniform_size() const { return uniform_size; }
+  uint64_t get_total_size() const { return total_size; }
+  // @brief Get the size of a sample.
+  //
+  // @param[in] sample_index: Sample index (0-based, < get_sample_count()).
+  // @return uint32_t: Sample size (bytes).
+  uint32_t get_sample_size(uint32_t sample_index) const {
+    return (uniform_size != 0) ? uniform_size : sizes[sample_index];
+  }
+
+ private:
+  // sample_count: Number of samples.
+  uint32_t sample_count = 0;
+  // uniform_size: Size of every sample (0 if the sizes differ).
+  uint32_t uniform_size = 0;
+  // total_size: Sum of all the sample sizes (bytes).
+  uint64_t total_size = 0;
+  // sizes: Per-sample sizes (empty if uniform_size != 0).
+  std::vector<uint32_t> sizes;
+};
+
+// Sample-to-offset index of a track (from stsc, stco/co64, and stsz).
+//
+// Instead of a per-sample offset array, the index keeps the chunk offsets,
+// and the stsc runs of chunks with the same number of samples per chunk,
+// each with the number of samples before it (prefix sums). A lookup finds
+// the run (binary search), then the chunk, and adds up the sizes of the
+// samples before the requested one in that chunk.
+class ChunkOffsetIndex {
+ public:
+  // @brief Build the index.
+  //
+  // @param[in] stsc: stsc box payload.
+  // @param[in] stsc_size: stsc box payload size.
+  // @param[in] chunk_offsets: stco or co64 box payload.
+  // @param[in] chunk_offsets_size: stco or co64 box payload size.
+  // @param[in] chunk_offsets_64: Whether chunk_offsets is a co64 box.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int build(const uint8_t* stsc, size_t stsc_size,
+            const uint8_t* chunk_offsets, size_t chunk_offsets_size,
+            bool chunk_offsets_64);
+
+  // @brief Get the file offset of a sample.
+  //
+  // @param[in] sample_index: Sample index (0-based).
+  // @param[in] sizes: Sample sizes.
+  // @param[out] offset: File offset of the sample.
+  // @return int: Error code (0 if ok, !=0 otherwise, e.g. the sample is not
+  // in any chunk).
+  int get_sample_offset(uint32_t sample_index, const SampleSizeTable& sizes,
+                        uint64_t* offset) const;
+
+  // @brief Walk the samples in order, with their file offsets. The offsets
+  // are kept as running sums per chunk, so a walk takes O(1) per sample
+  // (get_sample_offset() adds up the sizes of the previous samples in the
+  // chunk on every call).
+  //
+  // @param[in] sizes: Sample sizes.
+  // @param[in] callback: Called with the index and the file offset of each
+  // sample. A non-zero return value stops the walk.
+  // @return int: 0 if all the samples were walked, the callback return
+  // value otherwise.
+  int for_each_sample_offset(
+      const SampleSizeTable& sizes,
+      const std::function<int(uint32_t, uint64_t)>& callback) const;
+
+  // get_sample_count: Number of samples in all the chunks.
+  uint64_t get_sample_count() const { return sample_count; }
+
+ private:
+  // Run of consecutive chunks with the same number of samples.
+  struct ChunkRun {
+    // first_chunk: Index of the first chunk (0-based).
+    uint32_t first_chunk;
+    // samples_per_chunk: Number of samples in each chunk.
+    uint32_t samples_per_chunk;
+    // first_sample: Index of the first sample (0-based).
+    uint64_t first_sample;
+  };
+  std::vector<ChunkRun> runs;
+  // chunk_offsets: File offset of each chunk.
+  std::vector<uint64_t> chunk_offsets;
+  // sample_count: Number of samples in all the chunks.
+  uint64_t sample_count = 0;
+};
+
+// Sample tables of the video track.
+struct SampleTable {
+  SampleSizeTable sizes;
+
+  // @brief Get the file offset of a sample. The chunk offset index is built
+  // on the first call (from the raw stsc and stco/co64 payloads).
+  //
+  // @param[in] sample_index: Sample index (0-based).
+  // @param[out] offset: File offset of the sample.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int get_sample_offset(uint32_t sample_index, uint64_t* offset);
+
+  // @brief Walk the samples in order, with their file offsets (see
+  // ChunkOffsetIndex::for_each_sample_offset()).
+  //
+  // @return int: Error code (0 if ok, -1 if the tables are invalid, the
+  // callback return value if it stopped the walk).
+  int for_each_sample_offset(
+      const std::function<int(uint32_t, uint64_t)>& callback);
+
+  // @brief Build the chunk offset index (on the first call only).
+  //
+  // @return int: Error code (0 if ok, -1 if the tables are invalid).
+  int build_chunk_offset_index();
+
+  // stsc: Raw stsc payload (until the chunk offset index is built).
+  std::vector<uint8_t> stsc;
+  // chunk_offsets: Raw stco/co64 payload (until the chunk offset index is
+  // built).
+  std::vector<uint8_t> chunk_offsets;
+  // chunk_offsets_64: Whether chunk_offsets is a co64 payload.
+  bool chunk_offsets_64 = false;
+  // chunk_offset_index_status: 0 if not built yet, 1 if built, -1 if the
+  // tables are invalid.
+  int chunk_offset_index_status = 0;
+  ChunkOffsetIndex chunk_offset_index;
+
+  // sample_entry_type: Type of the (first) stsd sample entry (e.g. "hvc1").
+  std::string sample_entry_type;
+  // nal_length_size: Size of the NAL unit length fields of the samples
+  // (from hvcC/avcC, 0 if there is no hvcC/avcC box).
+  int nal_length_size = 0;
+  // parameter_sets: Parameter-set NAL units (from hvcC/avcC).
+  std::vector<std::vector<uint8_t>> parameter_sets;
+};
+
+// Timing tables of a video track (stts, ctts, and stss box payloads),
+// pointing straight into the moov box bytes.
+struct TimingTableView {
+  // stts: stts box payload (nullptr if there is no stts box).
+  const uint8_t* stts = nullptr;
+  size_t stts_size = 0;
+  // ctts: ctts box payload (nullptr if there is no ctts box).
+  const uint8_t* ctts = nullptr;
+  size_t ctts_size = 0;
+  // stss: stss box payload (nullptr if there is no stss box).
+  const uint8_t* stss = nullptr;
+  size_t stss_size = 0;
+  // sample_count: Number of samples in the stsz/stz2 box (UINT64_MAX if
+  // there is no valid stsz/stz2 box).
+  uint64_t sample_count = UINT64_MAX;
+};
+
+// @brief Read an array of big-endian 32-bit values (e.g. the entries of a
+// stss box). The loop is a plain byte swap (bswap), which the compiler
+// can vectorize (e.g. pshufb with SSSE3).
+//
+// @param[in] data: Big-endian values.
+// @param[in] count: Number of values.
+// @param[out] values: Host-order values (count elements).
+void read_be32_array(const uint8_t* data, size_t count, uint32_t* values);
+
+// @brief Decode a stts box payload in place into per-sample durations.
+//
+// @param[in] data: stts box payload.
+// @param[in] size: stts box payload size.
+// @param[in] max_sample_count: Maximum number of samples (e.g. the stsz
+// sample count). Tables with more samples are rejected.
+// @param[out] sample_delta_list: Per-sample durations (track timescale).
+// @param[in] control: Stop control of the analysis (or nullptr), checked
+// every kAnalysisCheckInterval samples.
+// @return int: Error code (0 if ok, the stop code if the analysis must
+// stop, -1 otherwise).
+int decode_stts(const uint8_t* data, size_t size, uint64_t max_sample_count,
+                std::vector<uint32_t>* sample_delta_list,
+                AnalysisControl* control = nullptr);
+
+// @brief Decode a ctts box payload in place into per-sample composition
+// offsets.
+//
+// @param[in] data: ctts box payload.
+// @param[in] size: ctts box payload size.
+// @param[in] max_sample_count: Maximum number of samples (e.g. the stsz
+// sample count). Tables with more samples are rejected.
+// @param[out] sample_offset_list: Per-sample composition offsets (track
+// timescale).
+// @param[out] last_sample_offset: Composition offset of the last entry (0
+// if there are no entries).
+// @param[in] control: Stop control of the analysis (or nullptr), checked
+// every kAnalysisCheckInterval samples.
+// @return int: Error code (0 if ok, the stop code if the analysis must
+// stop, -1 otherwise).
+int decode_ctts(const uint8_t* data, size_t size, uint64_t max_sample_count,
+                std::vector<int32_t>* sample_offset_list,
+                int32_t* last_sample_offset,
+                AnalysisControl* control = nullptr);
+
+// @brief Decode a stss box payload in place into sample numbers.
+//
+// @param[in] data: stss box payload.
+// @param[in] size: stss box payload size.
+// @param[out] sample_number_list: Sync sample numbers (starting at 1).
+// @return int: Error code (0 if ok, !=0 otherwise).
+int decode_stss(const uint8_t* data, size_t size,
+                std::vector<uint32_t>* sample_number_list);
+
+// Entry and sample counts of the timing tables of a video track.
+struct TimingTableCounts {
+  // num_entries: Number of stts, ctts, and stss entries.
+  uint64_t num_entries = 0;
+  // num_samples: Number of samples (the larger of the stts and ctts sample
+  // count sums).
+  uint64_t num_samples = 0;
+};
+
+// @brief Count the entries and samples of the timing tables of a video
+// track, without decoding them (e.g. to check them against a budget before
+// allocating the per-sample lists).
+//
+// @param[in] tables: Timing tables.
+// @param[out] counts: Entry and sample counts.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. truncated tables).
+int count_timing_tables(const TimingTableView& tables,
+                        TimingTableCounts* counts);
+
+// @brief Get the timing tables of the video tracks of a moov box.
+//
+// @param[in] moov: moov box bytes (header included).
+// @param[in] size: moov box size.
+// @param[out] tables: Timing tables of each video track (in track order).
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not a moov box).
+int find_video_timing_tables(const uint8_t* moov, size_t size,
+                             std::vector<TimingTableView>* tables);
+
+// @brief Read the raw bytes of the (first top-level) moov box of an ISOBMFF
+// file, header included. A truncated moov box is returned up to the end of
+// the file.
+//
+// @param[in] infile: Name of the file.
+// @param[out] moov: moov box bytes.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. no moov box).
+int read_moov_box(const char* infile, std::vector<uint8_t>* moov);
+
+// @brief Add up the sizes of the top-level metadata boxes (moov and moof)
+// of an ISOBMFF file. Only the box headers are read. As the sample tables
+// live in these boxes, the result is a cheap estimate of the parsing cost
+// of the file, for both regular and fragmented files.
+//
+// @param[in] infile: Name of the file.
+// @param[out] metadata_size: Size of the moov and moof boxes (bytes).
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. no moov box).
+int get_metadata_box_size(const char* infile, uint64_t* metadata_size);
+
+// @brief Find the (first top-level) moov box of an ISOBMFF file in memory
+// (e.g. a memory-mapped file). As in read_moov_box(), a truncated moov box
+// is returned up to the end of the data.
+//
+// @param[in] data: File contents.
+// @param[in] size: File size.
+// @param[out] moov: moov box bytes (header included, pointing into data).
+// @param[out] moov_size: moov box size.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. no moov box).
+int find_moov_box(const uint8_t* data, size_t size, const uint8_t** moov,
+                  size_t* moov_size);
+
+// @brief Parse the sample tables of the video track from a moov box. As in
+// IsobmffFileInformation::parse(), the last video track is used.
+//
+// @param[in] moov: moov box bytes (header included).
+// @param[in] size: moov box size.
+// @param[out] table: Video track sample tables.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. no video track).
+int parse_video_sample_table(const uint8_t* moov, size_t size,
+                             SampleTable* table);
+
+// @brief Read the sample tables of the video track of an ISOBMFF file.
+//
+// @param[in] infile: Name of the file.
+// @param[out] table: Video track sample tables.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int read_video_sample_table(const char* infile, SampleTable* table);
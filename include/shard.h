@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Sharded execution (lcvm --shard i/N).
+//
+// A shared file list is partitioned by a hash of each path, so every node
+// of a sweep gets a deterministic, disjoint slice without coordination.
+
+// @brief Parse a shard specification ("<index>/<count>", with 0 <= index <
+// count).
+//
+// @param[in] spec: Shard specification.
+// @param[out] shard_index: Shard index.
+// @param[out] num_shards: Number of shards.
+// @return int: Error code (0 if ok, !=0 otherwise).
+int parse_shard_spec(const char* spec, int* shard_index, int* num_shards);
+
+// @brief Hash a file path (64-bit FNV-1a). The hash is part of the shard
+// assignment, so it must not change across versions or platforms.
+//
+// @param[in] path: File path.
+// @return uint64_t: Hash of the path.
+uint64_t get_shard_hash(const std::string& path);
+
+// @brief Get the files of a shard (in input order).
+//
+// @param[in] infile_list: Names of all the files.
+// @param[in] shard_index: Shard index.
+// @param[in] num_shards: Number of shards.
+// @return vector: Names of the files of the shard.
+std::vector<std::string> get_shard_files(
+    const std::vector<std::string>& infile_list, int shard_index,
+    int num_shards);
+
+// Checkpoint of a run that writes one output row per file.
+//
+// The checkpoint is an append-only text file, with one line per completed
+// file: the size of the output file after the file's row, and the file
+// name. On restart, the output file is truncated to the size recorded by
+// the last complete line (dropping rows written after it, and any torn
+// row), and the completed files are skipped, so a resumed run produces
+// the same output as an uninterrupted one. Lines past the actual output
+// file size (e.g. the output was not written back before a machine crash)
+// and a torn last line are dropped.
+class ShardCheckpoint {
+ public:
+  ShardCheckpoint() = default;
+  ~ShardCheckpoint();
+  ShardCheckpoint(const ShardCheckpoint&) = delete;
+  ShardCheckpoint& operator=(const ShardCheckpoint&) = delete;
+
+  // @brief Load a checkpoint file (created if needed), and open it for
+  // appending.
+  //
+  // @param[in] checkpoint_file: Name of the checkpoint file.
+  // @param[in] output_file_size: Current size of the output file (0 if it
+  // does not exist).
+  // @param[out] output_size: Size the output file must be truncated to.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int open(const std::string& checkpoint_file, uint64_t output_file_size,
+           uint64_t* output_size);
+
+  // @brief Check whether a file was completed.
+  bool is_done(const std::string& infile) const;
+
+  // @brief Record a completed file (the checkpoint is flushed). Its output
+  // row must be flushed first.
+  //
+  // @param[in] infile: Name of the file.
+  // @param[in] output_size: Size of the output file after the file's row.
+  // @return int: Error code (0 if ok, !=0 otherwise).
+  int add(const std::string& infile, uint64_t output_size);
+
+  // @brief Number of completed files.
+  size_t size() const { return done.size(); }
+
+ private:
+  // fp: Checkpoint file (open for appending).
+  FILE* fp = nullptr;
+  // done: Completed files.
+  std::unordered_set<std::string> done;
+};
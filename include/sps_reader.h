@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Fields extracted from the SPS of a video track (H.264 or H.265).
+struct SpsInfo {
+  // colour_primaries, transfer_characteristics, matrix_coeffs, and
+  // video_full_range_flag are only set (!= -1) when the VUI includes a
+  // colour description.
+  int colour_primaries = -1;
+  int transfer_characteristics = -1;
+  int matrix_coeffs = -1;
+  int video_full_range_flag = -1;
+  int profile_idc = -1;
+  int level_idc = -1;
+  std::string profile_type_str;
+};
+
+// Minimal SPS readers.
+//
+// liblcvm only needs a few SPS fields: the profile and level, and the VUI
+// colour description. These readers parse an SPS NAL unit up to the VUI
+// colour description and stop there, without building a syntax tree. The
+// emulation prevention bytes are skipped while reading, so the NAL unit is
+// not copied. liblcvm uses them instead of the h264nal/h265nal parsers when
+// built with -DADD_SPS_READER=ON (see test/sps_reader_unittest.cc for the
+// cross-check against h264nal/h265nal).
+
+// @brief Read the fields of an H.264 SPS NAL unit.
+//
+// @param[in] data: NAL unit (starting with the NAL unit header).
+// @param[in] size: NAL unit size.
+// @param[out] info: SPS fields.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not an SPS, or
+// truncated).
+int read_h264_sps(const uint8_t* data, size_t size, SpsInfo* info);
+
+// @brief Read the fields of an H.265 SPS NAL unit.
+//
+// @param[in] data: NAL unit (starting with the NAL unit header).
+// @param[in] size: NAL unit size.
+// @param[out] info: SPS fields.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not an SPS, or
+// truncated).
+int read_h265_sps(const uint8_t* data, size_t size, SpsInfo* info);
+
+// Minimal slice header readers (used to check the slice type of the first
+// slice of a sample without parsing the rest of the sample).
+
+// @brief Read the pps_pic_parameter_set_id and num_extra_slice_header_bits
+// fields of an H.265 PPS NAL unit.
+//
+// @param[in] data: NAL unit (starting with the NAL unit header).
+// @param[in] size: NAL unit size.
+// @param[out] pps_id: PPS id.
+// @param[out] num_extra_slice_header_bits: Number of extra slice header
+// bits.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not a PPS).
+int read_h265_pps(const uint8_t* data, size_t size, uint32_t* pps_id,
+                  uint32_t* num_extra_slice_header_bits);
+
+// @brief Read the slice type of an H.264 slice NAL unit.
+//
+// @param[in] data: NAL unit (starting with the NAL unit header).
+// @param[in] size: NAL unit size.
+// @param[out] slice_type: Slice type (0-9, 7.4.3).
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not a slice).
+int read_h264_slice_type(const uint8_t* data, size_t size,
+                         uint32_t* slice_type);
+
+// @brief Read the slice type of the first slice segment of an H.265
+// picture.
+//
+// @param[in] data: NAL unit (starting with the NAL unit header).
+// @param[in] size: NAL unit size.
+// @param[in] pps_num_extra_slice_header_bits: num_extra_slice_header_bits
+// of each PPS (by PPS id).
+// @param[out] slice_type: Slice type (0: B, 1: P, 2: I).
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not the first slice
+// segment of a picture, or unknown PPS).
+int read_h265_slice_type(
+    const uint8_t* data, size_t size,
+    const std::map<uint32_t, uint32_t>& pps_num_extra_slice_header_bits,
+    uint32_t* slice_type);
@@ -0,0 +1,501 @@
+#include "analysis_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#if HAVE_UNIX_SOCKETS
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#if HAVE_UNIX_SOCKETS
+// a closed peer must fail the write instead of raising SIGPIPE
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+// Write a whole buffer.
+int write_all(int fd, const uint8_t* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, kSendFlags);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Read a whole buffer. Returns 1 if the stream ends before the first byte.
+int read_all(int fd, uint8_t* data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = recv(fd, data + done, size - done, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      return (done == 0) ? 1 : -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+int get_socket_address(const char* socket_path, struct sockaddr_un* address) {
+  memset(address, 0, sizeof(*address));
+  if (strlen(socket_path) >= sizeof(address->sun_path)) {
+    return -1;
+  }
+  address->sun_family = AF_UNIX;
+  strncpy(address->sun_path, socket_path, sizeof(address->sun_path) - 1);
+  return 0;
+}
+#endif
+
+// Get the response payload of a request.
+std::string get_response(uint64_t number, const BatchResult& result,
+                         bool policy_only) {
+  // in policy-only mode, only the file name and the policy results are valid
+  static const std::vector<std::string> policy_only_keys = {
+      "infile", "policy_version", "warn_list", "error_list"};
+  std::string response =
+      std::to_string(number) + "," + std::to_string(result.ret) + "\n";
+  if (result.ret != 0) {
+    return response;
+  }
+  std::string header;
+  std::string row;
+  const char* separator = "";
+  for (size_t i = 0; i < result.keys.size() && i < result.vals.size(); ++i) {
+    if (policy_only &&
+        std::find(policy_only_keys.begin(), policy_only_keys.end(),
+                  result.keys[i]) == policy_only_keys.end()) {
+      continue;
+    }
+    std::string value;
+    if (liblcvmvalue_to_string(result.vals[i], &value) != 0) {
+      value = "ERROR";
+    }
+    header += separator + csv_escape(result.keys[i]);
+    row += separator + csv_escape(value);
+    separator = ",";
+  }
+  return response + header + "\n" + row + "\n";
+}
+
+}  // namespace
+
+int write_frame(int fd, const std::string& payload, int passed_fd) {
+#if HAVE_UNIX_SOCKETS
+  if (payload.size() > kServerMaxFrameSize) {
+    return -1;
+  }
+  uint32_t size = payload.size();
+  uint8_t header[4] = {uint8_t(size >> 24), uint8_t(size >> 16),
+                       uint8_t(size >> 8), uint8_t(size)};
+  size_t header_sent = 0;
+  if (passed_fd >= 0) {
+    // the file descriptor travels with the first header byte
+    struct iovec iov = {header, sizeof(header)};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+    ssize_t n;
+    do {
+      n = sendmsg(fd, &msg, kSendFlags);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      return -1;
+    }
+    header_sent = n;
+  }
+  if (write_all(fd, header + header_sent, sizeof(header) - header_sent) != 0 ||
+      write_all(fd, reinterpret_cast<const uint8_t*>(payload.data()),
+                payload.size()) != 0) {
+    return -1;
+  }
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+int read_frame(int fd, std::string* payload, int* passed_fd) {
+  if (passed_fd != nullptr) {
+    *passed_fd = -1;
+  }
+#if HAVE_UNIX_SOCKETS
+  // 1. read the header (and the passed file descriptor)
+  uint8_t header[4];
+  struct iovec iov = {header, sizeof(header)};
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  ssize_t n;
+  do {
+    n = recvmsg(fd, &msg, flags);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return (n == 0) ? 1 : -1;
+  }
+  // the control buffer has room for 2 descriptors (CMSG_SPACE() rounds up),
+  // so all the passed descriptors are installed: only the first one is
+  // kept, and the frame fails if there is more than one
+  int received_fd = -1;
+  size_t num_received_fds = 0;
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len < CMSG_LEN(0)) {
+      continue;
+    }
+    size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < num_fds; ++i) {
+      int cmsg_fd;
+      memcpy(&cmsg_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      if (num_received_fds++ == 0) {
+        received_fd = cmsg_fd;
+      } else {
+        close(cmsg_fd);
+      }
+    }
+  }
+
+  // 2. read the payload
+  uint32_t size = 0;
+  int ret = (num_received_fds > 1) ? -1 : 0;
+  if (ret == 0) {
+    ret = read_all(fd, header + n, sizeof(header) - n);
+  }
+  if (ret == 0) {
+    size = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) |
+           (uint32_t(header[2]) << 8) | uint32_t(header[3]);
+    ret = (size > kServerMaxFrameSize) ? -1 : 0;
+  }
+  if (ret == 0) {
+    payload->resize(size);
+    ret = read_all(fd, reinterpret_cast<uint8_t*>(&(*payload)[0]), size);
+  }
+  if (ret != 0 || (msg.msg_flags & MSG_CTRUNC) || passed_fd == nullptr) {
+    if (received_fd >= 0) {
+      close(received_fd);
+    }
+    return (ret != 0 || (msg.msg_flags & MSG_CTRUNC)) ? -1 : 0;
+  }
+  *passed_fd = received_fd;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+AnalysisServer::AnalysisServer(const LiblcvmConfig& server_config,
+                               int num_threads)
+    : liblcvm_config(server_config),
+      analyzer(num_threads, kServerMaxInFlight * std::max(1, num_threads)) {
+#if HAVE_UNIX_SOCKETS
+  if (pipe(wake_pipe) != 0) {
+    wake_pipe[0] = wake_pipe[1] = -1;
+  }
+#endif
+}
+
+AnalysisServer::~AnalysisServer() {
+  stop();
+#if HAVE_UNIX_SOCKETS
+  for (int fd : wake_pipe) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+void AnalysisServer::stop() {
+  stopping = true;
+#if HAVE_UNIX_SOCKETS
+  if (wake_pipe[1] >= 0) {
+    ssize_t n = write(wake_pipe[1], "x", 1);
+    (void)n;
+  }
+#endif
+}
+
+int AnalysisServer::serve(const char* socket_path) {
+#if HAVE_UNIX_SOCKETS
+  // 1. listen on the socket (replacing a stale socket file)
+  struct sockaddr_un address;
+  if (wake_pipe[0] < 0 || get_socket_address(socket_path, &address) != 0) {
+    return -1;
+  }
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    return -1;
+  }
+  // only a socket is replaced (never a regular file given by mistake)
+  struct stat path_stat;
+  if (lstat(socket_path, &path_stat) == 0) {
+    if (!S_ISSOCK(path_stat.st_mode) || unlink(socket_path) != 0) {
+      close(listen_fd);
+      return -1;
+    }
+  } else if (errno != ENOENT) {
+    close(listen_fd);
+    return -1;
+  }
+  if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    close(listen_fd);
+    return -1;
+  }
+
+  // 2. accept connections (each one is served by its own thread) until
+  // stop() wakes the loop up
+  int ret = 0;
+  while (!stopping) {
+    struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ret = -1;
+      break;
+    }
+    if (stopping || !(fds[0].revents & POLLIN)) {
+      continue;
+    }
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EMFILE || errno == ENFILE) {
+        // wait for connections to close
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    connection_fds.push_back(fd);
+    ++num_connections;
+    std::thread(&AnalysisServer::serve_connection, this, fd).detach();
+  }
+  close(listen_fd);
+  unlink(socket_path);
+
+  // 3. stop reading requests, and wait for the pending responses
+  std::unique_lock<std::mutex> lock(mutex);
+  for (int fd : connection_fds) {
+    shutdown(fd, SHUT_RD);
+  }
+  connections_done.wait(lock, [this] { return num_connections == 0; });
+  return ret;
+#else
+  return -1;
+#endif
+}
+
+int AnalysisServer::submit(const std::string& name, int passed_fd,
+                           AsyncAnalyzer::Callback callback) {
+  std::string infile = name;
+#if HAVE_UNIX_SOCKETS
+  if (passed_fd >= 0) {
+    // the library opens the files by name
+    infile = "/dev/fd/" + std::to_string(passed_fd);
+    callback = [callback, passed_fd, name](BatchResult& result) {
+      close(passed_fd);
+      result.infile = name;
+      for (size_t i = 0; i < result.keys.size() && i < result.vals.size();
+           ++i) {
+        if (result.keys[i] == "infile") {
+          result.vals[i] = name;
+        }
+      }
+      callback(result);
+    };
+  }
+#endif
+  // the analyzer queue is shared by all the connections
+  while (analyzer.submit(infile, liblcvm_config, false, callback) != 0) {
+    if (stopping) {
+#if HAVE_UNIX_SOCKETS
+      if (passed_fd >= 0) {
+        close(passed_fd);
+      }
+#endif
+      return -1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return 0;
+}
+
+void AnalysisServer::serve_connection(int fd) {
+#if HAVE_UNIX_SOCKETS
+  // responses are queued, and written by a connection thread, so the
+  // analysis threads never block on a slow client
+  struct ConnectionState {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::string> responses;
+    // in_flight: Number of requests whose response was not written yet.
+    size_t in_flight = 0;
+    // reading: Whether requests are still being read.
+    bool reading = true;
+  };
+  auto state = std::make_shared<ConnectionState>();
+
+  // 1. write the responses
+  std::thread writer([fd, state] {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (true) {
+      state->changed.wait(lock, [&] {
+        return !state->responses.empty() ||
+               (!state->reading && state->in_flight == 0);
+      });
+      if (state->responses.empty()) {
+        break;
+      }
+      std::string response = std::move(state->responses.front());
+      state->responses.pop_front();
+      lock.unlock();
+      // keep draining when the client is gone
+      write_frame(fd, response);
+      lock.lock();
+      --state->in_flight;
+      state->changed.notify_all();
+    }
+  });
+
+  // 2. read and run the requests
+  for (uint64_t number = 0;; ++number) {
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->changed.wait(
+          lock, [&] { return state->in_flight < kServerMaxInFlight; });
+    }
+    std::string name;
+    int passed_fd;
+    if (read_frame(fd, &name, &passed_fd) != 0) {
+      break;
+    }
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      ++state->in_flight;
+    }
+    bool policy_only = liblcvm_config.get_policy_only();
+    auto callback = [state, number, policy_only](BatchResult& result) {
+      std::string response = get_response(number, result, policy_only);
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->responses.push_back(std::move(response));
+      state->changed.notify_all();
+    };
+    if (submit(name, passed_fd, callback) != 0) {
+      BatchResult result;
+      result.ret = kAnalysisCancelled;
+      callback(result);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->reading = false;
+    state->changed.notify_all();
+  }
+  writer.join();
+
+  // 3. close the connection
+  std::lock_guard<std::mutex> lock(mutex);
+  connection_fds.erase(
+      std::find(connection_fds.begin(), connection_fds.end(), fd));
+  close(fd);
+  --num_connections;
+  connections_done.notify_all();
+#endif
+}
+
+int analysis_client(const char* socket_path,
+                    const std::vector<std::string>& infile_list, bool pass_fds,
+                    const std::function<void(const std::string&)>& callback) {
+#if HAVE_UNIX_SOCKETS
+  // 1. connect to the server
+  struct sockaddr_un address;
+  if (get_socket_address(socket_path, &address) != 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  // 2. send the requests while reading the responses (the server stops
+  // reading requests when too many responses are pending)
+  std::thread sender([fd, pass_fds, &infile_list] {
+    for (const auto& infile : infile_list) {
+      // files that cannot be opened are sent by name (and fail there)
+      int passed_fd = pass_fds ? open(infile.c_str(), O_RDONLY) : -1;
+      int ret = write_frame(fd, infile, passed_fd);
+      if (passed_fd >= 0) {
+        close(passed_fd);
+      }
+      if (ret != 0) {
+        break;
+      }
+    }
+    shutdown(fd, SHUT_WR);
+  });
+
+  // 3. read the responses
+  size_t num_responses = 0;
+  std::string payload;
+  int ret;
+  while ((ret = read_frame(fd, &payload, nullptr)) == 0) {
+    callback(payload);
+    ++num_responses;
+  }
+  sender.join();
+  close(fd);
+  return (ret == 1 && num_responses == infile_list.size()) ? 0 : -1;
+#else
+  return -1;
+#endif
+}
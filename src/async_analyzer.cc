@@ -0,0 +1,140 @@
+#include "async_analyzer.h"
+
+#include <algorithm>
+#include <memory>
+
+AsyncAnalyzer::AsyncAnalyzer(int num_threads, size_t max_depth)
+    : max_queue_depth(max_depth > 0 ? max_depth : 1) {
+  for (int t = 0; t < std::max(1, num_threads); ++t) {
+    threads.emplace_back(&AsyncAnalyzer::run, this);
+  }
+}
+
+AsyncAnalyzer::~AsyncAnalyzer() {
+  // 1. take the queued analyses out
+  std::deque<Request> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    cancelled.swap(queue);
+  }
+  not_empty.notify_all();
+
+  // 2. complete them as cancelled
+  for (auto& request : cancelled) {
+    BatchResult result;
+    result.index = request.id;
+    result.infile = request.infile;
+    result.ret = kAnalysisCancelled;
+    request.callback(result);
+  }
+
+  // 3. wait for the running analyses
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+int AsyncAnalyzer::submit(const std::string& infile,
+                          const LiblcvmConfig& liblcvm_config,
+                          bool calculate_timestamps, Callback callback,
+                          uint64_t* id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping || queue.size() >= max_queue_depth) {
+      return -1;
+    }
+    if (id != nullptr) {
+      *id = next_id;
+    }
+    queue.push_back({next_id++, infile, liblcvm_config, calculate_timestamps,
+                     std::move(callback), nullptr});
+    // running analyses are cancelled through their token
+    Request& request = queue.back();
+    if (request.liblcvm_config.get_cancellation_token() == nullptr) {
+      request.token = std::make_shared<CancellationToken>();
+      request.liblcvm_config.set_cancellation_token(request.token);
+    }
+  }
+  not_empty.notify_one();
+  return 0;
+}
+
+int AsyncAnalyzer::submit(const std::string& infile,
+                          const LiblcvmConfig& liblcvm_config,
+                          bool calculate_timestamps,
+                          std::future<BatchResult>* future, uint64_t* id) {
+  auto promise = std::make_shared<std::promise<BatchResult>>();
+  std::future<BatchResult> result_future = promise->get_future();
+  if (submit(
+          infile, liblcvm_config, calculate_timestamps,
+          [promise](BatchResult& result) {
+            promise->set_value(std::move(result));
+          },
+          id) != 0) {
+    return -1;
+  }
+  *future = std::move(result_future);
+  return 0;
+}
+
+int AsyncAnalyzer::cancel(uint64_t id) {
+  Request request;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(queue.begin(), queue.end(),
+                           [id](const Request& r) { return r.id == id; });
+    if (it == queue.end()) {
+      auto running_it = running.find(id);
+      if (running_it == running.end() || running_it->second == nullptr) {
+        return -1;
+      }
+      running_it->second->cancel();
+      return 0;
+    }
+    request = std::move(*it);
+    queue.erase(it);
+  }
+  BatchResult result;
+  result.index = request.id;
+  result.infile = request.infile;
+  result.ret = kAnalysisCancelled;
+  request.callback(result);
+  return 0;
+}
+
+size_t AsyncAnalyzer::get_queue_depth() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return queue.size();
+}
+
+void AsyncAnalyzer::run() {
+  while (true) {
+    // 1. get the next analysis
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_empty.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      request = std::move(queue.front());
+      queue.pop_front();
+      running[request.id] = request.token;
+    }
+
+    // 2. run it
+    BatchResult result;
+    result.index = request.id;
+    result.infile = request.infile;
+    result.ret = IsobmffFileInformation::parse_to_lists(
+        result.infile.c_str(), request.liblcvm_config, &result.keys,
+        &result.vals, request.calculate_timestamps, &result.keys_timing,
+        &result.vals_timing);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running.erase(request.id);
+    }
+    request.callback(result);
+  }
+}
@@ -0,0 +1,177 @@
+#include "batch_pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "sample_table.h"
+
+uint64_t get_batch_cost(const std::string& infile) {
+  uint64_t cost = 0;
+  if (get_metadata_box_size(infile.c_str(), &cost) != 0) {
+    std::error_code ec;
+    uintmax_t file_size = std::filesystem::file_size(infile, ec);
+    cost = ec ? 0 : static_cast<uint64_t>(file_size);
+  }
+  return cost;
+}
+
+size_t get_reorder_window(const BatchPipelineConfig& pipeline_config) {
+  size_t stage_files =
+      static_cast<size_t>(std::max(1, pipeline_config.compute_threads)) +
+      static_cast<size_t>(std::max(1, pipeline_config.prefetch_threads)) +
+      static_cast<size_t>(std::max(1, pipeline_config.prefetch_depth));
+  return std::max(
+      static_cast<size_t>(std::max(1, pipeline_config.reorder_depth)),
+      stage_files);
+}
+
+int run_batch_pipeline(const std::vector<std::string>& infile_list,
+                       const LiblcvmConfig& liblcvm_config,
+                       bool calculate_timestamps,
+                       const BatchPipelineConfig& pipeline_config,
+                       const std::function<void(BatchResult&)>& writer) {
+  const size_t num_files = infile_list.size();
+  const int prefetch_threads = std::max(1, pipeline_config.prefetch_threads);
+  const int compute_threads = std::max(1, pipeline_config.compute_threads);
+  const size_t reorder_depth = get_reorder_window(pipeline_config);
+
+  // 1. stage queues
+  BoundedQueue<size_t> prefetched(
+      static_cast<size_t>(std::max(1, pipeline_config.prefetch_depth)));
+  BoundedQueue<BatchResult> results(reorder_depth);
+  // next_write: Index of the next file to write. Only the files within the
+  // reorder window of it (next_write + reorder_depth) enter the pipeline,
+  // so the finished results waiting for an earlier file are bounded, and
+  // the results stream out. The window is enforced at the start of the
+  // pipeline so that the file being waited for is never stuck behind a
+  // full queue.
+  std::mutex window_mutex;
+  std::condition_variable window_cv;
+  size_t next_write = 0;
+  // unsized: Files within the window whose cost was not read yet (only
+  // with largest_first).
+  std::deque<size_t> unsized;
+  // num_sizing: Number of files whose cost is being read.
+  size_t num_sizing = 0;
+  // ready: Files within the window that did not enter the pipeline yet,
+  // as (inverted cost, index), so the largest file (or the first one, in
+  // input order) comes first.
+  std::set<std::pair<uint64_t, size_t>> ready;
+  // window_end: End of the files added to the window.
+  size_t window_end = 0;
+  auto fill_window = [&]() {
+    for (; window_end < std::min(num_files, next_write + reorder_depth);
+         ++window_end) {
+      if (pipeline_config.largest_first) {
+        unsized.push_back(window_end);
+      } else {
+        ready.emplace(0, window_end);
+      }
+    }
+  };
+  fill_window();
+
+  // 2. prefetch stage: read the moov boxes ahead
+  std::atomic<int> active_prefetch_threads{prefetch_threads};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < prefetch_threads; ++t) {
+    threads.emplace_back([&]() {
+      while (true) {
+        size_t i;
+        bool sizing = false;
+        {
+          std::unique_lock<std::mutex> lock(window_mutex);
+          window_cv.wait(lock, [&]() {
+            return !unsized.empty() || !ready.empty() ||
+                   (window_end == num_files && num_sizing == 0);
+          });
+          if (!unsized.empty()) {
+            // the costs of the new files are read first, so the largest
+            // file of the window is known before picking the next one
+            i = unsized.front();
+            unsized.pop_front();
+            ++num_sizing;
+            sizing = true;
+          } else if (!ready.empty()) {
+            i = ready.begin()->second;
+            ready.erase(ready.begin());
+          } else {
+            break;
+          }
+        }
+        if (sizing) {
+          uint64_t cost = get_batch_cost(infile_list[i]);
+          {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            ready.emplace(UINT64_MAX - cost, i);
+            --num_sizing;
+          }
+          window_cv.notify_all();
+          continue;
+        }
+        // the moov box is dropped: the goal is to have it in the page cache
+        // when the compute stage parses the file
+        std::vector<uint8_t> moov;
+        read_moov_box(infile_list[i].c_str(), &moov);
+        if (!prefetched.push(i)) {
+          break;
+        }
+      }
+      if (active_prefetch_threads.fetch_sub(1) == 1) {
+        prefetched.close();
+      }
+    });
+  }
+
+  // 3. compute stage: run the analysis
+  std::atomic<int> active_compute_threads{compute_threads};
+  for (int t = 0; t < compute_threads; ++t) {
+    threads.emplace_back([&]() {
+      size_t i;
+      while (prefetched.pop(&i)) {
+        BatchResult result;
+        result.index = i;
+        result.infile = infile_list[i];
+        result.ret = IsobmffFileInformation::parse_to_lists(
+            result.infile.c_str(), liblcvm_config, &result.keys, &result.vals,
+            calculate_timestamps, &result.keys_timing, &result.vals_timing);
+        results.push(std::move(result));
+      }
+      if (active_compute_threads.fetch_sub(1) == 1) {
+        results.close();
+      }
+    });
+  }
+
+  // 4. write stage: hand the results over in input order
+  int num_errors = 0;
+  std::map<size_t, BatchResult> pending;
+  BatchResult result;
+  while (results.pop(&result)) {
+    size_t index = result.index;
+    pending.emplace(index, std::move(result));
+    auto it = pending.begin();
+    while (it != pending.end() && it->first == next_write) {
+      if (it->second.ret != 0) {
+        ++num_errors;
+      }
+      writer(it->second);
+      it = pending.erase(it);
+      {
+        std::lock_guard<std::mutex> lock(window_mutex);
+        ++next_write;
+        fill_window();
+      }
+      window_cv.notify_all();
+    }
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return num_errors;
+}
@@ -0,0 +1,222 @@
+#include "directory_watcher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+
+#if HAVE_INOTIFY
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// ISOBMFF media file extensions (lowercase)
+const char* const kMediaFileExtensions[] = {".3g2", ".3gp", ".m4a",
+                                            ".m4v", ".mov", ".mp4"};
+
+}  // namespace
+
+bool is_media_file_name(const std::string& name) {
+  if (name.empty() || name[0] == '.') {
+    return false;
+  }
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string extension = name.substr(dot);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return std::find(std::begin(kMediaFileExtensions),
+                   std::end(kMediaFileExtensions),
+                   extension) != std::end(kMediaFileExtensions);
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::string& watch_dir,
+                                   int debounce_ms)
+    : dir(watch_dir), debounce(std::max(0, debounce_ms)) {}
+
+DirectoryWatcher::~DirectoryWatcher() {
+#if HAVE_INOTIFY
+  for (int fd : {inotify_fd, wake_pipe[0], wake_pipe[1]}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+int DirectoryWatcher::start() {
+#if HAVE_INOTIFY
+  if (inotify_fd >= 0) {
+    return -1;
+  }
+  if (pipe(wake_pipe) != 0) {
+    wake_pipe[0] = wake_pipe[1] = -1;
+    return -1;
+  }
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    return -1;
+  }
+  if (inotify_add_watch(inotify_fd, dir.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+    close(inotify_fd);
+    inotify_fd = -1;
+    return -1;
+  }
+  scan_time = FileClock::now();
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+int DirectoryWatcher::run(Callback callback) {
+#if HAVE_INOTIFY
+  if (inotify_fd < 0) {
+    return -1;
+  }
+  int ret = 0;
+  while (!stopping) {
+    // 1. wait for events, or for the end of the next debounce delay
+    int timeout_ms = -1;
+    if (!pending.empty()) {
+      Clock::time_point deadline = Clock::now() + debounce;
+      for (const auto& entry : pending) {
+        deadline = std::min(deadline, entry.second + debounce);
+      }
+      auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+          deadline - Clock::now());
+      timeout_ms = static_cast<int>(std::max<int64_t>(0, wait.count()));
+    }
+    struct pollfd fds[2] = {{inotify_fd, POLLIN, 0},
+                            {wake_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, timeout_ms) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ret = -1;
+      break;
+    }
+
+    // 2. read the events
+    if ((fds[0].revents & POLLIN) && read_events() != 0) {
+      ret = -1;
+      break;
+    }
+
+    // 3. report the debounced files
+    report_files(false, callback);
+  }
+
+  // 4. report the files still being debounced
+  if (ret == 0) {
+    read_events();
+  }
+  report_files(true, callback);
+  return ret;
+#else
+  return -1;
+#endif
+}
+
+void DirectoryWatcher::stop() {
+  stopping = true;
+#if HAVE_INOTIFY
+  if (wake_pipe[1] >= 0) {
+    ssize_t n = write(wake_pipe[1], "x", 1);
+    (void)n;
+  }
+#endif
+}
+
+int DirectoryWatcher::read_events() {
+#if HAVE_INOTIFY
+  alignas(struct inotify_event) char buffer[4096];
+  FileClock::time_point read_time = FileClock::now();
+  bool overflow = false;
+  while (true) {
+    ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN) {
+        return -1;
+      }
+      break;
+    }
+    Clock::time_point now = Clock::now();
+    for (ssize_t offset = 0; offset < n;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(buffer + offset);
+      offset += sizeof(struct inotify_event) + event->len;
+      if (event->mask & IN_IGNORED) {
+        // the directory was removed (or unmounted)
+        return -1;
+      }
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflow = true;
+        continue;
+      }
+      if (event->len == 0 || (event->mask & IN_ISDIR) ||
+          !is_media_file_name(event->name)) {
+        continue;
+      }
+      pending[dir + "/" + event->name] = now;
+    }
+  }
+
+  // the events lost on a queue overflow cannot be recovered: look for the
+  // files they were about instead
+  if (overflow) {
+    fprintf(stderr,
+            "warning: inotify queue overflow in %s, rescanning the "
+            "directory\n",
+            dir.c_str());
+    scan_files();
+  }
+  scan_time = read_time;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+void DirectoryWatcher::scan_files() {
+  // files written during the last second before the previous read may be
+  // reported twice (file times can be that coarse)
+  FileClock::time_point since = scan_time - std::chrono::seconds(1);
+  Clock::time_point now = Clock::now();
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(dir, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    std::error_code file_ec;
+    if (!it->is_regular_file(file_ec) ||
+        !is_media_file_name(it->path().filename().string())) {
+      continue;
+    }
+    FileClock::time_point write_time = it->last_write_time(file_ec);
+    if (!file_ec && write_time >= since) {
+      pending[dir + "/" + it->path().filename().string()] = now;
+    }
+  }
+}
+
+void DirectoryWatcher::report_files(bool all, const Callback& callback) {
+  Clock::time_point now = Clock::now();
+  for (auto it = pending.begin(); it != pending.end();) {
+    if (!all && now - it->second < debounce) {
+      ++it;
+      continue;
+    }
+    std::string path = it->first;
+    it = pending.erase(it);
+    callback(path);
+  }
+}
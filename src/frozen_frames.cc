@@ -0,0 +1,192 @@
+#include "frozen_frames.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "range_reader.h"
+#include "sps_reader.h"
+
+namespace {
+
+// @brief Check the type of the first slice of a sample.
+//
+// @param[in] data: First bytes of the sample (length-prefixed NAL units).
+// @param[in] size: Number of bytes.
+// @param[in] h265: Whether the sample is H.265 (H.264 otherwise).
+// @param[in] nal_length_size: Size of the NAL unit length fields.
+// @param[in] pps_num_extra_slice_header_bits: H.265 PPS values.
+// @return int: 1 if the slice is inter-coded (P/B), 0 if it is intra-coded,
+// and -1 if it cannot be read.
+int check_first_slice_type(
+    const uint8_t* data, size_t size, bool h265, int nal_length_size,
+    const std::map<uint32_t, uint32_t>& pps_num_extra_slice_header_bits) {
+  size_t pos = 0;
+  while (size - pos > static_cast<size_t>(nal_length_size)) {
+    size_t nal_size = 0;
+    for (int i = 0; i < nal_length_size; ++i) {
+      nal_size = (nal_size << 8) | data[pos + i];
+    }
+    pos += nal_length_size;
+    // the read may stop in the middle of the NAL unit
+    const uint8_t* nal = data + pos;
+    size_t nal_read_size = std::min(nal_size, size - pos);
+    uint32_t slice_type;
+    if (nal_read_size == 0) {
+      // empty NAL unit
+    } else if (h265 && ((nal[0] >> 1) & 0x3f) <= 31) {
+      if (read_h265_slice_type(nal, nal_read_size,
+                               pps_num_extra_slice_header_bits,
+                               &slice_type) != 0) {
+        return -1;
+      }
+      // 2: I slice
+      return (slice_type != 2) ? 1 : 0;
+    } else if (!h265 && ((nal[0] & 0x1f) == 1 || (nal[0] & 0x1f) == 5)) {
+      if (read_h264_slice_type(nal, nal_read_size, &slice_type) != 0) {
+        return -1;
+      }
+      // 2, 7: I slice, 4, 9: SI slice
+      return (slice_type % 5 != 2 && slice_type % 5 != 4) ? 1 : 0;
+    }
+    // skip the non-VCL NAL unit (AUD, SEI, parameter sets)
+    if (nal_size > size - pos) {
+      return -1;
+    }
+    pos += nal_size;
+  }
+  return -1;
+}
+
+}  // namespace
+
+int detect_frozen_frames(
+    const char* infile, SampleTable* table,
+    const std::vector<uint32_t>& keyframe_sample_number_list,
+    std::vector<FrozenFrameSegment>* segments, int debug,
+    AnalysisControl* control) {
+  segments->clear();
+
+  // 1. check the codec
+  bool h265;
+  if (table->sample_entry_type == "hvc1" ||
+      table->sample_entry_type == "hev1") {
+    h265 = true;
+  } else if (table->sample_entry_type == "avc1" ||
+             table->sample_entry_type == "avc3") {
+    h265 = false;
+  } else {
+    return -1;
+  }
+  if (table->nal_length_size == 0) {
+    return -1;
+  }
+  std::map<uint32_t, uint32_t> pps_num_extra_slice_header_bits;
+  if (h265) {
+    for (const auto& parameter_set : table->parameter_sets) {
+      uint32_t pps_id;
+      uint32_t num_extra_slice_header_bits;
+      if (read_h265_pps(parameter_set.data(), parameter_set.size(), &pps_id,
+                        &num_extra_slice_header_bits) == 0) {
+        pps_num_extra_slice_header_bits[pps_id] = num_extra_slice_header_bits;
+      }
+    }
+  }
+
+  // 2. get the candidate size threshold (from the non-keyframe sizes). With
+  // no stss box, every sample is a keyframe.
+  const SampleSizeTable& sizes = table->sizes;
+  uint32_t sample_count = sizes.get_sample_count();
+  std::vector<bool> is_keyframe(sample_count,
+                                keyframe_sample_number_list.empty());
+  for (const auto& sample_number : keyframe_sample_number_list) {
+    if (sample_number >= 1 && sample_number <= sample_count) {
+      is_keyframe[sample_number - 1] = true;
+    }
+  }
+  std::vector<uint32_t> non_keyframe_sizes;
+  for (uint32_t i = 0; i < sample_count; ++i) {
+    if (!is_keyframe[i]) {
+      non_keyframe_sizes.push_back(sizes.get_sample_size(i));
+    }
+  }
+  if (non_keyframe_sizes.empty()) {
+    return 0;
+  }
+  auto median = non_keyframe_sizes.begin() + non_keyframe_sizes.size() / 2;
+  std::nth_element(non_keyframe_sizes.begin(), median,
+                   non_keyframe_sizes.end());
+  double max_size = std::min(static_cast<double>(kFrozenFrameMaxSize),
+                             kFrozenFrameSizeRatio * (*median));
+
+  // 3. read the first bytes of the candidates (in a single batch). The
+  // samples are walked in order, so their offsets are running sums.
+  std::vector<bool> frozen(sample_count, false);
+  std::vector<std::pair<uint32_t, size_t>> candidate_list;
+  RangeReader reader;
+  int ret = table->for_each_sample_offset([&](uint32_t i, uint64_t offset) {
+    if (control != nullptr && control->check(i) != 0) {
+      return control->get_stop_code();
+    }
+    uint32_t sample_size = sizes.get_sample_size(i);
+    if (is_keyframe[i] || sample_size > max_size) {
+      return 0;
+    } else if (sample_size == 0) {
+      // empty samples repeat the previous frame
+      frozen[i] = true;
+    } else {
+      size_t index =
+          reader.add(offset, std::min(sample_size, kFrozenFrameReadSize));
+      candidate_list.emplace_back(i, index);
+    }
+    return 0;
+  });
+  if (ret != 0) {
+    return ret;
+  }
+  if (!candidate_list.empty() && reader.read(infile) != 0) {
+    return -1;
+  }
+
+  // 4. confirm the candidates
+  for (const auto& [i, index] : candidate_list) {
+    const uint8_t* data = reader.get_data(index);
+    if (data != nullptr) {
+      size_t read_size = std::min(sizes.get_sample_size(i),
+                                  kFrozenFrameReadSize);
+      frozen[i] = (check_first_slice_type(data, read_size, h265,
+                                          table->nal_length_size,
+                                          pps_num_extra_slice_header_bits) ==
+                   1);
+    }
+  }
+
+  // 5. gather the runs
+  uint32_t run_first_sample = 0;
+  uint32_t run_num_samples = 0;
+  for (uint32_t i = 0; i <= sample_count; ++i) {
+    if (i < sample_count && frozen[i]) {
+      if (run_num_samples == 0) {
+        run_first_sample = i;
+      }
+      ++run_num_samples;
+      continue;
+    }
+    if (run_num_samples >= kFrozenFrameMinCount) {
+      segments->push_back({run_first_sample, run_num_samples});
+    }
+    run_num_samples = 0;
+  }
+
+  if (debug > 1) {
+    fprintf(stdout,
+            "-> frozen frames: max_size: %f reads: %lu read_bytes: %lu "
+            "segments: %zu\n",
+            max_size, static_cast<unsigned long>(reader.get_num_reads()),
+            static_cast<unsigned long>(reader.get_read_bytes()),
+            segments->size());
+  }
+  return 0;
+}
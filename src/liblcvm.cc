@@ -6,12 +6,14 @@
 
 #include "liblcvm.h"
 
+#if !ADD_SPS_READER
 #include <h264_bitstream_parser.h>
 #include <h264_common.h>
 #include <h264_nal_unit_parser.h>
 #include <h265_bitstream_parser.h>
 #include <h265_common.h>
 #include <h265_nal_unit_parser.h>
+#endif
 #include <inttypes.h>
 #include <stdint.h>  // for uint32_t, uint64_t
 #include <sys/stat.h>
@@ -19,23 +21,234 @@
 #include <ISOBMFF.hpp>  // for various
 #include <Parser.hpp>   // for isobmff Parser
 #include <algorithm>    // for sort
+#include <climits>      // for INT_MAX
 #include <cmath>        // for sqrt
 #include <cstdio>       // for fprintf, stderr, stdout
+#include <cstring>      // for memcmp
 #include <list>         // for list
 #include <map>          // for map
 #include <memory>       // for shared_ptr, operator==, __shared...
+#include <mutex>        // for mutex, lock_guard
+#include <new>          // for bad_alloc
 #include <numeric>      // for accumulate
+#include <set>          // for set
 #include <sstream>      // for ostringstream
+#include <stdexcept>    // for length_error
 #include <string>       // for basic_string, string
+#include <thread>       // for thread
 #include <vector>       // for vector
 
 #include "config.h"
+#include "mapped_file.h"
+#include "parallel_stats.h"
+#include "parameter_set_cache.h"
+#include "result_cache.h"
+#include "sps_reader.h"
 
+#define MAX_AUDIO_VIDEO_RATIO 1.05
+#define BITRATE_WINDOW_SEC 1.0
+
+// Analysis stages run by IsobmffFileInformation::parse(). The container
+// stage (track durations and timescales, video width/height, and the
+// audio/video ratio) always runs.
+enum AnalysisStage : uint32_t {
+  // audio sample entry (mp4a/mp4s)
+  STAGE_AUDIO = 1 << 0,
+  // stts/ctts parsing, and the derived timing statistics
+  STAGE_TIMING = 1 << 1,
+  // stss parsing
+  STAGE_KEYFRAME = 1 << 2,
+  // video sample entry (hvc1/hev1/avc1/avc3, and hvcC/avcC)
+  STAGE_FRAME = 1 << 3,
+  // file size and bitrate
+  STAGE_FILESIZE = 1 << 4,
+  // stsz/stz2 parsing, and the video bitrate values
+  STAGE_BITRATE = 1 << 5,
+  // frozen frame detector (only with LiblcvmConfig::frozen_frames)
+  STAGE_FROZEN = 1 << 6,
+  STAGE_ALL = (1 << 7) - 1,
+};
+
+// Analysis stages each value depends on. Keys are listed in the same order
+// as in IsobmffFileInformation::LiblcvmConfig_to_lists().
+const std::vector<std::pair<std::string, uint32_t>> kMetricStageList = {
+    {"infile", 0},
+    {"filesize", STAGE_FILESIZE},
+    {"bitrate_bps", STAGE_FILESIZE},
+    {"width", 0},
+    {"height", 0},
+    {"video_codec_type", STAGE_FRAME},
+    {"horizresolution", STAGE_FRAME},
+    {"vertresolution", STAGE_FRAME},
+    {"depth", STAGE_FRAME},
+    {"chroma_format", STAGE_FRAME},
+    {"bit_depth_luma", STAGE_FRAME},
+    {"bit_depth_chroma", STAGE_FRAME},
+    {"video_full_range_flag", STAGE_FRAME},
+    {"colour_primaries", STAGE_FRAME},
+    {"transfer_characteristics", STAGE_FRAME},
+    {"matrix_coeffs", STAGE_FRAME},
+    {"profile_idc", STAGE_FRAME},
+    {"level_idc", STAGE_FRAME},
+    {"profile_type_str", STAGE_FRAME},
+    {"num_video_frames", STAGE_TIMING},
+    {"frame_rate_fps_median", STAGE_TIMING},
+    {"frame_rate_fps_average", STAGE_TIMING},
+    {"frame_rate_fps_reverse_average", STAGE_TIMING},
+    {"frame_rate_fps_stddev", STAGE_TIMING},
+    {"video_freeze", 0},
+    {"audio_video_ratio", 0},
+    {"duration_video_sec", 0},
+    {"duration_audio_sec", 0},
+    {"timescale_movie_hz", 0},
+    {"timescale_video_hz", 0},
+    {"timescale_audio_hz", 0},
+    {"pts_duration_sec_average", STAGE_TIMING},
+    {"pts_duration_sec_median", STAGE_TIMING},
+    {"pts_duration_sec_stddev", STAGE_TIMING},
+    {"pts_duration_sec_mad", STAGE_TIMING},
+    {"frame_drop_count", STAGE_TIMING},
+    {"frame_drop_ratio", STAGE_TIMING},
+    {"normalized_frame_drop_average_length", STAGE_TIMING},
+    {"frame_drop_length_percentile_50", STAGE_TIMING},
+    {"frame_drop_length_percentile_90", STAGE_TIMING},
+    {"frame_drop_length_consecutive_2", STAGE_TIMING},
+    {"frame_drop_length_consecutive_5", STAGE_TIMING},
+    // keyframe values are derived with the timing values
+    {"num_video_keyframes", STAGE_TIMING | STAGE_KEYFRAME},
+    {"key_frame_ratio", STAGE_TIMING | STAGE_KEYFRAME},
+    {"audio_type", STAGE_AUDIO},
+    {"channel_count", STAGE_AUDIO},
+    {"sample_rate", STAGE_AUDIO},
+    {"sample_size", STAGE_AUDIO},
+    // window and keyframe values use the timing (and keyframe) values
+    {"video_bitrate_bps", STAGE_BITRATE},
+    {"video_bitrate_bps_peak", STAGE_BITRATE | STAGE_TIMING},
+    {"keyframe_size_bytes_average",
+     STAGE_BITRATE | STAGE_TIMING | STAGE_KEYFRAME},
+    {"non_keyframe_size_bytes_average",
+     STAGE_BITRATE | STAGE_TIMING | STAGE_KEYFRAME},
+    {"keyframe_size_ratio", STAGE_BITRATE | STAGE_TIMING | STAGE_KEYFRAME},
+    {"frozen_frame_count",
+     STAGE_FROZEN | STAGE_BITRATE | STAGE_TIMING | STAGE_KEYFRAME},
+    {"frozen_segment_count",
+     STAGE_FROZEN | STAGE_BITRATE | STAGE_TIMING | STAGE_KEYFRAME},
+    {"frozen_duration_sec",
+     STAGE_FROZEN | STAGE_BITRATE | STAGE_TIMING | STAGE_KEYFRAME},
+};
+
+// Get the analysis stages parse() needs to run. The stages only depend on
+// the policy string, so they are computed once per policy (compiling the
+// policy against the metric keys here would also evict the policy the
+// runner compiled against the output keys, and its re-plan stats).
+uint32_t get_analysis_stages(const LiblcvmConfig& liblcvm_config) {
 #if ADD_POLICY
-#include "policy_protovisitor.h"
+  if (!liblcvm_config.get_policy_only() ||
+      liblcvm_config.get_policy().empty()) {
+    return STAGE_ALL;
+  }
+  static std::mutex cache_mutex;
+  static std::string cached_policy_str;
+  static uint32_t cached_stages = STAGE_ALL;
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (!cached_policy_str.empty() &&
+      cached_policy_str == liblcvm_config.get_policy()) {
+    return cached_stages;
+  }
+  cached_policy_str = liblcvm_config.get_policy();
+  cached_stages = STAGE_ALL;
+  LiblcvmKeyList keys;
+  for (const auto& metric_stage : kMetricStageList) {
+    keys.push_back(metric_stage.first);
+  }
+  std::set<std::string> columns;
+  if (policy_columns(liblcvm_config.get_policy(), keys, &columns) != 0) {
+    // let the policy runner report the error
+    return STAGE_ALL;
+  }
+  uint32_t stages = 0;
+  for (const auto& metric_stage : kMetricStageList) {
+    if (columns.count(metric_stage.first) > 0) {
+      stages |= metric_stage.second;
+    }
+  }
+  if (liblcvm_config.get_debug() > 1) {
+    fprintf(stdout, "-> policy columns: %zu analysis stages: 0x%02x\n",
+            columns.size(), stages);
+  }
+  cached_stages = stages;
+  return stages;
+#else
+  return STAGE_ALL;
 #endif
+}
 
-#define MAX_AUDIO_VIDEO_RATIO 1.05
+// Content-addressed analysis cache (see LiblcvmConfig::moov_cache). Files
+// whose moov boxes are byte-identical share the whole analysis, except for
+// the file size and bitrate, which are derived again for every file. The
+// cache keeps the last kMoovCacheSize analyses. The key is only a (64-bit)
+// hash, so every entry keeps its moov box, and hits are verified against
+// it.
+constexpr size_t kMoovCacheSize = 64;
+
+class MoovCache {
+ public:
+  std::shared_ptr<const IsobmffFileInformation> lookup(const std::string& key,
+                                                       const uint8_t* moov,
+                                                       size_t moov_size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.moov.size() != moov_size ||
+        memcmp(it->second.moov.data(), moov, moov_size) != 0) {
+      return nullptr;
+    }
+    return it->second.ptr;
+  }
+
+  // @brief Store an analysis. The cached object is shared by all the hits,
+  // so it must not be modified (or referenced by an analysis) afterwards.
+  void insert(const std::string& key, const uint8_t* moov, size_t moov_size,
+              std::shared_ptr<const IsobmffFileInformation> ptr) {
+    Entry entry;
+    entry.moov.assign(moov, moov + moov_size);
+    entry.ptr = std::move(ptr);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(key) > 0) {
+      return;
+    }
+    if (order.size() >= kMoovCacheSize) {
+      entries.erase(order.front());
+      order.pop_front();
+    }
+    entries[key] = std::move(entry);
+    order.push_back(key);
+  }
+
+ private:
+  struct Entry {
+    // moov: Raw moov box of the analyzed file.
+    std::vector<uint8_t> moov;
+    std::shared_ptr<const IsobmffFileInformation> ptr;
+  };
+  std::mutex mutex;
+  std::map<std::string, Entry> entries;
+  // order: Keys in insertion order (oldest first).
+  std::list<std::string> order;
+};
+
+MoovCache moov_cache;
+
+// Get the moov cache key: a hash and the size of the raw moov box, plus the
+// config values that change the analysis.
+void get_moov_cache_key(const uint8_t* moov, size_t moov_size,
+                        const LiblcvmConfig& liblcvm_config, uint32_t stages,
+                        std::string* key) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "%016" PRIx64 ":%zu:%d:%02x",
+           hash_moov_data(moov, moov_size), moov_size,
+           liblcvm_config.get_sort_by_pts() ? 1 : 0, stages);
+  *key = buf;
+}
 
 void IsobmffFileInformation::get_liblcvm_version(std::string& version) {
   version = PROJECT_VER;
@@ -75,6 +288,72 @@ int liblcvmvalue_to_string(const LiblcvmValue& value, std::string* result) {
   }
 }
 
+std::string csv_escape(const std::string& value) {
+  bool must_quote = value.find_first_of(",\"\n") != std::string::npos;
+  std::string escaped = value;
+  size_t pos = 0;
+  while ((pos = escaped.find('"', pos)) != std::string::npos) {
+    escaped.insert(pos, "\"");
+    pos += 2;
+  }
+  if (must_quote) {
+    escaped = "\"" + escaped + "\"";
+  }
+  return escaped;
+}
+
+std::string json_escape(const std::string& value) {
+  std::string escaped = "\"";
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      escaped += buf;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped + "\"";
+}
+
+int liblcvmvalue_to_json(const LiblcvmValue& value, std::string* result) {
+  if (std::holds_alternative<std::string>(value)) {
+    *result = json_escape(std::get<std::string>(value));
+    return 0;
+  } else if (std::holds_alternative<double>(value) &&
+             !std::isfinite(std::get<double>(value))) {
+    // JSON has no NaN or infinity
+    *result = "null";
+    return 0;
+  }
+  return liblcvmvalue_to_string(value, result);
+}
+
+int get_column_map(const LiblcvmKeyList& keys, const LiblcvmKeyList& header,
+                   std::vector<size_t>* columns) {
+  columns->clear();
+  if (header.size() != keys.size()) {
+    return -1;
+  }
+  std::map<std::string, size_t> header_index;
+  for (size_t i = 0; i < header.size(); ++i) {
+    if (!header_index.emplace(header[i], i).second) {
+      return -1;
+    }
+  }
+  for (const auto& key : keys) {
+    auto it = header_index.find(key);
+    if (it == header_index.end()) {
+      return -1;
+    }
+    columns->push_back(it->second);
+  }
+  return 0;
+}
+
 std::string join_list(const std::list<std::string>& lst,
                       const char* sep = ";") {
   std::ostringstream oss;
@@ -96,19 +375,81 @@ int IsobmffFileInformation::parse_to_lists(const char* infile,
                                            bool calculate_timestamps,
                                            LiblcvmKeyList* pkeys_timing,
                                            LiblcvmTimingList* pvals_timing) {
-  // Default parsing logic
+  int debug = liblcvm_config.get_debug();
+
+  // 1. look up the result cache
+  std::shared_ptr<ResultCache> cache;
+  std::string cache_key;
+  if (!liblcvm_config.get_cache_dir().empty()) {
+    cache = ResultCache::get(liblcvm_config.get_cache_dir());
+    if (cache != nullptr &&
+        get_result_cache_key(infile, liblcvm_config, &cache_key) != 0) {
+      cache = nullptr;
+    }
+    if (cache != nullptr &&
+        cache->lookup(cache_key, calculate_timestamps, pkeys, pvals,
+                      pkeys_timing, pvals_timing)) {
+      if (debug > 1) {
+        fprintf(stdout, "-> result cache hit: %s\n", infile);
+      }
+      // the same file may be reached through a different path
+      for (size_t i = 0; i < pkeys->size() && i < pvals->size(); ++i) {
+        if ((*pkeys)[i] == "infile") {
+          (*pvals)[i] = std::string(infile);
+        }
+      }
+      if (!calculate_timestamps) {
+        pkeys_timing->clear();
+        pvals_timing->clear();
+      }
+      return 0;
+    }
+  }
+
+  // 2. parse the file
+  int error = 0;
   std::shared_ptr<IsobmffFileInformation> pobj =
-      IsobmffFileInformation::parse(infile, liblcvm_config);
+      IsobmffFileInformation::parse(infile, liblcvm_config, &error);
   if (!pobj) {
-    fprintf(stderr, "Failed to parse file: %s\n", infile);
-    return -1;
+    if (error == kAnalysisTimeout) {
+      fprintf(stderr, "Timeout parsing file: %s\n", infile);
+    } else if (error == kAnalysisCancelled) {
+      fprintf(stderr, "Cancelled parsing file: %s\n", infile);
+    } else if (error == kAnalysisOverBudget) {
+      fprintf(stderr, "Over budget parsing file: %s\n", infile);
+    } else {
+      fprintf(stderr, "Failed to parse file: %s\n", infile);
+    }
+    return error;
+  }
+  if (pobj->get_summary_only()) {
+    fprintf(stderr, "Over budget parsing file (summary only): %s\n", infile);
   }
 
-  // convert IsobmffFileInformation to list
-  int debug = liblcvm_config.get_debug();
-  return IsobmffFileInformation::LiblcvmConfig_to_lists(
-      pobj, pkeys, pvals, calculate_timestamps, pkeys_timing, pvals_timing,
-      debug);
+  // 3. convert IsobmffFileInformation to list (the per-frame lists are
+  // copied, so this can also run out of memory)
+  int ret;
+  try {
+    ret = IsobmffFileInformation::LiblcvmConfig_to_lists(
+        pobj, pkeys, pvals, calculate_timestamps, pkeys_timing, pvals_timing,
+        debug);
+  } catch (const std::bad_alloc&) {
+    ret = kAnalysisOverBudget;
+  } catch (const std::length_error&) {
+    ret = kAnalysisOverBudget;
+  }
+  if (ret == kAnalysisOverBudget) {
+    fprintf(stderr, "Over budget parsing file: %s\n", infile);
+    return ret;
+  }
+
+  // 4. store the result (summary-only results depend on the budget)
+  if (ret == 0 && cache != nullptr && !pobj->get_summary_only() &&
+      cache->insert(cache_key, calculate_timestamps, *pkeys, *pvals,
+                    *pkeys_timing, *pvals_timing) != 0) {
+    fprintf(stderr, "error: cannot write result cache entry: %s\n", infile);
+  }
+  return ret;
 }
 
 int IsobmffFileInformation::LiblcvmConfig_to_lists(
@@ -240,6 +581,24 @@ int IsobmffFileInformation::LiblcvmConfig_to_lists(
   pvals->push_back(pobj->get_audio().get_sample_rate());
   pkeys->push_back("sample_size");
   pvals->push_back(pobj->get_audio().get_sample_size());
+  // video bitrate values
+  pkeys->push_back("video_bitrate_bps");
+  pvals->push_back(pobj->get_frame().get_video_bitrate_bps());
+  pkeys->push_back("video_bitrate_bps_peak");
+  pvals->push_back(pobj->get_frame().get_video_bitrate_bps_peak());
+  pkeys->push_back("keyframe_size_bytes_average");
+  pvals->push_back(pobj->get_frame().get_keyframe_size_bytes_average());
+  pkeys->push_back("non_keyframe_size_bytes_average");
+  pvals->push_back(pobj->get_frame().get_non_keyframe_size_bytes_average());
+  pkeys->push_back("keyframe_size_ratio");
+  pvals->push_back(pobj->get_frame().get_keyframe_size_ratio());
+  // frozen frame values (-1 if the detector is disabled)
+  pkeys->push_back("frozen_frame_count");
+  pvals->push_back(pobj->get_timing().get_frozen_frame_count());
+  pkeys->push_back("frozen_segment_count");
+  pvals->push_back(pobj->get_timing().get_frozen_segment_count());
+  pkeys->push_back("frozen_duration_sec");
+  pvals->push_back(pobj->get_timing().get_frozen_duration_sec());
 
   // 2. run the policy
 #if ADD_POLICY
@@ -248,8 +607,19 @@ int IsobmffFileInformation::LiblcvmConfig_to_lists(
   std::string version_str;
   if (!pobj->get_policy().empty()) {
     // Policy string provided, run policy logic
-    int policy_status = policy_runner(pobj->get_policy(), pkeys, pvals,
-                                      &warn_list, &error_list, &version_str);
+    int policy_status;
+    if (pobj->get_policy_first_error()) {
+      bool passed;
+      std::string first_error;
+      policy_status = policy_check(pobj->get_policy(), *pkeys, *pvals,
+                                   &passed, &first_error, &version_str);
+      if (policy_status == 0 && !passed) {
+        error_list.push_back(first_error);
+      }
+    } else {
+      policy_status = policy_runner(pobj->get_policy(), pkeys, pvals,
+                                    &warn_list, &error_list, &version_str);
+    }
     if (policy_status != 0 || !pvals || pvals->empty()) {
       fprintf(stderr, "Policy evaluation failed for file: %s\n",
               pobj->get_filename().c_str());
@@ -323,13 +693,150 @@ int IsobmffFileInformation::LiblcvmConfig_to_lists(
   return 0;
 }
 
+void IsobmffFileInformation::get_key_lists(LiblcvmKeyList* pkeys,
+                                           LiblcvmKeyList* pkeys_timing) {
+  // convert an empty (zero-initialized) object with no policy
+  std::shared_ptr<IsobmffFileInformation> pobj(new IsobmffFileInformation());
+  LiblcvmValList vals;
+  LiblcvmTimingList vals_timing;
+  LiblcvmConfig_to_lists(pobj, pkeys, &vals, true, pkeys_timing, &vals_timing,
+                         0);
+}
+
 std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
-    const char* infile, const LiblcvmConfig& liblcvm_config) {
+    const char* infile, const LiblcvmConfig& liblcvm_config, int* error) {
+  // the deadline starts with the analysis
+  AnalysisControl control(liblcvm_config.get_cancellation_token(),
+                          liblcvm_config.get_timeout_ms());
+  AnalysisBudget budget;
+  budget.max_samples = liblcvm_config.get_max_samples();
+  budget.max_table_entries = liblcvm_config.get_max_table_entries();
+  budget.max_moov_size = liblcvm_config.get_max_moov_size();
+  budget.max_memory_bytes = liblcvm_config.get_max_memory_bytes();
+  control.set_budget(budget);
+  // check the metadata size from the box headers, before reading (and
+  // parsing) the metadata boxes (files without a moov box fail later)
+  uint64_t metadata_size;
+  std::shared_ptr<IsobmffFileInformation> ptr;
+  if (budget.is_limited() &&
+      get_metadata_box_size(infile, &metadata_size) == 0 &&
+      control.check_metadata_size(metadata_size) != 0) {
+    if (liblcvm_config.get_debug() > 0) {
+      fprintf(stderr,
+              "error: metadata over budget (%" PRIu64 " bytes) in %s\n",
+              metadata_size, infile);
+    }
+  } else {
+    // a corrupt file may still ask for more memory than available (e.g.
+    // an unlimited budget and huge sample counts): fail the analysis
+    // instead of the caller (analysis threads do not expect exceptions)
+    try {
+      ptr = parse_file(infile, liblcvm_config, &control);
+    } catch (const std::bad_alloc&) {
+      ptr = nullptr;
+      control.stop(kAnalysisOverBudget);
+    } catch (const std::length_error&) {
+      ptr = nullptr;
+      control.stop(kAnalysisOverBudget);
+    }
+    if (ptr == nullptr && control.get_stop_code() == kAnalysisOverBudget &&
+        liblcvm_config.get_debug() > 0) {
+      fprintf(stderr, "error: out of memory parsing %s\n", infile);
+    }
+  }
+  if (ptr != nullptr) {
+    ptr->control = nullptr;
+  } else if (error != nullptr) {
+    *error = (control.get_stop_code() != 0) ? control.get_stop_code() : -1;
+  }
+  return ptr;
+}
+
+std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse_file(
+    const char* infile, const LiblcvmConfig& liblcvm_config,
+    AnalysisControl* control) {
   // 0. create an ISOBMFF configuration object
   std::shared_ptr<IsobmffFileInformation> ptr =
       std::make_shared<IsobmffFileInformation>();
   ptr->filename = infile;
+  ptr->control = control;
   ptr->policy = liblcvm_config.get_policy();
+  ptr->policy_first_error = liblcvm_config.get_policy_first_error();
+  uint32_t stages = get_analysis_stages(liblcvm_config);
+  if (!liblcvm_config.get_frozen_frames()) {
+    stages &= ~STAGE_FROZEN;
+  }
+  // the frozen frame values are -1 unless the detector runs
+  ptr->timing.frozen_frame_count = -1;
+  ptr->timing.frozen_segment_count = -1;
+  ptr->timing.frozen_duration_sec = -1.0;
+
+  // 0.1. get the raw moov box, from a mapping of the file, or read through
+  // stdio (the moov cache hash, the timing tables, and the sample tables
+  // are all decoded from it)
+  MappedFile mapped_file;
+  std::vector<uint8_t> moov_buffer;
+  const uint8_t* moov_data = nullptr;
+  size_t moov_size = 0;
+  if (liblcvm_config.get_mmap_input() &&
+      (mapped_file.open(infile) != 0 ||
+       mapped_file.get_moov_box(&moov_data, &moov_size) != 0)) {
+    if (liblcvm_config.get_debug() > 0) {
+      fprintf(stderr, "warning: cannot map %s, using stdio\n", infile);
+    }
+    mapped_file.close();
+    moov_data = nullptr;
+  }
+  if (moov_data == nullptr &&
+      (liblcvm_config.get_moov_cache() ||
+       (stages & (STAGE_TIMING | STAGE_BITRATE))) &&
+      read_moov_box(infile, &moov_buffer) == 0) {
+    moov_data = moov_buffer.data();
+    moov_size = moov_buffer.size();
+  }
+  std::vector<TimingTableView> timing_tables;
+  if (moov_data != nullptr &&
+      find_video_timing_tables(moov_data, moov_size, &timing_tables) != 0) {
+    timing_tables.clear();
+  }
+
+  // 0.2. look up the moov cache
+  std::string moov_key;
+  if (liblcvm_config.get_moov_cache() && moov_data != nullptr) {
+    get_moov_cache_key(moov_data, moov_size, liblcvm_config, stages,
+                       &moov_key);
+    std::shared_ptr<const IsobmffFileInformation> cached =
+        moov_cache.lookup(moov_key, moov_data, moov_size);
+    // copying the cached analysis also allocates its per-sample lists
+    if (cached != nullptr &&
+        control->check_tables(0, cached->timing.pts_sec_list.size()) != 0) {
+      cached = nullptr;
+    }
+    if (cached != nullptr) {
+      if (liblcvm_config.get_debug() > 1) {
+        fprintf(stdout, "-> moov cache hit: %s\n", infile);
+      }
+      std::shared_ptr<IsobmffFileInformation> copy =
+          std::make_shared<IsobmffFileInformation>(*cached);
+      copy->filename = ptr->filename;
+      copy->policy = ptr->policy;
+      copy->policy_first_error = ptr->policy_first_error;
+      copy->control = control;
+      // patch the filename-dependent values
+      if ((stages & STAGE_FILESIZE) &&
+          copy->frame.derive_frame_info(copy, liblcvm_config.get_sort_by_pts(),
+                                        liblcvm_config.get_debug()) < 0) {
+        return nullptr;
+      }
+      // the frozen frame detector reads the sample data
+      if ((stages & STAGE_FROZEN) &&
+          copy->timing.derive_frozen_frame_info(
+              copy, liblcvm_config.get_debug()) < 0) {
+        return nullptr;
+      }
+      return copy;
+    }
+  }
 
   // 1. parse the input file
   ISOBMFF::Parser parser;
@@ -338,6 +845,9 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
     fprintf(stderr, "error: %s\n", err.GetMessage().c_str());
     return nullptr;
   }
+  if (ptr->check_stop() != 0) {
+    return nullptr;
+  }
   std::shared_ptr<ISOBMFF::File> file = parser.GetFile();
   if (file == nullptr) {
     if (liblcvm_config.get_debug() > 0) {
@@ -371,11 +881,15 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
   // 4. look for trak container boxes
   ptr->timing.duration_video_sec = -1.0;
   ptr->timing.duration_audio_sec = -1.0;
+  int video_track_index = -1;
   for (auto& box : moov->GetBoxes()) {
     std::string name = box->GetName();
     if (name.compare("trak") != 0) {
       continue;
     }
+    if (ptr->check_stop() != 0) {
+      return nullptr;
+    }
     auto trak = std::dynamic_pointer_cast<ISOBMFF::ContainerBox>(box);
 
     // 5. look for a mdia container box
@@ -428,6 +942,7 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
     } else if (handler_type.compare("vide") == 0) {
       ptr->timing.duration_video_sec = mdhd_duration_sec;
       ptr->timing.timescale_video_hz = timescale_track_hz;
+      ++video_track_index;
     }
 
     if (handler_type.compare("vide") != 0 &&
@@ -458,7 +973,7 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
     }
 
     // stbl-based audio processing
-    if (handler_type.compare("soun") == 0) {
+    if (handler_type.compare("soun") == 0 && (stages & STAGE_AUDIO)) {
       if (ptr->audio.parse_mp4a(stbl, ptr, liblcvm_config.get_debug()) < 0) {
         if (liblcvm_config.get_debug() > 0) {
           fprintf(stderr, "error: in getting audio information in %s\n",
@@ -507,39 +1022,81 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
       continue;
     }
 
-    // 10. get video timing information
-    // init timing info
-    ptr->timing.num_video_frames = 0;
-    ptr->timing.dts_sec_list.clear();
-    ptr->timing.pts_unit_list.clear();
-    ptr->timing.pts_sec_list.clear();
-    ptr->timing.stts_unit_list.clear();
-    ptr->timing.ctts_unit_list.clear();
-    // first frame starts at 0.0
-    ptr->timing.dts_sec_list.push_back(0.0);
-    ptr->timing.pts_unit_list.push_back(0);
-    ptr->timing.pts_sec_list.push_back(0.0);
-    if (ptr->timing.parse_timing_information(stbl, timescale_track_hz, ptr,
-                                             liblcvm_config.get_debug()) < 0) {
+    // 10. get video timing information (the tables are checked against the
+    // analysis budget before decoding them)
+    const TimingTableView* timing_table =
+        (video_track_index >= 0 &&
+         video_track_index < static_cast<int>(timing_tables.size()))
+            ? &timing_tables[video_track_index]
+            : nullptr;
+    if ((stages & STAGE_TIMING) &&
+        ptr->check_table_budget(stbl, timing_table) != 0) {
       if (liblcvm_config.get_debug() > 0) {
-        fprintf(stderr, "error: no timing information in %s\n",
+        fprintf(stderr, "%s: sample tables over budget in %s\n",
+                liblcvm_config.get_budget_summary_only() ? "warning" : "error",
                 ptr->filename.c_str());
       }
-      return nullptr;
+      if (!liblcvm_config.get_budget_summary_only()) {
+        control->stop(kAnalysisOverBudget);
+        return nullptr;
+      }
+      // only derive the summary (track-level) values
+      stages &= ~(STAGE_TIMING | STAGE_KEYFRAME | STAGE_BITRATE | STAGE_FROZEN);
+      ptr->summary_only = true;
+      ptr->timing.num_video_frames = 0;
+      ptr->timing.dts_sec_list.clear();
+      ptr->timing.pts_unit_list.clear();
+      ptr->timing.pts_sec_list.clear();
+      ptr->timing.stts_unit_list.clear();
+      ptr->timing.ctts_unit_list.clear();
+      ptr->timing.keyframe_sample_number_list.clear();
     }
+    if (stages & STAGE_TIMING) {
+      // init timing info
+      ptr->timing.num_video_frames = 0;
+      ptr->timing.dts_sec_list.clear();
+      ptr->timing.pts_unit_list.clear();
+      ptr->timing.pts_sec_list.clear();
+      ptr->timing.stts_unit_list.clear();
+      ptr->timing.ctts_unit_list.clear();
+      // first frame starts at 0.0
+      ptr->timing.dts_sec_list.push_back(0.0);
+      ptr->timing.pts_unit_list.push_back(0);
+      ptr->timing.pts_sec_list.push_back(0.0);
+      // decode the raw tables when available
+      int ret = (timing_table != nullptr)
+                    ? ptr->timing.parse_raw_timing_information(
+                          *timing_table, timescale_track_hz, ptr,
+                          liblcvm_config.get_debug())
+                    : ptr->timing.parse_timing_information(
+                          stbl, timescale_track_hz, ptr,
+                          liblcvm_config.get_debug());
+      if (ret < 0) {
+        if (liblcvm_config.get_debug() > 0) {
+          fprintf(stderr, "error: no timing information in %s\n",
+                  ptr->filename.c_str());
+        }
+        return nullptr;
+      }
 
-    // 11. get video keyframe information
-    if (ptr->timing.parse_keyframe_information(
-            stbl, ptr, liblcvm_config.get_debug()) < 0) {
-      if (liblcvm_config.get_debug() > 0) {
-        fprintf(stderr, "error: no keyframe information in %s\n",
-                ptr->filename.c_str());
+      // 11. get video keyframe information
+      ret = (timing_table != nullptr)
+                ? ptr->timing.parse_raw_keyframe_information(
+                      *timing_table, ptr, liblcvm_config.get_debug())
+                : ptr->timing.parse_keyframe_information(
+                      stbl, ptr, liblcvm_config.get_debug());
+      if (ret < 0) {
+        if (liblcvm_config.get_debug() > 0) {
+          fprintf(stderr, "error: no keyframe information in %s\n",
+                  ptr->filename.c_str());
+        }
+        return nullptr;
       }
-      return nullptr;
     }
 
     // 12. get video frame information
-    if (ptr->frame.parse_frame_information(stbl, ptr,
+    if ((stages & STAGE_FRAME) &&
+        ptr->frame.parse_frame_information(stbl, ptr,
                                            liblcvm_config.get_debug()) < 0) {
       if (liblcvm_config.get_debug() > 0) {
         fprintf(stderr, "error: no frame information in %s\n",
@@ -549,9 +1106,26 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
     }
   }
 
-  // 13. derive timing info
-  if (ptr->timing.derive_timing_info(ptr, liblcvm_config.get_sort_by_pts(),
-                                     liblcvm_config.get_debug()) < 0) {
+  // 13. derive timing info (in parallel for very long files)
+  if (ptr->check_stop() != 0) {
+    return nullptr;
+  }
+  int timing_threads = 1;
+  if (liblcvm_config.get_parallel_timing_threshold() > 0 &&
+      ptr->timing.pts_sec_list.size() >=
+          static_cast<size_t>(liblcvm_config.get_parallel_timing_threshold())) {
+    timing_threads = liblcvm_config.get_parallel_timing_threads();
+    if (timing_threads <= 0) {
+      timing_threads =
+          std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+  }
+  if (!(stages & STAGE_TIMING)) {
+    TimingInformation::derive_audio_video_info(ptr,
+                                               liblcvm_config.get_debug());
+  } else if (ptr->timing.derive_timing_info(
+                 ptr, liblcvm_config.get_sort_by_pts(),
+                 liblcvm_config.get_debug(), timing_threads) < 0) {
     if (liblcvm_config.get_debug() > 0) {
       fprintf(stderr, "error: cannot derive timing information in %s\n",
               ptr->filename.c_str());
@@ -560,7 +1134,11 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
   }
 
   // 14. derive frame info
-  if (ptr->frame.derive_frame_info(ptr, liblcvm_config.get_sort_by_pts(),
+  if (ptr->check_stop() != 0) {
+    return nullptr;
+  }
+  if ((stages & STAGE_FILESIZE) &&
+      ptr->frame.derive_frame_info(ptr, liblcvm_config.get_sort_by_pts(),
                                    liblcvm_config.get_debug()) < 0) {
     if (liblcvm_config.get_debug() > 0) {
       fprintf(stderr, "error: cannot derive frame information in %s\n",
@@ -569,9 +1147,89 @@ std::shared_ptr<IsobmffFileInformation> IsobmffFileInformation::parse(
     return nullptr;
   }
 
+  // 15. derive bitrate info
+  if (ptr->check_stop() != 0) {
+    return nullptr;
+  }
+  if ((stages & STAGE_BITRATE) &&
+      ptr->frame.derive_bitrate_info(ptr, moov_data, moov_size,
+                                     liblcvm_config.get_debug()) < 0) {
+    if (liblcvm_config.get_debug() > 0) {
+      fprintf(stderr, "error: cannot derive bitrate information in %s\n",
+              ptr->filename.c_str());
+    }
+    return nullptr;
+  }
+
+  // 16. detect frozen frames
+  if (ptr->check_stop() != 0) {
+    return nullptr;
+  }
+  if ((stages & STAGE_FROZEN) &&
+      ptr->timing.derive_frozen_frame_info(ptr, liblcvm_config.get_debug()) <
+          0) {
+    if (liblcvm_config.get_debug() > 0) {
+      fprintf(stderr, "error: cannot detect frozen frames in %s\n",
+              ptr->filename.c_str());
+    }
+    return nullptr;
+  }
+
+  // 17. store the analysis in the moov cache (summary-only analyses depend
+  // on the budget)
+  if (!moov_key.empty() && !ptr->summary_only) {
+    // cache a copy: the returned object is modified by the caller (e.g. its
+    // stop control is reset when the analysis ends)
+    std::shared_ptr<IsobmffFileInformation> entry =
+        std::make_shared<IsobmffFileInformation>(*ptr);
+    entry->control = nullptr;
+    moov_cache.insert(moov_key, moov_data, moov_size, entry);
+  }
+
   return ptr;
 }
 
+int IsobmffFileInformation::check_table_budget(
+    std::shared_ptr<ISOBMFF::ContainerBox> stbl,
+    const TimingTableView* timing_table) {
+  if (control == nullptr || !control->get_budget().is_limited()) {
+    return 0;
+  }
+  TimingTableCounts counts;
+  if (timing_table != nullptr) {
+    // invalid tables are reported by the decoders
+    if (count_timing_tables(*timing_table, &counts) != 0) {
+      return 0;
+    }
+  } else {
+    std::shared_ptr<ISOBMFF::STTS> stts =
+        stbl->GetTypedBox<ISOBMFF::STTS>("stts");
+    std::shared_ptr<ISOBMFF::CTTS> ctts =
+        stbl->GetTypedBox<ISOBMFF::CTTS>("ctts");
+    std::shared_ptr<ISOBMFF::STSS> stss =
+        stbl->GetTypedBox<ISOBMFF::STSS>("stss");
+    uint64_t stts_sample_count = 0;
+    uint64_t ctts_sample_count = 0;
+    if (stts != nullptr) {
+      counts.num_entries += stts->GetEntryCount();
+      for (unsigned int i = 0; i < stts->GetEntryCount(); i++) {
+        stts_sample_count += stts->GetSampleCount(i);
+      }
+    }
+    if (ctts != nullptr) {
+      counts.num_entries += ctts->GetEntryCount();
+      for (unsigned int i = 0; i < ctts->GetEntryCount(); i++) {
+        ctts_sample_count += ctts->GetSampleCount(i);
+      }
+    }
+    if (stss != nullptr) {
+      counts.num_entries += stss->GetEntryCount();
+    }
+    counts.num_samples = std::max(stts_sample_count, ctts_sample_count);
+  }
+  return control->check_tables(counts.num_entries, counts.num_samples);
+}
+
 int TimingInformation::parse_timing_information(
     std::shared_ptr<ISOBMFF::ContainerBox> stbl, uint32_t timescale_track_hz,
     std::shared_ptr<IsobmffFileInformation> ptr, int debug) {
@@ -588,14 +1246,24 @@ int TimingInformation::parse_timing_information(
 
   // 2. gather the stts timestamp durations
   // run all through the stts table
-  uint32_t stts_sample_count = 0;
+  uint64_t stts_sample_count = 0;
   uint32_t last_dts_unit = 0.0;
   for (unsigned int i = 0; i < stts->GetEntryCount(); i++) {
     uint32_t sample_count = stts->GetSampleCount(i);
     stts_sample_count += sample_count;
+    if (stts_sample_count > INT_MAX) {
+      if (debug > 0) {
+        fprintf(stderr, "error: invalid /moov/trak/mdia/minf/stbl/stts in %s\n",
+                ptr->filename.c_str());
+      }
+      return -1;
+    }
     ptr->timing.num_video_frames += sample_count;
     uint32_t sample_offset = stts->GetSampleOffset(i);
     for (uint32_t sample = 0; sample < sample_count; sample++) {
+      if (ptr->check_stop(ptr->timing.stts_unit_list.size()) != 0) {
+        return -1;
+      }
       // store the new stts value
       ptr->timing.stts_unit_list.push_back(sample_offset);
       // set the dts value of the next frame
@@ -627,17 +1295,32 @@ int TimingInformation::parse_timing_information(
   if (ctts != nullptr) {
     int32_t last_ctts_sample_offset_unit = 0;
     // 10.1. adjust pts list using ctts timestamp durations
-    uint32_t ctts_sample_count = 0;
-    uint32_t cur_video_frame = 0;
+    uint64_t ctts_sample_count = 0;
+    uint64_t cur_video_frame = 0;
     for (unsigned int i = 0; i < ctts->GetEntryCount(); i++) {
       uint32_t sample_count = ctts->GetSampleCount(i);
       ctts_sample_count += sample_count;
+      if (ctts_sample_count > INT_MAX) {
+        if (debug > 0) {
+          fprintf(stderr,
+                  "error: invalid /moov/trak/mdia/minf/stbl/ctts in %s\n",
+                  ptr->filename.c_str());
+        }
+        return -1;
+      }
       // update pts_sec_list
       int32_t sample_offset = ctts->GetSampleOffset(i);
       last_ctts_sample_offset_unit = sample_offset;
       for (uint32_t sample = 0; sample < sample_count; sample++) {
+        if (ptr->check_stop(ptr->timing.ctts_unit_list.size()) != 0) {
+          return -1;
+        }
         // store the new ctts value
         ptr->timing.ctts_unit_list.push_back(sample_offset);
+        // ignore ctts values past the last stts sample
+        if (cur_video_frame >= stts_sample_count) {
+          continue;
+        }
         // update the pts value
         ptr->timing.pts_unit_list[cur_video_frame] += sample_offset;
         ptr->timing.pts_sec_list[cur_video_frame] =
@@ -662,9 +1345,9 @@ int TimingInformation::parse_timing_information(
       ++cur_video_frame;
     }
     if (debug > 2) {
-      printf("cur_video_frame: %u\n", cur_video_frame);
-      printf("stts_sample_count: %u\n", stts_sample_count);
-      printf("ctts_sample_count: %u\n", ctts_sample_count);
+      printf("cur_video_frame: %" PRIu64 "\n", cur_video_frame);
+      printf("stts_sample_count: %" PRIu64 "\n", stts_sample_count);
+      printf("ctts_sample_count: %" PRIu64 "\n", ctts_sample_count);
     }
   }
 
@@ -693,6 +1376,118 @@ int TimingInformation::parse_keyframe_information(
   return 0;
 }
 
+int TimingInformation::parse_raw_timing_information(
+    const TimingTableView& tables, uint32_t timescale_track_hz,
+    std::shared_ptr<IsobmffFileInformation> ptr, int debug) {
+  // 1. look for a stts box
+  if (tables.stts == nullptr) {
+    if (debug > 0) {
+      fprintf(stderr, "error: no /moov/trak/mdia/minf/stbl/stts in %s\n",
+              ptr->filename.c_str());
+    }
+    return -1;
+  }
+
+  // 2. gather the stts timestamp durations (the tables cannot describe more
+  // samples than the stsz/stz2 box, or than num_video_frames can count)
+  uint64_t max_sample_count =
+      std::min<uint64_t>(tables.sample_count, INT_MAX);
+  if (ptr->check_stop() != 0) {
+    return -1;
+  }
+  if (decode_stts(tables.stts, tables.stts_size, max_sample_count,
+                  &ptr->timing.stts_unit_list, ptr->control) != 0) {
+    if (debug > 0 && ptr->check_stop() == 0) {
+      fprintf(stderr, "error: invalid /moov/trak/mdia/minf/stbl/stts in %s\n",
+              ptr->filename.c_str());
+    }
+    return -1;
+  }
+  size_t stts_sample_count = ptr->timing.stts_unit_list.size();
+  ptr->timing.num_video_frames += static_cast<int>(stts_sample_count);
+  ptr->timing.dts_sec_list.reserve(stts_sample_count + 1);
+  ptr->timing.pts_unit_list.reserve(stts_sample_count + 1);
+  ptr->timing.pts_sec_list.reserve(stts_sample_count + 1);
+  uint32_t last_dts_unit = 0;
+  for (const auto& sample_offset : ptr->timing.stts_unit_list) {
+    if (ptr->check_stop(ptr->timing.dts_sec_list.size()) != 0) {
+      return -1;
+    }
+    // set the dts value of the next frame
+    uint32_t dts_unit = last_dts_unit + sample_offset;
+    double dts_sec = ((double)dts_unit) / timescale_track_hz;
+    ptr->timing.dts_sec_list.push_back(dts_sec);
+    // init the pts value of the next frame
+    ptr->timing.pts_unit_list.push_back(dts_unit);
+    ptr->timing.pts_sec_list.push_back(dts_sec);
+    last_dts_unit = dts_unit;
+  }
+  // we need to remove the last element of the dts and pts lists, as we
+  // set them pointing at the start of the next frame (inexistent)
+  ptr->timing.dts_sec_list.pop_back();
+  ptr->timing.pts_unit_list.pop_back();
+  ptr->timing.pts_sec_list.pop_back();
+
+  // 3. look for a ctts box
+  if (tables.ctts != nullptr) {
+    int32_t last_ctts_sample_offset_unit;
+    if (decode_ctts(tables.ctts, tables.ctts_size, max_sample_count,
+                    &ptr->timing.ctts_unit_list, &last_ctts_sample_offset_unit,
+                    ptr->control) != 0) {
+      if (debug > 0 && ptr->check_stop() == 0) {
+        fprintf(stderr,
+                "error: invalid /moov/trak/mdia/minf/stbl/ctts in %s\n",
+                ptr->filename.c_str());
+      }
+      return -1;
+    }
+    // 3.1. adjust pts list using ctts timestamp durations. As in
+    // parse_timing_information(), if there are less ctts than actual
+    // samples, the latest ctts sample offset is reused.
+    for (size_t cur_video_frame = 0; cur_video_frame < stts_sample_count;
+         ++cur_video_frame) {
+      if (ptr->check_stop(cur_video_frame) != 0) {
+        return -1;
+      }
+      ptr->timing.pts_unit_list[cur_video_frame] +=
+          (cur_video_frame < ptr->timing.ctts_unit_list.size())
+              ? ptr->timing.ctts_unit_list[cur_video_frame]
+              : last_ctts_sample_offset_unit;
+      ptr->timing.pts_sec_list[cur_video_frame] =
+          ((double)ptr->timing.pts_unit_list[cur_video_frame]) /
+          timescale_track_hz;
+    }
+  }
+  if (debug > 2) {
+    printf("stts_sample_count: %zu\n", stts_sample_count);
+    printf("ctts_sample_count: %zu\n", ptr->timing.ctts_unit_list.size());
+  }
+
+  return 0;
+}
+
+int TimingInformation::parse_raw_keyframe_information(
+    const TimingTableView& tables, std::shared_ptr<IsobmffFileInformation> ptr,
+    int debug) {
+  // look for a stss box in the video track for key frames
+  ptr->timing.keyframe_sample_number_list.clear();
+  if (tables.stss == nullptr) {
+    if (debug > 0) {
+      fprintf(stderr, "warning: no /moov/trak/mdia/minf/stbl/stss in %s\n",
+              ptr->get_filename().c_str());
+    }
+  } else if (decode_stss(tables.stss, tables.stss_size,
+                         &ptr->timing.keyframe_sample_number_list) != 0) {
+    if (debug > 0) {
+      fprintf(stderr, "error: invalid /moov/trak/mdia/minf/stbl/stss in %s\n",
+              ptr->get_filename().c_str());
+    }
+    return -1;
+  }
+
+  return 0;
+}
+
 // Function derives an (N-1)-element vector from an N-element vector by
 // setting element i-th as:
 //   out[i] = in[i] - in[i-1]
@@ -753,15 +1548,90 @@ double calculate_median_absolute_deviation(const std::vector<double>& vec) {
   // |Xi - \tilde(X)|: vector of absolute differences to the median
   std::vector<double> vec_abs_differences(vec.size());
   for (size_t i = 0; i < vec.size(); i++) {
-    vec_abs_differences[i] = abs(vec[i] - median);
+    vec_abs_differences[i] = std::fabs(vec[i] - median);
   }
   // MAD = median(|Xi - \tilde(X)|)
   double mad = calculate_median(vec_abs_differences);
   return mad;
 }
 
+void TimingInformation::get_dts_decode_sec_list(
+    std::vector<double>* dts_decode_sec_list) const {
+  dts_decode_sec_list->clear();
+  if (frame_num_orig_list.size() != dts_sec_list.size()) {
+    return;
+  }
+  // undo the pts sorting
+  dts_decode_sec_list->resize(dts_sec_list.size());
+  for (uint32_t i = 0; i < dts_sec_list.size(); ++i) {
+    (*dts_decode_sec_list)[frame_num_orig_list[i]] = dts_sec_list[i];
+  }
+}
+
+int TimingInformation::derive_frozen_frame_info(
+    std::shared_ptr<IsobmffFileInformation> ptr, int debug) {
+  // 1. detect the frozen frames
+  ptr->timing.frozen_segment_list.clear();
+  ptr->timing.frozen_frame_count = 0;
+  ptr->timing.frozen_segment_count = 0;
+  ptr->timing.frozen_duration_sec = 0.0;
+  if (detect_frozen_frames(ptr->filename.c_str(), &ptr->frame.sample_table,
+                           ptr->timing.keyframe_sample_number_list,
+                           &ptr->timing.frozen_segment_list, debug,
+                           ptr->control) != 0) {
+    if (ptr->check_stop() != 0) {
+      return -1;
+    }
+    if (debug > 0) {
+      fprintf(stderr, "warning: cannot detect frozen frames in %s\n",
+              ptr->filename.c_str());
+    }
+    return 0;
+  }
+
+  // 2. get the segment lengths (from the dts of the first frozen frame to
+  // the dts of the next frame)
+  std::vector<double> dts_decode_sec_list;
+  ptr->timing.get_dts_decode_sec_list(&dts_decode_sec_list);
+  for (const auto& segment : ptr->timing.frozen_segment_list) {
+    ptr->timing.frozen_frame_count += segment.num_samples;
+    uint32_t end_sample = segment.first_sample + segment.num_samples;
+    if (end_sample > dts_decode_sec_list.size()) {
+      continue;
+    }
+    double end_sec = (end_sample < dts_decode_sec_list.size())
+                         ? dts_decode_sec_list[end_sample]
+                         : ptr->timing.duration_video_sec;
+    ptr->timing.frozen_duration_sec +=
+        end_sec - dts_decode_sec_list[segment.first_sample];
+  }
+  ptr->timing.frozen_segment_count = ptr->timing.frozen_segment_list.size();
+  return 0;
+}
+
 int TimingInformation::derive_timing_info(
-    std::shared_ptr<IsobmffFileInformation> ptr, bool sort_by_pts, int debug) {
+    std::shared_ptr<IsobmffFileInformation> ptr, bool sort_by_pts, int debug,
+    int num_threads) {
+  // use the parallel statistics (see parallel_stats.h) for more than 1
+  // thread
+  const bool parallel = num_threads > 1;
+  auto average = [&](const std::vector<double>& vec) {
+    return parallel ? parallel_average(vec, num_threads)
+                    : calculate_average(vec);
+  };
+  auto median = [&](const std::vector<double>& vec) {
+    return parallel ? parallel_median(vec, num_threads)
+                    : calculate_median(vec);
+  };
+  auto standard_deviation = [&](const std::vector<double>& vec) {
+    return parallel ? parallel_standard_deviation(vec, num_threads)
+                    : calculate_standard_deviation(vec);
+  };
+  auto sum = [&](const std::vector<double>& vec) {
+    return parallel ? parallel_sum(vec, num_threads)
+                    : std::accumulate(vec.begin(), vec.end(), 0.0);
+  };
+
   // 1. set the frame_num_orig_list vector
   ptr->timing.frame_num_orig_list.resize(ptr->timing.pts_sec_list.size());
   for (uint32_t i = 0; i < ptr->timing.pts_sec_list.size(); ++i) {
@@ -769,7 +1639,16 @@ int TimingInformation::derive_timing_info(
   }
 
   // 2. sort the frames by pts value
-  if (sort_by_pts) {
+  if (sort_by_pts && parallel) {
+    parallel_stable_sort_index(ptr->timing.pts_sec_list, num_threads,
+                               &ptr->timing.frame_num_orig_list);
+    const auto& index_list = ptr->timing.frame_num_orig_list;
+    parallel_permute(&ptr->timing.stts_unit_list, index_list, num_threads);
+    parallel_permute(&ptr->timing.ctts_unit_list, index_list, num_threads);
+    parallel_permute(&ptr->timing.dts_sec_list, index_list, num_threads);
+    parallel_permute(&ptr->timing.pts_unit_list, index_list, num_threads);
+    parallel_permute(&ptr->timing.pts_sec_list, index_list, num_threads);
+  } else if (sort_by_pts) {
     // sort frame_num_orig_list elements based on the values in pts_sec_list
     // TODO(chema): there should be a clear way to access the struct element
     const auto& pts_sec_list = ptr->timing.pts_sec_list;
@@ -817,6 +1696,9 @@ int TimingInformation::derive_timing_info(
   }
 
   // 3. derived timing values
+  if (ptr->check_stop() != 0) {
+    return -1;
+  }
   // 3.1. calculate the duration (inter-frame distance)
   std::vector<int32_t> pts_duration_unit_list;
   calculate_vector_deltas_int32_t(ptr->timing.pts_unit_list,
@@ -828,14 +1710,17 @@ int TimingInformation::derive_timing_info(
   }
   // 3.2. calculate the duration average/median
   ptr->timing.pts_duration_sec_average =
-      calculate_average(ptr->timing.pts_duration_sec_list);
+      average(ptr->timing.pts_duration_sec_list);
   ptr->timing.pts_duration_sec_median =
-      calculate_median(ptr->timing.pts_duration_sec_list);
+      median(ptr->timing.pts_duration_sec_list);
   // 3.3. calculate the duration stddev and median absolute difference (MAD)
   ptr->timing.pts_duration_sec_stddev =
-      calculate_standard_deviation(ptr->timing.pts_duration_sec_list);
+      standard_deviation(ptr->timing.pts_duration_sec_list);
   ptr->timing.pts_duration_sec_mad =
-      calculate_median_absolute_deviation(ptr->timing.pts_duration_sec_list);
+      parallel ? parallel_median_absolute_deviation(
+                     ptr->timing.pts_duration_sec_list, num_threads)
+               : calculate_median_absolute_deviation(
+                     ptr->timing.pts_duration_sec_list);
   // 3.4. derive the pts_duration_delta_sec_list
   ptr->timing.pts_duration_delta_sec_list.resize(
       ptr->timing.pts_duration_sec_list.size());
@@ -863,17 +1748,7 @@ int TimingInformation::derive_timing_info(
                                     : 0.0;
 
   // 5. audio/video ratio and video freeze info
-  // use a default invalid value for audio video ratio
-  ptr->timing.audio_video_ratio = -1.0;
-  ptr->timing.video_freeze = false;
-  if ((ptr->timing.duration_video_sec != -1.0) &&
-      (ptr->timing.duration_audio_sec != -1.0) &&
-      (ptr->timing.duration_video_sec >= 2.0)) {
-    ptr->timing.audio_video_ratio =
-        ptr->timing.duration_audio_sec / ptr->timing.duration_video_sec;
-    ptr->timing.video_freeze =
-        ptr->timing.audio_video_ratio > MAX_AUDIO_VIDEO_RATIO;
-  }
+  TimingInformation::derive_audio_video_info(ptr, debug);
 
   // 6. calculate framerate statistics
   // 6.1. get the framerate series
@@ -886,11 +1761,10 @@ int TimingInformation::derive_timing_info(
                    return val != 0.0f ? 1.0f / static_cast<double>(val) : 0.0f;
                  });
   // 6.2. median
-  ptr->timing.frame_rate_fps_median =
-      calculate_median(ptr->timing.frame_rate_fps_list);
+  ptr->timing.frame_rate_fps_median = median(ptr->timing.frame_rate_fps_list);
   // 6.3. average
   ptr->timing.frame_rate_fps_average =
-      calculate_average(ptr->timing.frame_rate_fps_list);
+      average(ptr->timing.frame_rate_fps_list);
   // 6.4. reverse average
   // Considering the sample_duration of different frames inside boxes
   // as a series X: {x1, x2, ..., xn}, for calculating average FPS from this,
@@ -905,7 +1779,11 @@ int TimingInformation::derive_timing_info(
       1.0 / ptr->timing.pts_duration_sec_average;
   // 6.5. stddev
   ptr->timing.frame_rate_fps_stddev =
-      calculate_standard_deviation(ptr->timing.frame_rate_fps_list);
+      standard_deviation(ptr->timing.frame_rate_fps_list);
+
+  if (ptr->check_stop() != 0) {
+    return -1;
+  }
 
   // 7. calculate the threshold to consider frame drop: This should be 2
   // times the median, minus a factor
@@ -914,9 +1792,15 @@ int TimingInformation::derive_timing_info(
       ptr->timing.pts_duration_sec_median * FACTOR * 2;
 
   // 8. get the list of all the drops (absolute inter-frame values)
-  for (const auto& pts_duration_sec : ptr->timing.pts_duration_sec_list) {
-    if (pts_duration_sec > pts_duration_sec_threshold) {
-      ptr->timing.frame_drop_length_sec_list.push_back(pts_duration_sec);
+  if (parallel) {
+    parallel_select_over(ptr->timing.pts_duration_sec_list,
+                         pts_duration_sec_threshold, num_threads,
+                         &ptr->timing.frame_drop_length_sec_list);
+  } else {
+    for (const auto& pts_duration_sec : ptr->timing.pts_duration_sec_list) {
+      if (pts_duration_sec > pts_duration_sec_threshold) {
+        ptr->timing.frame_drop_length_sec_list.push_back(pts_duration_sec);
+      }
     }
   }
   // ptr->timing.frame_drop_length_sec_list: {0.6668900000000022,
@@ -924,10 +1808,8 @@ int TimingInformation::derive_timing_info(
   // ...}
 
   // 9. sum all the drops, but adding only the length over 1x frame time
-  double frame_drop_length_sec_list = 0.0;
-  for (const auto& drop_length_sec : ptr->timing.frame_drop_length_sec_list) {
-    frame_drop_length_sec_list += drop_length_sec;
-  }
+  double frame_drop_length_sec_list =
+      sum(ptr->timing.frame_drop_length_sec_list);
   double drop_length_duration_sec =
       frame_drop_length_sec_list -
       ptr->timing.pts_duration_sec_median *
@@ -935,10 +1817,7 @@ int TimingInformation::derive_timing_info(
   // drop_length_duration_sec: sum({33.35900000000022, 66.92600000000168, ...})
 
   // 10. get the total duration as the sum of all the inter-frame distances
-  double total_duration_sec = 0.0;
-  for (const auto& pts_duration_sec : ptr->timing.pts_duration_sec_list) {
-    total_duration_sec += pts_duration_sec;
-  }
+  double total_duration_sec = sum(ptr->timing.pts_duration_sec_list);
 
   // 11. calculate frame drop ratio as extra drop length over total duration
   ptr->timing.frame_drop_ratio = drop_length_duration_sec / total_duration_sec;
@@ -961,6 +1840,21 @@ int TimingInformation::derive_timing_info(
   return 0;
 }
 
+void TimingInformation::derive_audio_video_info(
+    std::shared_ptr<IsobmffFileInformation> ptr, int debug) {
+  // use a default invalid value for audio video ratio
+  ptr->timing.audio_video_ratio = -1.0;
+  ptr->timing.video_freeze = false;
+  if ((ptr->timing.duration_video_sec != -1.0) &&
+      (ptr->timing.duration_audio_sec != -1.0) &&
+      (ptr->timing.duration_video_sec >= 2.0)) {
+    ptr->timing.audio_video_ratio =
+        ptr->timing.duration_audio_sec / ptr->timing.duration_video_sec;
+    ptr->timing.video_freeze =
+        ptr->timing.audio_video_ratio > MAX_AUDIO_VIDEO_RATIO;
+  }
+}
+
 void TimingInformation::calculate_percentile_list(
     const std::vector<double> percentile_list,
     std::vector<double>& frame_drop_length_percentile_list, int debug) {
@@ -1016,11 +1910,200 @@ int FrameInformation::derive_frame_info(
   return 0;
 }
 
-void FrameInformation::parse_avcc(std::shared_ptr<ISOBMFF::AVCC> avcc,
-                                  int debug) {
+int FrameInformation::derive_bitrate_info(
+    std::shared_ptr<IsobmffFileInformation> ptr, const uint8_t* moov,
+    size_t moov_size, int debug) {
+  // 1. read the video sample sizes (stsz/stz2)
+  ptr->frame.sample_table = SampleTable();
+  ptr->frame.video_bitrate_bps = 0.0;
+  ptr->frame.video_bitrate_bps_peak = 0.0;
+  ptr->frame.video_bitrate_bps_window_list.clear();
+  ptr->frame.keyframe_size_bytes_average = 0.0;
+  ptr->frame.non_keyframe_size_bytes_average = 0.0;
+  ptr->frame.keyframe_size_ratio = 0.0;
+  int ret = (moov != nullptr)
+                ? parse_video_sample_table(moov, moov_size,
+                                           &ptr->frame.sample_table)
+                : read_video_sample_table(ptr->filename.c_str(),
+                                          &ptr->frame.sample_table);
+  if (ret != 0) {
+    if (debug > 0) {
+      fprintf(stderr, "warning: no video sample sizes in %s\n",
+              ptr->filename.c_str());
+    }
+    return 0;
+  }
+  const SampleSizeTable& sizes = ptr->frame.sample_table.sizes;
+  uint32_t sample_count = sizes.get_sample_count();
+
+  // 2. video bitrate
+  double duration_video_sec = ptr->timing.duration_video_sec;
+  if (duration_video_sec > 0.0) {
+    ptr->frame.video_bitrate_bps =
+        8.0 * ((double)sizes.get_total_size()) / duration_video_sec;
+  }
+
+  // 3. windowed bitrates (need the dts values, in decode order)
+  std::vector<double> dts_decode_sec_list;
+  ptr->timing.get_dts_decode_sec_list(&dts_decode_sec_list);
+  if (sample_count > 0 && dts_decode_sec_list.size() == sample_count) {
+    // 3.1. peak bitrate: the window ending at each sample covers the samples
+    // with dts in (dts - BITRATE_WINDOW_SEC, dts]. Both window ends only
+    // move forward, so the window sums take O(n).
+    uint64_t window_bytes = 0;
+    uint32_t window_start = 0;
+    for (uint32_t i = 0; i < sample_count; ++i) {
+      window_bytes += sizes.get_sample_size(i);
+      while (window_start < i &&
+             dts_decode_sec_list[window_start] <=
+                 dts_decode_sec_list[i] - BITRATE_WINDOW_SEC) {
+        window_bytes -= sizes.get_sample_size(window_start);
+        ++window_start;
+      }
+      double window_bitrate_bps =
+          8.0 * ((double)window_bytes) / BITRATE_WINDOW_SEC;
+      ptr->frame.video_bitrate_bps_peak =
+          std::max(ptr->frame.video_bitrate_bps_peak, window_bitrate_bps);
+    }
+    // 3.2. per-window bitrate. The number of windows is bounded by the
+    // video duration, so a corrupt stts delta cannot size the list (the
+    // samples past the duration go to the last window).
+    double max_dts_sec = 0.0;
+    for (const auto& dts_sec : dts_decode_sec_list) {
+      max_dts_sec = std::max(max_dts_sec, dts_sec);
+    }
+    double num_windows = std::floor(max_dts_sec / BITRATE_WINDOW_SEC) + 1.0;
+    if (duration_video_sec > 0.0) {
+      num_windows = std::min(
+          num_windows,
+          std::max(std::ceil(duration_video_sec / BITRATE_WINDOW_SEC), 1.0));
+    }
+    // the window list counts toward the analysis budget
+    if (ptr->control != nullptr &&
+        ptr->control->check_tables(
+            0, (uint64_t)std::min(num_windows, (double)UINT32_MAX)) != 0) {
+      if (debug > 0) {
+        fprintf(stderr, "error: too many bitrate windows in %s\n",
+                ptr->filename.c_str());
+      }
+      ptr->control->stop(kAnalysisOverBudget);
+      return -1;
+    }
+    ptr->frame.video_bitrate_bps_window_list.resize((size_t)num_windows, 0.0);
+    for (uint32_t i = 0; i < sample_count; ++i) {
+      double dts_sec = std::max(dts_decode_sec_list[i], 0.0);
+      size_t window = (size_t)std::min(
+          std::floor(dts_sec / BITRATE_WINDOW_SEC), num_windows - 1.0);
+      ptr->frame.video_bitrate_bps_window_list[window] +=
+          8.0 * ((double)sizes.get_sample_size(i)) / BITRATE_WINDOW_SEC;
+    }
+  }
+
+  // 4. keyframe vs. non-keyframe sizes
+  uint64_t keyframe_bytes = 0;
+  uint32_t keyframe_count = 0;
+  uint32_t last_sample_number = 0;
+  for (const auto& sample_number : ptr->timing.keyframe_sample_number_list) {
+    // stss sample numbers start at 1, and are strictly increasing
+    if (sample_number <= last_sample_number || sample_number > sample_count) {
+      continue;
+    }
+    keyframe_bytes += sizes.get_sample_size(sample_number - 1);
+    ++keyframe_count;
+    last_sample_number = sample_number;
+  }
+  uint32_t non_keyframe_count = sample_count - keyframe_count;
+  if (keyframe_count > 0) {
+    ptr->frame.keyframe_size_bytes_average =
+        ((double)keyframe_bytes) / keyframe_count;
+  }
+  if (non_keyframe_count > 0) {
+    ptr->frame.non_keyframe_size_bytes_average =
+        ((double)(sizes.get_total_size() - keyframe_bytes)) /
+        non_keyframe_count;
+  }
+  if (ptr->frame.non_keyframe_size_bytes_average > 0.0) {
+    ptr->frame.keyframe_size_ratio =
+        ptr->frame.keyframe_size_bytes_average /
+        ptr->frame.non_keyframe_size_bytes_average;
+  }
+
+  if (debug > 1) {
+    fprintf(stdout,
+            "-> video_bitrate_bps: %f video_bitrate_bps_peak: %f "
+            "keyframe_size_ratio: %f\n",
+            ptr->frame.video_bitrate_bps, ptr->frame.video_bitrate_bps_peak,
+            ptr->frame.keyframe_size_ratio);
+  }
+  return 0;
+}
+
+// Parameter-set NAL unit of a codec configuration record.
+struct ParameterSet {
+  // nal_unit_type: NAL unit type of the hvcC array (0 for avcC).
+  uint8_t nal_unit_type;
+  std::vector<uint8_t> data;
+};
+
+// parameter_set_cache: SPS fields of the recent parameter sets (shared by
+// all the analyses).
+ParameterSetCache parameter_set_cache;
+
+// Get the parameter-set cache key: the codec, followed by the type, length,
+// and bytes of every parameter set.
+std::string get_parameter_set_key(char codec,
+                                  const std::vector<ParameterSet>& sets) {
+  std::string key(1, codec);
+  for (const auto& set : sets) {
+    uint32_t size = set.data.size();
+    key.push_back(static_cast<char>(set.nal_unit_type));
+    key.push_back(static_cast<char>((size >> 24) & 0xff));
+    key.push_back(static_cast<char>((size >> 16) & 0xff));
+    key.push_back(static_cast<char>((size >> 8) & 0xff));
+    key.push_back(static_cast<char>(size & 0xff));
+    key.append(set.data.begin(), set.data.end());
+  }
+  return key;
+}
+
+#if ADD_SPS_READER
+// Update the SPS fields with the ones of a later SPS (the colour fields
+// are only replaced if the later SPS has a colour description).
+void update_sps_info(const SpsInfo& sps_info, SpsInfo* info) {
+  if (sps_info.colour_primaries != -1) {
+    info->colour_primaries = sps_info.colour_primaries;
+    info->transfer_characteristics = sps_info.transfer_characteristics;
+    info->matrix_coeffs = sps_info.matrix_coeffs;
+    info->video_full_range_flag = sps_info.video_full_range_flag;
+  }
+  info->profile_idc = sps_info.profile_idc;
+  info->level_idc = sps_info.level_idc;
+  info->profile_type_str = sps_info.profile_type_str;
+}
+
+void parse_h264_sps_info(const std::vector<ParameterSet>& sets, SpsInfo* info) {
+  for (const auto& set : sets) {
+    SpsInfo sps_info;
+    if (read_h264_sps(set.data.data(), set.data.size(), &sps_info) == 0) {
+      update_sps_info(sps_info, info);
+    }
+  }
+}
+
+void parse_h265_sps_info(const std::vector<ParameterSet>& sets, SpsInfo* info) {
+  for (const auto& set : sets) {
+    SpsInfo sps_info;
+    // nal_unit_type 33: SPS_NUT
+    if ((set.nal_unit_type == 33) &&
+        (read_h265_sps(set.data.data(), set.data.size(), &sps_info) == 0)) {
+      update_sps_info(sps_info, info);
+    }
+  }
+}
+#else
+void parse_h264_sps_info(const std::vector<ParameterSet>& sets, SpsInfo* info) {
   // define an avcc parser state
   h264nal::H264BitstreamParserState bitstream_parser_state;
-  std::unique_ptr<h264nal::H264BitstreamParser::BitstreamState> bitstream;
   h264nal::ParsingOptions parsing_options;
   parsing_options.add_offset = false;
   parsing_options.add_length = false;
@@ -1028,20 +2111,11 @@ void FrameInformation::parse_avcc(std::shared_ptr<ISOBMFF::AVCC> avcc,
   parsing_options.add_checksum = false;
   parsing_options.add_resolution = false;
 
-  // set default values
-  this->colour_primaries = -1;
-  this->transfer_characteristics = -1;
-  this->matrix_coeffs = -1;
-  this->video_full_range_flag = -1;
-  this->profile_idc = -1;
-  this->level_idc = -1;
-  this->profile_type_str = "";
-
-  // extract the SPS NAL Units
-  for (const auto& sps : avcc->GetSequenceParameterSetNALUnits()) {
-    std::vector<uint8_t> buffer = sps->GetData();
+  // parse the SPS NAL Units
+  for (const auto& set : sets) {
     auto nal_unit = h264nal::H264NalUnitParser::ParseNalUnit(
-        buffer.data(), buffer.size(), &bitstream_parser_state, parsing_options);
+        set.data.data(), set.data.size(), &bitstream_parser_state,
+        parsing_options);
     if (nal_unit == nullptr) {
       // cannot parse the NalUnit
       continue;
@@ -1051,38 +2125,28 @@ void FrameInformation::parse_avcc(std::shared_ptr<ISOBMFF::AVCC> avcc,
     if ((nal_unit->nal_unit_payload != nullptr) &&
         (nal_unit->nal_unit_payload->sps != nullptr) &&
         (nal_unit->nal_unit_payload->sps->sps_data != nullptr)) {
-      if ((nal_unit->nal_unit_payload->sps->sps_data->vui_parameters !=
-           nullptr) &&
-          (nal_unit->nal_unit_payload->sps->sps_data->vui_parameters
-               ->colour_description_present_flag == 1) &&
-          (nal_unit->nal_unit_payload->sps->sps_data
-               ->vui_parameters_present_flag == 1)) {
-        this->colour_primaries = nal_unit->nal_unit_payload->sps->sps_data
-                                     ->vui_parameters->colour_primaries;
-        this->transfer_characteristics =
-            nal_unit->nal_unit_payload->sps->sps_data->vui_parameters
-                ->transfer_characteristics;
-        this->matrix_coeffs = nal_unit->nal_unit_payload->sps->sps_data
-                                  ->vui_parameters->matrix_coefficients;
-        this->video_full_range_flag =
-            nal_unit->nal_unit_payload->sps->sps_data->vui_parameters
-                ->video_full_range_flag;
+      const auto& sps_data = nal_unit->nal_unit_payload->sps->sps_data;
+      if ((sps_data->vui_parameters != nullptr) &&
+          (sps_data->vui_parameters->colour_description_present_flag == 1) &&
+          (sps_data->vui_parameters_present_flag == 1)) {
+        info->colour_primaries = sps_data->vui_parameters->colour_primaries;
+        info->transfer_characteristics =
+            sps_data->vui_parameters->transfer_characteristics;
+        info->matrix_coeffs = sps_data->vui_parameters->matrix_coefficients;
+        info->video_full_range_flag =
+            sps_data->vui_parameters->video_full_range_flag;
       }
-      this->profile_idc =
-          nal_unit->nal_unit_payload->sps->sps_data->profile_idc;
-      this->level_idc = nal_unit->nal_unit_payload->sps->sps_data->level_idc;
-      h264nal::profileTypeToString(
-          nal_unit->nal_unit_payload->sps->sps_data->profile_type,
-          this->profile_type_str);
+      info->profile_idc = sps_data->profile_idc;
+      info->level_idc = sps_data->level_idc;
+      h264nal::profileTypeToString(sps_data->profile_type,
+                                   info->profile_type_str);
     }
   }
 }
 
-void FrameInformation::parse_hvcc(std::shared_ptr<ISOBMFF::HVCC> hvcc,
-                                  int debug) {
+void parse_h265_sps_info(const std::vector<ParameterSet>& sets, SpsInfo* info) {
   // define an hevc parser state
   h265nal::H265BitstreamParserState bitstream_parser_state;
-  std::unique_ptr<h265nal::H265BitstreamParser::BitstreamState> bitstream;
   h265nal::ParsingOptions parsing_options;
   parsing_options.add_offset = false;
   parsing_options.add_length = false;
@@ -1090,64 +2154,103 @@ void FrameInformation::parse_hvcc(std::shared_ptr<ISOBMFF::HVCC> hvcc,
   parsing_options.add_checksum = false;
   parsing_options.add_resolution = false;
 
-  // set default values
-  this->colour_primaries = -1;
-  this->transfer_characteristics = -1;
-  this->matrix_coeffs = -1;
-  this->video_full_range_flag = -1;
-  this->profile_idc = -1;
-  this->level_idc = -1;
-  this->profile_type_str = "";
+  // parse the NAL Units
+  for (const auto& set : sets) {
+    auto nal_unit = h265nal::H265NalUnitParser::ParseNalUnit(
+        set.data.data(), set.data.size(), &bitstream_parser_state,
+        parsing_options);
+    if (nal_unit == nullptr) {
+      // cannot parse the NalUnit
+      continue;
+    }
+
+    // Look for SPS NAL units
+    if ((set.nal_unit_type == h265nal::NalUnitType::SPS_NUT) &&
+        (nal_unit->nal_unit_payload != nullptr) &&
+        (nal_unit->nal_unit_payload->sps != nullptr)) {
+      const auto& sps = nal_unit->nal_unit_payload->sps;
+      if ((sps->vui_parameters != nullptr) &&
+          (sps->vui_parameters_present_flag == 1) &&
+          (sps->vui_parameters->colour_description_present_flag == 1)) {
+        info->colour_primaries = sps->vui_parameters->colour_primaries;
+        info->transfer_characteristics =
+            sps->vui_parameters->transfer_characteristics;
+        info->matrix_coeffs = sps->vui_parameters->matrix_coeffs;
+        info->video_full_range_flag =
+            sps->vui_parameters->video_full_range_flag;
+      }
+      if ((sps->profile_tier_level != nullptr) &&
+          (sps->profile_tier_level->general != nullptr)) {
+        info->profile_idc = sps->profile_tier_level->general->profile_idc;
+        info->level_idc = sps->profile_tier_level->general_level_idc;
+        h265nal::profileTypeToString(
+            sps->profile_tier_level->general->profile_type,
+            info->profile_type_str);
+      }
+    }
+  }
+}
+
+#endif
+
+// Get the SPS fields of a list of parameter sets, using the parameter-set
+// cache.
+void get_sps_info(char codec, const std::vector<ParameterSet>& sets,
+                  SpsInfo* info) {
+  std::string key = get_parameter_set_key(codec, sets);
+  if (parameter_set_cache.lookup(key, info)) {
+    return;
+  }
+  if (codec == 'a') {
+    parse_h264_sps_info(sets, info);
+  } else {
+    parse_h265_sps_info(sets, info);
+  }
+  parameter_set_cache.insert(key, *info);
+}
+
+void FrameInformation::parse_avcc(std::shared_ptr<ISOBMFF::AVCC> avcc,
+                                  int debug) {
+  // 1. extract the SPS NAL Units
+  std::vector<ParameterSet> sets;
+  for (const auto& sps : avcc->GetSequenceParameterSetNALUnits()) {
+    sets.push_back({0, sps->GetData()});
+  }
+
+  // 2. get the SPS fields
+  SpsInfo info;
+  get_sps_info('a', sets, &info);
+  this->colour_primaries = info.colour_primaries;
+  this->transfer_characteristics = info.transfer_characteristics;
+  this->matrix_coeffs = info.matrix_coeffs;
+  this->video_full_range_flag = info.video_full_range_flag;
+  this->profile_idc = info.profile_idc;
+  this->level_idc = info.level_idc;
+  this->profile_type_str = info.profile_type_str;
+}
 
-  // extract the NAL Units
+void FrameInformation::parse_hvcc(std::shared_ptr<ISOBMFF::HVCC> hvcc,
+                                  int debug) {
+  // 1. extract the NAL Units
+  std::vector<ParameterSet> sets;
   for (const auto& array : hvcc->GetArrays()) {
     // bool array_completeness = array->GetArrayCompleteness();
     uint8_t nal_unit_type = array->GetNALUnitType();
     for (const auto& data : array->GetNALUnits()) {
-      std::vector<uint8_t> buffer = data->GetData();
-      auto nal_unit = h265nal::H265NalUnitParser::ParseNalUnit(
-          buffer.data(), buffer.size(), &bitstream_parser_state,
-          parsing_options);
-      if (nal_unit == nullptr) {
-        // cannot parse the NalUnit
-        continue;
-      }
-
-      // Look for SPS NAL units
-      if ((nal_unit_type == h265nal::NalUnitType::SPS_NUT) &&
-          (nal_unit->nal_unit_payload != nullptr) &&
-          (nal_unit->nal_unit_payload->sps != nullptr)) {
-        if ((nal_unit->nal_unit_payload->sps->vui_parameters != nullptr) &&
-            (nal_unit->nal_unit_payload->sps->vui_parameters_present_flag ==
-             1) &&
-            (nal_unit->nal_unit_payload->sps->vui_parameters
-                 ->colour_description_present_flag == 1)) {
-          this->colour_primaries =
-              nal_unit->nal_unit_payload->sps->vui_parameters->colour_primaries;
-          this->transfer_characteristics =
-              nal_unit->nal_unit_payload->sps->vui_parameters
-                  ->transfer_characteristics;
-          this->matrix_coeffs =
-              nal_unit->nal_unit_payload->sps->vui_parameters->matrix_coeffs;
-          this->video_full_range_flag =
-              nal_unit->nal_unit_payload->sps->vui_parameters
-                  ->video_full_range_flag;
-        }
-        if ((nal_unit->nal_unit_payload->sps->profile_tier_level != nullptr) &&
-            (nal_unit->nal_unit_payload->sps->profile_tier_level->general !=
-             nullptr)) {
-          this->profile_idc = nal_unit->nal_unit_payload->sps
-                                  ->profile_tier_level->general->profile_idc;
-          this->level_idc = nal_unit->nal_unit_payload->sps->profile_tier_level
-                                ->general_level_idc;
-          h265nal::profileTypeToString(
-              nal_unit->nal_unit_payload->sps->profile_tier_level->general
-                  ->profile_type,
-              this->profile_type_str);
-        }
-      }
+      sets.push_back({nal_unit_type, data->GetData()});
     }
   }
+
+  // 2. get the SPS fields
+  SpsInfo info;
+  get_sps_info('h', sets, &info);
+  this->colour_primaries = info.colour_primaries;
+  this->transfer_characteristics = info.transfer_characteristics;
+  this->matrix_coeffs = info.matrix_coeffs;
+  this->video_full_range_flag = info.video_full_range_flag;
+  this->profile_idc = info.profile_idc;
+  this->level_idc = info.level_idc;
+  this->profile_type_str = info.profile_type_str;
 }
 
 int AudioInformation::parse_mp4a(std::shared_ptr<ISOBMFF::ContainerBox> stbl,
@@ -3,6 +3,7 @@
 
 #include <liblcvm_c.h>
 
+#include <cstddef>
 #include <cstring>
 #include <memory>
 #include <string>
@@ -54,6 +55,8 @@ const char* liblcvm_get_error_string(liblcvm_error_t error) {
       return "Unknown error";
     case LIBLCVM_ERROR_OUT_OF_MEMORY:
       return "Out of memory";
+    case LIBLCVM_ERROR_TIMEOUT:
+      return "Timeout";
     default:
       return "Unknown error code";
   }
@@ -85,6 +88,23 @@ void liblcvm_config_init(liblcvm_config_t* config) {
   config->policy[0] = '\0';
 }
 
+// Whether a limits structure of the caller's size holds a field (callers
+// built against an older header pass a smaller structure)
+#define LIMITS_HAS_FIELD(struct_size, field)            \
+  ((struct_size) >= offsetof(liblcvm_limits_t, field) + \
+                        sizeof(((liblcvm_limits_t*)nullptr)->field))
+
+void liblcvm_limits_init(liblcvm_limits_t* limits, size_t struct_size) {
+  if (!limits || !LIMITS_HAS_FIELD(struct_size, struct_size))
+    return;
+
+  limits->struct_size = struct_size;
+  if (LIMITS_HAS_FIELD(struct_size, timeout_ms))
+    limits->timeout_ms = 0;
+  if (LIMITS_HAS_FIELD(struct_size, max_memory_bytes))
+    limits->max_memory_bytes = 0;
+}
+
 // ====================
 // Main Analysis API
 // ====================
@@ -93,9 +113,20 @@ liblcvm_error_t liblcvm_parse_file(
     const char* filename,
     const liblcvm_config_t* config,
     liblcvm_file_info_t* handle) {
+  return liblcvm_parse_file_with_limits(filename, config, nullptr, handle);
+}
+
+liblcvm_error_t liblcvm_parse_file_with_limits(
+    const char* filename,
+    const liblcvm_config_t* config,
+    const liblcvm_limits_t* limits,
+    liblcvm_file_info_t* handle) {
   if (!filename || !handle) {
     return LIBLCVM_ERROR_INVALID_PARAMS;
   }
+  if (limits && !LIMITS_HAS_FIELD(limits->struct_size, struct_size)) {
+    return LIBLCVM_ERROR_INVALID_PARAMS;
+  }
 
   if (!file_exists(filename)) {
     return LIBLCVM_ERROR_FILE_NOT_FOUND;
@@ -115,11 +146,24 @@ liblcvm_error_t liblcvm_parse_file(
       cpp_config.set_sort_by_pts(true);
       cpp_config.set_debug(0);
     }
+    if (limits) {
+      if (LIMITS_HAS_FIELD(limits->struct_size, timeout_ms)) {
+        cpp_config.set_timeout_ms(limits->timeout_ms);
+      }
+      if (LIMITS_HAS_FIELD(limits->struct_size, max_memory_bytes)) {
+        cpp_config.set_max_memory_bytes(limits->max_memory_bytes);
+      }
+    }
 
     // Parse the file
-    auto cpp_info = IsobmffFileInformation::parse(filename, cpp_config);
+    int error = 0;
+    auto cpp_info = IsobmffFileInformation::parse(filename, cpp_config, &error);
     if (!cpp_info) {
-      return LIBLCVM_ERROR_PARSE_FAILED;
+      if (error == kAnalysisTimeout) {
+        return LIBLCVM_ERROR_TIMEOUT;
+      }
+      return (error == kAnalysisOverBudget) ? LIBLCVM_ERROR_OUT_OF_MEMORY
+                                            : LIBLCVM_ERROR_PARSE_FAILED;
     }
 
     // Create wrapper
@@ -0,0 +1,84 @@
+#include "mapped_file.h"
+
+#include "sample_table.h"
+
+#if HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+int MappedFile::open(const char* infile) {
+  close();
+#if HAVE_MMAP
+  // 1. open the file
+  fd = ::open(infile, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close();
+    return -1;
+  }
+
+  // 2. map it
+  void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    close();
+    return -1;
+  }
+  data = static_cast<const uint8_t*>(addr);
+  size = static_cast<size_t>(st.st_size);
+  // only the box headers are read until the moov box
+  madvise(addr, size, MADV_RANDOM);
+  return 0;
+#else
+  (void)infile;
+  return -1;
+#endif
+}
+
+void MappedFile::close() {
+#if HAVE_MMAP
+  if (data != nullptr) {
+    void* addr = const_cast<uint8_t*>(data);
+    madvise(addr, size, MADV_DONTNEED);
+    munmap(addr, size);
+  }
+  if (fd >= 0) {
+#ifdef POSIX_FADV_DONTNEED
+    // only drop the pages this analysis read
+    if (touched_size > 0) {
+      posix_fadvise(fd, touched_offset, touched_size, POSIX_FADV_DONTNEED);
+    }
+#endif
+    ::close(fd);
+  }
+#endif
+  fd = -1;
+  data = nullptr;
+  size = 0;
+  touched_offset = 0;
+  touched_size = 0;
+}
+
+int MappedFile::get_moov_box(const uint8_t** moov, size_t* moov_size) {
+  if (data == nullptr || find_moov_box(data, size, moov, moov_size) != 0) {
+    return -1;
+  }
+#if HAVE_MMAP
+  // prefetch the moov box (madvise() needs a page-aligned address)
+  uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t start = reinterpret_cast<uintptr_t>(*moov) & ~(page_size - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(*moov) + *moov_size;
+  madvise(reinterpret_cast<void*>(start), end - start, MADV_WILLNEED);
+  touched_offset = *moov - data;
+  touched_size = *moov_size;
+#endif
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "parallel_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <thread>
+
+namespace {
+
+size_t get_num_chunks(size_t size) {
+  return (size + kParallelChunkSize - 1) / kParallelChunkSize;
+}
+
+// @brief Run a function over a number of tasks, in parallel (the tasks are
+// handed dynamically to the threads).
+void parallel_for_tasks(size_t num_tasks, int num_threads,
+                        const std::function<void(size_t task)>& fn) {
+  size_t thread_count = std::min<size_t>(std::max(1, num_threads), num_tasks);
+  std::atomic<size_t> next_task{0};
+  auto run_tasks = [&]() {
+    size_t task;
+    while ((task = next_task.fetch_add(1)) < num_tasks) {
+      fn(task);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < thread_count; ++t) {
+    threads.emplace_back(run_tasks);
+  }
+  run_tasks();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// @brief Sort a list in parallel: each chunk is sorted, and then the sorted
+// runs are merged pairwise (the merges of a round run in parallel). The
+// merges keep the order of equal elements when the chunk sort does.
+template <typename T, typename Compare, typename Sort>
+void parallel_sort(std::vector<T>* list, Compare comp, Sort sort,
+                   int num_threads) {
+  const size_t size = list->size();
+  // 1. sort the chunks
+  parallel_for_chunks(size, num_threads, [&](size_t, size_t begin, size_t end) {
+    sort(list->begin() + begin, list->begin() + end, comp);
+  });
+  // 2. merge the sorted runs
+  for (size_t width = kParallelChunkSize; width < size; width *= 2) {
+    size_t num_merges = (size + 2 * width - 1) / (2 * width);
+    parallel_for_tasks(num_merges, num_threads, [&](size_t merge) {
+      size_t begin = merge * 2 * width;
+      size_t middle = std::min(begin + width, size);
+      size_t end = std::min(begin + 2 * width, size);
+      std::inplace_merge(list->begin() + begin, list->begin() + middle,
+                         list->begin() + end, comp);
+    });
+  }
+}
+
+}  // namespace
+
+void parallel_for_chunks(
+    size_t size, int num_threads,
+    const std::function<void(size_t chunk, size_t begin, size_t end)>& fn) {
+  size_t num_chunks = get_num_chunks(size);
+  parallel_for_tasks(num_chunks, num_threads, [&](size_t chunk) {
+    size_t begin = chunk * kParallelChunkSize;
+    fn(chunk, begin, std::min(begin + kParallelChunkSize, size));
+  });
+}
+
+void parallel_stable_sort_index(const std::vector<double>& key_list,
+                                int num_threads,
+                                std::vector<uint32_t>* index_list) {
+  index_list->resize(key_list.size());
+  std::iota(index_list->begin(), index_list->end(), 0);
+  parallel_sort(
+      index_list,
+      [&key_list](uint32_t a, uint32_t b) { return key_list[a] < key_list[b]; },
+      [](auto begin, auto end, auto comp) {
+        std::stable_sort(begin, end, comp);
+      },
+      num_threads);
+}
+
+double parallel_sum(const std::vector<double>& vec, int num_threads) {
+  size_t num_chunks = get_num_chunks(vec.size());
+  std::vector<double> chunk_sums(num_chunks, 0.0);
+  parallel_for_chunks(vec.size(), num_threads,
+                      [&](size_t chunk, size_t begin, size_t end) {
+                        double sum = 0.0;
+                        for (size_t i = begin; i < end; ++i) {
+                          sum += vec[i];
+                        }
+                        chunk_sums[chunk] = sum;
+                      });
+  // add up the chunk sums in chunk order
+  return std::accumulate(chunk_sums.begin(), chunk_sums.end(), 0.0);
+}
+
+double parallel_average(const std::vector<double>& vec, int num_threads) {
+  return parallel_sum(vec, num_threads) / vec.size();
+}
+
+double parallel_median(const std::vector<double>& vec, int num_threads) {
+  if (vec.empty()) {
+    fprintf(stderr, "error: calculate_median empty input vector\n");
+    return 0.0;
+  }
+  std::vector<double> vec2 = vec;
+  parallel_sort(
+      &vec2, std::less<double>(),
+      [](auto begin, auto end, auto comp) { std::sort(begin, end, comp); },
+      num_threads);
+  size_t n = vec2.size();
+  if (n % 2 == 0) {
+    return (vec2[n / 2 - 1] + vec2[n / 2]) / 2.0;
+  } else {
+    return vec2[n / 2];
+  }
+}
+
+double parallel_standard_deviation(const std::vector<double>& vec,
+                                   int num_threads) {
+  if (vec.size() < 2) {
+    fprintf(stderr,
+            "error: calculate_standard_deviation needs at least 2 "
+            "elements\n");
+    return 0.0;
+  }
+  double mean = parallel_average(vec, num_threads);
+  size_t num_chunks = get_num_chunks(vec.size());
+  std::vector<double> chunk_sums(num_chunks, 0.0);
+  parallel_for_chunks(vec.size(), num_threads,
+                      [&](size_t chunk, size_t begin, size_t end) {
+                        double sum_squares = 0.0;
+                        for (size_t i = begin; i < end; ++i) {
+                          sum_squares += (vec[i] - mean) * (vec[i] - mean);
+                        }
+                        chunk_sums[chunk] = sum_squares;
+                      });
+  double sum_squares =
+      std::accumulate(chunk_sums.begin(), chunk_sums.end(), 0.0);
+  return std::sqrt(sum_squares / (vec.size() - 1));
+}
+
+double parallel_median_absolute_deviation(const std::vector<double>& vec,
+                                          int num_threads) {
+  double median = parallel_median(vec, num_threads);
+  std::vector<double> vec_abs_differences(vec.size());
+  parallel_for_chunks(vec.size(), num_threads,
+                      [&](size_t, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; ++i) {
+                          vec_abs_differences[i] = std::fabs(vec[i] - median);
+                        }
+                      });
+  return parallel_median(vec_abs_differences, num_threads);
+}
+
+void parallel_select_over(const std::vector<double>& vec, double threshold,
+                          int num_threads, std::vector<double>* out) {
+  size_t num_chunks = get_num_chunks(vec.size());
+  std::vector<std::vector<double>> chunk_out(num_chunks);
+  parallel_for_chunks(vec.size(), num_threads,
+                      [&](size_t chunk, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; ++i) {
+                          if (vec[i] > threshold) {
+                            chunk_out[chunk].push_back(vec[i]);
+                          }
+                        }
+                      });
+  // concatenate the chunk results in chunk order
+  for (const auto& values : chunk_out) {
+    out->insert(out->end(), values.begin(), values.end());
+  }
+}
@@ -0,0 +1,33 @@
+// Parameter-set cache (SPS fields memoized by the parameter-set bytes).
+
+#include "parameter_set_cache.h"
+
+bool ParameterSetCache::lookup(const std::string& key, SpsInfo* info) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    return false;
+  }
+  // move the entry to the front (most recently used)
+  order.splice(order.begin(), order, it->second);
+  *info = it->second->second;
+  return true;
+}
+
+void ParameterSetCache::insert(const std::string& key, const SpsInfo& info) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (entries.count(key) > 0) {
+    return;
+  }
+  if (order.size() >= kParameterSetCacheSize) {
+    entries.erase(order.back().first);
+    order.pop_back();
+  }
+  order.emplace_front(key, info);
+  entries[key] = order.begin();
+}
+
+size_t ParameterSetCache::size() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return order.size();
+}
@@ -0,0 +1,942 @@
+#include "policy_compiler.h"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <variant>
+
+namespace {
+
+// The first re-plan happens after kFirstReplan evaluations, and every
+// re-plan doubles the number of evaluations to the next one, so the operand
+// order settles quickly.
+constexpr uint64_t kFirstReplan = 64;
+
+// After the first kFirstReplan evaluations, only one in kStatsSampleInterval
+// single-row evaluations updates the operand statistics (the estimated
+// operand probabilities are unchanged, and concurrent evaluations do not
+// contend on the shared counters).
+constexpr uint64_t kStatsSampleInterval = 16;
+
+// Largest number of shared predicates, so the memo of a single-row
+// evaluation fits in a fixed-size stack buffer (further repeated predicates
+// are evaluated every time).
+constexpr int32_t kMaxMemos = 64;
+
+}  // namespace
+
+// Lowers dsl::Expr trees into CompiledPolicy instructions.
+class PolicyCompiler {
+ public:
+  PolicyCompiler(CompiledPolicy* compiled_policy, const LiblcvmKeyList& keys,
+                 const CompiledPolicy* previous_policy)
+      : policy(compiled_policy), previous(previous_policy) {
+    // later keys overwrite earlier ones (same as the policy_runner dict)
+    for (size_t i = 0; i < keys.size(); ++i) {
+      slot_map[keys[i]] = static_cast<int32_t>(i);
+    }
+  }
+
+  // Number the and/or operands in source order, so the stats index of an
+  // operand does not depend on the order it is scheduled in.
+  void number_operands(const dsl::Expr& expr) {
+    if (expr.has_not_expr()) {
+      number_operands(expr.not_expr().expr());
+    } else if (expr.has_logical()) {
+      operand_base[&expr.logical()] = num_operands;
+      num_operands += expr.logical().operands_size();
+      for (const auto& operand : expr.logical().operands()) {
+        number_operands(operand);
+      }
+    }
+  }
+
+  size_t get_num_operands() const { return num_operands; }
+
+  // Whether evaluating the expression can throw (ordered comparisons do on
+  // string values). Operands that can throw are never reordered.
+  bool can_throw(const dsl::Expr& expr) const {
+    switch (expr.expr_kind_case()) {
+      case dsl::Expr::kComparison:
+        return get_slot(expr.comparison().column()) >= 0 &&
+               expr.comparison().op() != dsl::ComparisonOpType::EQ &&
+               expr.comparison().op() != dsl::ComparisonOpType::NE;
+      case dsl::Expr::kNotExpr:
+        return can_throw(expr.not_expr().expr());
+      case dsl::Expr::kLogical:
+        for (const auto& operand : expr.logical().operands()) {
+          if (can_throw(operand)) {
+            return true;
+          }
+        }
+        return false;
+      default:
+        return false;
+    }
+  }
+
+  // Static cost estimate: numeric predicates cost 1, string and
+  // column-vs-column predicates cost 2, and missing columns are free.
+  double cost(const dsl::Expr& expr) const {
+    switch (expr.expr_kind_case()) {
+      case dsl::Expr::kComparison: {
+        const dsl::Comparison& cmp = expr.comparison();
+        if (get_slot(cmp.column()) < 0) {
+          return 0.0;
+        }
+        if (get_slot(cmp.value()) >= 0) {
+          return 2.0;
+        }
+        try {
+          std::stod(cmp.value());
+        } catch (const std::exception&) {
+          return 2.0;
+        }
+        return 1.0;
+      }
+      case dsl::Expr::kRange:
+        return (get_slot(expr.range().column()) < 0) ? 0.0 : 1.0;
+      case dsl::Expr::kNotExpr:
+        return cost(expr.not_expr().expr());
+      case dsl::Expr::kLogical: {
+        double sum = 0.0;
+        for (const auto& operand : expr.logical().operands()) {
+          sum += cost(operand);
+        }
+        return sum;
+      }
+      default:
+        return 0.0;
+    }
+  }
+
+  // Schedule the operands of an and/or. Operands are sorted by their cost
+  // per short-circuit (cost / P(false) for and, cost / P(true) for or),
+  // with P() estimated from the previous policy stats (1/2 if there are
+  // none). Sorting happens only inside runs of operands that cannot throw,
+  // so the order never changes whether an evaluation fails.
+  std::vector<int> plan_operands(const dsl::Logical& logic,
+                                 uint32_t base) const {
+    std::vector<int> order(logic.operands_size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<double> rank(order.size());
+    std::vector<bool> pinned(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      pinned[i] = can_throw(logic.operands(i));
+      double evaluations = 0.0;
+      double matches = 0.0;
+      if (previous != nullptr) {
+        const PolicyOperandStats& stats =
+            previous->get_operand_stats(base + i);
+        evaluations = stats.evaluations.load(std::memory_order_relaxed);
+        matches = stats.matches.load(std::memory_order_relaxed);
+      }
+      double p_true = (matches + 1.0) / (evaluations + 2.0);
+      double p_short_circuit =
+          (logic.op() == dsl::LogicOpType::AND) ? (1.0 - p_true) : p_true;
+      rank[i] = cost(logic.operands(i)) / p_short_circuit;
+    }
+    size_t begin = 0;
+    while (begin < order.size()) {
+      if (pinned[begin]) {
+        ++begin;
+        continue;
+      }
+      size_t end = begin;
+      while (end < order.size() && !pinned[end]) {
+        ++end;
+      }
+      std::stable_sort(order.begin() + begin, order.begin() + end,
+                       [&rank](int a, int b) { return rank[a] < rank[b]; });
+      begin = end;
+    }
+    return order;
+  }
+
+  int32_t get_slot(const std::string& column) const {
+    auto it = slot_map.find(column);
+    return (it == slot_map.end()) ? -1 : it->second;
+  }
+
+  // Same as get_slot(), but records the column as referenced.
+  int32_t use_slot(const std::string& column) {
+    int32_t slot = get_slot(column);
+    if (slot >= 0) {
+      policy->referenced_columns.insert(column);
+    }
+    return slot;
+  }
+
+  uint32_t emit(const PolicyInstruction& ins) {
+    policy->code.push_back(ins);
+    return static_cast<uint32_t>(policy->code.size() - 1);
+  }
+
+  void emit_const(bool value) {
+    PolicyInstruction ins;
+    ins.opcode = value ? PolicyOpcode::kTrue : PolicyOpcode::kFalse;
+    emit(ins);
+  }
+
+  void compile_comparison(const dsl::Comparison& cmp) {
+    PolicyInstruction ins;
+    ins.slot = use_slot(cmp.column());
+    if (ins.slot < 0) {
+      // a missing column never matches
+      emit_const(false);
+      return;
+    }
+    ins.opcode = PolicyOpcode::kCompare;
+    ins.op = cmp.op();
+    // the RHS is a variable if it names an existing column
+    ins.rhs_slot = use_slot(cmp.value());
+    if (ins.rhs_slot < 0) {
+      ins.rhs_string = static_cast<uint32_t>(policy->string_table.size());
+      policy->string_table.push_back(cmp.value());
+      try {
+        ins.rhs_number = std::stod(cmp.value());
+        ins.rhs_number_valid = true;
+      } catch (const std::exception&) {
+        ins.rhs_number_valid = false;
+      }
+    }
+    emit(ins);
+  }
+
+  void compile_range(const dsl::RangeCheck& range) {
+    PolicyInstruction ins;
+    ins.slot = use_slot(range.column());
+    if (ins.slot < 0) {
+      emit_const(false);
+      return;
+    }
+    ins.opcode = PolicyOpcode::kRange;
+    ins.rhs_number = range.low();
+    ins.high = range.high();
+    emit(ins);
+  }
+
+  void compile_logical(const dsl::Logical& logic) {
+    PolicyOpcode jump_opcode;
+    switch (logic.op()) {
+      case dsl::LogicOpType::AND:
+        jump_opcode = PolicyOpcode::kJumpIfFalse;
+        break;
+      case dsl::LogicOpType::OR:
+        jump_opcode = PolicyOpcode::kJumpIfTrue;
+        break;
+      default:
+        emit_const(false);
+        return;
+    }
+    if (logic.operands().empty()) {
+      // empty and is true, empty or is false
+      emit_const(logic.op() == dsl::LogicOpType::AND);
+      return;
+    }
+    // every operand short-circuits to the end with the accumulator
+    // untouched (the jump after the last operand only records its stats)
+    uint32_t base = operand_base.at(&logic);
+    std::vector<uint32_t> jumps;
+    for (int i : plan_operands(logic, base)) {
+      compile_expr(logic.operands(i));
+      PolicyInstruction ins;
+      ins.opcode = jump_opcode;
+      ins.operand = static_cast<int32_t>(base + i);
+      jumps.push_back(emit(ins));
+    }
+    uint32_t end = static_cast<uint32_t>(policy->code.size());
+    for (uint32_t pc : jumps) {
+      policy->code[pc].target = end;
+    }
+  }
+
+  void compile_expr(const dsl::Expr& expr) {
+    switch (expr.expr_kind_case()) {
+      case dsl::Expr::kComparison:
+        compile_comparison(expr.comparison());
+        break;
+      case dsl::Expr::kRange:
+        compile_range(expr.range());
+        break;
+      case dsl::Expr::kNotExpr: {
+        compile_expr(expr.not_expr().expr());
+        PolicyInstruction ins;
+        ins.opcode = PolicyOpcode::kNot;
+        emit(ins);
+      } break;
+      case dsl::Expr::kLogical:
+        compile_logical(expr.logical());
+        break;
+      default:
+        emit_const(false);
+        break;
+    }
+  }
+
+  // Collect the message columns, in the same order the policy_runner used
+  // to list them.
+  void collect_message_slots(const dsl::Expr& expr,
+                             std::vector<int32_t>* slots) const {
+    if (expr.has_comparison()) {
+      int32_t slot = get_slot(expr.comparison().column());
+      if (slot >= 0) {
+        slots->push_back(slot);
+      }
+    } else if (expr.has_range()) {
+      int32_t slot = get_slot(expr.range().column());
+      if (slot >= 0) {
+        slots->push_back(slot);
+      }
+    } else if (expr.has_not_expr()) {
+      collect_message_slots(expr.not_expr().expr(), slots);
+    } else if (expr.has_logical()) {
+      for (const auto& operand : expr.logical().operands()) {
+        collect_message_slots(operand, slots);
+      }
+    }
+  }
+
+  void compile_rule(const dsl::Rule& rule) {
+    PolicyCompiledRule compiled_rule;
+    compiled_rule.severity = rule.severity();
+    compiled_rule.label = rule.label();
+    compiled_rule.begin = static_cast<uint32_t>(policy->code.size());
+    compile_expr(rule.condition());
+    compiled_rule.end = static_cast<uint32_t>(policy->code.size());
+    collect_message_slots(rule.condition(), &compiled_rule.message_slots);
+    policy->rules.push_back(std::move(compiled_rule));
+  }
+
+ private:
+  CompiledPolicy* policy;
+  const CompiledPolicy* previous;
+  std::map<std::string, int32_t> slot_map;
+  std::map<const dsl::Logical*, uint32_t> operand_base;
+  uint32_t num_operands = 0;
+};
+
+std::shared_ptr<CompiledPolicy> CompiledPolicy::compile(
+    const dsl::RuleSet& rule_set, const LiblcvmKeyList& keys) {
+  return compile(rule_set, keys, nullptr);
+}
+
+std::shared_ptr<CompiledPolicy> CompiledPolicy::compile(
+    const dsl::RuleSet& rule_set, const LiblcvmKeyList& keys,
+    const CompiledPolicy* previous) {
+  auto policy = std::make_shared<CompiledPolicy>();
+  policy->version = rule_set.version();
+  policy->keys = keys;
+  policy->rule_set = rule_set;
+  PolicyCompiler compiler(policy.get(), keys, previous);
+  for (const auto& rule : policy->rule_set.rules()) {
+    compiler.number_operands(rule.condition());
+  }
+  for (const auto& rule : policy->rule_set.rules()) {
+    compiler.compile_rule(rule);
+  }
+  policy->share_predicates();
+
+  // the stats keep running across re-plans
+  policy->num_operands = compiler.get_num_operands();
+  policy->operand_stats =
+      std::make_unique<PolicyOperandStats[]>(policy->num_operands);
+  policy->next_replan = kFirstReplan;
+  if (previous != nullptr) {
+    for (size_t i = 0; i < policy->num_operands; ++i) {
+      const PolicyOperandStats& stats = previous->operand_stats[i];
+      policy->operand_stats[i].evaluations.store(
+          stats.evaluations.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+      policy->operand_stats[i].matches.store(
+          stats.matches.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+    uint64_t evaluations = previous->get_evaluations();
+    policy->evaluations.store(evaluations, std::memory_order_relaxed);
+    policy->next_replan = std::max(kFirstReplan, 2 * evaluations);
+  }
+  return policy;
+}
+
+// Give the leaf predicates that appear more than once (in the same or in
+// different rules) a shared memo slot.
+void CompiledPolicy::share_predicates() {
+  using PredicateKey = std::tuple<PolicyOpcode, dsl::ComparisonOpType, int32_t,
+                                  int32_t, std::string, bool, double, double>;
+  std::map<PredicateKey, std::vector<uint32_t>> predicates;
+  for (uint32_t pc = 0; pc < code.size(); ++pc) {
+    const PolicyInstruction& ins = code[pc];
+    if (ins.opcode != PolicyOpcode::kCompare &&
+        ins.opcode != PolicyOpcode::kRange) {
+      continue;
+    }
+    bool literal = (ins.opcode == PolicyOpcode::kCompare && ins.rhs_slot < 0);
+    PredicateKey key(ins.opcode, ins.op, ins.slot, ins.rhs_slot,
+                     literal ? string_table[ins.rhs_string] : std::string(),
+                     ins.rhs_number_valid, ins.rhs_number, ins.high);
+    predicates[key].push_back(pc);
+  }
+  num_memos = 0;
+  for (const auto& [key, pcs] : predicates) {
+    if (pcs.size() < 2 || num_memos >= kMaxMemos) {
+      continue;
+    }
+    for (uint32_t pc : pcs) {
+      code[pc].memo = num_memos;
+    }
+    ++num_memos;
+  }
+}
+
+std::shared_ptr<CompiledPolicy> CompiledPolicy::compile(
+    const std::string& policy_str, const LiblcvmKeyList& keys) {
+  return CompiledPolicy::compile(parse_policy_string(policy_str), keys);
+}
+
+bool CompiledPolicy::matches_keys(const LiblcvmKeyList& other_keys) const {
+  return keys == other_keys;
+}
+
+bool CompiledPolicy::needs_replan() const {
+  return num_operands > 0 && get_evaluations() >= next_replan;
+}
+
+std::shared_ptr<CompiledPolicy> CompiledPolicy::replan() const {
+  return compile(rule_set, keys, this);
+}
+
+void CompiledPolicy::record_operand(const PolicyInstruction& ins,
+                                    uint64_t evaluated,
+                                    uint64_t matched) const {
+  PolicyOperandStats& stats = operand_stats[ins.operand];
+  stats.evaluations.fetch_add(evaluated, std::memory_order_relaxed);
+  stats.matches.fetch_add(matched, std::memory_order_relaxed);
+}
+
+bool CompiledPolicy::sample_stats() const {
+  uint64_t evaluation = evaluations.fetch_add(1, std::memory_order_relaxed);
+  return num_operands > 0 && (evaluation < kFirstReplan ||
+                              evaluation % kStatsSampleInterval == 0);
+}
+
+void CompiledPolicy::check_vals(const LiblcvmValList& vals) const {
+  if (vals.size() != keys.size()) {
+    throw std::runtime_error("Policy value list size mismatch: " +
+                             std::to_string(vals.size()) + " values for " +
+                             std::to_string(keys.size()) + " keys");
+  }
+}
+
+bool CompiledPolicy::eval_compare(const PolicyInstruction& ins,
+                                  const LiblcvmValList& vals) const {
+  const LiblcvmValue& val = vals[ins.slot];
+
+  if (std::holds_alternative<std::string>(val)) {
+    // string comparisons
+    const std::string& lhs = std::get<std::string>(val);
+    bool equal;
+    if (ins.rhs_slot < 0) {
+      equal = (lhs == string_table[ins.rhs_string]);
+    } else if (std::holds_alternative<std::string>(vals[ins.rhs_slot])) {
+      equal = (lhs == std::get<std::string>(vals[ins.rhs_slot]));
+    } else {
+      std::string rhs;
+      if (liblcvmvalue_to_string(vals[ins.rhs_slot], &rhs) != 0) {
+        return false;
+      }
+      equal = (lhs == rhs);
+    }
+
+    switch (ins.op) {
+      case dsl::ComparisonOpType::EQ:
+        return equal;
+      case dsl::ComparisonOpType::NE:
+        return !equal;
+      default:
+        throw std::runtime_error("Unsupported comparison op for strings: " +
+                                 std::to_string(static_cast<int>(ins.op)));
+    }
+  }
+
+  // numeric comparisons
+  double lhs;
+  if (liblcvmvalue_to_double(val, &lhs) != 0) {
+    return false;
+  }
+
+  double rhs;
+  if (ins.rhs_slot >= 0) {
+    if (liblcvmvalue_to_double(vals[ins.rhs_slot], &rhs) != 0) {
+      return false;
+    }
+  } else if (ins.rhs_number_valid) {
+    rhs = ins.rhs_number;
+  } else {
+    // RHS is not a number and not a variable
+    return false;
+  }
+
+  switch (ins.op) {
+    case dsl::ComparisonOpType::EQ:
+      return lhs == rhs;
+    case dsl::ComparisonOpType::NE:
+      return lhs != rhs;
+    case dsl::ComparisonOpType::LT:
+      return lhs < rhs;
+    case dsl::ComparisonOpType::LE:
+      return lhs <= rhs;
+    case dsl::ComparisonOpType::GT:
+      return lhs > rhs;
+    case dsl::ComparisonOpType::GE:
+      return lhs >= rhs;
+    default:
+      throw std::runtime_error("Unsupported comparison op for numeric: " +
+                               std::to_string(static_cast<int>(ins.op)));
+  }
+}
+
+bool CompiledPolicy::eval_range(const PolicyInstruction& ins,
+                                const LiblcvmValList& vals) const {
+  double val;
+  if (liblcvmvalue_to_double(vals[ins.slot], &val) != 0) {
+    return false;
+  }
+  return val >= ins.rhs_number && val <= ins.high;
+}
+
+bool CompiledPolicy::eval_predicate(const PolicyInstruction& ins,
+                                    const LiblcvmValList& vals,
+                                    int8_t* memo) const {
+  if (memo != nullptr && ins.memo >= 0 && memo[ins.memo] >= 0) {
+    return memo[ins.memo] != 0;
+  }
+  bool result = (ins.opcode == PolicyOpcode::kCompare)
+                    ? eval_compare(ins, vals)
+                    : eval_range(ins, vals);
+  if (memo != nullptr && ins.memo >= 0) {
+    memo[ins.memo] = result ? 1 : 0;
+  }
+  return result;
+}
+
+bool CompiledPolicy::evaluate_rule(size_t rule_index,
+                                   const LiblcvmValList& vals) const {
+  return evaluate_rule(rule_index, vals, nullptr, true);
+}
+
+bool CompiledPolicy::evaluate_rule(size_t rule_index,
+                                   const LiblcvmValList& vals, int8_t* memo,
+                                   bool record_stats) const {
+  const PolicyCompiledRule& rule = rules[rule_index];
+  bool acc = false;
+  uint32_t pc = rule.begin;
+  while (pc < rule.end) {
+    const PolicyInstruction& ins = code[pc];
+    switch (ins.opcode) {
+      case PolicyOpcode::kFalse:
+        acc = false;
+        ++pc;
+        break;
+      case PolicyOpcode::kTrue:
+        acc = true;
+        ++pc;
+        break;
+      case PolicyOpcode::kCompare:
+      case PolicyOpcode::kRange:
+        acc = eval_predicate(ins, vals, memo);
+        ++pc;
+        break;
+      case PolicyOpcode::kNot:
+        acc = !acc;
+        ++pc;
+        break;
+      case PolicyOpcode::kJumpIfFalse:
+        if (record_stats) {
+          record_operand(ins, 1, acc);
+        }
+        pc = acc ? pc + 1 : ins.target;
+        break;
+      case PolicyOpcode::kJumpIfTrue:
+        if (record_stats) {
+          record_operand(ins, 1, acc);
+        }
+        pc = acc ? ins.target : pc + 1;
+        break;
+    }
+  }
+  return acc;
+}
+
+std::string CompiledPolicy::format_rule_message(
+    size_t rule_index, const LiblcvmValList& vals) const {
+  const PolicyCompiledRule& rule = rules[rule_index];
+  std::string message = rule.label;
+
+  bool first = true;
+  for (int32_t slot : rule.message_slots) {
+    std::string value_str;
+    if (liblcvmvalue_to_string(vals[slot], &value_str) != 0) {
+      continue;
+    }
+    message += first ? " (" : ", ";
+    message += keys[slot] + ": " + value_str;
+    first = false;
+  }
+  if (!first) {
+    message += ")";
+  }
+
+  return message;
+}
+
+void CompiledPolicy::evaluate(const LiblcvmValList& vals,
+                              std::list<std::string>* warn_list,
+                              std::list<std::string>* error_list) const {
+  check_vals(vals);
+  bool record_stats = sample_stats();
+  int8_t memo[kMaxMemos];
+  std::fill_n(memo, num_memos, -1);
+  for (size_t i = 0; i < rules.size(); ++i) {
+    // rules without an output list are not evaluated
+    std::list<std::string>* list =
+        (rules[i].severity == dsl::SeverityType::WARN)    ? warn_list
+        : (rules[i].severity == dsl::SeverityType::ERROR) ? error_list
+                                                          : nullptr;
+    if (list == nullptr || !evaluate_rule(i, vals, memo, record_stats)) {
+      continue;
+    }
+    list->push_back(format_rule_message(i, vals));
+  }
+}
+
+int CompiledPolicy::first_error(const LiblcvmValList& vals) const {
+  check_vals(vals);
+  bool record_stats = sample_stats();
+  int8_t memo[kMaxMemos];
+  std::fill_n(memo, num_memos, -1);
+  for (size_t i = 0; i < rules.size(); ++i) {
+    if (rules[i].severity == dsl::SeverityType::ERROR &&
+        evaluate_rule(i, vals, memo, record_stats)) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// Column-wise view of a batch of value lists. Rows are grouped in 64-row
+// words, and the per-row vectors are padded to a full number of words.
+struct PolicyColumn {
+  // value: per-row value.
+  std::vector<const LiblcvmValue*> value;
+  // number: per-row numeric value (0.0 where is_number is not set).
+  std::vector<double> number;
+  // is_number: per-row bit, set if the value converts to double.
+  std::vector<uint64_t> is_number;
+  // is_string: per-row bit, set if the value is a string.
+  std::vector<uint64_t> is_string;
+};
+
+namespace {
+
+constexpr size_t kRowsPerWord = 64;
+
+void load_column(const std::vector<LiblcvmValList>& vals_list, int32_t slot,
+                 size_t num_words, PolicyColumn* column) {
+  column->value.assign(num_words * kRowsPerWord, nullptr);
+  column->number.assign(num_words * kRowsPerWord, 0.0);
+  column->is_number.assign(num_words, 0);
+  column->is_string.assign(num_words, 0);
+  for (size_t row = 0; row < vals_list.size(); ++row) {
+    const LiblcvmValue& value = vals_list[row][slot];
+    uint64_t bit = uint64_t(1) << (row % kRowsPerWord);
+    column->value[row] = &value;
+    if (std::holds_alternative<std::string>(value)) {
+      column->is_string[row / kRowsPerWord] |= bit;
+    } else if (liblcvmvalue_to_double(value, &column->number[row]) == 0) {
+      column->is_number[row / kRowsPerWord] |= bit;
+    }
+  }
+}
+
+// Compare 64 lanes of numbers against a per-lane RHS into a bitmask.
+template <typename Cmp>
+uint64_t compare_lanes(const double* lhs, const double* rhs, size_t rhs_step,
+                       Cmp cmp) {
+  uint64_t bits = 0;
+  for (size_t lane = 0; lane < kRowsPerWord; ++lane) {
+    bits |= uint64_t(cmp(lhs[lane], rhs[lane * rhs_step])) << lane;
+  }
+  return bits;
+}
+
+}  // namespace
+
+uint64_t CompiledPolicy::eval_compare_word(
+    const PolicyInstruction& ins, const std::vector<PolicyColumn>& columns,
+    size_t word, uint64_t active, uint64_t* failed) const {
+  const PolicyColumn& lhs = columns[ins.slot];
+  const PolicyColumn* rhs = (ins.rhs_slot >= 0) ? &columns[ins.rhs_slot]
+                                                : nullptr;
+  uint64_t bits = 0;
+
+  // string comparisons (row by row)
+  uint64_t string_rows = lhs.is_string[word] & active;
+  while (string_rows != 0) {
+    size_t lane = __builtin_ctzll(string_rows);
+    string_rows &= string_rows - 1;
+    size_t row = word * kRowsPerWord + lane;
+    const std::string& lhs_str = std::get<std::string>(*lhs.value[row]);
+    bool equal;
+    if (rhs == nullptr) {
+      equal = (lhs_str == string_table[ins.rhs_string]);
+    } else if (std::holds_alternative<std::string>(*rhs->value[row])) {
+      equal = (lhs_str == std::get<std::string>(*rhs->value[row]));
+    } else {
+      std::string rhs_str;
+      if (liblcvmvalue_to_string(*rhs->value[row], &rhs_str) != 0) {
+        continue;
+      }
+      equal = (lhs_str == rhs_str);
+    }
+    switch (ins.op) {
+      case dsl::ComparisonOpType::EQ:
+        bits |= uint64_t(equal) << lane;
+        break;
+      case dsl::ComparisonOpType::NE:
+        bits |= uint64_t(!equal) << lane;
+        break;
+      default:
+        // ordered comparisons of strings fail the row (evaluate() throws)
+        *failed |= uint64_t(1) << lane;
+        break;
+    }
+  }
+
+  // numeric comparisons (all 64 lanes at once)
+  uint64_t numeric_rows = lhs.is_number[word] & active;
+  const double* rhs_number = nullptr;
+  size_t rhs_step = 0;
+  if (rhs != nullptr) {
+    numeric_rows &= rhs->is_number[word];
+    rhs_number = &rhs->number[word * kRowsPerWord];
+    rhs_step = 1;
+  } else if (ins.rhs_number_valid) {
+    rhs_number = &ins.rhs_number;
+  } else {
+    numeric_rows = 0;
+  }
+  if (numeric_rows == 0) {
+    return bits;
+  }
+  const double* lhs_number = &lhs.number[word * kRowsPerWord];
+  uint64_t numeric_bits;
+  switch (ins.op) {
+    case dsl::ComparisonOpType::EQ:
+      numeric_bits = compare_lanes(lhs_number, rhs_number, rhs_step,
+                                   [](double a, double b) { return a == b; });
+      break;
+    case dsl::ComparisonOpType::NE:
+      numeric_bits = compare_lanes(lhs_number, rhs_number, rhs_step,
+                                   [](double a, double b) { return a != b; });
+      break;
+    case dsl::ComparisonOpType::LT:
+      numeric_bits = compare_lanes(lhs_number, rhs_number, rhs_step,
+                                   [](double a, double b) { return a < b; });
+      break;
+    case dsl::ComparisonOpType::LE:
+      numeric_bits = compare_lanes(lhs_number, rhs_number, rhs_step,
+                                   [](double a, double b) { return a <= b; });
+      break;
+    case dsl::ComparisonOpType::GT:
+      numeric_bits = compare_lanes(lhs_number, rhs_number, rhs_step,
+                                   [](double a, double b) { return a > b; });
+      break;
+    case dsl::ComparisonOpType::GE:
+      numeric_bits = compare_lanes(lhs_number, rhs_number, rhs_step,
+                                   [](double a, double b) { return a >= b; });
+      break;
+    default:
+      throw std::runtime_error("Unsupported comparison op for numeric: " +
+                               std::to_string(static_cast<int>(ins.op)));
+  }
+  return bits | (numeric_bits & numeric_rows);
+}
+
+uint64_t CompiledPolicy::eval_range_word(
+    const PolicyInstruction& ins, const std::vector<PolicyColumn>& columns,
+    size_t word, uint64_t active) const {
+  const PolicyColumn& column = columns[ins.slot];
+  const double* number = &column.number[word * kRowsPerWord];
+  uint64_t bits = 0;
+  for (size_t lane = 0; lane < kRowsPerWord; ++lane) {
+    bits |= uint64_t(number[lane] >= ins.rhs_number &&
+                     number[lane] <= ins.high)
+            << lane;
+  }
+  return bits & column.is_number[word] & active;
+}
+
+// Runs the rule bytecode over all the rows at once. Instead of jumping,
+// rows that short-circuit are parked (with their accumulator bit frozen)
+// until the bytecode reaches the jump target, so the remaining operands are
+// only evaluated for the rows that still need them.
+void CompiledPolicy::evaluate_rule_batch(
+    size_t rule_index, const std::vector<PolicyColumn>& columns,
+    size_t num_rows, std::vector<uint64_t>* result,
+    std::vector<uint64_t>* failed) const {
+  const PolicyCompiledRule& rule = rules[rule_index];
+  size_t num_words = (num_rows + kRowsPerWord - 1) / kRowsPerWord;
+  std::vector<uint64_t>& acc = *result;
+  acc.assign(num_words, 0);
+  std::vector<uint64_t> active(num_words, ~uint64_t(0));
+  // the padding rows of the last word are never active
+  if (num_rows % kRowsPerWord != 0) {
+    active[num_words - 1] = (uint64_t(1) << (num_rows % kRowsPerWord)) - 1;
+  }
+  std::map<uint32_t, std::vector<uint64_t>> parked;
+
+  for (uint32_t pc = rule.begin; pc < rule.end; ++pc) {
+    auto it = parked.find(pc);
+    if (it != parked.end()) {
+      for (size_t w = 0; w < num_words; ++w) {
+        active[w] |= it->second[w];
+      }
+      parked.erase(it);
+    }
+    const PolicyInstruction& ins = code[pc];
+    switch (ins.opcode) {
+      case PolicyOpcode::kFalse:
+        for (size_t w = 0; w < num_words; ++w) {
+          acc[w] &= ~active[w];
+        }
+        break;
+      case PolicyOpcode::kTrue:
+        for (size_t w = 0; w < num_words; ++w) {
+          acc[w] |= active[w];
+        }
+        break;
+      case PolicyOpcode::kCompare:
+      case PolicyOpcode::kRange:
+        for (size_t w = 0; w < num_words; ++w) {
+          if (active[w] == 0) {
+            continue;
+          }
+          uint64_t bits =
+              (ins.opcode == PolicyOpcode::kCompare)
+                  ? eval_compare_word(ins, columns, w, active[w],
+                                      &(*failed)[w])
+                  : eval_range_word(ins, columns, w, active[w]);
+          acc[w] = (acc[w] & ~active[w]) | bits;
+        }
+        break;
+      case PolicyOpcode::kNot:
+        for (size_t w = 0; w < num_words; ++w) {
+          acc[w] ^= active[w];
+        }
+        break;
+      case PolicyOpcode::kJumpIfFalse:
+      case PolicyOpcode::kJumpIfTrue: {
+        std::vector<uint64_t>& target = parked[ins.target];
+        target.resize(num_words, 0);
+        uint64_t evaluated = 0;
+        uint64_t matched = 0;
+        for (size_t w = 0; w < num_words; ++w) {
+          evaluated += __builtin_popcountll(active[w]);
+          matched += __builtin_popcountll(active[w] & acc[w]);
+          uint64_t jump = (ins.opcode == PolicyOpcode::kJumpIfFalse)
+                              ? (active[w] & ~acc[w])
+                              : (active[w] & acc[w]);
+          target[w] |= jump;
+          active[w] &= ~jump;
+        }
+        record_operand(ins, evaluated, matched);
+      } break;
+    }
+  }
+}
+
+void CompiledPolicy::evaluate_batch(
+    const std::vector<LiblcvmValList>& vals_list,
+    std::vector<std::list<std::string>>* warn_lists,
+    std::vector<std::list<std::string>>* error_lists,
+    std::vector<int>* row_errors) const {
+  for (const auto& vals : vals_list) {
+    check_vals(vals);
+  }
+  size_t num_rows = vals_list.size();
+  size_t num_words = (num_rows + kRowsPerWord - 1) / kRowsPerWord;
+  if (warn_lists) {
+    warn_lists->assign(num_rows, {});
+  }
+  if (error_lists) {
+    error_lists->assign(num_rows, {});
+  }
+  evaluations.fetch_add(num_rows, std::memory_order_relaxed);
+
+  // 1. load the referenced columns
+  std::vector<PolicyColumn> columns(keys.size());
+  std::vector<bool> loaded(keys.size(), false);
+  for (const auto& ins : code) {
+    if (ins.opcode != PolicyOpcode::kCompare &&
+        ins.opcode != PolicyOpcode::kRange) {
+      continue;
+    }
+    for (int32_t slot : {ins.slot, ins.rhs_slot}) {
+      if (slot >= 0 && !loaded[slot]) {
+        load_column(vals_list, slot, num_words, &columns[slot]);
+        loaded[slot] = true;
+      }
+    }
+  }
+
+  // 2. evaluate the rules, and format the messages of the matching rows
+  std::vector<uint64_t> result;
+  // failed: Rows that cannot be evaluated (per-row bit).
+  std::vector<uint64_t> failed(num_words, 0);
+  for (size_t i = 0; i < rules.size(); ++i) {
+    std::vector<std::list<std::string>>* lists =
+        (rules[i].severity == dsl::SeverityType::WARN)    ? warn_lists
+        : (rules[i].severity == dsl::SeverityType::ERROR) ? error_lists
+                                                          : nullptr;
+    if (lists == nullptr) {
+      continue;
+    }
+    evaluate_rule_batch(i, columns, num_rows, &result, &failed);
+    for (size_t w = 0; w < num_words; ++w) {
+      uint64_t bits = result[w] & ~failed[w];
+      while (bits != 0) {
+        size_t row = w * kRowsPerWord + __builtin_ctzll(bits);
+        bits &= bits - 1;
+        (*lists)[row].push_back(format_rule_message(i, vals_list[row]));
+      }
+    }
+  }
+
+  // 3. report the rows that cannot be evaluated
+  if (row_errors) {
+    row_errors->assign(num_rows, 0);
+  }
+  for (size_t w = 0; w < num_words; ++w) {
+    uint64_t bits = failed[w];
+    while (bits != 0) {
+      size_t row = w * kRowsPerWord + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      if (row_errors == nullptr) {
+        throw std::runtime_error(
+            "Unsupported comparison op for strings in row " +
+            std::to_string(row));
+      }
+      (*row_errors)[row] = -1;
+      if (warn_lists) {
+        (*warn_lists)[row].clear();
+      }
+      if (error_lists) {
+        (*error_lists)[row].clear();
+      }
+    }
+  }
+}
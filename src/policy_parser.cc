@@ -0,0 +1,466 @@
+#include "policy_parser.h"
+
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "policy_compiler.h"
+
+namespace {
+
+// Token types, in the same order as the lexer rules in policy/rules.g4. On
+// equal-length matches, the earlier type wins (as in ANTLR).
+enum class TokenType {
+  OR,
+  AND,
+  NOT,
+  IN,
+  RANGE,
+  EQ,
+  NE,
+  LT,
+  GT,
+  LE,
+  GE,
+  LPAREN,
+  RPAREN,
+  COMMA,
+  VERSION,
+  WARN,
+  ERROR,
+  IDENT,
+  VERSIONID,
+  NUMBER,
+  STRING,
+  END,
+};
+
+struct Token {
+  TokenType type;
+  std::string text;
+  int line;
+  int column;
+};
+
+bool is_ident_start(char c) {
+  return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool is_ident_char(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool is_alnum(char c) { return std::isalnum(static_cast<unsigned char>(c)); }
+
+bool is_digit(char c) { return std::isdigit(static_cast<unsigned char>(c)); }
+
+class PolicyLexer {
+ public:
+  explicit PolicyLexer(const std::string& input_str) : input(input_str) {}
+
+  std::vector<Token> tokenize() {
+    std::vector<Token> tokens;
+    while (true) {
+      skip_whitespace_and_comments();
+      if (pos >= input.size()) {
+        tokens.push_back({TokenType::END, "<EOF>", line, column});
+        return tokens;
+      }
+      tokens.push_back(next_token());
+    }
+  }
+
+ private:
+  const std::string& input;
+  size_t pos = 0;
+  int line = 1;
+  int column = 0;
+
+  void advance(size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      if (input[pos] == '\n') {
+        ++line;
+        column = 0;
+      } else {
+        ++column;
+      }
+      ++pos;
+    }
+  }
+
+  void skip_whitespace_and_comments() {
+    while (pos < input.size()) {
+      char c = input[pos];
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        advance(1);
+      } else if (c == '#') {
+        while (pos < input.size() && input[pos] != '\r' &&
+               input[pos] != '\n') {
+          advance(1);
+        }
+      } else {
+        break;
+      }
+    }
+  }
+
+  [[noreturn]] void error(const std::string& msg) const {
+    throw std::runtime_error("Parse error: line " + std::to_string(line) +
+                             ":" + std::to_string(column) + " " + msg);
+  }
+
+  // IDENT: [a-zA-Z_][a-zA-Z_0-9]*
+  size_t match_ident() const {
+    if (!is_ident_start(input[pos])) {
+      return 0;
+    }
+    size_t end = pos + 1;
+    while (end < input.size() && is_ident_char(input[end])) {
+      ++end;
+    }
+    return end - pos;
+  }
+
+  // VERSIONID: ([A-Za-z0-9]+ '.')+ [A-Za-z0-9]+
+  size_t match_versionid() const {
+    size_t end = pos;
+    while (end < input.size() && is_alnum(input[end])) {
+      ++end;
+    }
+    if (end == pos) {
+      return 0;
+    }
+    size_t best = 0;
+    while (end + 1 < input.size() && input[end] == '.' &&
+           is_alnum(input[end + 1])) {
+      end += 1;
+      while (end < input.size() && is_alnum(input[end])) {
+        ++end;
+      }
+      best = end - pos;
+    }
+    return best;
+  }
+
+  // NUMBER: [0-9]+ ('.' [0-9]+)?
+  size_t match_number() const {
+    size_t end = pos;
+    while (end < input.size() && is_digit(input[end])) {
+      ++end;
+    }
+    if (end == pos) {
+      return 0;
+    }
+    if (end + 1 < input.size() && input[end] == '.' &&
+        is_digit(input[end + 1])) {
+      end += 1;
+      while (end < input.size() && is_digit(input[end])) {
+        ++end;
+      }
+    }
+    return end - pos;
+  }
+
+  Token next_token() {
+    static const struct {
+      const char* text;
+      TokenType type;
+    } kFixedTokens[] = {
+        {"or", TokenType::OR},         {"and", TokenType::AND},
+        {"not", TokenType::NOT},       {"in", TokenType::IN},
+        {"range", TokenType::RANGE},   {"==", TokenType::EQ},
+        {"!=", TokenType::NE},         {"<", TokenType::LT},
+        {">", TokenType::GT},          {"<=", TokenType::LE},
+        {">=", TokenType::GE},         {"(", TokenType::LPAREN},
+        {")", TokenType::RPAREN},      {",", TokenType::COMMA},
+        {"version", TokenType::VERSION}, {"warn", TokenType::WARN},
+        {"error", TokenType::ERROR},
+    };
+    Token token{TokenType::END, "", line, column};
+
+    // STRING: '"' (~["\\] | '\\' .)* '"'
+    if (input[pos] == '"') {
+      size_t end = pos + 1;
+      while (end < input.size() && input[end] != '"') {
+        end += (input[end] == '\\') ? 2 : 1;
+      }
+      if (end >= input.size()) {
+        error("unterminated string");
+      }
+      token.type = TokenType::STRING;
+      token.text = input.substr(pos, end + 1 - pos);
+      advance(token.text.size());
+      return token;
+    }
+
+    // longest match, with the earliest rule winning ties
+    size_t best_length = 0;
+    for (const auto& fixed : kFixedTokens) {
+      size_t length = std::char_traits<char>::length(fixed.text);
+      if (length > best_length && input.compare(pos, length, fixed.text) == 0) {
+        best_length = length;
+        token.type = fixed.type;
+      }
+    }
+    const struct {
+      size_t length;
+      TokenType type;
+    } kVariableTokens[] = {
+        {match_ident(), TokenType::IDENT},
+        {match_versionid(), TokenType::VERSIONID},
+        {match_number(), TokenType::NUMBER},
+    };
+    for (const auto& variable : kVariableTokens) {
+      if (variable.length > best_length) {
+        best_length = variable.length;
+        token.type = variable.type;
+      }
+    }
+    if (best_length == 0) {
+      error("token recognition error at: '" + input.substr(pos, 1) + "'");
+    }
+    token.text = input.substr(pos, best_length);
+    advance(best_length);
+    return token;
+  }
+};
+
+// Recursive-descent parser for policy/rules.g4.
+//
+// The precedence follows what ANTLR generates for the left-recursive expr
+// rule, where earlier alternatives bind tighter: or (6) binds tighter than
+// and (5), and not (4) applies to the full expression at its right. Both
+// binary operators are left-associative.
+class PolicyParser {
+ public:
+  explicit PolicyParser(std::vector<Token> token_list)
+      : tokens(std::move(token_list)) {}
+
+  dsl::RuleSet parse_program() {
+    dsl::RuleSet rule_set;
+    if (peek().type == TokenType::VERSION) {
+      next();
+      rule_set.set_version(expect(TokenType::VERSIONID, "VERSIONID").text);
+    }
+    do {
+      *rule_set.add_rules() = parse_statement();
+    } while (peek().type != TokenType::END);
+    return rule_set;
+  }
+
+ private:
+  std::vector<Token> tokens;
+  size_t pos = 0;
+
+  static constexpr int kOrPrecedence = 6;
+  static constexpr int kAndPrecedence = 5;
+  static constexpr int kNotPrecedence = 4;
+
+  const Token& peek() const { return tokens[pos]; }
+
+  const Token& next() {
+    const Token& token = tokens[pos];
+    if (token.type != TokenType::END) {
+      ++pos;
+    }
+    return token;
+  }
+
+  [[noreturn]] void error(const Token& token, const std::string& msg) const {
+    throw std::runtime_error("Parse error: line " + std::to_string(token.line) +
+                             ":" + std::to_string(token.column) + " " + msg +
+                             " at '" + token.text + "'");
+  }
+
+  const Token& expect(TokenType type, const char* name) {
+    if (peek().type != type) {
+      error(peek(), std::string("expecting ") + name);
+    }
+    return next();
+  }
+
+  static std::string strip_quotes(const std::string& text) {
+    return text.substr(1, text.size() - 2);
+  }
+
+  dsl::Rule parse_statement() {
+    dsl::Rule rule;
+    const Token& severity = next();
+    if (severity.type == TokenType::WARN) {
+      rule.set_severity(dsl::SeverityType::WARN);
+    } else if (severity.type == TokenType::ERROR) {
+      rule.set_severity(dsl::SeverityType::ERROR);
+    } else {
+      error(severity, "expecting {'warn', 'error'}");
+    }
+    rule.set_label(strip_quotes(expect(TokenType::STRING, "STRING").text));
+    *rule.mutable_condition() = parse_expr(0);
+    return rule;
+  }
+
+  static dsl::Expr make_logical(dsl::LogicOpType op, dsl::Expr lhs,
+                                dsl::Expr rhs) {
+    dsl::Expr e;
+    dsl::Logical* logic = e.mutable_logical();
+    logic->set_op(op);
+    *logic->add_operands() = std::move(lhs);
+    *logic->add_operands() = std::move(rhs);
+    return e;
+  }
+
+  dsl::Expr parse_expr(int precedence) {
+    dsl::Expr e = parse_primary();
+    while (true) {
+      if (peek().type == TokenType::OR && kOrPrecedence >= precedence) {
+        next();
+        e = make_logical(dsl::OR, std::move(e), parse_expr(kOrPrecedence + 1));
+      } else if (peek().type == TokenType::AND &&
+                 kAndPrecedence >= precedence) {
+        next();
+        e = make_logical(dsl::AND, std::move(e),
+                         parse_expr(kAndPrecedence + 1));
+      } else {
+        return e;
+      }
+    }
+  }
+
+  std::string parse_number() {
+    if (peek().type != TokenType::VERSIONID &&
+        peek().type != TokenType::NUMBER) {
+      error(peek(), "expecting number");
+    }
+    return next().text;
+  }
+
+  dsl::Expr parse_primary() {
+    dsl::Expr e;
+    const Token& token = next();
+    switch (token.type) {
+      case TokenType::NOT:
+        *e.mutable_not_expr()->mutable_expr() = parse_expr(kNotPrecedence);
+        return e;
+
+      case TokenType::LPAREN:
+        e = parse_expr(0);
+        expect(TokenType::RPAREN, "')'");
+        return e;
+
+      case TokenType::IDENT:
+        break;
+
+      default:
+        error(token, "expecting expression");
+    }
+
+    // IDENT IN RANGE LPAREN number COMMA number RPAREN
+    if (peek().type == TokenType::IN) {
+      next();
+      expect(TokenType::RANGE, "'range'");
+      expect(TokenType::LPAREN, "'('");
+      double low = std::stod(parse_number());
+      expect(TokenType::COMMA, "','");
+      double high = std::stod(parse_number());
+      expect(TokenType::RPAREN, "')'");
+      dsl::RangeCheck* range = e.mutable_range();
+      range->set_column(token.text);
+      range->set_low(low);
+      range->set_high(high);
+      return e;
+    }
+
+    // IDENT compOp value
+    dsl::Comparison* cmp = e.mutable_comparison();
+    cmp->set_column(token.text);
+    const Token& op = next();
+    switch (op.type) {
+      case TokenType::EQ:
+        cmp->set_op(dsl::EQ);
+        break;
+      case TokenType::NE:
+        cmp->set_op(dsl::NE);
+        break;
+      case TokenType::GT:
+        cmp->set_op(dsl::GT);
+        break;
+      case TokenType::GE:
+        cmp->set_op(dsl::GE);
+        break;
+      case TokenType::LT:
+        cmp->set_op(dsl::LT);
+        break;
+      case TokenType::LE:
+        cmp->set_op(dsl::LE);
+        break;
+      default:
+        error(op, "expecting comparison operator");
+    }
+    const Token& value = next();
+    switch (value.type) {
+      case TokenType::STRING:
+        // string literal - remove the surrounding quotes
+        cmp->set_value(strip_quotes(value.text));
+        break;
+      case TokenType::VERSIONID:
+      case TokenType::NUMBER:
+      case TokenType::IDENT:
+        cmp->set_value(value.text);
+        break;
+      default:
+        error(value, "expecting value");
+    }
+    return e;
+  }
+};
+
+}  // namespace
+
+dsl::RuleSet parse_policy_string_handwritten(const std::string& policy_str) {
+  PolicyLexer lexer(policy_str);
+  std::vector<Token> tokens = lexer.tokenize();
+  if (tokens.size() == 1) {
+    throw std::runtime_error("Parse error: Empty or invalid input");
+  }
+  PolicyParser parser(std::move(tokens));
+  return parser.parse_program();
+}
+
+bool is_policy_binary(const std::string& policy_str) {
+  return policy_str.compare(0, sizeof(kPolicyBinaryMagic) - 1,
+                            kPolicyBinaryMagic) == 0;
+}
+
+std::string serialize_policy_binary(const dsl::RuleSet& rule_set) {
+  std::string policy_str(kPolicyBinaryMagic, sizeof(kPolicyBinaryMagic) - 1);
+  policy_str += kPolicyBinaryFormatVersion;
+  if (!rule_set.AppendToString(&policy_str)) {
+    throw std::runtime_error("Cannot serialize policy");
+  }
+  return policy_str;
+}
+
+dsl::RuleSet parse_policy_binary(const std::string& policy_str) {
+  const size_t header_size = sizeof(kPolicyBinaryMagic);
+  if (!is_policy_binary(policy_str) || policy_str.size() < header_size) {
+    throw std::runtime_error("Parse error: not a binary policy");
+  }
+  if (policy_str[header_size - 1] != kPolicyBinaryFormatVersion) {
+    throw std::runtime_error(
+        "Parse error: unsupported binary policy format version " +
+        std::to_string(static_cast<int>(policy_str[header_size - 1])));
+  }
+  dsl::RuleSet rule_set;
+  if (!rule_set.ParseFromArray(policy_str.data() + header_size,
+                               policy_str.size() - header_size)) {
+    throw std::runtime_error("Parse error: invalid binary policy");
+  }
+  return rule_set;
+}
+
+dsl::RuleSet parse_policy_string(const std::string& policy_str) {
+  if (is_policy_binary(policy_str)) {
+    return parse_policy_binary(policy_str);
+  }
+  return parse_policy_string_handwritten(policy_str);
+}
@@ -1,15 +1,22 @@
 #include <google/protobuf/text_format.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <variant>
 
-#include "antlr4-runtime.h"
 #include "liblcvm.h"
-#include "policy_protovisitor.h"
+#include "policy_compiler.h"
+#include "policy_parser.h"
 #include "rules.pb.h"
+
+#if ADD_POLICY_ANTLR
+#include "antlr4-runtime.h"
+#include "policy_protovisitor.h"
 #include "rulesLexer.h"
 #include "rulesParser.h"
 #include "tree/Trees.h"
@@ -112,275 +119,173 @@ void writeProtoToFile(dsl::RuleSet ruleSet, std::string outfile) {
   outfile_stream.close();
 }
 
-// recursive evaluator
-bool evaluate_rule(const dsl::RuleSet& rules,
-                   const std::map<std::string, LiblcvmValue>& dict);
-
-bool eval_expr(const dsl::Expr& expr,
-               const std::map<std::string, LiblcvmValue>& dict);
-
-bool eval_comparison(const dsl::Comparison& cmp,
-                     const std::map<std::string, LiblcvmValue>& dict) {
-  auto it = dict.find(cmp.column());
-  if (it == dict.end()) {
-    return false;
-  }
-
-  const LiblcvmValue& val = it->second;
-
-  // Check if the RHS is a variable name or a literal value
-  std::string rhs_str = cmp.value();
-  bool rhs_is_variable = false;
-  LiblcvmValue rhs_val;
-
-  // Check if the RHS value is a variable name (exists in dict)
-  auto rhs_it = dict.find(rhs_str);
-  if (rhs_it != dict.end()) {
-    rhs_is_variable = true;
-    rhs_val = rhs_it->second;
-  }
-
-  if (std::holds_alternative<std::string>(val)) {
-    // string comparisons
-    std::string lhs;
-    if (liblcvmvalue_to_string(val, &lhs) != 0) {
-      return false;
-    }
-
-    std::string rhs;
-    if (rhs_is_variable) {
-      if (liblcvmvalue_to_string(rhs_val, &rhs) != 0) {
-        return false;
-      }
-    } else {
-      rhs = rhs_str;
-    }
-
-    switch (cmp.op()) {
-      case dsl::ComparisonOpType::EQ:
-        return lhs == rhs;
-      case dsl::ComparisonOpType::NE:
-        return lhs != rhs;
-      default:
-        throw std::runtime_error("Unsupported comparison op for strings: " +
-                                 std::to_string(static_cast<int>(cmp.op())));
-    }
-  }
-
-  // numeric comparisons
-  double lhs;
-  if (liblcvmvalue_to_double(val, &lhs) != 0) {
-    return false;
-  }
-
-  double rhs;
-  if (rhs_is_variable) {
-    if (liblcvmvalue_to_double(rhs_val, &rhs) != 0) {
-      return false;
-    }
-  } else {
-    // Try to convert RHS to a number; if it fails, the variable doesn't exist
-    try {
-      rhs = std::stod(rhs_str);
-    } catch (const std::exception&) {
-      // RHS is not a number and not a variable in dict - return false
-      return false;
-    }
-  }
-
-  switch (cmp.op()) {
-    case dsl::ComparisonOpType::EQ:
-      return lhs == rhs;
-    case dsl::ComparisonOpType::NE:
-      return lhs != rhs;
-    case dsl::ComparisonOpType::LT:
-      return lhs < rhs;
-    case dsl::ComparisonOpType::LE:
-      return lhs <= rhs;
-    case dsl::ComparisonOpType::GT:
-      return lhs > rhs;
-    case dsl::ComparisonOpType::GE:
-      return lhs >= rhs;
-    default:
-      throw std::runtime_error("Unsupported comparison op for numeric: " +
-                               std::to_string(static_cast<int>(cmp.op())));
-  }
-}
-
-bool eval_range(const dsl::RangeCheck& range,
-                const std::map<std::string, LiblcvmValue>& dict) {
-  auto it = dict.find(range.column());
-  if (it == dict.end()) {
-    return false;
+ParserContext create_parser_content_from_string(const std::string& policy_str) {
+  ParserContext ctx;
+  ctx.input = std::make_unique<antlr4::ANTLRInputStream>(policy_str);
+  ctx.lexer = std::make_unique<rulesLexer>(ctx.input.get());
+  ctx.tokens = std::make_unique<antlr4::CommonTokenStream>(ctx.lexer.get());
+  ctx.parser = std::make_unique<rulesParser>(ctx.tokens.get());
+  ctx.tree = ctx.parser->program();
+  if (!ctx.tree || ctx.tree->children.empty()) {
+    throw std::runtime_error("Parse error: Empty or invalid input");
   }
-
-  double val;
-  if (liblcvmvalue_to_double(it->second, &val) != 0) {
-    return false;
+  // do not convert a tree produced by error recovery
+  if (ctx.lexer->getNumberOfSyntaxErrors() > 0 ||
+      ctx.parser->getNumberOfSyntaxErrors() > 0) {
+    throw std::runtime_error("Parse error: Invalid input");
   }
-  double low = range.low();
-  double high = range.high();
-
-  return val >= low && val <= high;
+  return ctx;
 }
 
-bool eval_not(const dsl::NotExpr& not_expr,
-              const std::map<std::string, LiblcvmValue>& dict) {
-  return !eval_expr(not_expr.expr(), dict);
+dsl::RuleSet parse_policy_string_antlr(const std::string& policy_str) {
+  ParserContext ctx = create_parser_content_from_string(policy_str);
+  return convert_parser_context_to_proto(ctx);
 }
-
-bool eval_logical(const dsl::Logical& logic,
-                  const std::map<std::string, LiblcvmValue>& dict) {
-  switch (logic.op()) {
-    case dsl::LogicOpType::AND:
-      for (const auto& e : logic.operands())
-        if (!eval_expr(e, dict)) {
-          return false;
-        }
-      return true;
-    case dsl::LogicOpType::OR:
-      for (const auto& e : logic.operands())
-        if (eval_expr(e, dict)) {
-          return true;
-        }
-      return false;
-    default:
-      return false;
+#endif
+
+// Policies are compiled once and reused while the policy string and the key
+// list stay the same (e.g. when the same policy runs over a batch of files).
+// The cached policy is periodically re-planned using its evaluation stats.
+std::shared_ptr<const CompiledPolicy> get_compiled_policy(
+    const std::string& policy_str, const LiblcvmKeyList& keys) {
+  static std::mutex cache_mutex;
+  static std::string cached_policy_str;
+  static std::shared_ptr<const CompiledPolicy> cached_policy;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  if (cached_policy != nullptr && cached_policy_str == policy_str &&
+      cached_policy->matches_keys(keys)) {
+    if (cached_policy->needs_replan()) {
+      cached_policy = cached_policy->replan();
+    }
+    return cached_policy;
   }
+  cached_policy = CompiledPolicy::compile(policy_str, keys);
+  cached_policy_str = policy_str;
+  return cached_policy;
 }
 
-bool eval_expr(const dsl::Expr& expr,
-               const std::map<std::string, LiblcvmValue>& dict) {
-  switch (expr.expr_kind_case()) {
-    case dsl::Expr::kComparison:
-      return eval_comparison(expr.comparison(), dict);
-    case dsl::Expr::kRange:
-      return eval_range(expr.range(), dict);
-    case dsl::Expr::kNotExpr:
-      return eval_not(expr.not_expr(), dict);
-    case dsl::Expr::kLogical:
-      return eval_logical(expr.logical(), dict);
-    default:
-      return false;
+int policy_runner(const std::string& policy_str, LiblcvmKeyList* pkeys,
+                  LiblcvmValList* pvals, std::list<std::string>* warn_list,
+                  std::list<std::string>* error_list, std::string* version) {
+  // reset warn_list/error_list
+  warn_list->clear();
+  error_list->clear();
+
+  if (version) {
+    version->clear();
   }
-}
 
-// Helper function to collect variable names and values from an expression
-void collect_variables_from_expr(
-    const dsl::Expr& expr, const std::map<std::string, LiblcvmValue>& dict,
-    std::vector<std::pair<std::string, std::string>>& var_values) {
-  if (expr.has_comparison()) {
-    const auto& comparison = expr.comparison();
-    auto it = dict.find(comparison.column());
-    if (it != dict.end()) {
-      std::string value_str;
-      if (liblcvmvalue_to_string(it->second, &value_str) == 0) {
-        var_values.push_back({comparison.column(), value_str});
+  // run the policy
+  try {
+    std::shared_ptr<const CompiledPolicy> policy;
+    if (pkeys->size() == pvals->size()) {
+      policy = get_compiled_policy(policy_str, *pkeys);
+      if (version) {
+        *version = policy->get_version();
       }
-    }
-  } else if (expr.has_range()) {
-    const auto& range = expr.range();
-    auto it = dict.find(range.column());
-    if (it != dict.end()) {
-      std::string value_str;
-      if (liblcvmvalue_to_string(it->second, &value_str) == 0) {
-        var_values.push_back({range.column(), value_str});
+      policy->evaluate(*pvals, warn_list, error_list);
+    } else {
+      // only the leading key/value pairs can be matched
+      size_t n = std::min(pkeys->size(), pvals->size());
+      LiblcvmKeyList keys(pkeys->begin(), pkeys->begin() + n);
+      LiblcvmValList vals(pvals->begin(), pvals->begin() + n);
+      policy = CompiledPolicy::compile(policy_str, keys);
+      if (version) {
+        *version = policy->get_version();
       }
+      policy->evaluate(vals, warn_list, error_list);
     }
-  } else if (expr.has_not_expr()) {
-    collect_variables_from_expr(expr.not_expr().expr(), dict, var_values);
-  } else if (expr.has_logical()) {
-    const auto& logical = expr.logical();
-    for (const auto& operand : logical.operands()) {
-      collect_variables_from_expr(operand, dict, var_values);
-    }
+  } catch (const std::exception& ex) {
+    std::cerr << "Fatal error: " << ex.what() << std::endl;
+    return 1;
   }
+  return 0;
 }
 
-std::string format_rule_message_with_values(
-    const dsl::Rule& rule, const std::map<std::string, LiblcvmValue>& dict) {
-  std::string message = rule.label();
-
-  // Collect all variable names and their values
-  std::vector<std::pair<std::string, std::string>> var_values;
-  collect_variables_from_expr(rule.condition(), dict, var_values);
-
-  // Format the message with variable names and values
-  if (!var_values.empty()) {
-    message += " (";
-    for (size_t i = 0; i < var_values.size(); ++i) {
-      if (i > 0) {
-        message += ", ";
-      }
-      message += var_values[i].first + ": " + var_values[i].second;
-    }
-    message += ")";
+int policy_check(const std::string& policy_str, const LiblcvmKeyList& keys,
+                 const LiblcvmValList& vals, bool* passed,
+                 std::string* first_error, std::string* version) {
+  *passed = false;
+  if (first_error) {
+    first_error->clear();
   }
-
-  return message;
-}
-
-void evaluate_rules(const dsl::RuleSet& rules,
-                    const std::map<std::string, LiblcvmValue>& dict,
-                    std::list<std::string>* warn_list,
-                    std::list<std::string>* error_list) {
-  for (const auto& rule : rules.rules()) {
-    bool result = eval_expr(rule.condition(), dict);
-    if (result) {
-      std::string formatted_message =
-          format_rule_message_with_values(rule, dict);
-      if (rule.severity() == dsl::SeverityType::WARN && warn_list) {
-        warn_list->push_back(formatted_message);
-      } else if (rule.severity() == dsl::SeverityType::ERROR && error_list) {
-        error_list->push_back(formatted_message);
-      }
-    }
+  if (version) {
+    version->clear();
   }
-}
 
-ParserContext create_parser_content_from_string(const std::string& policy_str) {
-  ParserContext ctx;
-  ctx.input = std::make_unique<antlr4::ANTLRInputStream>(policy_str);
-  ctx.lexer = std::make_unique<rulesLexer>(ctx.input.get());
-  ctx.tokens = std::make_unique<antlr4::CommonTokenStream>(ctx.lexer.get());
-  ctx.parser = std::make_unique<rulesParser>(ctx.tokens.get());
-  ctx.tree = ctx.parser->program();
-  if (!ctx.tree || ctx.tree->children.empty()) {
-    throw std::runtime_error("Parse error: Empty or invalid input");
+  // run the error rules
+  try {
+    std::shared_ptr<const CompiledPolicy> policy =
+        get_compiled_policy(policy_str, keys);
+    if (version) {
+      *version = policy->get_version();
+    }
+    int rule_index = policy->first_error(vals);
+    *passed = (rule_index < 0);
+    if (!*passed && first_error) {
+      *first_error = policy->format_rule_message(rule_index, vals);
+    }
+  } catch (const std::exception& ex) {
+    std::cerr << "Fatal error: " << ex.what() << std::endl;
+    return 1;
   }
-  return ctx;
+  return 0;
 }
 
-int policy_runner(const std::string& policy_str, LiblcvmKeyList* pkeys,
-                  LiblcvmValList* pvals, std::list<std::string>* warn_list,
-                  std::list<std::string>* error_list, std::string* version) {
-  // convert the keys/vals into a dictionary
-  std::map<std::string, LiblcvmValue> dict;
-  auto itK = pkeys->begin();
-  auto itV = pvals->begin();
-  for (; itK != pkeys->end() && itV != pvals->end(); ++itK, ++itV) {
-    // overwrites if the same key appears twice
-    dict[*itK] = *itV;
+int policy_runner_batch(const std::string& policy_str,
+                        const LiblcvmKeyList& keys,
+                        const std::vector<LiblcvmValList>& vals_list,
+                        std::vector<std::list<std::string>>* warn_lists,
+                        std::vector<std::list<std::string>>* error_lists,
+                        std::string* version,
+                        std::vector<int>* row_errors) {
+  warn_lists->clear();
+  error_lists->clear();
+  if (row_errors) {
+    row_errors->clear();
   }
 
-  // reset warn_list/error_list
-  warn_list->clear();
-  error_list->clear();
-
   if (version) {
     version->clear();
   }
 
   // run the policy
   try {
-    ParserContext ctx = create_parser_content_from_string(policy_str);
-    dsl::RuleSet ruleSet = convert_parser_context_to_proto(ctx);
-
+    std::shared_ptr<const CompiledPolicy> policy =
+        get_compiled_policy(policy_str, keys);
     if (version) {
-      *version = ruleSet.version();
+      *version = policy->get_version();
     }
+    policy->evaluate_batch(vals_list, warn_lists, error_lists, row_errors);
+  } catch (const std::exception& ex) {
+    std::cerr << "Fatal error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int policy_columns(const std::string& policy_str, const LiblcvmKeyList& keys,
+                   std::set<std::string>* columns) {
+  columns->clear();
+  try {
+    // compiled outside the policy cache, which is kept for the evaluations
+    *columns =
+        CompiledPolicy::compile(policy_str, keys)->get_referenced_columns();
+  } catch (const std::exception& ex) {
+    std::cerr << "Fatal error: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
-    evaluate_rules(ruleSet, dict, warn_list, error_list);
+int policy_compile(const std::string& policy_str, std::string* policy_binary) {
+  policy_binary->clear();
+  try {
+    dsl::RuleSet rule_set = parse_policy_string(policy_str);
+    // make sure the rules can be lowered
+    CompiledPolicy::compile(rule_set, LiblcvmKeyList());
+    *policy_binary = serialize_policy_binary(rule_set);
   } catch (const std::exception& ex) {
     std::cerr << "Fatal error: " << ex.what() << std::endl;
     return 1;
@@ -13,6 +13,14 @@ namespace py = pybind11;
 #define FRAME_GETTERS(class_name)                                     \
   .def("get_filesize", &class_name::get_filesize)                     \
       .def("get_bitrate_bps", &class_name::get_bitrate_bps)           \
+      .def("get_video_bitrate_bps",                                   \
+           &class_name::get_video_bitrate_bps)                        \
+      .def("get_video_bitrate_bps_peak",                              \
+           &class_name::get_video_bitrate_bps_peak)                   \
+      .def("get_video_bitrate_bps_window_list",                       \
+           &class_name::get_video_bitrate_bps_window_list)            \
+      .def("get_keyframe_size_ratio",                                 \
+           &class_name::get_keyframe_size_ratio)                      \
       .def("get_width", &class_name::get_width)                       \
       .def("get_height", &class_name::get_height)                     \
       .def("get_video_codec_type", &class_name::get_video_codec_type) \
@@ -32,6 +40,10 @@ namespace py = pybind11;
 // Define the macro to bind timing getters
 #define TIMING_GETTERS(class_name)                                            \
   .def("get_video_freeze", &class_name::get_video_freeze)                     \
+      .def("get_frozen_frame_count", &class_name::get_frozen_frame_count)     \
+      .def("get_frozen_segment_count",                                        \
+           &class_name::get_frozen_segment_count)                             \
+      .def("get_frozen_duration_sec", &class_name::get_frozen_duration_sec)   \
       .def("get_audio_video_ratio", &class_name::get_audio_video_ratio)       \
       .def("get_duration_video_sec", &class_name::get_duration_video_sec)     \
       .def("get_duration_audio_sec", &class_name::get_duration_audio_sec)     \
@@ -112,9 +124,13 @@ PYBIND11_MODULE(liblcvm, m) {
       .def("get_audio", &IsobmffFileInformation::get_audio);
 
   // Expose the parse method as a standalone function
-  m.def("parse", &IsobmffFileInformation::parse, py::arg("infile"),
-        py::arg("liblcvm_config"),
-        "Parse an ISOBMFF file and return file information.");
+  m.def(
+      "parse",
+      [](const char* infile, const LiblcvmConfig& liblcvm_config) {
+        return IsobmffFileInformation::parse(infile, liblcvm_config);
+      },
+      py::arg("infile"), py::arg("liblcvm_config"),
+      "Parse an ISOBMFF file and return file information.");
 
   // Expose the FrameInformation class
   py::class_<FrameInformation>(m, "FrameInformation")
@@ -0,0 +1,178 @@
+#include "range_reader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+#if HAVE_PREADV
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Largest number of buffers per read call (POSIX guarantees an IOV_MAX of
+// at least 16, and Linux and macOS use 1024).
+constexpr size_t kMaxBuffers = 1024;
+
+// A buffer (or a gap) to fill in a span read.
+struct SpanBuffer {
+  uint8_t* data;
+  size_t size;
+};
+
+}  // namespace
+
+size_t RangeReader::add(uint64_t offset, uint32_t size) {
+  ranges.push_back({offset, size, buffer.size(), false});
+  buffer.resize(buffer.size() + size);
+  return ranges.size() - 1;
+}
+
+const uint8_t* RangeReader::get_data(size_t index) const {
+  if (index >= ranges.size() || !ranges[index].complete) {
+    return nullptr;
+  }
+  return buffer.data() + ranges[index].buffer_offset;
+}
+
+void RangeReader::clear() {
+  ranges.clear();
+  buffer.clear();
+}
+
+int RangeReader::read(const char* infile, uint64_t max_gap) {
+  // 1. open the file
+#if HAVE_PREADV
+  int fd = open(infile, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+#else
+  FILE* fp = fopen(infile, "rb");
+  if (fp == nullptr) {
+    return -1;
+  }
+#endif
+
+  // 2. sort the ranges by offset
+  std::vector<size_t> order(ranges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+    return ranges[a].offset < ranges[b].offset;
+  });
+
+  // 3. read the spans of coalesced ranges
+  std::vector<uint8_t> gap_buffer;
+  std::vector<SpanBuffer> span_buffers;
+  size_t i = 0;
+  while (i < order.size()) {
+    // 3.1. gather the ranges of the span. A range that overlaps the
+    // previous one starts a new span.
+    uint64_t span_offset = ranges[order[i]].offset;
+    uint64_t span_end = span_offset;
+    size_t first = i;
+    span_buffers.clear();
+    while (i < order.size() && span_buffers.size() + 2 <= kMaxBuffers) {
+      Range& range = ranges[order[i]];
+      if (range.size == 0) {
+        range.complete = true;
+        ++i;
+        continue;
+      }
+      if (range.offset < span_end ||
+          (i > first && range.offset - span_end > max_gap)) {
+        break;
+      }
+      if (range.offset > span_end) {
+        size_t gap = range.offset - span_end;
+        if (gap_buffer.size() < gap) {
+          gap_buffer.resize(gap);
+        }
+        span_buffers.push_back({nullptr, gap});
+      }
+      span_buffers.push_back(
+          {buffer.data() + range.buffer_offset, range.size});
+      span_end = range.offset + range.size;
+      ++i;
+    }
+    if (span_buffers.empty()) {
+      continue;
+    }
+    // the gap buffer may have moved while growing
+    for (auto& span_buffer : span_buffers) {
+      if (span_buffer.data == nullptr) {
+        span_buffer.data = gap_buffer.data();
+      }
+    }
+
+    // 3.2. read the span (a short read means the end of the file)
+    uint64_t span_read_size = 0;
+#if HAVE_PREADV
+    std::vector<struct iovec> iov(span_buffers.size());
+    for (size_t j = 0; j < span_buffers.size(); ++j) {
+      iov[j].iov_base = span_buffers[j].data;
+      iov[j].iov_len = span_buffers[j].size;
+    }
+    size_t iov_index = 0;
+    while (iov_index < iov.size()) {
+      ssize_t ret =
+          preadv(fd, iov.data() + iov_index, iov.size() - iov_index,
+                 static_cast<off_t>(span_offset + span_read_size));
+      if (ret < 0 && errno == EINTR) {
+        continue;
+      }
+      num_reads += 1;
+      if (ret <= 0) {
+        break;
+      }
+      span_read_size += ret;
+      read_bytes += ret;
+      // skip the filled buffers
+      size_t done = ret;
+      while (iov_index < iov.size() && done >= iov[iov_index].iov_len) {
+        done -= iov[iov_index].iov_len;
+        ++iov_index;
+      }
+      if (iov_index < iov.size()) {
+        iov[iov_index].iov_base =
+            static_cast<uint8_t*>(iov[iov_index].iov_base) + done;
+        iov[iov_index].iov_len -= done;
+      }
+    }
+#else
+    // read the whole span, and copy it to the buffers
+    std::vector<uint8_t> span_data(span_end - span_offset);
+    if (fseeko(fp, static_cast<off_t>(span_offset), SEEK_SET) == 0) {
+      span_read_size = fread(span_data.data(), 1, span_data.size(), fp);
+      num_reads += 1;
+      read_bytes += span_read_size;
+    }
+    size_t pos = 0;
+    for (const auto& span_buffer : span_buffers) {
+      size_t size = std::min<size_t>(span_buffer.size, span_read_size - pos);
+      std::copy(span_data.begin() + pos, span_data.begin() + pos + size,
+                span_buffer.data);
+      pos += size;
+    }
+#endif
+
+    // 3.3. mark the complete ranges
+    for (size_t j = first; j < i; ++j) {
+      Range& range = ranges[order[j]];
+      if (range.size > 0) {
+        range.complete =
+            range.offset + range.size <= span_offset + span_read_size;
+      }
+    }
+  }
+
+#if HAVE_PREADV
+  close(fd);
+#else
+  fclose(fp);
+#endif
+  return 0;
+}
@@ -0,0 +1,484 @@
+#include "result_cache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#include "config.h"
+#include "sample_table.h"
+
+namespace {
+
+constexpr uint32_t kRecordMagic = 0x4352434c;  // "LCRC"
+constexpr size_t kRecordHeaderSize = 16;
+constexpr const char* kLogName = "results.lcvmcache";
+// Record format version (bump it when the record serialization changes).
+constexpr uint32_t kRecordFormatVersion = 1;
+
+uint64_t fnv1a(const void* data, size_t size,
+               uint64_t hash = 0xcbf29ce484222325ULL) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Serializes records into a byte string (native endianness: the cache is
+// local to the machine).
+class RecordWriter {
+ public:
+  template <typename T>
+  void put(T value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void put_string(const std::string& str) {
+    put(static_cast<uint32_t>(str.size()));
+    buffer.append(str);
+  }
+
+  void put_value(const LiblcvmValue& value) {
+    put(static_cast<uint8_t>(value.index()));
+    if (std::holds_alternative<int>(value)) {
+      put(static_cast<int32_t>(std::get<int>(value)));
+    } else if (std::holds_alternative<unsigned int>(value)) {
+      put(static_cast<uint32_t>(std::get<unsigned int>(value)));
+    } else if (std::holds_alternative<long int>(value)) {
+      put(static_cast<int64_t>(std::get<long int>(value)));
+    } else if (std::holds_alternative<double>(value)) {
+      put(std::get<double>(value));
+    } else {
+      put_string(std::get<std::string>(value));
+    }
+  }
+
+  std::string buffer;
+};
+
+// Get the hash of the result schema: the record format version, and the
+// keys of parse_to_lists(). Records of another schema (e.g. written by a
+// build with other keys) get other cache keys, even with the same library
+// version.
+uint64_t get_schema_hash() {
+  static const uint64_t schema_hash = []() {
+    LiblcvmKeyList keys;
+    LiblcvmKeyList keys_timing;
+    IsobmffFileInformation::get_key_lists(&keys, &keys_timing);
+    RecordWriter schema;
+    schema.put(kRecordFormatVersion);
+    schema.put(static_cast<uint32_t>(keys.size()));
+    for (const auto& key : keys) {
+      schema.put_string(key);
+    }
+    schema.put(static_cast<uint32_t>(keys_timing.size()));
+    for (const auto& key : keys_timing) {
+      schema.put_string(key);
+    }
+    return fnv1a(schema.buffer.data(), schema.buffer.size());
+  }();
+  return schema_hash;
+}
+
+// Parses records (every read is bounds-checked).
+class RecordReader {
+ public:
+  explicit RecordReader(const std::string& buffer) : data(buffer), pos(0) {}
+
+  template <typename T>
+  bool get(T* value) {
+    if (data.size() - pos < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, data.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+
+  bool get_string(std::string* str) {
+    uint32_t size;
+    if (!get(&size) || data.size() - pos < size) {
+      return false;
+    }
+    str->assign(data, pos, size);
+    pos += size;
+    return true;
+  }
+
+  bool get_value(LiblcvmValue* value) {
+    uint8_t type;
+    if (!get(&type)) {
+      return false;
+    }
+    switch (type) {
+      case 0:
+        return get_as<int32_t, int>(value);
+      case 1:
+        return get_as<uint32_t, unsigned int>(value);
+      case 2:
+        return get_as<int64_t, long int>(value);
+      case 3:
+        return get_as<double, double>(value);
+      case 4: {
+        std::string str;
+        if (!get_string(&str)) {
+          return false;
+        }
+        *value = std::move(str);
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+ private:
+  template <typename Stored, typename T>
+  bool get_as(LiblcvmValue* value) {
+    Stored stored;
+    if (!get(&stored)) {
+      return false;
+    }
+    *value = static_cast<T>(stored);
+    return true;
+  }
+
+  const std::string& data;
+  size_t pos;
+};
+
+bool pread_full(int fd, void* buf, size_t size, uint64_t offset) {
+  char* p = static_cast<char*>(buf);
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool write_full(int fd, const char* buf, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, buf, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+}  // namespace
+
+int hash_moov_box(const char* infile, uint64_t* hash) {
+  // hash the full box (header included)
+  std::vector<uint8_t> moov;
+  if (read_moov_box(infile, &moov) != 0) {
+    return -1;
+  }
+  *hash = hash_moov_data(moov.data(), moov.size());
+  return 0;
+}
+
+uint64_t hash_moov_data(const uint8_t* moov, size_t moov_size) {
+  return fnv1a(moov, moov_size);
+}
+
+int get_file_identity(const char* infile, bool hash_moov,
+                      FileIdentity* identity) {
+  struct stat st;
+  if (stat(infile, &st) != 0) {
+    return -1;
+  }
+  identity->device = static_cast<uint64_t>(st.st_dev);
+  identity->inode = static_cast<uint64_t>(st.st_ino);
+  identity->size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+  identity->mtime_ns =
+      int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  identity->mtime_ns =
+      int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  identity->moov_hash = 0;
+  if (hash_moov && hash_moov_box(infile, &identity->moov_hash) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int get_result_cache_key(const char* infile,
+                         const LiblcvmConfig& liblcvm_config,
+                         std::string* key) {
+  FileIdentity identity;
+  if (get_file_identity(infile, liblcvm_config.get_cache_hash_moov(),
+                        &identity) != 0) {
+    return -1;
+  }
+  // hash the configuration fields that change the results
+  RecordWriter config;
+  config.put(static_cast<uint8_t>(liblcvm_config.get_sort_by_pts()));
+  config.put_string(liblcvm_config.get_policy());
+  config.put(static_cast<uint8_t>(liblcvm_config.get_policy_only()));
+  config.put(static_cast<uint8_t>(liblcvm_config.get_policy_first_error()));
+  config.put(static_cast<uint8_t>(liblcvm_config.get_frozen_frames()));
+  uint64_t config_hash = fnv1a(config.buffer.data(), config.buffer.size());
+
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%llx:%llx:%llx:%llx:%llx:%s:%llx:%llx",
+           static_cast<unsigned long long>(identity.device),
+           static_cast<unsigned long long>(identity.inode),
+           static_cast<unsigned long long>(identity.size),
+           static_cast<unsigned long long>(identity.mtime_ns),
+           static_cast<unsigned long long>(identity.moov_hash), PROJECT_VER,
+           static_cast<unsigned long long>(get_schema_hash()),
+           static_cast<unsigned long long>(config_hash));
+  *key = buf;
+  return 0;
+}
+
+ResultCache::~ResultCache() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+std::shared_ptr<ResultCache> ResultCache::get(const std::string& cache_dir) {
+  static std::mutex caches_mutex;
+  static std::map<std::string, std::shared_ptr<ResultCache>> caches;
+
+  std::lock_guard<std::mutex> lock(caches_mutex);
+  auto it = caches.find(cache_dir);
+  if (it != caches.end()) {
+    return it->second;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir, ec);
+  std::shared_ptr<ResultCache> cache(new ResultCache());
+  std::string path = (std::filesystem::path(cache_dir) / kLogName).string();
+  if (cache->open(path) != 0) {
+    fprintf(stderr, "error: cannot open result cache: %s\n", path.c_str());
+    cache = nullptr;
+  }
+  caches[cache_dir] = cache;
+  return cache;
+}
+
+int ResultCache::open(const std::string& path) {
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  flock(fd, LOCK_EX);
+  int ret = read_index();
+  flock(fd, LOCK_UN);
+  return ret;
+}
+
+int ResultCache::read_index() {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return -1;
+  }
+  uint64_t file_size = static_cast<uint64_t>(st.st_size);
+  uint64_t offset = 0;
+  while (offset + kRecordHeaderSize <= file_size) {
+    uint8_t header[kRecordHeaderSize];
+    if (!pread_full(fd, header, sizeof(header), offset)) {
+      break;
+    }
+    uint32_t magic;
+    uint32_t payload_size;
+    memcpy(&magic, header, sizeof(magic));
+    memcpy(&payload_size, header + 4, sizeof(payload_size));
+    uint64_t payload_offset = offset + kRecordHeaderSize;
+    if (magic != kRecordMagic || payload_offset + payload_size > file_size) {
+      break;
+    }
+    // the payload starts with the key and the timing flag
+    uint32_t key_size;
+    if (!pread_full(fd, &key_size, sizeof(key_size), payload_offset) ||
+        sizeof(key_size) + key_size + 1 > payload_size) {
+      break;
+    }
+    std::string key(key_size, '\0');
+    uint8_t has_timing;
+    if (!pread_full(fd, &key[0], key_size, payload_offset + 4) ||
+        !pread_full(fd, &has_timing, 1, payload_offset + 4 + key_size)) {
+      break;
+    }
+    // later records replace earlier ones
+    index[key] = {payload_offset, payload_size, has_timing != 0};
+    offset = payload_offset + payload_size;
+  }
+  if (offset < file_size) {
+    // drop the torn (or corrupt) tail of the log
+    if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+bool ResultCache::lookup(const std::string& key, bool need_timing,
+                         LiblcvmKeyList* pkeys, LiblcvmValList* pvals,
+                         LiblcvmKeyList* pkeys_timing,
+                         LiblcvmTimingList* pvals_timing) {
+  IndexEntry entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+      return false;
+    }
+    entry = it->second;
+  }
+  if (need_timing && !entry.has_timing) {
+    return false;
+  }
+
+  // 1. read and check the record
+  uint8_t header[kRecordHeaderSize];
+  std::string payload(entry.payload_size, '\0');
+  if (!pread_full(fd, header, sizeof(header),
+                  entry.offset - kRecordHeaderSize) ||
+      !pread_full(fd, &payload[0], payload.size(), entry.offset)) {
+    return false;
+  }
+  uint64_t checksum;
+  memcpy(&checksum, header + 8, sizeof(checksum));
+  if (checksum != fnv1a(payload.data(), payload.size())) {
+    return false;
+  }
+
+  // 2. parse the record
+  RecordReader reader(payload);
+  std::string record_key;
+  uint8_t has_timing;
+  uint32_t num_vals;
+  if (!reader.get_string(&record_key) || record_key != key ||
+      !reader.get(&has_timing) || !reader.get(&num_vals)) {
+    return false;
+  }
+  pkeys->clear();
+  pvals->clear();
+  pkeys_timing->clear();
+  pvals_timing->clear();
+  for (uint32_t i = 0; i < num_vals; ++i) {
+    std::string k;
+    LiblcvmValue v;
+    if (!reader.get_string(&k) || !reader.get_value(&v)) {
+      return false;
+    }
+    pkeys->push_back(std::move(k));
+    pvals->push_back(std::move(v));
+  }
+  uint32_t num_timing_keys;
+  uint32_t num_timing_rows;
+  if (!reader.get(&num_timing_keys)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < num_timing_keys; ++i) {
+    std::string k;
+    if (!reader.get_string(&k)) {
+      return false;
+    }
+    pkeys_timing->push_back(std::move(k));
+  }
+  if (!reader.get(&num_timing_rows)) {
+    return false;
+  }
+  pvals_timing->resize(num_timing_rows);
+  for (auto& row : *pvals_timing) {
+    if (!reader.get(&std::get<0>(row)) || !reader.get(&std::get<1>(row)) ||
+        !reader.get(&std::get<2>(row)) || !reader.get(&std::get<3>(row)) ||
+        !reader.get(&std::get<4>(row)) || !reader.get(&std::get<5>(row)) ||
+        !reader.get(&std::get<6>(row)) || !reader.get(&std::get<7>(row))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int ResultCache::insert(const std::string& key, bool has_timing,
+                        const LiblcvmKeyList& keys, const LiblcvmValList& vals,
+                        const LiblcvmKeyList& keys_timing,
+                        const LiblcvmTimingList& vals_timing) {
+  if (keys.size() != vals.size()) {
+    return -1;
+  }
+  // 1. serialize the record
+  RecordWriter payload;
+  payload.put_string(key);
+  payload.put(static_cast<uint8_t>(has_timing));
+  payload.put(static_cast<uint32_t>(vals.size()));
+  for (size_t i = 0; i < vals.size(); ++i) {
+    payload.put_string(keys[i]);
+    payload.put_value(vals[i]);
+  }
+  const LiblcvmKeyList empty_keys;
+  const LiblcvmTimingList empty_vals;
+  const LiblcvmKeyList& record_keys_timing =
+      has_timing ? keys_timing : empty_keys;
+  const LiblcvmTimingList& record_vals_timing =
+      has_timing ? vals_timing : empty_vals;
+  payload.put(static_cast<uint32_t>(record_keys_timing.size()));
+  for (const auto& k : record_keys_timing) {
+    payload.put_string(k);
+  }
+  payload.put(static_cast<uint32_t>(record_vals_timing.size()));
+  for (const auto& row : record_vals_timing) {
+    payload.put(std::get<0>(row));
+    payload.put(std::get<1>(row));
+    payload.put(std::get<2>(row));
+    payload.put(std::get<3>(row));
+    payload.put(std::get<4>(row));
+    payload.put(std::get<5>(row));
+    payload.put(std::get<6>(row));
+    payload.put(std::get<7>(row));
+  }
+  RecordWriter record;
+  record.put(kRecordMagic);
+  record.put(static_cast<uint32_t>(payload.buffer.size()));
+  record.put(fnv1a(payload.buffer.data(), payload.buffer.size()));
+  record.buffer += payload.buffer;
+
+  // 2. append it to the log (one write, under the lock)
+  std::lock_guard<std::mutex> lock(mutex);
+  flock(fd, LOCK_EX);
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 &&
+            write_full(fd, record.buffer.data(), record.buffer.size());
+  flock(fd, LOCK_UN);
+  if (!ok) {
+    return -1;
+  }
+  index[key] = {static_cast<uint64_t>(st.st_size) + kRecordHeaderSize,
+                static_cast<uint32_t>(payload.buffer.size()), has_timing};
+  return 0;
+}
+
+size_t ResultCache::size() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return index.size();
+}
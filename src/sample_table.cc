@@ -0,0 +1,849 @@
+#include "sample_table.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Largest number of samples reserved up front when decoding a timing table
+// (a table can claim up to 2^32 samples per entry, so larger tables grow
+// as they are decoded, and stop at the analysis deadline).
+constexpr uint64_t kMaxReservedSamples = 1024 * 1024;
+
+uint32_t read_be32(const uint8_t* p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t read_be64(const uint8_t* p) {
+  return (uint64_t(read_be32(p)) << 32) | read_be32(p + 4);
+}
+
+// @brief Get the next box of a container payload.
+//
+// @param[in] data: Container payload.
+// @param[in] size: Container payload size.
+// @param[in,out] offset: Offset of the box (updated to the next box).
+// @param[out] type: Box type (4 chars).
+// @param[out] payload: Box payload.
+// @param[out] payload_size: Box payload size.
+// @return bool: Whether a (complete) box was found.
+bool next_box(const uint8_t* data, size_t size, size_t* offset,
+              const uint8_t** type, const uint8_t** payload,
+              size_t* payload_size) {
+  if (*offset > size || size - *offset < 8) {
+    return false;
+  }
+  const uint8_t* p = data + *offset;
+  uint64_t box_size = read_be32(p);
+  size_t header_size = 8;
+  if (box_size == 1) {
+    // 64-bit largesize
+    if (size - *offset < 16) {
+      return false;
+    }
+    box_size = read_be64(p + 8);
+    header_size = 16;
+  } else if (box_size == 0) {
+    // box extends to the end of the container
+    box_size = size - *offset;
+  }
+  if (box_size < header_size || box_size > size - *offset) {
+    return false;
+  }
+  *type = p + 4;
+  *payload = p + header_size;
+  *payload_size = static_cast<size_t>(box_size) - header_size;
+  *offset += static_cast<size_t>(box_size);
+  return true;
+}
+
+// @brief Find the first child box of a given type.
+bool find_box(const uint8_t* data, size_t size, const char* type,
+              const uint8_t** payload, size_t* payload_size) {
+  size_t offset = 0;
+  const uint8_t* box_type;
+  while (next_box(data, size, &offset, &box_type, payload, payload_size)) {
+    if (memcmp(box_type, type, 4) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// @brief Read a list of parameter sets (16-bit length, NAL unit).
+bool read_parameter_sets(const uint8_t* data, size_t size, size_t* offset,
+                         uint32_t count,
+                         std::vector<std::vector<uint8_t>>* parameter_sets) {
+  for (uint32_t i = 0; i < count; ++i) {
+    if (size - *offset < 2) {
+      return false;
+    }
+    size_t length = (size_t(data[*offset]) << 8) | data[*offset + 1];
+    *offset += 2;
+    if (size - *offset < length) {
+      return false;
+    }
+    parameter_sets->emplace_back(data + *offset, data + *offset + length);
+    *offset += length;
+  }
+  return true;
+}
+
+// @brief Parse the NAL unit length size and the parameter sets of the
+// (first) sample entry of a stsd box.
+int parse_sample_entry(const uint8_t* stsd, size_t stsd_size,
+                       SampleTable* table) {
+  // 1. get the first sample entry
+  // version/flags (4), entry_count (4), entries[]
+  if (stsd_size < 8) {
+    return -1;
+  }
+  size_t offset = 8;
+  const uint8_t* type;
+  const uint8_t* entry;
+  size_t entry_size;
+  if (!next_box(stsd, stsd_size, &offset, &type, &entry, &entry_size)) {
+    return -1;
+  }
+  table->sample_entry_type.assign(reinterpret_cast<const char*>(type), 4);
+
+  // 2. look for the codec configuration box (after the 78 bytes of the
+  // VisualSampleEntry fields)
+  constexpr size_t kVisualSampleEntrySize = 78;
+  if (entry_size < kVisualSampleEntrySize) {
+    return -1;
+  }
+  const uint8_t* config;
+  size_t config_size;
+  size_t pos = 0;
+  if (find_box(entry + kVisualSampleEntrySize,
+               entry_size - kVisualSampleEntrySize, "hvcC", &config,
+               &config_size)) {
+    // hvcC: 21 bytes, lengthSizeMinusOne (2 lsb), numOfArrays (1),
+    // {NAL_unit_type (6 lsb), numNalus (2), nalus[]}[]
+    if (config_size < 23) {
+      return -1;
+    }
+    table->nal_length_size = (config[21] & 0x03) + 1;
+    uint32_t num_arrays = config[22];
+    pos = 23;
+    for (uint32_t i = 0; i < num_arrays; ++i) {
+      if (config_size - pos < 3) {
+        return -1;
+      }
+      uint32_t num_nalus = (uint32_t(config[pos + 1]) << 8) | config[pos + 2];
+      pos += 3;
+      if (!read_parameter_sets(config, config_size, &pos, num_nalus,
+                               &table->parameter_sets)) {
+        return -1;
+      }
+    }
+  } else if (find_box(entry + kVisualSampleEntrySize,
+                      entry_size - kVisualSampleEntrySize, "avcC", &config,
+                      &config_size)) {
+    // avcC: 4 bytes, lengthSizeMinusOne (2 lsb), numOfSPS (5 lsb), SPSs,
+    // numOfPPS (1), PPSs
+    if (config_size < 6) {
+      return -1;
+    }
+    table->nal_length_size = (config[4] & 0x03) + 1;
+    pos = 6;
+    if (!read_parameter_sets(config, config_size, &pos, config[5] & 0x1f,
+                             &table->parameter_sets) ||
+        pos >= config_size) {
+      return -1;
+    }
+    uint32_t num_pps = config[pos];
+    pos += 1;
+    if (!read_parameter_sets(config, config_size, &pos, num_pps,
+                             &table->parameter_sets)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Payload of a box (nullptr if missing).
+struct BoxView {
+  const uint8_t* data;
+  size_t size;
+};
+
+// @brief Get the stbl box payloads of the video tracks of a moov box, in
+// track order (nullptr for a video track without a stbl box).
+//
+// @param[in] moov: moov box bytes (header included).
+// @param[in] size: moov box size.
+// @param[out] stbl_list: stbl box payloads.
+// @return int: Error code (0 if ok, !=0 otherwise, e.g. not a moov box).
+int get_video_stbl_list(const uint8_t* moov, size_t size,
+                        std::vector<BoxView>* stbl_list) {
+  // 1. skip the moov box header
+  size_t offset = 0;
+  const uint8_t* type;
+  const uint8_t* moov_payload;
+  size_t moov_payload_size;
+  if (!next_box(moov, size, &offset, &type, &moov_payload,
+                &moov_payload_size) ||
+      memcmp(type, "moov", 4) != 0) {
+    return -1;
+  }
+
+  // 2. look for the video tracks
+  stbl_list->clear();
+  offset = 0;
+  const uint8_t* trak;
+  size_t trak_size;
+  while (next_box(moov_payload, moov_payload_size, &offset, &type, &trak,
+                  &trak_size)) {
+    if (memcmp(type, "trak", 4) != 0) {
+      continue;
+    }
+    const uint8_t* mdia;
+    size_t mdia_size;
+    const uint8_t* hdlr;
+    size_t hdlr_size;
+    const uint8_t* minf;
+    size_t minf_size;
+    const uint8_t* stbl;
+    size_t stbl_size;
+    if (!find_box(trak, trak_size, "mdia", &mdia, &mdia_size) ||
+        !find_box(mdia, mdia_size, "hdlr", &hdlr, &hdlr_size)) {
+      continue;
+    }
+    // version/flags (4), pre_defined (4), handler_type (4)
+    if (hdlr_size < 12 || memcmp(hdlr + 8, "vide", 4) != 0) {
+      continue;
+    }
+    if (!find_box(mdia, mdia_size, "minf", &minf, &minf_size) ||
+        !find_box(minf, minf_size, "stbl", &stbl, &stbl_size)) {
+      stbl_list->push_back({nullptr, 0});
+      continue;
+    }
+    stbl_list->push_back({stbl, stbl_size});
+  }
+  return 0;
+}
+
+}  // namespace
+
+int SampleSizeTable::parse_stsz(const uint8_t* data, size_t size) {
+  // version/flags (4), sample_size (4), sample_count (4), entry_size[]
+  if (size < 12) {
+    return -1;
+  }
+  uint32_t stsz_sample_size = read_be32(data + 4);
+  uint32_t stsz_sample_count = read_be32(data + 8);
+  sizes.clear();
+  if (stsz_sample_size != 0) {
+    // uniform-size fast path: no per-sample table
+    sample_count = stsz_sample_count;
+    uniform_size = stsz_sample_size;
+    total_size = uint64_t(stsz_sample_size) * stsz_sample_count;
+    return 0;
+  }
+  if (uint64_t(stsz_sample_count) * 4 > size - 12) {
+    return -1;
+  }
+  sample_count = stsz_sample_count;
+  uniform_size = 0;
+  total_size = 0;
+  sizes.resize(sample_count);
+  for (uint32_t i = 0; i < sample_count; ++i) {
+    sizes[i] = read_be32(data + 12 + 4 * i);
+    total_size += sizes[i];
+  }
+  return 0;
+}
+
+int SampleSizeTable::parse_stz2(const uint8_t* data, size_t size) {
+  // version/flags (4), reserved (3), field_size (1), sample_count (4),
+  // entry_size[]
+  if (size < 12) {
+    return -1;
+  }
+  uint8_t field_size = data[7];
+  uint32_t stz2_sample_count = read_be32(data + 8);
+  if (field_size != 4 && field_size != 8 && field_size != 16) {
+    return -1;
+  }
+  if ((uint64_t(stz2_sample_count) * field_size + 7) / 8 > size - 12) {
+    return -1;
+  }
+  sample_count = stz2_sample_count;
+  uniform_size = 0;
+  total_size = 0;
+  sizes.resize(sample_count);
+  const uint8_t* entries = data + 12;
+  for (uint32_t i = 0; i < sample_count; ++i) {
+    if (field_size == 4) {
+      // two entries per byte, the first one in the upper nibble
+      uint8_t byte = entries[i / 2];
+      sizes[i] = (i % 2 == 0) ? (byte >> 4) : (byte & 0x0f);
+    } else if (field_size == 8) {
+      sizes[i] = entries[i];
+    } else {
+      sizes[i] = (uint32_t(entries[2 * i]) << 8) | entries[2 * i + 1];
+    }
+    total_size += sizes[i];
+  }
+  return 0;
+}
+
+int ChunkOffsetIndex::build(const uint8_t* stsc, size_t stsc_size,
+                            const uint8_t* chunk_offsets_data,
+                            size_t chunk_offsets_size,
+                            bool chunk_offsets_64) {
+  runs.clear();
+  chunk_offsets.clear();
+  sample_count = 0;
+
+  // 1. parse the chunk offsets
+  // version/flags (4), entry_count (4), chunk_offset[]
+  if (chunk_offsets_size < 8) {
+    return -1;
+  }
+  uint32_t chunk_count = read_be32(chunk_offsets_data + 4);
+  size_t field_size = chunk_offsets_64 ? 8 : 4;
+  if (uint64_t(chunk_count) * field_size > chunk_offsets_size - 8) {
+    return -1;
+  }
+  chunk_offsets.resize(chunk_count);
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    const uint8_t* p = chunk_offsets_data + 8 + field_size * i;
+    chunk_offsets[i] = chunk_offsets_64 ? read_be64(p) : read_be32(p);
+  }
+
+  // 2. parse the stsc runs
+  // version/flags (4), entry_count (4), {first_chunk (4),
+  // samples_per_chunk (4), sample_description_index (4)}[]
+  if (stsc_size < 8) {
+    return -1;
+  }
+  uint32_t entry_count = read_be32(stsc + 4);
+  if (uint64_t(entry_count) * 12 > stsc_size - 8) {
+    return -1;
+  }
+  runs.reserve(entry_count);
+  for (uint32_t i = 0; i < entry_count; ++i) {
+    const uint8_t* p = stsc + 8 + 12 * i;
+    // first_chunk starts at 1, and is strictly increasing
+    uint32_t first_chunk = read_be32(p);
+    if ((runs.empty() && first_chunk != 1) ||
+        (!runs.empty() && first_chunk <= runs.back().first_chunk + 1)) {
+      return -1;
+    }
+    if (first_chunk > chunk_count) {
+      // runs past the last chunk have no samples
+      break;
+    }
+    if (!runs.empty()) {
+      // close the previous run
+      sample_count += uint64_t(first_chunk - 1 - runs.back().first_chunk) *
+                      runs.back().samples_per_chunk;
+    }
+    runs.push_back({first_chunk - 1, read_be32(p + 4), sample_count});
+  }
+  if (!runs.empty()) {
+    // the last run extends to the last chunk
+    sample_count += uint64_t(chunk_count - runs.back().first_chunk) *
+                    runs.back().samples_per_chunk;
+  }
+  return 0;
+}
+
+int ChunkOffsetIndex::get_sample_offset(uint32_t sample_index,
+                                        const SampleSizeTable& sizes,
+                                        uint64_t* offset) const {
+  if (sample_index >= sample_count ||
+      sample_index >= sizes.get_sample_count()) {
+    return -1;
+  }
+  // 1. find the run (the last one starting at or before the sample). Runs
+  // with no samples share their first_sample with the next run, and are
+  // skipped by upper_bound().
+  auto it = std::upper_bound(runs.begin(), runs.end(), sample_index,
+                             [](uint64_t index, const ChunkRun& run) {
+                               return index < run.first_sample;
+                             });
+  const ChunkRun& run = *(it - 1);
+
+  // 2. find the chunk, and the first sample in it
+  uint64_t sample_in_run = sample_index - run.first_sample;
+  uint64_t chunk = run.first_chunk + sample_in_run / run.samples_per_chunk;
+  uint32_t first_sample_in_chunk =
+      sample_index - sample_in_run % run.samples_per_chunk;
+
+  // 3. add up the sizes of the previous samples in the chunk
+  uint64_t sample_offset = chunk_offsets[chunk];
+  if (sizes.get_uniform_size() != 0) {
+    sample_offset += uint64_t(sample_index - first_sample_in_chunk) *
+                     sizes.get_uniform_size();
+  } else {
+    for (uint32_t i = first_sample_in_chunk; i < sample_index; ++i) {
+      sample_offset += sizes.get_sample_size(i);
+    }
+  }
+  *offset = sample_offset;
+  return 0;
+}
+
+int ChunkOffsetIndex::for_each_sample_offset(
+    const SampleSizeTable& sizes,
+    const std::function<int(uint32_t, uint64_t)>& callback) const {
+  uint64_t num_samples =
+      std::min<uint64_t>(sample_count, sizes.get_sample_count());
+  uint32_t sample_index = 0;
+  for (size_t r = 0; r < runs.size() && sample_index < num_samples; ++r) {
+    // the run ends at the first sample of the next one
+    uint64_t run_end =
+        std::min((r + 1 < runs.size()) ? runs[r + 1].first_sample
+                                       : sample_count,
+                 num_samples);
+    uint32_t chunk = runs[r].first_chunk;
+    while (sample_index < run_end) {
+      uint64_t sample_offset = chunk_offsets[chunk];
+      for (uint32_t i = 0;
+           i < runs[r].samples_per_chunk && sample_index < run_end; ++i) {
+        int ret = callback(sample_index, sample_offset);
+        if (ret != 0) {
+          return ret;
+        }
+        sample_offset += sizes.get_sample_size(sample_index);
+        ++sample_index;
+      }
+      ++chunk;
+    }
+  }
+  return 0;
+}
+
+int SampleTable::build_chunk_offset_index() {
+  if (chunk_offset_index_status == 0) {
+    // build the index (once), and drop the raw payloads
+    chunk_offset_index_status =
+        (chunk_offset_index.build(stsc.data(), stsc.size(),
+                                  chunk_offsets.data(), chunk_offsets.size(),
+                                  chunk_offsets_64) == 0)
+            ? 1
+            : -1;
+    std::vector<uint8_t>().swap(stsc);
+    std::vector<uint8_t>().swap(chunk_offsets);
+  }
+  return (chunk_offset_index_status == 1) ? 0 : -1;
+}
+
+int SampleTable::get_sample_offset(uint32_t sample_index, uint64_t* offset) {
+  if (build_chunk_offset_index() != 0) {
+    return -1;
+  }
+  return chunk_offset_index.get_sample_offset(sample_index, sizes, offset);
+}
+
+int SampleTable::for_each_sample_offset(
+    const std::function<int(uint32_t, uint64_t)>& callback) {
+  if (build_chunk_offset_index() != 0) {
+    return -1;
+  }
+  return chunk_offset_index.for_each_sample_offset(sizes, callback);
+}
+
+int read_moov_box(const char* infile, std::vector<uint8_t>* moov) {
+  FILE* fp = fopen(infile, "rb");
+  if (fp == nullptr) {
+    return -1;
+  }
+  // walk the top-level boxes until the moov box
+  int ret = -1;
+  uint8_t header[16];
+  while (fread(header, 1, 8, fp) == 8) {
+    uint64_t box_size = read_be32(header);
+    size_t header_size = 8;
+    if (box_size == 1) {
+      // 64-bit largesize
+      if (fread(header + 8, 1, 8, fp) != 8) {
+        break;
+      }
+      box_size = read_be64(header + 8);
+      header_size = 16;
+    } else if (box_size == 0) {
+      // box extends to the end of the file
+      box_size = UINT64_MAX;
+    }
+    if (box_size < header_size) {
+      break;
+    }
+    if (memcmp(header + 4, "moov", 4) != 0) {
+      if (box_size == UINT64_MAX ||
+          fseeko(fp, static_cast<off_t>(box_size - header_size), SEEK_CUR) !=
+              0) {
+        break;
+      }
+      continue;
+    }
+    // read the full box (header included). Grow the buffer while reading,
+    // so a bogus box size does not cause a large allocation.
+    moov->assign(header, header + header_size);
+    uint64_t remaining = box_size - header_size;
+    uint8_t buffer[64 * 1024];
+    while (remaining > 0) {
+      size_t chunk =
+          static_cast<size_t>(std::min<uint64_t>(remaining, sizeof(buffer)));
+      size_t n = fread(buffer, 1, chunk, fp);
+      moov->insert(moov->end(), buffer, buffer + n);
+      if (n < chunk) {
+        // truncated box (or box extending to the end of the file)
+        break;
+      }
+      remaining -= n;
+    }
+    ret = 0;
+    break;
+  }
+  fclose(fp);
+  return ret;
+}
+
+int get_metadata_box_size(const char* infile, uint64_t* metadata_size) {
+  FILE* fp = fopen(infile, "rb");
+  if (fp == nullptr) {
+    return -1;
+  }
+  // walk all the top-level boxes
+  bool found_moov = false;
+  *metadata_size = 0;
+  uint8_t header[16];
+  while (fread(header, 1, 8, fp) == 8) {
+    uint64_t box_size = read_be32(header);
+    size_t header_size = 8;
+    if (box_size == 1) {
+      // 64-bit largesize
+      if (fread(header + 8, 1, 8, fp) != 8) {
+        break;
+      }
+      box_size = read_be64(header + 8);
+      header_size = 16;
+    } else if (box_size == 0) {
+      // box extends to the end of the file
+      off_t start = ftello(fp) - static_cast<off_t>(header_size);
+      if (fseeko(fp, 0, SEEK_END) != 0 || ftello(fp) < start) {
+        break;
+      }
+      box_size = static_cast<uint64_t>(ftello(fp) - start);
+      fseeko(fp, start + static_cast<off_t>(header_size), SEEK_SET);
+    }
+    if (box_size < header_size) {
+      break;
+    }
+    if (memcmp(header + 4, "moov", 4) == 0) {
+      found_moov = true;
+      *metadata_size += box_size;
+    } else if (memcmp(header + 4, "moof", 4) == 0) {
+      *metadata_size += box_size;
+    }
+    if (fseeko(fp, static_cast<off_t>(box_size - header_size), SEEK_CUR) !=
+        0) {
+      break;
+    }
+  }
+  fclose(fp);
+  return found_moov ? 0 : -1;
+}
+
+int find_moov_box(const uint8_t* data, size_t size, const uint8_t** moov,
+                  size_t* moov_size) {
+  // walk the top-level boxes until the moov box
+  size_t offset = 0;
+  while (size - offset >= 8) {
+    uint64_t box_size = read_be32(data + offset);
+    size_t header_size = 8;
+    if (box_size == 1) {
+      // 64-bit largesize
+      if (size - offset < 16) {
+        break;
+      }
+      box_size = read_be64(data + offset + 8);
+      header_size = 16;
+    } else if (box_size == 0) {
+      // box extends to the end of the file
+      box_size = size - offset;
+    }
+    if (box_size < header_size) {
+      break;
+    }
+    if (memcmp(data + offset + 4, "moov", 4) == 0) {
+      // a truncated moov box is returned up to the end of the data
+      *moov = data + offset;
+      *moov_size = static_cast<size_t>(
+          std::min<uint64_t>(box_size, size - offset));
+      return 0;
+    }
+    if (box_size > size - offset) {
+      break;
+    }
+    offset += static_cast<size_t>(box_size);
+  }
+  return -1;
+}
+
+int parse_video_sample_table(const uint8_t* moov, size_t size,
+                             SampleTable* table) {
+  // 1. look for the (last) video track
+  std::vector<BoxView> stbl_list;
+  if (get_video_stbl_list(moov, size, &stbl_list) != 0) {
+    return -1;
+  }
+  const uint8_t* video_stbl = nullptr;
+  size_t video_stbl_size = 0;
+  for (const auto& stbl : stbl_list) {
+    if (stbl.data != nullptr) {
+      video_stbl = stbl.data;
+      video_stbl_size = stbl.size;
+    }
+  }
+  if (video_stbl == nullptr) {
+    return -1;
+  }
+
+  // 2. parse the sample sizes
+  const uint8_t* box;
+  size_t box_size;
+  int ret = -1;
+  if (find_box(video_stbl, video_stbl_size, "stsz", &box, &box_size)) {
+    ret = table->sizes.parse_stsz(box, box_size);
+  } else if (find_box(video_stbl, video_stbl_size, "stz2", &box, &box_size)) {
+    ret = table->sizes.parse_stz2(box, box_size);
+  }
+  if (ret != 0) {
+    return ret;
+  }
+
+  // 3. keep the stsc and stco/co64 payloads (the chunk offset index is only
+  // built when a sample offset is requested)
+  table->stsc.clear();
+  table->chunk_offsets.clear();
+  table->chunk_offsets_64 = false;
+  table->chunk_offset_index_status = 0;
+  if (find_box(video_stbl, video_stbl_size, "stsc", &box, &box_size)) {
+    table->stsc.assign(box, box + box_size);
+  }
+  if (find_box(video_stbl, video_stbl_size, "stco", &box, &box_size)) {
+    table->chunk_offsets.assign(box, box + box_size);
+  } else if (find_box(video_stbl, video_stbl_size, "co64", &box, &box_size)) {
+    table->chunk_offsets.assign(box, box + box_size);
+    table->chunk_offsets_64 = true;
+  }
+
+  // 4. get the codec configuration (only needed to read the samples)
+  table->sample_entry_type.clear();
+  table->nal_length_size = 0;
+  table->parameter_sets.clear();
+  if (find_box(video_stbl, video_stbl_size, "stsd", &box, &box_size) &&
+      parse_sample_entry(box, box_size, table) != 0) {
+    table->nal_length_size = 0;
+    table->parameter_sets.clear();
+  }
+  return 0;
+}
+
+void read_be32_array(const uint8_t* data, size_t count, uint32_t* values) {
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t value;
+    memcpy(&value, data + 4 * i, sizeof(value));
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    values[i] = __builtin_bswap32(value);
+#else
+    values[i] = read_be32(data + 4 * i);
+#endif
+  }
+}
+
+int decode_stts(const uint8_t* data, size_t size, uint64_t max_sample_count,
+                std::vector<uint32_t>* sample_delta_list,
+                AnalysisControl* control) {
+  // version/flags (4), entry_count (4), {sample_count, sample_delta}[]
+  sample_delta_list->clear();
+  if (size < 8) {
+    return -1;
+  }
+  uint32_t entry_count = read_be32(data + 4);
+  if ((size - 8) / 8 < entry_count) {
+    return -1;
+  }
+  const uint8_t* entry = data + 8;
+  uint64_t sample_count = 0;
+  for (uint32_t i = 0; i < entry_count; ++i) {
+    sample_count += read_be32(entry + 8 * i);
+  }
+  // the table cannot describe more samples than the track has
+  if (sample_count > max_sample_count) {
+    return -1;
+  }
+  sample_delta_list->reserve(std::min(sample_count, kMaxReservedSamples));
+  for (uint32_t i = 0; i < entry_count; ++i, entry += 8) {
+    uint32_t entry_sample_count = read_be32(entry);
+    uint32_t sample_delta = read_be32(entry + 4);
+    for (uint32_t j = 0; j < entry_sample_count; ++j) {
+      if (control != nullptr &&
+          control->check(sample_delta_list->size()) != 0) {
+        return control->get_stop_code();
+      }
+      sample_delta_list->push_back(sample_delta);
+    }
+  }
+  return 0;
+}
+
+int decode_ctts(const uint8_t* data, size_t size, uint64_t max_sample_count,
+                std::vector<int32_t>* sample_offset_list,
+                int32_t* last_sample_offset, AnalysisControl* control) {
+  // version/flags (4), entry_count (4), {sample_count, sample_offset}[]
+  // (sample_offset is signed in version 1, and < 2^31 in version 0)
+  sample_offset_list->clear();
+  *last_sample_offset = 0;
+  if (size < 8) {
+    return -1;
+  }
+  uint32_t entry_count = read_be32(data + 4);
+  if ((size - 8) / 8 < entry_count) {
+    return -1;
+  }
+  const uint8_t* entry = data + 8;
+  uint64_t sample_count = 0;
+  for (uint32_t i = 0; i < entry_count; ++i) {
+    sample_count += read_be32(entry + 8 * i);
+  }
+  // the table cannot describe more samples than the track has
+  if (sample_count > max_sample_count) {
+    return -1;
+  }
+  sample_offset_list->reserve(std::min(sample_count, kMaxReservedSamples));
+  for (uint32_t i = 0; i < entry_count; ++i, entry += 8) {
+    uint32_t entry_sample_count = read_be32(entry);
+    *last_sample_offset = static_cast<int32_t>(read_be32(entry + 4));
+    for (uint32_t j = 0; j < entry_sample_count; ++j) {
+      if (control != nullptr &&
+          control->check(sample_offset_list->size()) != 0) {
+        return control->get_stop_code();
+      }
+      sample_offset_list->push_back(*last_sample_offset);
+    }
+  }
+  return 0;
+}
+
+int decode_stss(const uint8_t* data, size_t size,
+                std::vector<uint32_t>* sample_number_list) {
+  // version/flags (4), entry_count (4), sample_number[]
+  sample_number_list->clear();
+  if (size < 8) {
+    return -1;
+  }
+  uint32_t entry_count = read_be32(data + 4);
+  if ((size - 8) / 4 < entry_count) {
+    return -1;
+  }
+  sample_number_list->resize(entry_count);
+  read_be32_array(data + 8, entry_count, sample_number_list->data());
+  return 0;
+}
+
+namespace {
+
+// Count the entries and samples of a stts or ctts box payload.
+int count_sample_entries(const uint8_t* data, size_t size,
+                         uint64_t* entry_count, uint64_t* sample_count) {
+  // version/flags (4), entry_count (4), {sample_count, value}[]
+  *entry_count = 0;
+  *sample_count = 0;
+  if (data == nullptr) {
+    return 0;
+  }
+  if (size < 8) {
+    return -1;
+  }
+  *entry_count = read_be32(data + 4);
+  if ((size - 8) / 8 < *entry_count) {
+    return -1;
+  }
+  for (uint64_t i = 0; i < *entry_count; ++i) {
+    *sample_count += read_be32(data + 8 + 8 * i);
+  }
+  return 0;
+}
+
+}  // namespace
+
+int count_timing_tables(const TimingTableView& tables,
+                        TimingTableCounts* counts) {
+  uint64_t stts_entry_count;
+  uint64_t stts_sample_count;
+  uint64_t ctts_entry_count;
+  uint64_t ctts_sample_count;
+  if (count_sample_entries(tables.stts, tables.stts_size, &stts_entry_count,
+                           &stts_sample_count) != 0 ||
+      count_sample_entries(tables.ctts, tables.ctts_size, &ctts_entry_count,
+                           &ctts_sample_count) != 0) {
+    return -1;
+  }
+  // version/flags (4), entry_count (4), sample_number[]
+  uint64_t stss_entry_count = 0;
+  if (tables.stss != nullptr) {
+    if (tables.stss_size < 8) {
+      return -1;
+    }
+    stss_entry_count = read_be32(tables.stss + 4);
+  }
+  counts->num_entries = stts_entry_count + ctts_entry_count + stss_entry_count;
+  counts->num_samples = std::max(stts_sample_count, ctts_sample_count);
+  return 0;
+}
+
+int find_video_timing_tables(const uint8_t* moov, size_t size,
+                             std::vector<TimingTableView>* tables) {
+  std::vector<BoxView> stbl_list;
+  if (get_video_stbl_list(moov, size, &stbl_list) != 0) {
+    return -1;
+  }
+  tables->clear();
+  for (const auto& stbl : stbl_list) {
+    TimingTableView view;
+    const uint8_t* box;
+    size_t box_size;
+    if (stbl.data != nullptr &&
+        find_box(stbl.data, stbl.size, "stts", &box, &box_size)) {
+      view.stts = box;
+      view.stts_size = box_size;
+    }
+    if (stbl.data != nullptr &&
+        find_box(stbl.data, stbl.size, "ctts", &box, &box_size)) {
+      view.ctts = box;
+      view.ctts_size = box_size;
+    }
+    if (stbl.data != nullptr &&
+        find_box(stbl.data, stbl.size, "stss", &box, &box_size)) {
+      view.stss = box;
+      view.stss_size = box_size;
+    }
+    // version/flags (4), sample_size (stsz) or reserved/field_size
+    // (stz2) (4), sample_count (4)
+    if (stbl.data != nullptr &&
+        (find_box(stbl.data, stbl.size, "stsz", &box, &box_size) ||
+         find_box(stbl.data, stbl.size, "stz2", &box, &box_size)) &&
+        box_size >= 12) {
+      view.sample_count = read_be32(box + 8);
+    }
+    tables->push_back(view);
+  }
+  return 0;
+}
+
+int read_video_sample_table(const char* infile, SampleTable* table) {
+  std::vector<uint8_t> moov;
+  if (read_moov_box(infile, &moov) != 0) {
+    return -1;
+  }
+  return parse_video_sample_table(moov.data(), moov.size(), table);
+}
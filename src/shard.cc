@@ -0,0 +1,151 @@
+#include "shard.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Escape a file name as a checkpoint line field (no newlines).
+std::string escape_name(const std::string& name) {
+  std::string escaped;
+  for (char c : name) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string unescape_name(const std::string& escaped) {
+  std::string name;
+  for (size_t i = 0; i < escaped.size(); ++i) {
+    if (escaped[i] == '\\' && i + 1 < escaped.size()) {
+      ++i;
+      name += (escaped[i] == 'n') ? '\n' : escaped[i];
+    } else {
+      name += escaped[i];
+    }
+  }
+  return name;
+}
+
+}  // namespace
+
+int parse_shard_spec(const char* spec, int* shard_index, int* num_shards) {
+  char* endptr;
+  errno = 0;
+  long int index = strtol(spec, &endptr, 10);
+  if (endptr == spec || *endptr != '/' || errno != 0) {
+    return -1;
+  }
+  const char* count_str = endptr + 1;
+  long int count = strtol(count_str, &endptr, 10);
+  if (endptr == count_str || *endptr != '\0' || errno != 0 || count < 1 ||
+      count > INT_MAX || index < 0 || index >= count) {
+    return -1;
+  }
+  *shard_index = static_cast<int>(index);
+  *num_shards = static_cast<int>(count);
+  return 0;
+}
+
+uint64_t get_shard_hash(const std::string& path) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : path) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::vector<std::string> get_shard_files(
+    const std::vector<std::string>& infile_list, int shard_index,
+    int num_shards) {
+  std::vector<std::string> shard_files;
+  for (const auto& infile : infile_list) {
+    if (get_shard_hash(infile) % num_shards ==
+        static_cast<uint64_t>(shard_index)) {
+      shard_files.push_back(infile);
+    }
+  }
+  return shard_files;
+}
+
+ShardCheckpoint::~ShardCheckpoint() {
+  if (fp != nullptr) {
+    fclose(fp);
+  }
+}
+
+int ShardCheckpoint::open(const std::string& checkpoint_file,
+                          uint64_t output_file_size, uint64_t* output_size) {
+  // 1. open the checkpoint file
+  if (fp != nullptr) {
+    return -1;
+  }
+  fp = fopen(checkpoint_file.c_str(), "a+b");
+  if (fp == nullptr) {
+    return -1;
+  }
+  rewind(fp);
+
+  // 2. load the complete lines
+  done.clear();
+  *output_size = 0;
+  uint64_t valid_length = 0;
+  char* line = nullptr;
+  size_t line_capacity = 0;
+  ssize_t line_length;
+  while ((line_length = getline(&line, &line_capacity, fp)) > 0) {
+    // a torn line (no newline) ends the checkpoint
+    if (line[line_length - 1] != '\n') {
+      break;
+    }
+    line[line_length - 1] = '\0';
+    char* endptr;
+    errno = 0;
+    uint64_t size = strtoull(line, &endptr, 10);
+    if (endptr == line || *endptr != ' ' || errno != 0 ||
+        size < *output_size || size > output_file_size) {
+      break;
+    }
+    *output_size = size;
+    done.insert(unescape_name(endptr + 1));
+    valid_length += line_length;
+  }
+  free(line);
+
+  // 3. drop the rest (appends go after the last complete line)
+  if (fflush(fp) != 0 || ftruncate(fileno(fp), valid_length) != 0) {
+    fclose(fp);
+    fp = nullptr;
+    return -1;
+  }
+  return 0;
+}
+
+bool ShardCheckpoint::is_done(const std::string& infile) const {
+  return done.count(infile) > 0;
+}
+
+int ShardCheckpoint::add(const std::string& infile, uint64_t output_size) {
+  if (fp == nullptr) {
+    return -1;
+  }
+  if (fprintf(fp, "%" PRIu64 " %s\n", output_size,
+              escape_name(infile).c_str()) < 0 ||
+      fflush(fp) != 0) {
+    return -1;
+  }
+  done.insert(infile);
+  return 0;
+}
@@ -0,0 +1,694 @@
+// Minimal H.264/H.265 SPS (and slice header) readers.
+
+#include "sps_reader.h"
+
+#include <stdint.h>  // for uint32_t, uint64_t
+
+#include <string>  // for string
+
+namespace {
+
+// Bit reader over the RBSP of a NAL unit. Emulation prevention bytes
+// (0x03 after two zero bytes) are skipped as the bytes are loaded. Reading
+// past the end of the data sets a sticky error flag, after which every read
+// returns 0.
+class BitReader {
+ public:
+  BitReader(const uint8_t* buffer, size_t buffer_size)
+      : data(buffer), size(buffer_size) {}
+
+  bool error() const { return read_error; }
+
+  uint32_t read_bit() {
+    if (bits_left == 0) {
+      // skip emulation prevention bytes
+      if ((zeros >= 2) && (pos < size) && (data[pos] == 0x03)) {
+        pos++;
+        zeros = 0;
+      }
+      if (pos >= size) {
+        read_error = true;
+        return 0;
+      }
+      byte = data[pos++];
+      zeros = (byte == 0) ? zeros + 1 : 0;
+      bits_left = 8;
+    }
+    bits_left--;
+    return (byte >> bits_left) & 0x01;
+  }
+
+  // read u(n) (n <= 32)
+  uint32_t read_bits(int num_bits) {
+    uint32_t value = 0;
+    for (int i = 0; i < num_bits; i++) {
+      value = (value << 1) | read_bit();
+    }
+    return value;
+  }
+
+  void skip_bits(int num_bits) {
+    for (int i = 0; i < num_bits; i++) {
+      read_bit();
+    }
+  }
+
+  // read ue(v)
+  uint32_t read_ue() {
+    int leading_zeros = 0;
+    while (read_bit() == 0) {
+      if (read_error || (++leading_zeros > 31)) {
+        read_error = true;
+        return 0;
+      }
+    }
+    uint64_t value = (1ull << leading_zeros) - 1 + read_bits(leading_zeros);
+    if (value > UINT32_MAX) {
+      read_error = true;
+      return 0;
+    }
+    return static_cast<uint32_t>(value);
+  }
+
+  // read se(v)
+  int32_t read_se() {
+    uint32_t value = read_ue();
+    if (value & 0x01) {
+      return static_cast<int32_t>((value >> 1) + 1);
+    }
+    return -static_cast<int32_t>(value >> 1);
+  }
+
+ private:
+  const uint8_t* data;
+  size_t size;
+  // pos: Offset of the next byte to load.
+  size_t pos = 0;
+  // zeros: Number of consecutive zero bytes loaded.
+  int zeros = 0;
+  uint8_t byte = 0;
+  int bits_left = 0;
+  bool read_error = false;
+};
+
+// Read the VUI up to the colour description (the start of the VUI is the
+// same in H.264 and H.265). Returns false if the VUI is truncated.
+bool read_vui_colour_description(BitReader* reader, SpsInfo* info) {
+  // aspect_ratio_info_present_flag
+  if (reader->read_bit()) {
+    uint32_t aspect_ratio_idc = reader->read_bits(8);
+    // Extended_SAR: sar_width, sar_height
+    if (aspect_ratio_idc == 255) {
+      reader->skip_bits(32);
+    }
+  }
+  // overscan_info_present_flag
+  if (reader->read_bit()) {
+    // overscan_appropriate_flag
+    reader->skip_bits(1);
+  }
+  // video_signal_type_present_flag
+  if (reader->read_bit() == 0) {
+    return !reader->error();
+  }
+  // video_format
+  reader->skip_bits(3);
+  uint32_t video_full_range_flag = reader->read_bit();
+  // colour_description_present_flag
+  if (reader->read_bit() == 0) {
+    return !reader->error();
+  }
+  uint32_t colour_primaries = reader->read_bits(8);
+  uint32_t transfer_characteristics = reader->read_bits(8);
+  uint32_t matrix_coeffs = reader->read_bits(8);
+  if (reader->error()) {
+    return false;
+  }
+  info->colour_primaries = colour_primaries;
+  info->transfer_characteristics = transfer_characteristics;
+  info->matrix_coeffs = matrix_coeffs;
+  info->video_full_range_flag = video_full_range_flag;
+  return true;
+}
+
+// H.264 profile types (Annex A.2), named as in h264nal.
+void get_h264_profile_type_str(uint32_t profile_idc, uint32_t constraint_flags,
+                               std::string* profile_type_str) {
+  bool constraint_set1_flag = (constraint_flags >> 6) & 0x01;
+  bool constraint_set3_flag = (constraint_flags >> 4) & 0x01;
+  bool constraint_set4_flag = (constraint_flags >> 3) & 0x01;
+  bool constraint_set5_flag = (constraint_flags >> 2) & 0x01;
+  switch (profile_idc) {
+    case 66:
+      *profile_type_str =
+          constraint_set1_flag ? "ConstrainedBaseline" : "Baseline";
+      break;
+    case 77:
+      *profile_type_str = "Main";
+      break;
+    case 88:
+      *profile_type_str = "Extended";
+      break;
+    case 100:
+      if (constraint_set4_flag && constraint_set5_flag) {
+        *profile_type_str = "ConstrainedHigh";
+      } else if (constraint_set4_flag) {
+        *profile_type_str = "ProgressiveHigh";
+      } else {
+        *profile_type_str = "High";
+      }
+      break;
+    case 110:
+      if (constraint_set3_flag) {
+        *profile_type_str = "High10Intra";
+      } else if (constraint_set4_flag) {
+        *profile_type_str = "ProgressiveHigh10";
+      } else {
+        *profile_type_str = "High10";
+      }
+      break;
+    case 122:
+      *profile_type_str = constraint_set3_flag ? "High422Intra" : "High422";
+      break;
+    case 244:
+      *profile_type_str = constraint_set3_flag ? "High444Intra" : "High444";
+      break;
+    case 44:
+      *profile_type_str = "CAVLC444Intra";
+      break;
+    default:
+      *profile_type_str = "";
+      break;
+  }
+}
+
+// H.265 profile types (Annex A.3), named as in h265nal.
+void get_h265_profile_type_str(uint32_t profile_idc,
+                               std::string* profile_type_str) {
+  switch (profile_idc) {
+    case 1:
+      *profile_type_str = "Main";
+      break;
+    case 2:
+      *profile_type_str = "Main10";
+      break;
+    case 3:
+      *profile_type_str = "MainStillPicture";
+      break;
+    default:
+      *profile_type_str = "";
+      break;
+  }
+}
+
+// H.264 scaling_list() (only parsed to skip it).
+void skip_h264_scaling_list(BitReader* reader, int size) {
+  int32_t last_scale = 8;
+  int32_t next_scale = 8;
+  for (int j = 0; (j < size) && !reader->error(); j++) {
+    if (next_scale != 0) {
+      int32_t delta_scale = reader->read_se();
+      next_scale = (last_scale + delta_scale + 256) % 256;
+    }
+    last_scale = (next_scale == 0) ? last_scale : next_scale;
+  }
+}
+
+// H.265 scaling_list_data() (only parsed to skip it).
+void skip_h265_scaling_list_data(BitReader* reader) {
+  for (int size_id = 0; size_id < 4; size_id++) {
+    for (int matrix_id = 0; matrix_id < 6;
+         matrix_id += (size_id == 3) ? 3 : 1) {
+      // scaling_list_pred_mode_flag
+      if (reader->read_bit() == 0) {
+        // scaling_list_pred_matrix_id_delta
+        reader->read_ue();
+        continue;
+      }
+      int coef_num = 1 << (4 + (size_id << 1));
+      coef_num = (coef_num < 64) ? coef_num : 64;
+      if (size_id > 1) {
+        // scaling_list_dc_coef_minus8
+        reader->read_se();
+      }
+      for (int i = 0; (i < coef_num) && !reader->error(); i++) {
+        // scaling_list_delta_coef
+        reader->read_se();
+      }
+    }
+  }
+}
+
+// Maximum number of pictures in a short-term reference picture set.
+constexpr uint32_t kMaxShortTermRefPics = 16;
+
+// Short-term reference picture set (the delta POCs are needed to parse
+// the sets predicted from it).
+struct ShortTermRefPicSet {
+  uint32_t num_negative_pics = 0;
+  uint32_t num_positive_pics = 0;
+  int32_t delta_poc_s0[kMaxShortTermRefPics];
+  int32_t delta_poc_s1[kMaxShortTermRefPics];
+};
+
+// H.265 st_ref_pic_set() in an SPS (7.3.7, 7.4.8).
+bool read_h265_st_ref_pic_set(BitReader* reader, uint32_t idx,
+                              ShortTermRefPicSet* sets) {
+  ShortTermRefPicSet* set = &sets[idx];
+  // inter_ref_pic_set_prediction_flag
+  if ((idx != 0) && reader->read_bit()) {
+    // the reference set is the previous one (delta_idx_minus1 is only
+    // present in slice headers)
+    const ShortTermRefPicSet* ref = &sets[idx - 1];
+    uint32_t delta_rps_sign = reader->read_bit();
+    uint32_t abs_delta_rps_minus1 = reader->read_ue();
+    if (abs_delta_rps_minus1 > (1 << 15) - 1) {
+      return false;
+    }
+    int32_t delta_rps = (1 - 2 * static_cast<int32_t>(delta_rps_sign)) *
+                        static_cast<int32_t>(abs_delta_rps_minus1 + 1);
+    uint32_t num_delta_pocs = ref->num_negative_pics + ref->num_positive_pics;
+    bool use_delta_flag[2 * kMaxShortTermRefPics + 1];
+    for (uint32_t j = 0; j <= num_delta_pocs; j++) {
+      // used_by_curr_pic_flag, use_delta_flag
+      use_delta_flag[j] = (reader->read_bit() == 1) || reader->read_bit();
+    }
+    // derive the delta POCs (7-61, 7-62)
+    uint32_t i = 0;
+    for (int32_t j = ref->num_positive_pics - 1; j >= 0; j--) {
+      int32_t d_poc = ref->delta_poc_s1[j] + delta_rps;
+      if ((d_poc < 0) && use_delta_flag[ref->num_negative_pics + j]) {
+        if (i >= kMaxShortTermRefPics) {
+          return false;
+        }
+        set->delta_poc_s0[i++] = d_poc;
+      }
+    }
+    if ((delta_rps < 0) && use_delta_flag[num_delta_pocs]) {
+      if (i >= kMaxShortTermRefPics) {
+        return false;
+      }
+      set->delta_poc_s0[i++] = delta_rps;
+    }
+    for (uint32_t j = 0; j < ref->num_negative_pics; j++) {
+      int32_t d_poc = ref->delta_poc_s0[j] + delta_rps;
+      if ((d_poc < 0) && use_delta_flag[j]) {
+        if (i >= kMaxShortTermRefPics) {
+          return false;
+        }
+        set->delta_poc_s0[i++] = d_poc;
+      }
+    }
+    set->num_negative_pics = i;
+    i = 0;
+    for (int32_t j = ref->num_negative_pics - 1; j >= 0; j--) {
+      int32_t d_poc = ref->delta_poc_s0[j] + delta_rps;
+      if ((d_poc > 0) && use_delta_flag[j]) {
+        if (i >= kMaxShortTermRefPics) {
+          return false;
+        }
+        set->delta_poc_s1[i++] = d_poc;
+      }
+    }
+    if ((delta_rps > 0) && use_delta_flag[num_delta_pocs]) {
+      if (i >= kMaxShortTermRefPics) {
+        return false;
+      }
+      set->delta_poc_s1[i++] = delta_rps;
+    }
+    for (uint32_t j = 0; j < ref->num_positive_pics; j++) {
+      int32_t d_poc = ref->delta_poc_s1[j] + delta_rps;
+      if ((d_poc > 0) && use_delta_flag[ref->num_negative_pics + j]) {
+        if (i >= kMaxShortTermRefPics) {
+          return false;
+        }
+        set->delta_poc_s1[i++] = d_poc;
+      }
+    }
+    set->num_positive_pics = i;
+    return !reader->error();
+  }
+
+  // explicit set
+  set->num_negative_pics = reader->read_ue();
+  set->num_positive_pics = reader->read_ue();
+  if ((set->num_negative_pics > kMaxShortTermRefPics) ||
+      (set->num_positive_pics > kMaxShortTermRefPics)) {
+    return false;
+  }
+  int32_t poc = 0;
+  for (uint32_t i = 0; i < set->num_negative_pics; i++) {
+    // delta_poc_s0_minus1, used_by_curr_pic_s0_flag
+    uint32_t delta_poc_minus1 = reader->read_ue();
+    reader->skip_bits(1);
+    if (delta_poc_minus1 > (1 << 15) - 1) {
+      return false;
+    }
+    poc -= static_cast<int32_t>(delta_poc_minus1 + 1);
+    set->delta_poc_s0[i] = poc;
+  }
+  poc = 0;
+  for (uint32_t i = 0; i < set->num_positive_pics; i++) {
+    // delta_poc_s1_minus1, used_by_curr_pic_s1_flag
+    uint32_t delta_poc_minus1 = reader->read_ue();
+    reader->skip_bits(1);
+    if (delta_poc_minus1 > (1 << 15) - 1) {
+      return false;
+    }
+    poc += static_cast<int32_t>(delta_poc_minus1 + 1);
+    set->delta_poc_s1[i] = poc;
+  }
+  return !reader->error();
+}
+
+}  // namespace
+
+int read_h264_sps(const uint8_t* data, size_t size, SpsInfo* info) {
+  // 1. check the NAL unit header (nal_unit_type 7: SPS)
+  if ((size < 1) || ((data[0] & 0x1f) != 7)) {
+    return -1;
+  }
+  BitReader reader(data + 1, size - 1);
+
+  // 2. read the profile and level
+  uint32_t profile_idc = reader.read_bits(8);
+  uint32_t constraint_flags = reader.read_bits(8);
+  uint32_t level_idc = reader.read_bits(8);
+  // seq_parameter_set_id
+  reader.read_ue();
+
+  // 3. skip the fields up to the VUI (7.3.2.1.1)
+  if ((profile_idc == 100) || (profile_idc == 110) || (profile_idc == 122) ||
+      (profile_idc == 244) || (profile_idc == 44) || (profile_idc == 83) ||
+      (profile_idc == 86) || (profile_idc == 118) || (profile_idc == 128) ||
+      (profile_idc == 138) || (profile_idc == 139) || (profile_idc == 134) ||
+      (profile_idc == 135)) {
+    uint32_t chroma_format_idc = reader.read_ue();
+    if (chroma_format_idc == 3) {
+      // separate_colour_plane_flag
+      reader.skip_bits(1);
+    }
+    // bit_depth_luma_minus8, bit_depth_chroma_minus8
+    reader.read_ue();
+    reader.read_ue();
+    // qpprime_y_zero_transform_bypass_flag
+    reader.skip_bits(1);
+    // seq_scaling_matrix_present_flag
+    if (reader.read_bit()) {
+      int num_lists = (chroma_format_idc != 3) ? 8 : 12;
+      for (int i = 0; i < num_lists; i++) {
+        // seq_scaling_list_present_flag
+        if (reader.read_bit()) {
+          skip_h264_scaling_list(&reader, (i < 6) ? 16 : 64);
+        }
+      }
+    }
+  }
+  // log2_max_frame_num_minus4
+  reader.read_ue();
+  uint32_t pic_order_cnt_type = reader.read_ue();
+  if (pic_order_cnt_type == 0) {
+    // log2_max_pic_order_cnt_lsb_minus4
+    reader.read_ue();
+  } else if (pic_order_cnt_type == 1) {
+    // delta_pic_order_always_zero_flag, offset_for_non_ref_pic,
+    // offset_for_top_to_bottom_field
+    reader.skip_bits(1);
+    reader.read_se();
+    reader.read_se();
+    uint32_t num_ref_frames_in_pic_order_cnt_cycle = reader.read_ue();
+    if (num_ref_frames_in_pic_order_cnt_cycle > 255) {
+      return -1;
+    }
+    for (uint32_t i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; i++) {
+      // offset_for_ref_frame
+      reader.read_se();
+    }
+  }
+  // max_num_ref_frames, gaps_in_frame_num_value_allowed_flag,
+  // pic_width_in_mbs_minus1, pic_height_in_map_units_minus1
+  reader.read_ue();
+  reader.skip_bits(1);
+  reader.read_ue();
+  reader.read_ue();
+  // frame_mbs_only_flag
+  if (reader.read_bit() == 0) {
+    // mb_adaptive_frame_field_flag
+    reader.skip_bits(1);
+  }
+  // direct_8x8_inference_flag
+  reader.skip_bits(1);
+  // frame_cropping_flag
+  if (reader.read_bit()) {
+    for (int i = 0; i < 4; i++) {
+      reader.read_ue();
+    }
+  }
+  // vui_parameters_present_flag
+  uint32_t vui_parameters_present_flag = reader.read_bit();
+  if (reader.error()) {
+    return -1;
+  }
+
+  // 4. read the VUI colour description
+  SpsInfo sps_info;
+  if (vui_parameters_present_flag &&
+      !read_vui_colour_description(&reader, &sps_info)) {
+    return -1;
+  }
+  sps_info.profile_idc = profile_idc;
+  sps_info.level_idc = level_idc;
+  get_h264_profile_type_str(profile_idc, constraint_flags,
+                            &sps_info.profile_type_str);
+  *info = sps_info;
+  return 0;
+}
+
+int read_h265_sps(const uint8_t* data, size_t size, SpsInfo* info) {
+  // 1. check the NAL unit header (nal_unit_type 33: SPS_NUT)
+  if ((size < 2) || (((data[0] >> 1) & 0x3f) != 33)) {
+    return -1;
+  }
+  BitReader reader(data + 2, size - 2);
+
+  // 2. read the profile and level (profile_tier_level(), 7.3.3)
+  // sps_video_parameter_set_id
+  reader.skip_bits(4);
+  uint32_t sps_max_sub_layers_minus1 = reader.read_bits(3);
+  if (sps_max_sub_layers_minus1 > 6) {
+    return -1;
+  }
+  // sps_temporal_id_nesting_flag, general_profile_space, general_tier_flag
+  reader.skip_bits(4);
+  uint32_t profile_idc = reader.read_bits(5);
+  // general_profile_compatibility_flag[32], general_progressive_source_flag,
+  // general_interlaced_source_flag, general_non_packed_constraint_flag,
+  // general_frame_only_constraint_flag, and 44 constraint/reserved bits
+  reader.skip_bits(32 + 4 + 44);
+  uint32_t level_idc = reader.read_bits(8);
+  bool sub_layer_profile_present_flag[8];
+  bool sub_layer_level_present_flag[8];
+  for (uint32_t i = 0; i < sps_max_sub_layers_minus1; i++) {
+    sub_layer_profile_present_flag[i] = reader.read_bit();
+    sub_layer_level_present_flag[i] = reader.read_bit();
+  }
+  if (sps_max_sub_layers_minus1 > 0) {
+    // reserved_zero_2bits
+    reader.skip_bits(2 * (8 - sps_max_sub_layers_minus1));
+  }
+  for (uint32_t i = 0; i < sps_max_sub_layers_minus1; i++) {
+    if (sub_layer_profile_present_flag[i]) {
+      reader.skip_bits(88);
+    }
+    if (sub_layer_level_present_flag[i]) {
+      reader.skip_bits(8);
+    }
+  }
+
+  // 3. skip the fields up to the VUI (7.3.2.2)
+  // sps_seq_parameter_set_id
+  reader.read_ue();
+  uint32_t chroma_format_idc = reader.read_ue();
+  if (chroma_format_idc == 3) {
+    // separate_colour_plane_flag
+    reader.skip_bits(1);
+  }
+  // pic_width_in_luma_samples, pic_height_in_luma_samples
+  reader.read_ue();
+  reader.read_ue();
+  // conformance_window_flag
+  if (reader.read_bit()) {
+    for (int i = 0; i < 4; i++) {
+      reader.read_ue();
+    }
+  }
+  // bit_depth_luma_minus8, bit_depth_chroma_minus8
+  reader.read_ue();
+  reader.read_ue();
+  uint32_t log2_max_pic_order_cnt_lsb_minus4 = reader.read_ue();
+  if (log2_max_pic_order_cnt_lsb_minus4 > 12) {
+    return -1;
+  }
+  uint32_t sps_sub_layer_ordering_info_present_flag = reader.read_bit();
+  for (uint32_t i = sps_sub_layer_ordering_info_present_flag
+                        ? 0
+                        : sps_max_sub_layers_minus1;
+       i <= sps_max_sub_layers_minus1; i++) {
+    // sps_max_dec_pic_buffering_minus1, sps_max_num_reorder_pics,
+    // sps_max_latency_increase_plus1
+    reader.read_ue();
+    reader.read_ue();
+    reader.read_ue();
+  }
+  // log2_min_luma_coding_block_size_minus3,
+  // log2_diff_max_min_luma_coding_block_size,
+  // log2_min_luma_transform_block_size_minus2,
+  // log2_diff_max_min_luma_transform_block_size,
+  // max_transform_hierarchy_depth_inter, max_transform_hierarchy_depth_intra
+  for (int i = 0; i < 6; i++) {
+    reader.read_ue();
+  }
+  // scaling_list_enabled_flag
+  if (reader.read_bit()) {
+    // sps_scaling_list_data_present_flag
+    if (reader.read_bit()) {
+      skip_h265_scaling_list_data(&reader);
+    }
+  }
+  // amp_enabled_flag, sample_adaptive_offset_enabled_flag
+  reader.skip_bits(2);
+  // pcm_enabled_flag
+  if (reader.read_bit()) {
+    // pcm_sample_bit_depth_luma_minus1, pcm_sample_bit_depth_chroma_minus1,
+    // log2_min_pcm_luma_coding_block_size_minus3,
+    // log2_diff_max_min_pcm_luma_coding_block_size,
+    // pcm_loop_filter_disabled_flag
+    reader.skip_bits(8);
+    reader.read_ue();
+    reader.read_ue();
+    reader.skip_bits(1);
+  }
+  uint32_t num_short_term_ref_pic_sets = reader.read_ue();
+  if (num_short_term_ref_pic_sets > 64) {
+    return -1;
+  }
+  ShortTermRefPicSet sets[64];
+  for (uint32_t i = 0; i < num_short_term_ref_pic_sets; i++) {
+    if (!read_h265_st_ref_pic_set(&reader, i, sets)) {
+      return -1;
+    }
+  }
+  // long_term_ref_pics_present_flag
+  if (reader.read_bit()) {
+    uint32_t num_long_term_ref_pics_sps = reader.read_ue();
+    if (num_long_term_ref_pics_sps > 32) {
+      return -1;
+    }
+    for (uint32_t i = 0; i < num_long_term_ref_pics_sps; i++) {
+      // lt_ref_pic_poc_lsb_sps, used_by_curr_pic_lt_sps_flag
+      reader.skip_bits(log2_max_pic_order_cnt_lsb_minus4 + 4);
+      reader.skip_bits(1);
+    }
+  }
+  // sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+  reader.skip_bits(2);
+  // vui_parameters_present_flag
+  uint32_t vui_parameters_present_flag = reader.read_bit();
+  if (reader.error()) {
+    return -1;
+  }
+
+  // 4. read the VUI colour description
+  SpsInfo sps_info;
+  if (vui_parameters_present_flag &&
+      !read_vui_colour_description(&reader, &sps_info)) {
+    return -1;
+  }
+  sps_info.profile_idc = profile_idc;
+  sps_info.level_idc = level_idc;
+  get_h265_profile_type_str(profile_idc, &sps_info.profile_type_str);
+  *info = sps_info;
+  return 0;
+}
+
+int read_h265_pps(const uint8_t* data, size_t size, uint32_t* pps_id,
+                  uint32_t* num_extra_slice_header_bits) {
+  // 1. check the NAL unit header (nal_unit_type 34: PPS_NUT)
+  if ((size < 2) || (((data[0] >> 1) & 0x3f) != 34)) {
+    return -1;
+  }
+  BitReader reader(data + 2, size - 2);
+
+  // 2. read the PPS fields (7.3.2.3.1)
+  uint32_t pps_pic_parameter_set_id = reader.read_ue();
+  // pps_seq_parameter_set_id
+  reader.read_ue();
+  // dependent_slice_segments_enabled_flag, output_flag_present_flag
+  reader.skip_bits(2);
+  uint32_t extra_bits = reader.read_bits(3);
+  if (reader.error() || pps_pic_parameter_set_id > 63) {
+    return -1;
+  }
+  *pps_id = pps_pic_parameter_set_id;
+  *num_extra_slice_header_bits = extra_bits;
+  return 0;
+}
+
+int read_h264_slice_type(const uint8_t* data, size_t size,
+                         uint32_t* slice_type) {
+  // 1. check the NAL unit header (nal_unit_type 1: non-IDR slice, 5: IDR
+  // slice)
+  if ((size < 1) || (((data[0] & 0x1f) != 1) && ((data[0] & 0x1f) != 5))) {
+    return -1;
+  }
+  BitReader reader(data + 1, size - 1);
+
+  // 2. read the slice header fields (7.3.3)
+  // first_mb_in_slice
+  reader.read_ue();
+  uint32_t value = reader.read_ue();
+  if (reader.error() || value > 9) {
+    return -1;
+  }
+  *slice_type = value;
+  return 0;
+}
+
+int read_h265_slice_type(
+    const uint8_t* data, size_t size,
+    const std::map<uint32_t, uint32_t>& pps_num_extra_slice_header_bits,
+    uint32_t* slice_type) {
+  // 1. check the NAL unit header (nal_unit_type 0-31: VCL NAL units)
+  if (size < 2) {
+    return -1;
+  }
+  uint32_t nal_unit_type = (data[0] >> 1) & 0x3f;
+  if (nal_unit_type > 31) {
+    return -1;
+  }
+  BitReader reader(data + 2, size - 2);
+
+  // 2. read the slice segment header fields (7.3.6.1)
+  uint32_t first_slice_segment_in_pic_flag = reader.read_bit();
+  if (first_slice_segment_in_pic_flag == 0) {
+    // dependent_slice_segment_flag and slice_segment_address need the SPS
+    return -1;
+  }
+  // IRAP pictures (BLA_W_LP to RSV_IRAP_VCL23): no_output_of_prior_pics_flag
+  if (nal_unit_type >= 16 && nal_unit_type <= 23) {
+    reader.skip_bits(1);
+  }
+  uint32_t slice_pic_parameter_set_id = reader.read_ue();
+  auto it = pps_num_extra_slice_header_bits.find(slice_pic_parameter_set_id);
+  if (reader.error() || it == pps_num_extra_slice_header_bits.end()) {
+    return -1;
+  }
+  // slice_reserved_flag[]
+  reader.skip_bits(it->second);
+  uint32_t value = reader.read_ue();
+  if (reader.error() || value > 2) {
+    return -1;
+  }
+  *slice_type = value;
+  return 0;
+}
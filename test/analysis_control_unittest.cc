@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <analysis_control.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace liblcvm {
+
+class AnalysisControlTest : public ::testing::Test {
+ public:
+  AnalysisControlTest() {}
+  ~AnalysisControlTest() override {}
+};
+
+TEST_F(AnalysisControlTest, TestCancel) {
+  // 1. no token and no deadline: never stops
+  AnalysisControl no_control;
+  EXPECT_EQ(0, no_control.check());
+
+  // 2. the token stops the analysis, and the stop is sticky
+  auto token = std::make_shared<CancellationToken>();
+  AnalysisControl control(token, 0);
+  EXPECT_EQ(0, control.check());
+  token->cancel();
+  // the per-sample check only looks at the token every interval
+  EXPECT_EQ(0, control.check(1));
+  EXPECT_EQ(kAnalysisCancelled, control.check(kAnalysisCheckInterval));
+  EXPECT_EQ(kAnalysisCancelled, control.check(1));
+  EXPECT_EQ(kAnalysisCancelled, control.get_stop_code());
+}
+
+TEST_F(AnalysisControlTest, TestDeadline) {
+  AnalysisControl control(nullptr, 10);
+  EXPECT_EQ(0, control.check());
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(kAnalysisTimeout, control.check());
+  EXPECT_EQ(kAnalysisTimeout, control.get_stop_code());
+}
+
+TEST_F(AnalysisControlTest, TestBudget) {
+  // 1. no budget: everything fits
+  AnalysisControl no_budget;
+  EXPECT_EQ(0, no_budget.check_tables(1000000000, 1000000000));
+  EXPECT_EQ(0, no_budget.check_metadata_size(1000000000));
+
+  // 2. sample and table entry limits
+  AnalysisBudget budget;
+  budget.max_samples = 1000;
+  budget.max_table_entries = 10;
+  AnalysisControl control;
+  control.set_budget(budget);
+  EXPECT_EQ(0, control.check_tables(10, 1000));
+  EXPECT_EQ(kAnalysisOverBudget, control.check_tables(11, 1000));
+  EXPECT_EQ(kAnalysisOverBudget, control.check_tables(10, 1001));
+  // over-budget tables do not stop the analysis by themselves
+  EXPECT_EQ(0, control.check());
+
+  // 3. the heap limit covers the metadata and the samples
+  budget = AnalysisBudget();
+  budget.max_memory_bytes = 1000 * kAnalysisBytesPerSample;
+  AnalysisControl memory_control;
+  memory_control.set_budget(budget);
+  EXPECT_EQ(0, memory_control.check_tables(0, 1000));
+  ASSERT_EQ(0, memory_control.check_metadata_size(
+                   100 * kAnalysisBytesPerSample /
+                   kAnalysisBytesPerMetadataByte));
+  EXPECT_EQ(0, memory_control.check_tables(0, 900));
+  EXPECT_EQ(kAnalysisOverBudget, memory_control.check_tables(0, 901));
+
+  // 4. metadata over the budget stops the analysis
+  budget = AnalysisBudget();
+  budget.max_moov_size = 1000;
+  AnalysisControl moov_control;
+  moov_control.set_budget(budget);
+  EXPECT_EQ(0, moov_control.check_metadata_size(1000));
+  EXPECT_EQ(kAnalysisOverBudget, moov_control.check_metadata_size(1001));
+  EXPECT_EQ(kAnalysisOverBudget, moov_control.check());
+}
+}  // namespace liblcvm
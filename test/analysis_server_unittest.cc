@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <analysis_server.h>
+#include <fcntl.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace liblcvm {
+
+class AnalysisServerTest : public ::testing::Test {
+ public:
+  AnalysisServerTest() {}
+  ~AnalysisServerTest() override {}
+};
+
+namespace {
+size_t count_open_fds() {
+  size_t num_fds = 0;
+  for (const auto& entry :
+       std::filesystem::directory_iterator("/proc/self/fd")) {
+    (void)entry;
+    ++num_fds;
+  }
+  return num_fds;
+}
+}  // namespace
+
+TEST_F(AnalysisServerTest, TestFrames) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  // 1. a frame round-trips, with and without a file descriptor
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  int file_fd = open(infile.c_str(), O_RDONLY);
+  ASSERT_GE(file_fd, 0);
+  ASSERT_EQ(0, write_frame(fds[0], infile));
+  ASSERT_EQ(0, write_frame(fds[0], "", file_fd));
+  close(file_fd);
+  std::string payload;
+  int passed_fd;
+  ASSERT_EQ(0, read_frame(fds[1], &payload, &passed_fd));
+  EXPECT_EQ(infile, payload);
+  EXPECT_EQ(-1, passed_fd);
+  ASSERT_EQ(0, read_frame(fds[1], &payload, &passed_fd));
+  EXPECT_EQ("", payload);
+  ASSERT_GE(passed_fd, 0);
+  // the passed file descriptor reads the file
+  char magic[4];
+  EXPECT_EQ(4, pread(passed_fd, magic, sizeof(magic), 4));
+  close(passed_fd);
+
+  // 2. oversized frames are refused
+  std::string large(kServerMaxFrameSize + 1, 'x');
+  EXPECT_NE(0, write_frame(fds[0], large));
+  const unsigned char header[4] = {0xff, 0xff, 0xff, 0xff};
+  ASSERT_EQ(4, write(fds[0], header, sizeof(header)));
+  EXPECT_EQ(-1, read_frame(fds[1], &payload, nullptr));
+
+  // 3. frames with several file descriptors are refused, and all the
+  // passed file descriptors are closed
+  size_t num_open_fds = count_open_fds();
+  int passed_fds[2] = {open(infile.c_str(), O_RDONLY),
+                       open(infile.c_str(), O_RDONLY)};
+  ASSERT_GE(passed_fds[0], 0);
+  ASSERT_GE(passed_fds[1], 0);
+  const uint8_t empty_header[4] = {0, 0, 0, 0};
+  struct iovec iov = {const_cast<uint8_t*>(empty_header),
+                      sizeof(empty_header)};
+  char control[CMSG_SPACE(sizeof(passed_fds))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(passed_fds));
+  memcpy(CMSG_DATA(cmsg), passed_fds, sizeof(passed_fds));
+  ASSERT_EQ(4, sendmsg(fds[0], &msg, 0));
+  close(passed_fds[0]);
+  close(passed_fds[1]);
+  EXPECT_EQ(-1, read_frame(fds[1], &payload, &passed_fd));
+  EXPECT_EQ(-1, passed_fd);
+  EXPECT_EQ(num_open_fds, count_open_fds());
+
+  // 4. the end of the stream
+  close(fds[0]);
+  EXPECT_EQ(1, read_frame(fds[1], &payload, nullptr));
+  close(fds[1]);
+}
+
+TEST_F(AnalysisServerTest, TestServe) {
+  // 1. start a server
+  std::string socket_path = std::string(testing::TempDir()) + "/lcvm_" +
+                            std::to_string(getpid()) + ".sock";
+  LiblcvmConfig liblcvm_config;
+  AnalysisServer server(liblcvm_config, 2);
+  int serve_ret = -1;
+  std::thread serve_thread(
+      [&] { serve_ret = server.serve(socket_path.c_str()); });
+  // wait for the socket
+  for (int i = 0; i < 100 && access(socket_path.c_str(), F_OK) != 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // 2. send names and file descriptors (twice, to use the warm state)
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  std::vector<std::string> infile_list = {infile, "/nonexistent/file.mp4",
+                                          infile};
+  for (bool pass_fds : {false, true}) {
+    std::vector<std::string> responses(infile_list.size());
+    int num_responses = 0;
+    EXPECT_EQ(0, analysis_client(socket_path.c_str(), infile_list, pass_fds,
+                                 [&](const std::string& response) {
+                                   size_t number;
+                                   ASSERT_EQ(1, sscanf(response.c_str(), "%zu",
+                                                       &number));
+                                   ASSERT_LT(number, responses.size());
+                                   responses[number] = response;
+                                   ++num_responses;
+                                 }));
+    EXPECT_EQ(3, num_responses);
+    // the valid files get a CSV header and row, with the file name
+    EXPECT_THAT(responses[0], ::testing::StartsWith("0,0\ninfile"));
+    EXPECT_THAT(responses[0], ::testing::HasSubstr("\n" + infile));
+    EXPECT_THAT(responses[1], ::testing::StartsWith("1,-"));
+    EXPECT_THAT(responses[2], ::testing::StartsWith("2,0\n"));
+  }
+
+  // 3. stop the server
+  server.stop();
+  serve_thread.join();
+  EXPECT_EQ(0, serve_ret);
+  EXPECT_NE(0, access(socket_path.c_str(), F_OK));
+}
+
+TEST_F(AnalysisServerTest, TestServeNonSocket) {
+  // a file at the socket path is not replaced
+  std::string socket_path = std::string(testing::TempDir()) + "/lcvm_" +
+                            std::to_string(getpid()) + ".notsock";
+  FILE* fp = fopen(socket_path.c_str(), "wb");
+  ASSERT_NE(nullptr, fp);
+  fputs("data", fp);
+  fclose(fp);
+  LiblcvmConfig liblcvm_config;
+  AnalysisServer server(liblcvm_config, 1);
+  EXPECT_NE(0, server.serve(socket_path.c_str()));
+  EXPECT_EQ(0, access(socket_path.c_str(), F_OK));
+  unlink(socket_path.c_str());
+}
+}  // namespace liblcvm
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <async_analyzer.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace liblcvm {
+
+class AsyncAnalyzerTest : public ::testing::Test {
+ public:
+  AsyncAnalyzerTest() {}
+  ~AsyncAnalyzerTest() override {}
+};
+
+TEST_F(AsyncAnalyzerTest, TestFutures) {
+  // 1. submit valid and missing files
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  AsyncAnalyzer analyzer(2, 8);
+  std::vector<std::future<BatchResult>> futures(6);
+  std::vector<uint64_t> ids(futures.size());
+  for (size_t i = 0; i < futures.size(); ++i) {
+    ASSERT_EQ(0, analyzer.submit((i % 3 == 2) ? "/nonexistent/file.mp4"
+                                              : infile,
+                                 liblcvm_config, false, &futures[i], &ids[i]));
+  }
+
+  // 2. all the analyses complete, with their ids
+  for (size_t i = 0; i < futures.size(); ++i) {
+    BatchResult result = futures[i].get();
+    EXPECT_EQ(ids[i], result.index);
+    EXPECT_EQ(i % 3 == 2, result.ret != 0);
+    EXPECT_EQ(i % 3 == 2, result.keys.empty());
+  }
+}
+
+TEST_F(AsyncAnalyzerTest, TestQueueDepthAndCancel) {
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  // 1. keep the only pool thread busy in a completion callback
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::promise<void> started;
+  auto analyzer = std::make_unique<AsyncAnalyzer>(1, 2);
+  ASSERT_EQ(0, analyzer->submit(infile, liblcvm_config, false,
+                                [&](BatchResult& result) {
+                                  EXPECT_EQ(0, result.ret);
+                                  started.set_value();
+                                  released.wait();
+                                }));
+  started.get_future().wait();
+
+  // 2. fill the queue: submissions fail instead of blocking
+  uint64_t id1;
+  uint64_t id2;
+  std::atomic<int> num_cancelled{0};
+  auto count_cancelled = [&](BatchResult& result) {
+    if (result.ret == kAnalysisCancelled) {
+      ++num_cancelled;
+    }
+  };
+  ASSERT_EQ(0, analyzer->submit(infile, liblcvm_config, false,
+                                count_cancelled, &id1));
+  ASSERT_EQ(0, analyzer->submit(infile, liblcvm_config, false,
+                                count_cancelled, &id2));
+  EXPECT_EQ(2u, analyzer->get_queue_depth());
+  EXPECT_NE(0, analyzer->submit(infile, liblcvm_config, false,
+                                count_cancelled));
+
+  // 3. cancel a queued analysis (once)
+  EXPECT_EQ(0, analyzer->cancel(id1));
+  EXPECT_NE(0, analyzer->cancel(id1));
+  EXPECT_EQ(1, num_cancelled.load());
+  EXPECT_EQ(1u, analyzer->get_queue_depth());
+
+  // 4. the queued analyses still complete (run or cancelled) when the
+  // analyzer goes away
+  std::future<BatchResult> future;
+  ASSERT_EQ(0, analyzer->submit(infile, liblcvm_config, false, &future));
+  release.set_value();
+  analyzer.reset();
+  int ret = future.get().ret;
+  EXPECT_TRUE(ret == 0 || ret == kAnalysisCancelled) << ret;
+}
+}  // namespace liblcvm
@@ -0,0 +1,172 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <batch_pipeline.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace liblcvm {
+
+class BatchPipelineTest : public ::testing::Test {
+ public:
+  BatchPipelineTest() {}
+  ~BatchPipelineTest() override {}
+};
+
+TEST_F(BatchPipelineTest, TestBoundedQueue) {
+  // 1. a producer blocks on the full queue until the consumer catches up
+  BoundedQueue<int> queue(2);
+  std::thread producer([&queue]() {
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(queue.push(i));
+    }
+    queue.close();
+  });
+  std::vector<int> items;
+  int item;
+  while (queue.pop(&item)) {
+    items.push_back(item);
+  }
+  producer.join();
+  ASSERT_EQ(100u, items.size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i, items[i]);
+  }
+
+  // 2. a closed queue rejects new items
+  EXPECT_FALSE(queue.push(0));
+}
+
+TEST_F(BatchPipelineTest, TestOrderedResults) {
+  // 1. mix valid and missing files
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  std::vector<std::string> infile_list;
+  for (int i = 0; i < 12; ++i) {
+    infile_list.push_back((i % 5 == 3) ? "/nonexistent/file.mp4" : infile);
+  }
+
+  // 2. run the pipeline with more compute threads than reorder slots
+  LiblcvmConfig liblcvm_config;
+  BatchPipelineConfig pipeline_config;
+  pipeline_config.prefetch_threads = 2;
+  pipeline_config.prefetch_depth = 2;
+  pipeline_config.compute_threads = 4;
+  pipeline_config.reorder_depth = 3;
+  std::vector<size_t> indices;
+  std::vector<int> rets;
+  int num_errors = run_batch_pipeline(
+      infile_list, liblcvm_config, false, pipeline_config,
+      [&](BatchResult& result) {
+        indices.push_back(result.index);
+        rets.push_back(result.ret);
+        EXPECT_EQ(infile_list[result.index], result.infile);
+      });
+
+  // 3. results come in input order
+  EXPECT_EQ(2, num_errors);
+  ASSERT_EQ(infile_list.size(), indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    EXPECT_EQ(i, indices[i]);
+    EXPECT_EQ(i % 5 == 3, rets[i] != 0);
+  }
+
+  // 4. a largest-first schedule still writes the results in input order
+  pipeline_config.largest_first = true;
+  indices.clear();
+  EXPECT_EQ(2, run_batch_pipeline(infile_list, liblcvm_config, false,
+                                  pipeline_config, [&](BatchResult& result) {
+                                    indices.push_back(result.index);
+                                  }));
+  ASSERT_EQ(infile_list.size(), indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    EXPECT_EQ(i, indices[i]);
+  }
+
+  // 5. empty batch
+  EXPECT_EQ(0, run_batch_pipeline({}, liblcvm_config, false, pipeline_config,
+                                  [](BatchResult&) {}));
+}
+
+TEST_F(BatchPipelineTest, TestReorderWindow) {
+  // 1. the window holds the files of all the stages
+  BatchPipelineConfig pipeline_config;
+  pipeline_config.prefetch_threads = 2;
+  pipeline_config.prefetch_depth = 4;
+  pipeline_config.compute_threads = 32;
+  pipeline_config.reorder_depth = 16;
+  EXPECT_EQ(38u, get_reorder_window(pipeline_config));
+  pipeline_config.reorder_depth = 64;
+  EXPECT_EQ(64u, get_reorder_window(pipeline_config));
+
+  // 2. more compute threads than the reorder depth
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  std::vector<std::string> infile_list(40, infile);
+  LiblcvmConfig liblcvm_config;
+  pipeline_config.prefetch_threads = 1;
+  pipeline_config.prefetch_depth = 1;
+  pipeline_config.compute_threads = 8;
+  pipeline_config.reorder_depth = 2;
+  std::vector<size_t> indices;
+  EXPECT_EQ(0, run_batch_pipeline(infile_list, liblcvm_config, false,
+                                  pipeline_config, [&](BatchResult& result) {
+                                    indices.push_back(result.index);
+                                  }));
+  ASSERT_EQ(infile_list.size(), indices.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    EXPECT_EQ(i, indices[i]);
+  }
+}
+
+TEST_F(BatchPipelineTest, TestBatchCost) {
+  // 1. write files with top-level boxes of different sizes
+  auto write_boxes =
+      [](const std::string& outfile,
+         const std::vector<std::pair<std::string, uint32_t>>& boxes) {
+        FILE* fp = fopen(outfile.c_str(), "wb");
+        ASSERT_NE(nullptr, fp);
+        for (const auto& [type, size] : boxes) {
+          std::vector<uint8_t> box(size, 0);
+          box[0] = size >> 24;
+          box[1] = size >> 16;
+          box[2] = size >> 8;
+          box[3] = size;
+          std::copy(type.begin(), type.end(), box.begin() + 4);
+          fwrite(box.data(), 1, box.size(), fp);
+        }
+        fclose(fp);
+      };
+  std::string dir = std::filesystem::temp_directory_path().string();
+  std::vector<std::string> infile_list = {
+      dir + "/liblcvm_batch_small.mp4", dir + "/liblcvm_batch_large.mp4",
+      dir + "/liblcvm_batch_fragmented.mp4", "/nonexistent/file.mp4",
+      dir + "/liblcvm_batch_no_moov.mp4"};
+  write_boxes(infile_list[0], {{"ftyp", 16}, {"moov", 100}, {"mdat", 5000}});
+  write_boxes(infile_list[1], {{"ftyp", 16}, {"moov", 1000}, {"mdat", 10}});
+  // 100 + 2 * 500 bytes of metadata
+  write_boxes(infile_list[2], {{"ftyp", 16},
+                               {"moov", 100},
+                               {"moof", 500},
+                               {"mdat", 10},
+                               {"moof", 500},
+                               {"mdat", 10}});
+  // no moov box: the file size (58 bytes) is used
+  write_boxes(infile_list[4], {{"mdat", 58}});
+
+  // 2. the cost is the metadata size, or the file size
+  std::vector<uint64_t> costs;
+  for (const auto& infile : infile_list) {
+    costs.push_back(get_batch_cost(infile));
+  }
+  EXPECT_THAT(costs, ::testing::ElementsAre(100, 1000, 1100, 0, 58));
+  for (size_t i = 0; i < infile_list.size(); ++i) {
+    std::filesystem::remove(infile_list[i]);
+  }
+}
+}  // namespace liblcvm
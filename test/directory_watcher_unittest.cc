@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <directory_watcher.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace liblcvm {
+
+class DirectoryWatcherTest : public ::testing::Test {
+ public:
+  DirectoryWatcherTest() {}
+  ~DirectoryWatcherTest() override {}
+};
+
+namespace {
+void write_file(const std::string& path) {
+  FILE* fp = fopen(path.c_str(), "wb");
+  ASSERT_NE(nullptr, fp);
+  fputs("data", fp);
+  fclose(fp);
+}
+}  // namespace
+
+TEST_F(DirectoryWatcherTest, TestMediaFileName) {
+  EXPECT_TRUE(is_media_file_name("video.mp4"));
+  EXPECT_TRUE(is_media_file_name("MOV1.MOV"));
+  EXPECT_TRUE(is_media_file_name("a.b.m4v"));
+  EXPECT_FALSE(is_media_file_name(".video.mp4"));
+  EXPECT_FALSE(is_media_file_name("video.mp4.part"));
+  EXPECT_FALSE(is_media_file_name("mp4"));
+  EXPECT_FALSE(is_media_file_name(""));
+}
+
+TEST_F(DirectoryWatcherTest, TestWatch) {
+  // 1. watch an empty directory
+  std::filesystem::path dir =
+      std::filesystem::path(testing::TempDir()) / "lcvm_watch";
+  std::filesystem::remove_all(dir);
+  ASSERT_TRUE(std::filesystem::create_directories(dir));
+  DirectoryWatcher watcher(dir.string(), 50);
+  if (watcher.start() != 0) {
+    std::filesystem::remove_all(dir);
+    GTEST_SKIP() << "directory watching (inotify) is not supported";
+  }
+  std::mutex mutex;
+  std::vector<std::string> paths;
+  std::thread run_thread([&] {
+    EXPECT_EQ(0, watcher.run([&](const std::string& path) {
+      std::lock_guard<std::mutex> lock(mutex);
+      paths.push_back(path);
+    }));
+  });
+
+  // 2. a file written twice is reported once, a file moved into the
+  // directory is reported, and non-media files are not
+  write_file((dir / "first.mp4").string());
+  write_file((dir / "first.mp4").string());
+  write_file((dir / "notes.txt").string());
+  write_file((dir / ".second.mov.tmp").string());
+  std::filesystem::rename(dir / ".second.mov.tmp", dir / "second.mov");
+  for (int i = 0; i < 200; ++i) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (paths.size() >= 2) {
+        break;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_THAT(paths, ::testing::UnorderedElementsAre(
+                           (dir / "first.mp4").string(),
+                           (dir / "second.mov").string()));
+  }
+
+  // 3. stopping reports the files closed before it
+  write_file((dir / "third.mp4").string());
+  watcher.stop();
+  run_thread.join();
+  EXPECT_EQ(3, paths.size());
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DirectoryWatcherTest, TestWatchOverflow) {
+  // 1. watch an empty directory, with a callback that blocks on the first
+  // file
+  std::ifstream max_events_file("/proc/sys/fs/inotify/max_queued_events");
+  int max_events = 0;
+  if (!(max_events_file >> max_events) || max_events > 100000) {
+    GTEST_SKIP() << "cannot overflow the inotify queue";
+  }
+  std::filesystem::path dir =
+      std::filesystem::path(testing::TempDir()) / "lcvm_watch_overflow";
+  std::filesystem::remove_all(dir);
+  ASSERT_TRUE(std::filesystem::create_directories(dir));
+  DirectoryWatcher watcher(dir.string(), 10);
+  if (watcher.start() != 0) {
+    std::filesystem::remove_all(dir);
+    GTEST_SKIP() << "directory watching (inotify) is not supported";
+  }
+  std::mutex mutex;
+  std::set<std::string> paths;
+  std::atomic<bool> blocked{false};
+  std::atomic<bool> released{false};
+  std::thread run_thread([&] {
+    EXPECT_EQ(0, watcher.run([&](const std::string& path) {
+      blocked = true;
+      while (!released) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      paths.insert(path);
+    }));
+  });
+  write_file((dir / "first.mp4").string());
+  while (!blocked) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // 2. overflow the event queue while the callback is blocked: the lost
+  // files are found by rescanning the directory
+  std::set<std::string> expected_paths = {(dir / "first.mp4").string()};
+  for (int i = 0; i < max_events + 100; ++i) {
+    std::string path = (dir / ("file" + std::to_string(i) + ".mp4")).string();
+    write_file(path);
+    expected_paths.insert(path);
+  }
+  released = true;
+  for (int i = 0; i < 1000; ++i) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (paths.size() >= expected_paths.size()) {
+        break;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  watcher.stop();
+  run_thread.join();
+  EXPECT_EQ(expected_paths, paths);
+  std::filesystem::remove_all(dir);
+}
+}  // namespace liblcvm
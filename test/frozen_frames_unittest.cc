@@ -0,0 +1,239 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <frozen_frames.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sample_table.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace liblcvm {
+
+namespace {
+
+void put_be32(std::vector<uint8_t>* buffer, uint32_t value) {
+  buffer->push_back(value >> 24);
+  buffer->push_back(value >> 16);
+  buffer->push_back(value >> 8);
+  buffer->push_back(value);
+}
+
+std::vector<uint8_t> make_box(const char* type,
+                              const std::vector<uint8_t>& payload) {
+  std::vector<uint8_t> box;
+  put_be32(&box, 8 + payload.size());
+  box.insert(box.end(), type, type + 4);
+  box.insert(box.end(), payload.begin(), payload.end());
+  return box;
+}
+
+std::vector<uint8_t> concat(const std::vector<std::vector<uint8_t>>& parts) {
+  std::vector<uint8_t> buffer;
+  for (const auto& part : parts) {
+    buffer.insert(buffer.end(), part.begin(), part.end());
+  }
+  return buffer;
+}
+
+// @brief Write an ISOBMFF file (moov and mdat boxes) with a single video
+// track, and all the samples in a single chunk.
+//
+// @param[in] outfile: Name of the file.
+// @param[in] sample_entry: Sample entry box (e.g. avc1).
+// @param[in] samples: Sample data (length-prefixed NAL units).
+void write_file(const std::string& outfile,
+                const std::vector<uint8_t>& sample_entry,
+                const std::vector<std::vector<uint8_t>>& samples) {
+  // 1. sample tables (the chunk offset is patched below)
+  std::vector<uint8_t> stsd = {0, 0, 0, 0, 0, 0, 0, 1};
+  stsd.insert(stsd.end(), sample_entry.begin(), sample_entry.end());
+  std::vector<uint8_t> stsz = {0, 0, 0, 0, 0, 0, 0, 0};
+  put_be32(&stsz, samples.size());
+  for (const auto& sample : samples) {
+    put_be32(&stsz, sample.size());
+  }
+  std::vector<uint8_t> stsc = {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1};
+  put_be32(&stsc, samples.size());
+  put_be32(&stsc, 1);
+  std::vector<uint8_t> stco = {0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0};
+  std::vector<uint8_t> hdlr = {0, 0, 0, 0, 0, 0, 0, 0, 'v', 'i', 'd', 'e'};
+  hdlr.resize(hdlr.size() + 13, 0);
+
+  // 2. moov box
+  std::vector<uint8_t> stbl =
+      concat({make_box("stsd", stsd), make_box("stsz", stsz),
+              make_box("stsc", stsc), make_box("stco", stco)});
+  std::vector<uint8_t> minf = make_box("stbl", stbl);
+  std::vector<uint8_t> mdia =
+      concat({make_box("hdlr", hdlr), make_box("minf", minf)});
+  std::vector<uint8_t> moov =
+      make_box("moov", make_box("trak", make_box("mdia", mdia)));
+  // the stco entry is the last 4 bytes of the moov box
+  uint32_t chunk_offset = moov.size() + 8;
+  for (int i = 0; i < 4; ++i) {
+    moov[moov.size() - 4 + i] = chunk_offset >> (24 - 8 * i);
+  }
+
+  // 3. write the file
+  std::vector<uint8_t> mdat = make_box("mdat", concat(samples));
+  FILE* fp = fopen(outfile.c_str(), "wb");
+  ASSERT_NE(nullptr, fp);
+  fwrite(moov.data(), 1, moov.size(), fp);
+  fwrite(mdat.data(), 1, mdat.size(), fp);
+  fclose(fp);
+}
+
+// @brief Build a visual sample entry with a codec configuration box.
+std::vector<uint8_t> make_sample_entry(const char* type,
+                                       const std::vector<uint8_t>& config) {
+  std::vector<uint8_t> entry(78, 0);
+  entry.insert(entry.end(), config.begin(), config.end());
+  return make_box(type, entry);
+}
+
+// @brief Build a sample with a single NAL unit (4-byte length), padded up
+// to size bytes.
+std::vector<uint8_t> make_sample(const std::vector<uint8_t>& nal,
+                                 size_t size) {
+  std::vector<uint8_t> sample;
+  std::vector<uint8_t> payload = nal;
+  if (size > nal.size() + 4) {
+    payload.resize(size - 4, 0);
+  }
+  put_be32(&sample, payload.size());
+  sample.insert(sample.end(), payload.begin(), payload.end());
+  return sample;
+}
+
+}  // namespace
+
+class FrozenFramesTest : public ::testing::Test {
+ public:
+  FrozenFramesTest() {}
+  ~FrozenFramesTest() override {}
+
+  void SetUp() override {
+    outfile = (std::filesystem::temp_directory_path() /
+               ("liblcvm_frozen_frames_" +
+                std::string(::testing::UnitTest::GetInstance()
+                                ->current_test_info()
+                                ->name()) +
+                ".mp4"))
+                  .string();
+  }
+  void TearDown() override { std::filesystem::remove(outfile); }
+
+  std::string outfile;
+};
+
+TEST_F(FrozenFramesTest, TestH264) {
+  // 1. 20 samples: a keyframe, and 2000-byte P frames, except for tiny P
+  // frames at 5-8 and 15-16 (too short a run), and a tiny I frame at 12
+  const std::vector<uint8_t> idr = {0x65, 0x88};
+  const std::vector<uint8_t> p_slice = {0x41, 0xc0};
+  const std::vector<uint8_t> i_slice = {0x41, 0xb0};
+  std::vector<std::vector<uint8_t>> samples;
+  for (int i = 0; i < 20; ++i) {
+    if (i == 0) {
+      samples.push_back(make_sample(idr, 4000));
+    } else if ((i >= 5 && i <= 8) || i == 15 || i == 16) {
+      samples.push_back(make_sample(p_slice, 0));
+    } else if (i == 12) {
+      samples.push_back(make_sample(i_slice, 0));
+    } else {
+      samples.push_back(make_sample(p_slice, 2000));
+    }
+  }
+  // avcC with lengthSizeMinusOne 3, and no SPS/PPS
+  const std::vector<uint8_t> avcc = {1, 0x4d, 0, 0x28, 0xff, 0xe0, 0};
+  write_file(outfile, make_sample_entry("avc1", make_box("avcC", avcc)),
+             samples);
+
+  // 2. detect the frozen frames
+  SampleTable table;
+  ASSERT_EQ(0, read_video_sample_table(outfile.c_str(), &table));
+  EXPECT_EQ("avc1", table.sample_entry_type);
+  EXPECT_EQ(4, table.nal_length_size);
+  std::vector<FrozenFrameSegment> segments;
+  ASSERT_EQ(0, detect_frozen_frames(outfile.c_str(), &table, {1}, &segments,
+                                    0));
+  ASSERT_EQ(1u, segments.size());
+  EXPECT_EQ(5u, segments[0].first_sample);
+  EXPECT_EQ(4u, segments[0].num_samples);
+
+  // 3. the tiny frames are not frozen if they are all keyframes
+  ASSERT_EQ(0, detect_frozen_frames(outfile.c_str(), &table, {}, &segments,
+                                    0));
+  EXPECT_EQ(0u, segments.size());
+
+  // 4. the detection stops with the analysis
+  auto token = std::make_shared<CancellationToken>();
+  token->cancel();
+  AnalysisControl control(token, 0);
+  EXPECT_EQ(kAnalysisCancelled,
+            detect_frozen_frames(outfile.c_str(), &table, {1}, &segments, 0,
+                                 &control));
+  EXPECT_EQ(0u, segments.size());
+}
+
+TEST_F(FrozenFramesTest, TestH265) {
+  // 1. 20 samples: a keyframe, and 2000-byte P frames, except for tiny I
+  // frames at 2-4, and tiny P frames at 16-19. The PPS has 2 extra slice
+  // header bits, which precede the slice type
+  const std::vector<uint8_t> pps = {0x44, 0x01, 0xc4};
+  const std::vector<uint8_t> idr = {0x26, 0x01, 0xc6};
+  const std::vector<uint8_t> p_slice = {0x02, 0x01, 0xc4};
+  const std::vector<uint8_t> i_slice = {0x02, 0x01, 0xc6};
+  std::vector<std::vector<uint8_t>> samples;
+  for (int i = 0; i < 20; ++i) {
+    if (i == 0) {
+      samples.push_back(make_sample(idr, 4000));
+    } else if (i >= 2 && i <= 4) {
+      samples.push_back(make_sample(i_slice, 0));
+    } else if (i >= 16) {
+      samples.push_back(make_sample(p_slice, 0));
+    } else {
+      samples.push_back(make_sample(p_slice, 2000));
+    }
+  }
+  // hvcC with lengthSizeMinusOne 3, and a PPS array
+  std::vector<uint8_t> hvcc(21, 0);
+  hvcc.push_back(0x03);
+  hvcc.push_back(1);
+  hvcc.push_back(34);
+  hvcc.push_back(0);
+  hvcc.push_back(1);
+  hvcc.push_back(0);
+  hvcc.push_back(pps.size());
+  hvcc.insert(hvcc.end(), pps.begin(), pps.end());
+  write_file(outfile, make_sample_entry("hvc1", make_box("hvcC", hvcc)),
+             samples);
+
+  // 2. detect the frozen frames (the last 4 samples)
+  SampleTable table;
+  ASSERT_EQ(0, read_video_sample_table(outfile.c_str(), &table));
+  EXPECT_EQ(1u, table.parameter_sets.size());
+  std::vector<FrozenFrameSegment> segments;
+  ASSERT_EQ(0, detect_frozen_frames(outfile.c_str(), &table, {1}, &segments,
+                                    0));
+  ASSERT_EQ(1u, segments.size());
+  EXPECT_EQ(16u, segments[0].first_sample);
+  EXPECT_EQ(4u, segments[0].num_samples);
+}
+
+TEST_F(FrozenFramesTest, TestUnsupportedCodec) {
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  SampleTable table;
+  ASSERT_EQ(0, read_video_sample_table(infile.c_str(), &table));
+  table.sample_entry_type = "mp4v";
+  std::vector<FrozenFrameSegment> segments;
+  EXPECT_NE(0, detect_frozen_frames(infile.c_str(), &table, {1}, &segments,
+                                    0));
+}
+}  // namespace liblcvm
@@ -6,6 +6,8 @@
 #include <gtest/gtest.h>
 #include <liblcvm.h>  // for various
 
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
@@ -168,6 +170,14 @@ TEST_F(LiblcvmTest, TestParserPolicy) {
       "channel_count",
       "sample_rate",
       "sample_size",
+      "video_bitrate_bps",
+      "video_bitrate_bps_peak",
+      "keyframe_size_bytes_average",
+      "non_keyframe_size_bytes_average",
+      "keyframe_size_ratio",
+      "frozen_frame_count",
+      "frozen_segment_count",
+      "frozen_duration_sec",
 #if ADD_POLICY
       "policy_version",
       "warn_list",
@@ -230,6 +240,14 @@ TEST_F(LiblcvmTest, TestParserPolicy) {
       1,
       44100,
       16,
+      11909865.321563682,
+      13817392.0,
+      73669.636363636368,
+      23965.499197431781,
+      3.0739871411287371,
+      -1,
+      -1,
+      -1.0,
 #if ADD_POLICY
       std::string("0.1"),
       std::string("Suspicious bitrate_bps too low (bitrate_bps: "
@@ -256,4 +274,308 @@ TEST_F(LiblcvmTest, TestParserPolicy) {
            }();
   }
 }
+
+#if ADD_POLICY
+TEST_F(LiblcvmTest, TestParserPolicyOnly) {
+  // 1. set input files
+  std::string input_filename = "MOV1.MOV";
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/" + input_filename;
+  std::string policy_filename = "example.txt";
+  std::string policy_infile =
+      std::string(TEST_POLICY_DIR) + "/" + policy_filename;
+  std::string policy;
+  ASSERT_EQ(0, readFileToString(policy_infile, &policy));
+
+  // 2. parse the input file (full and policy-only)
+  LiblcvmConfig liblcvm_config;
+  liblcvm_config.set_policy(policy);
+  LiblcvmKeyList keys;
+  LiblcvmValList vals;
+  LiblcvmKeyList keys_timing;
+  LiblcvmTimingList vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &keys, &vals, false,
+                   &keys_timing, &vals_timing));
+  liblcvm_config.set_policy_only(true);
+  LiblcvmKeyList keys_policy_only;
+  LiblcvmValList vals_policy_only;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &keys_policy_only,
+                   &vals_policy_only, false, &keys_timing, &vals_timing));
+  ASSERT_EQ(keys, keys_policy_only);
+
+  // 3. check the policy results (and the values they use) are the same
+  for (const std::string key :
+       {"bitrate_bps", "width", "height", "depth", "bit_depth_luma",
+        "audio_video_ratio", "policy_version", "warn_list", "error_list"}) {
+    size_t index = std::find(keys.begin(), keys.end(), key) - keys.begin();
+    ASSERT_LT(index, keys.size()) << "key: " << key;
+    EXPECT_TRUE(values_are_close(vals[index], vals_policy_only[index]))
+        << "key: " << key;
+  }
+
+  // 4. check the timing analysis did not run
+  size_t index =
+      std::find(keys.begin(), keys.end(), "num_video_frames") - keys.begin();
+  ASSERT_LT(index, keys.size());
+  EXPECT_EQ(634, std::get<int>(vals[index]));
+  EXPECT_EQ(0, std::get<int>(vals_policy_only[index]));
+}
+#endif
+
+TEST_F(LiblcvmTest, TestParserMoovCache) {
+  // 1. copy the input file, adding a free box at the end (same moov box,
+  // different file size)
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  std::string copy_infile =
+      (std::filesystem::temp_directory_path() / "liblcvm_moov_cache.mov")
+          .string();
+  std::filesystem::copy_file(
+      infile, copy_infile, std::filesystem::copy_options::overwrite_existing);
+  {
+    std::ofstream out(copy_infile, std::ios::binary | std::ios::app);
+    const char free_box[16] = {0, 0, 0, 16, 'f', 'r', 'e', 'e'};
+    out.write(free_box, sizeof(free_box));
+  }
+
+  // 2. parse both files (the second one hits the moov cache)
+  LiblcvmConfig liblcvm_config;
+  liblcvm_config.set_moov_cache(true);
+  LiblcvmKeyList keys;
+  LiblcvmValList vals;
+  LiblcvmKeyList keys_timing;
+  LiblcvmTimingList vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &keys, &vals, true,
+                   &keys_timing, &vals_timing));
+  LiblcvmKeyList copy_keys;
+  LiblcvmValList copy_vals;
+  LiblcvmKeyList copy_keys_timing;
+  LiblcvmTimingList copy_vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   copy_infile.c_str(), liblcvm_config, &copy_keys,
+                   &copy_vals, true, &copy_keys_timing, &copy_vals_timing));
+  std::filesystem::remove(copy_infile);
+
+  // 3. only the filename-dependent values change
+  ASSERT_EQ(keys, copy_keys);
+  ASSERT_EQ(vals.size(), copy_vals.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (keys[i] == "infile") {
+      EXPECT_EQ(copy_infile, std::get<std::string>(copy_vals[i]));
+    } else if (keys[i] == "filesize") {
+      EXPECT_EQ(std::get<int>(vals[i]) + 16, std::get<int>(copy_vals[i]));
+    } else if (keys[i] == "bitrate_bps") {
+      EXPECT_LT(std::get<double>(vals[i]), std::get<double>(copy_vals[i]));
+    } else {
+      EXPECT_TRUE(values_are_close(vals[i], copy_vals[i], 0.0))
+          << "key: " << keys[i];
+    }
+  }
+  EXPECT_EQ(vals_timing, copy_vals_timing);
+}
+
+TEST_F(LiblcvmTest, TestParserParameterSetCache) {
+  // 1. parse the same file twice (the second parse gets the SPS fields
+  // from the parameter-set cache)
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  auto ptr = IsobmffFileInformation::parse(infile.c_str(), liblcvm_config);
+  ASSERT_NE(nullptr, ptr);
+  auto cached_ptr =
+      IsobmffFileInformation::parse(infile.c_str(), liblcvm_config);
+  ASSERT_NE(nullptr, cached_ptr);
+
+  // 2. the SPS fields match
+  const auto& frame = ptr->get_frame();
+  const auto& cached_frame = cached_ptr->get_frame();
+  EXPECT_NE(-1, frame.get_profile_idc());
+  EXPECT_EQ(frame.get_profile_idc(), cached_frame.get_profile_idc());
+  EXPECT_EQ(frame.get_level_idc(), cached_frame.get_level_idc());
+  EXPECT_EQ(frame.get_profile_type_str(), cached_frame.get_profile_type_str());
+  EXPECT_EQ(frame.get_colour_primaries(), cached_frame.get_colour_primaries());
+  EXPECT_EQ(frame.get_transfer_characteristics(),
+            cached_frame.get_transfer_characteristics());
+  EXPECT_EQ(frame.get_matrix_coeffs(), cached_frame.get_matrix_coeffs());
+  EXPECT_EQ(frame.get_video_full_range_flag(),
+            cached_frame.get_video_full_range_flag());
+}
+
+TEST_F(LiblcvmTest, TestParserCancelled) {
+  // 1. a cancelled analysis fails with its own error code
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  auto token = std::make_shared<CancellationToken>();
+  liblcvm_config.set_cancellation_token(token);
+  token->cancel();
+  int error = 0;
+  EXPECT_EQ(nullptr,
+            IsobmffFileInformation::parse(infile.c_str(), liblcvm_config,
+                                          &error));
+  EXPECT_EQ(kAnalysisCancelled, error);
+  LiblcvmKeyList keys;
+  LiblcvmValList vals;
+  LiblcvmKeyList keys_timing;
+  LiblcvmTimingList vals_timing;
+  EXPECT_EQ(kAnalysisCancelled,
+            IsobmffFileInformation::parse_to_lists(
+                infile.c_str(), liblcvm_config, &keys, &vals, false,
+                &keys_timing, &vals_timing));
+
+  // 2. other failures keep the generic error code
+  liblcvm_config.set_cancellation_token(nullptr);
+  liblcvm_config.set_timeout_ms(60 * 1000);
+  EXPECT_EQ(nullptr, IsobmffFileInformation::parse("/nonexistent/file.mp4",
+                                                   liblcvm_config, &error));
+  EXPECT_EQ(-1, error);
+  EXPECT_NE(nullptr,
+            IsobmffFileInformation::parse(infile.c_str(), liblcvm_config));
+}
+
+TEST_F(LiblcvmTest, TestParserBudget) {
+  // 1. a file within the budget is fully analyzed (634 samples)
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  liblcvm_config.set_max_samples(634);
+  liblcvm_config.set_max_memory_bytes(64 * 1024 * 1024);
+  std::shared_ptr<IsobmffFileInformation> ptr =
+      IsobmffFileInformation::parse(infile.c_str(), liblcvm_config);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_FALSE(ptr->get_summary_only());
+  EXPECT_EQ(634, ptr->get_timing().get_num_video_frames());
+
+  // 2. sample tables over the budget fail the analysis
+  liblcvm_config.set_max_samples(633);
+  int error = 0;
+  EXPECT_EQ(nullptr, IsobmffFileInformation::parse(infile.c_str(),
+                                                   liblcvm_config, &error));
+  EXPECT_EQ(kAnalysisOverBudget, error);
+
+  // 3. ... or only get the summary values
+  liblcvm_config.set_budget_summary_only(true);
+  ptr = IsobmffFileInformation::parse(infile.c_str(), liblcvm_config);
+  ASSERT_NE(nullptr, ptr);
+  EXPECT_TRUE(ptr->get_summary_only());
+  EXPECT_EQ(0, ptr->get_timing().get_num_video_frames());
+  EXPECT_TRUE(ptr->get_timing().get_pts_sec_list().empty());
+  EXPECT_GT(ptr->get_timing().get_duration_video_sec(), 0.0);
+  EXPECT_GT(ptr->get_frame().get_width(), 0.0);
+
+  // 4. metadata over the budget always fails the analysis
+  liblcvm_config.set_max_samples(0);
+  liblcvm_config.set_max_moov_size(1024);
+  EXPECT_EQ(nullptr, IsobmffFileInformation::parse(infile.c_str(),
+                                                   liblcvm_config, &error));
+  EXPECT_EQ(kAnalysisOverBudget, error);
+}
+
+TEST_F(LiblcvmTest, TestParserBitrateWindows) {
+  // 1. copy the input file, setting a huge delta in the video stts box
+  // (the second entry, so all the later samples are ~83 days late)
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  std::string copy_infile =
+      (std::filesystem::temp_directory_path() / "liblcvm_huge_stts.mov")
+          .string();
+  std::string contents;
+  {
+    std::ifstream in(infile, std::ios::binary);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    contents = ss.str();
+  }
+  // the first stts box is the video one: size, "stts", version and flags,
+  // entry_count, and then (sample_count, sample_delta) entries
+  size_t stts_offset = contents.find("stts");
+  ASSERT_NE(std::string::npos, stts_offset);
+  size_t delta_offset = stts_offset + 4 + 4 + 4 + 8 + 4;
+  ASSERT_LT(delta_offset + 4, contents.size());
+  for (size_t i = 0; i < 4; ++i) {
+    contents[delta_offset + i] = '\xff';
+  }
+  {
+    std::ofstream out(copy_infile, std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size());
+  }
+
+  // 2. the bitrate windows are bounded by the video duration
+  LiblcvmConfig liblcvm_config;
+  std::shared_ptr<IsobmffFileInformation> ptr =
+      IsobmffFileInformation::parse(copy_infile.c_str(), liblcvm_config);
+  ASSERT_NE(nullptr, ptr);
+  double duration_video_sec = ptr->get_timing().get_duration_video_sec();
+  ASSERT_GT(duration_video_sec, 0.0);
+  const std::vector<double>& window_list =
+      ptr->get_frame().get_video_bitrate_bps_window_list();
+  EXPECT_FALSE(window_list.empty());
+  EXPECT_LE(window_list.size(), std::ceil(duration_video_sec));
+  double total_bits = 0.0;
+  for (const auto& window_bitrate_bps : window_list) {
+    total_bits += window_bitrate_bps;
+  }
+  EXPECT_NEAR(8.0 * ptr->get_frame().get_sample_table().sizes.get_total_size(),
+              total_bits, 1.0);
+  std::filesystem::remove(copy_infile);
+}
+
+TEST_F(LiblcvmTest, TestParserParallelTiming) {
+  // 1. parse the input file serially and in parallel
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  LiblcvmKeyList keys;
+  LiblcvmValList vals;
+  LiblcvmKeyList keys_timing;
+  LiblcvmTimingList vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &keys, &vals, true,
+                   &keys_timing, &vals_timing));
+  liblcvm_config.set_parallel_timing_threshold(1);
+  liblcvm_config.set_parallel_timing_threads(4);
+  LiblcvmKeyList parallel_keys;
+  LiblcvmValList parallel_vals;
+  LiblcvmKeyList parallel_keys_timing;
+  LiblcvmTimingList parallel_vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &parallel_keys,
+                   &parallel_vals, true, &parallel_keys_timing,
+                   &parallel_vals_timing));
+
+  // 2. the frame order is the same, and the statistics close
+  ASSERT_EQ(keys, parallel_keys);
+  ASSERT_EQ(vals.size(), parallel_vals.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_TRUE(values_are_close(vals[i], parallel_vals[i], 1e-6))
+        << "key: " << keys[i];
+  }
+  EXPECT_EQ(vals_timing, parallel_vals_timing);
+}
+
+TEST_F(LiblcvmTest, TestValueFormats) {
+  EXPECT_EQ("a", csv_escape("a"));
+  EXPECT_EQ("\"a,\"\"b\"\"\"", csv_escape("a,\"b\""));
+  std::string json;
+  ASSERT_EQ(0, liblcvmvalue_to_json(std::string("a\"b\\c\n"), &json));
+  EXPECT_EQ("\"a\\\"b\\\\c\\u000a\"", json);
+  ASSERT_EQ(0, liblcvmvalue_to_json(42, &json));
+  EXPECT_EQ("42", json);
+  ASSERT_EQ(0, liblcvmvalue_to_json(std::nan(""), &json));
+  EXPECT_EQ("null", json);
+}
+
+TEST_F(LiblcvmTest, TestColumnMap) {
+  // 1. the same columns, in a different order, are mapped by name
+  LiblcvmKeyList keys = {"infile", "width", "height"};
+  std::vector<size_t> columns;
+  ASSERT_EQ(0, get_column_map(keys, {"infile", "width", "height"}, &columns));
+  EXPECT_THAT(columns, ::testing::ElementsAre(0, 1, 2));
+  ASSERT_EQ(0, get_column_map(keys, {"height", "infile", "width"}, &columns));
+  EXPECT_THAT(columns, ::testing::ElementsAre(1, 2, 0));
+
+  // 2. headers with different columns are rejected
+  EXPECT_NE(0, get_column_map(keys, {"infile", "width"}, &columns));
+  EXPECT_NE(0, get_column_map(keys, {"infile", "width", "depth"}, &columns));
+  EXPECT_NE(0,
+            get_column_map(keys, {"infile", "width", "height", "depth"},
+                           &columns));
+  EXPECT_NE(0, get_column_map(keys, {"infile", "width", "width"}, &columns));
+}
 }  // namespace liblcvm
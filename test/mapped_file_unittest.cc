@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <mapped_file.h>
+#include <sample_table.h>
+
+#include <string>
+#include <vector>
+
+namespace liblcvm {
+
+class MappedFileTest : public ::testing::Test {
+ public:
+  MappedFileTest() {}
+  ~MappedFileTest() override {}
+};
+
+TEST_F(MappedFileTest, TestMoovBox) {
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+
+  // 1. the mapped moov box matches the stdio one
+  MappedFile mapped_file;
+  ASSERT_EQ(0, mapped_file.open(infile.c_str()));
+  const uint8_t* moov;
+  size_t moov_size;
+  ASSERT_EQ(0, mapped_file.get_moov_box(&moov, &moov_size));
+  std::vector<uint8_t> expected_moov;
+  ASSERT_EQ(0, read_moov_box(infile.c_str(), &expected_moov));
+  EXPECT_EQ(expected_moov, std::vector<uint8_t>(moov, moov + moov_size));
+
+  // 2. parse the sample tables from the mapping
+  SampleTable table;
+  ASSERT_EQ(0, parse_video_sample_table(moov, moov_size, &table));
+  EXPECT_EQ(634u, table.sizes.get_sample_count());
+  EXPECT_EQ(15740872u, table.sizes.get_total_size());
+
+  // 3. close (and missing file)
+  mapped_file.close();
+  EXPECT_EQ(nullptr, mapped_file.get_data());
+  EXPECT_NE(0, mapped_file.get_moov_box(&moov, &moov_size));
+  EXPECT_NE(0, mapped_file.open("/nonexistent/file.mp4"));
+}
+
+TEST_F(MappedFileTest, TestFindMoovBox) {
+  // 1. moov box after a free box
+  const uint8_t data[] = {0, 0, 0, 10, 'f', 'r', 'e', 'e', 0, 0,
+                          0, 0, 0, 12, 'm', 'o', 'o', 'v', 1, 2, 3, 4};
+  const uint8_t* moov;
+  size_t moov_size;
+  ASSERT_EQ(0, find_moov_box(data, sizeof(data), &moov, &moov_size));
+  EXPECT_EQ(data + 10, moov);
+  EXPECT_EQ(12u, moov_size);
+
+  // 2. truncated moov box
+  ASSERT_EQ(0, find_moov_box(data, sizeof(data) - 2, &moov, &moov_size));
+  EXPECT_EQ(10u, moov_size);
+
+  // 3. no moov box
+  EXPECT_NE(0, find_moov_box(data, 10, &moov, &moov_size));
+}
+}  // namespace liblcvm
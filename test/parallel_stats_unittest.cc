@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <parallel_stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace liblcvm {
+
+class ParallelStatsTest : public ::testing::Test {
+ public:
+  ParallelStatsTest() {}
+  ~ParallelStatsTest() override {}
+
+  void SetUp() override {
+    // 5 chunks and a partial one, with repeated values (frame durations
+    // of a ~30 fps stream, with some drops)
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<int> dist(0, 99);
+    vec.resize(5 * kParallelChunkSize + 1234);
+    for (auto& val : vec) {
+      int r = dist(gen);
+      val = (r < 90) ? 1.0 / 30 : (r < 98) ? 1.0 / 29 : 2.0 / 30 + r;
+    }
+  }
+
+  // @brief Reference (serial) median.
+  static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return (n % 2 == 0) ? (v[n / 2 - 1] + v[n / 2]) / 2.0 : v[n / 2];
+  }
+
+  std::vector<double> vec;
+};
+
+TEST_F(ParallelStatsTest, TestChunks) {
+  // every element is visited once, in fixed chunks
+  std::vector<int> visits(vec.size(), 0);
+  std::vector<size_t> chunk_begin(6, 0);
+  parallel_for_chunks(vec.size(), 4, [&](size_t chunk, size_t begin,
+                                         size_t end) {
+    chunk_begin[chunk] = begin;
+    for (size_t i = begin; i < end; ++i) {
+      visits[i]++;
+    }
+  });
+  EXPECT_EQ(vec.size(), std::count(visits.begin(), visits.end(), 1));
+  for (size_t chunk = 0; chunk < chunk_begin.size(); ++chunk) {
+    EXPECT_EQ(chunk * kParallelChunkSize, chunk_begin[chunk]);
+  }
+  // empty range
+  parallel_for_chunks(0, 4, [](size_t, size_t, size_t) { FAIL(); });
+}
+
+TEST_F(ParallelStatsTest, TestSortIndex) {
+  // 1. reference stable sort
+  std::vector<uint32_t> expected_index_list(vec.size());
+  std::iota(expected_index_list.begin(), expected_index_list.end(), 0);
+  std::stable_sort(expected_index_list.begin(), expected_index_list.end(),
+                   [this](uint32_t a, uint32_t b) { return vec[a] < vec[b]; });
+
+  // 2. the parallel sort is stable, for any number of threads
+  for (int num_threads : {1, 2, 7}) {
+    std::vector<uint32_t> index_list;
+    parallel_stable_sort_index(vec, num_threads, &index_list);
+    EXPECT_EQ(expected_index_list, index_list) << num_threads;
+    std::vector<double> sorted = vec;
+    parallel_permute(&sorted, index_list, num_threads);
+    EXPECT_TRUE(std::is_sorted(sorted.begin(), sorted.end()));
+  }
+}
+
+TEST_F(ParallelStatsTest, TestStatistics) {
+  // 1. reference values
+  double expected_sum = std::accumulate(vec.begin(), vec.end(), 0.0);
+  double expected_average = expected_sum / vec.size();
+  double sum_squares = 0.0;
+  for (const double& x : vec) {
+    sum_squares += (x - expected_average) * (x - expected_average);
+  }
+  double expected_stddev = std::sqrt(sum_squares / (vec.size() - 1));
+  double expected_median = median(vec);
+  std::vector<double> abs_differences(vec.size());
+  for (size_t i = 0; i < vec.size(); ++i) {
+    abs_differences[i] = std::fabs(vec[i] - expected_median);
+  }
+  double expected_mad = median(abs_differences);
+  std::vector<double> expected_drops;
+  for (const double& x : vec) {
+    if (x > 0.05) {
+      expected_drops.push_back(x);
+    }
+  }
+
+  // 2. the medians and drops are exact, the sums close, and all the values
+  // are the same for any number of threads
+  double sum_1 = parallel_sum(vec, 1);
+  double stddev_1 = parallel_standard_deviation(vec, 1);
+  for (int num_threads : {1, 2, 7}) {
+    double sum = parallel_sum(vec, num_threads);
+    EXPECT_NEAR(expected_sum, sum, 1e-9 * expected_sum);
+    EXPECT_EQ(sum_1, sum);
+    EXPECT_EQ(sum_1 / vec.size(), parallel_average(vec, num_threads));
+    double stddev = parallel_standard_deviation(vec, num_threads);
+    EXPECT_NEAR(expected_stddev, stddev, 1e-9 * expected_stddev);
+    EXPECT_EQ(stddev_1, stddev);
+    EXPECT_EQ(expected_median, parallel_median(vec, num_threads));
+    EXPECT_EQ(expected_mad,
+              parallel_median_absolute_deviation(vec, num_threads));
+    std::vector<double> drops;
+    parallel_select_over(vec, 0.05, num_threads, &drops);
+    EXPECT_EQ(expected_drops, drops);
+  }
+
+  // 3. small inputs
+  EXPECT_EQ(2.5, parallel_median({4.0, 1.0, 3.0, 2.0}, 4));
+  EXPECT_EQ(0.0, parallel_standard_deviation({1.0}, 4));
+}
+}  // namespace liblcvm
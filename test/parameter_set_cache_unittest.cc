@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <parameter_set_cache.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace liblcvm {
+
+class ParameterSetCacheTest : public ::testing::Test {
+ public:
+  ParameterSetCacheTest() {}
+  ~ParameterSetCacheTest() override {}
+};
+
+namespace {
+
+SpsInfo make_info(int id) {
+  SpsInfo info;
+  info.profile_idc = id;
+  info.level_idc = id + 1;
+  info.profile_type_str = "profile" + std::to_string(id);
+  return info;
+}
+
+}  // namespace
+
+TEST_F(ParameterSetCacheTest, TestLookup) {
+  ParameterSetCache cache;
+  SpsInfo info;
+  EXPECT_FALSE(cache.lookup("a", &info));
+  EXPECT_EQ(-1, info.profile_idc);
+
+  // 1. a hit returns the inserted fields
+  cache.insert("a", make_info(1));
+  ASSERT_TRUE(cache.lookup("a", &info));
+  EXPECT_EQ(1, info.profile_idc);
+  EXPECT_EQ(2, info.level_idc);
+  EXPECT_EQ("profile1", info.profile_type_str);
+
+  // 2. inserting an existing key keeps the first fields
+  cache.insert("a", make_info(5));
+  ASSERT_TRUE(cache.lookup("a", &info));
+  EXPECT_EQ(1, info.profile_idc);
+  EXPECT_EQ(1u, cache.size());
+}
+
+TEST_F(ParameterSetCacheTest, TestEviction) {
+  // 1. fill the cache
+  ParameterSetCache cache;
+  for (size_t i = 0; i < kParameterSetCacheSize; ++i) {
+    cache.insert("key" + std::to_string(i), make_info(i));
+  }
+  EXPECT_EQ(kParameterSetCacheSize, cache.size());
+
+  // 2. use the oldest entry, so the second oldest is the least recently
+  // used
+  SpsInfo info;
+  ASSERT_TRUE(cache.lookup("key0", &info));
+
+  // 3. one more entry evicts the least recently used one
+  cache.insert("new", make_info(1000));
+  EXPECT_EQ(kParameterSetCacheSize, cache.size());
+  EXPECT_FALSE(cache.lookup("key1", &info));
+  ASSERT_TRUE(cache.lookup("key0", &info));
+  EXPECT_EQ(0, info.profile_idc);
+  ASSERT_TRUE(cache.lookup("key2", &info));
+  EXPECT_EQ(2, info.profile_idc);
+  ASSERT_TRUE(cache.lookup("new", &info));
+  EXPECT_EQ(1000, info.profile_idc);
+}
+
+TEST_F(ParameterSetCacheTest, TestConcurrentAccess) {
+  // 8 threads look up and insert overlapping keys (more than the cache
+  // holds, so entries are evicted while other threads look them up). Every
+  // hit must return the fields of its own key.
+  ParameterSetCache cache;
+  constexpr int kNumThreads = 8;
+  constexpr int kNumKeys = 2 * kParameterSetCacheSize;
+  std::atomic<int> num_mismatches{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&cache, &num_mismatches, t]() {
+      for (int i = 0; i < 4 * kNumKeys; ++i) {
+        int id = (i * 7 + t * 31) % kNumKeys;
+        std::string key = "key" + std::to_string(id);
+        SpsInfo info;
+        if (cache.lookup(key, &info)) {
+          if (info.profile_idc != id ||
+              info.profile_type_str != "profile" + std::to_string(id)) {
+            ++num_mismatches;
+          }
+        } else {
+          cache.insert(key, make_info(id));
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, num_mismatches.load());
+  EXPECT_EQ(kParameterSetCacheSize, cache.size());
+}
+}  // namespace liblcvm
@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <policy_parser.h>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+int readFileToString(const std::string& filename, std::string* result) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  if (!file) {
+    return -1;  // Error: Could not open file
+  }
+
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  *result = contents.str();
+  return 0;
+}
+
+// Parse a policy string, returning whether the parser accepted it.
+template <typename ParseFunction>
+bool try_parse(ParseFunction parse, const std::string& policy_str,
+               dsl::RuleSet* rule_set) {
+  try {
+    *rule_set = parse(policy_str);
+  } catch (const std::exception&) {
+    return false;
+  }
+  return true;
+}
+
+// Check the hand-written parser against the ANTLR parser: both must reject
+// the policy, or both must produce the same rule set.
+void check_parsers_agree(const std::string& policy_str) {
+  dsl::RuleSet rule_set;
+  bool accepted =
+      try_parse(parse_policy_string_handwritten, policy_str, &rule_set);
+#if ADD_POLICY_ANTLR
+  dsl::RuleSet expected_rule_set;
+  bool expected_accepted =
+      try_parse(parse_policy_string_antlr, policy_str, &expected_rule_set);
+  ASSERT_EQ(expected_accepted, accepted) << "policy: " << policy_str;
+  if (accepted) {
+    EXPECT_EQ(expected_rule_set.SerializeAsString(),
+              rule_set.SerializeAsString())
+        << "policy: " << policy_str
+        << "\nexpected: " << expected_rule_set.DebugString()
+        << "\nactual: " << rule_set.DebugString();
+  }
+#else
+  (void)accepted;
+#endif
+}
+
+// Policies from policy/ and policy/corpus/.
+std::vector<std::string> read_policy_corpus() {
+  std::vector<std::string> corpus;
+  std::vector<std::filesystem::path> paths = {
+      std::filesystem::path(TEST_POLICY_DIR) / "example.txt",
+      std::filesystem::path(TEST_POLICY_DIR) / "input.txt",
+  };
+  for (const auto& entry : std::filesystem::directory_iterator(
+           std::filesystem::path(TEST_POLICY_DIR) / "corpus")) {
+    paths.push_back(entry.path());
+  }
+  for (const auto& path : paths) {
+    std::string policy_str;
+    if (readFileToString(path.string(), &policy_str) == 0) {
+      corpus.push_back(policy_str);
+    }
+  }
+  return corpus;
+}
+}  // namespace
+
+namespace liblcvm {
+
+class PolicyParserTest : public ::testing::Test {
+ public:
+  PolicyParserTest() {}
+  ~PolicyParserTest() override {}
+};
+
+TEST_F(PolicyParserTest, TestRuleStructure) {
+  std::string policy_str =
+      "version 0.1\n"
+      "# comment\n"
+      "warn \"label \\\"1\\\"\" a == 1 or b != \"x\" and not c in "
+      "range(0.5, 2)\n"
+      "error \"label 2\" d >= e\n";
+  dsl::RuleSet rule_set = parse_policy_string_handwritten(policy_str);
+
+  EXPECT_EQ("0.1", rule_set.version());
+  ASSERT_EQ(2, rule_set.rules_size());
+
+  // warn rule: ((a == 1 or b != "x") and not (c in range(0.5, 2)))
+  const dsl::Rule& rule0 = rule_set.rules(0);
+  EXPECT_EQ(dsl::SeverityType::WARN, rule0.severity());
+  EXPECT_EQ("label \\\"1\\\"", rule0.label());
+  ASSERT_TRUE(rule0.condition().has_logical());
+  const dsl::Logical& and_expr = rule0.condition().logical();
+  EXPECT_EQ(dsl::AND, and_expr.op());
+  ASSERT_EQ(2, and_expr.operands_size());
+  ASSERT_TRUE(and_expr.operands(0).has_logical());
+  const dsl::Logical& or_expr = and_expr.operands(0).logical();
+  EXPECT_EQ(dsl::OR, or_expr.op());
+  ASSERT_EQ(2, or_expr.operands_size());
+  EXPECT_EQ("a", or_expr.operands(0).comparison().column());
+  EXPECT_EQ(dsl::EQ, or_expr.operands(0).comparison().op());
+  EXPECT_EQ("1", or_expr.operands(0).comparison().value());
+  EXPECT_EQ("b", or_expr.operands(1).comparison().column());
+  EXPECT_EQ(dsl::NE, or_expr.operands(1).comparison().op());
+  EXPECT_EQ("x", or_expr.operands(1).comparison().value());
+  ASSERT_TRUE(and_expr.operands(1).has_not_expr());
+  const dsl::Expr& not_operand = and_expr.operands(1).not_expr().expr();
+  ASSERT_TRUE(not_operand.has_range());
+  EXPECT_EQ("c", not_operand.range().column());
+  EXPECT_EQ(0.5, not_operand.range().low());
+  EXPECT_EQ(2.0, not_operand.range().high());
+
+  // error rule: d >= e (variable RHS)
+  const dsl::Rule& rule1 = rule_set.rules(1);
+  EXPECT_EQ(dsl::SeverityType::ERROR, rule1.severity());
+  EXPECT_EQ("label 2", rule1.label());
+  EXPECT_EQ("d", rule1.condition().comparison().column());
+  EXPECT_EQ(dsl::GE, rule1.condition().comparison().op());
+  EXPECT_EQ("e", rule1.condition().comparison().value());
+}
+
+TEST_F(PolicyParserTest, TestInvalidPolicies) {
+  std::vector<std::string> policies = {
+      "",
+      "# only a comment\n",
+      "version 0.1\n",
+      "warn \"a\"",
+      "warn a == 1",
+      "warn \"a\" == 1",
+      "warn \"a\" a ==",
+      "warn \"a\" a == 1 and",
+      "warn \"a\" (a == 1",
+      "warn \"a\" a in range(1, 2",
+      "warn \"a\" a in range(x, 2)",
+      "warn \"a\" a == 1 b == 2",
+      "warn \"a\" a == 1 $",
+      "version \"0.1\" warn \"a\" a == 1",
+  };
+  for (const auto& policy_str : policies) {
+    EXPECT_THROW(parse_policy_string_handwritten(policy_str),
+                 std::runtime_error)
+        << "policy: " << policy_str;
+    check_parsers_agree(policy_str);
+  }
+}
+
+TEST_F(PolicyParserTest, TestDifferentialCorpus) {
+  std::vector<std::string> corpus = read_policy_corpus();
+  ASSERT_FALSE(corpus.empty());
+  for (const auto& policy_str : corpus) {
+    check_parsers_agree(policy_str);
+  }
+}
+
+TEST_F(PolicyParserTest, TestDifferentialMutations) {
+  // mutate the corpus (delete, duplicate, replace, or swap characters), and
+  // check that the parsers keep agreeing
+  const std::string alphabet = "aeorn_019.,()<>=!\"\\# \n";
+  std::mt19937 gen(0x6c63766d);
+  std::vector<std::string> corpus = read_policy_corpus();
+  for (const auto& seed : corpus) {
+    for (int i = 0; i < 200; ++i) {
+      std::string policy_str = seed;
+      int num_mutations = 1 + gen() % 3;
+      for (int j = 0; j < num_mutations && !policy_str.empty(); ++j) {
+        size_t pos = gen() % policy_str.size();
+        char c = alphabet[gen() % alphabet.size()];
+        switch (gen() % 4) {
+          case 0:
+            policy_str.erase(pos, 1);
+            break;
+          case 1:
+            policy_str.insert(pos, 1, policy_str[pos]);
+            break;
+          case 2:
+            policy_str[pos] = c;
+            break;
+          default:
+            if (pos + 1 < policy_str.size()) {
+              std::swap(policy_str[pos], policy_str[pos + 1]);
+            }
+            break;
+        }
+      }
+      check_parsers_agree(policy_str);
+    }
+  }
+}
+}  // namespace liblcvm
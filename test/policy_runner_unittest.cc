@@ -5,10 +5,13 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <liblcvm.h>  // for various
+#include <policy_compiler.h>
+#include <policy_parser.h>
 
 #include <filesystem>
 #include <fstream>
 #include <list>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -87,4 +90,323 @@ TEST_F(PolicyRunnerTest, TestComparisons) {
   EXPECT_THAT(error_list,
               ElementsAre(StrEq("Invalid double (double: 1.000000)")));
 }
+
+TEST_F(PolicyRunnerTest, TestCompiledPolicy) {
+  // 1. set input keys/vals
+  LiblcvmKeyList keys = {
+      "width", "height", "video_codec_type", "bitrate_bps", "max_width",
+  };
+  LiblcvmValList vals = {
+      1920.0, 1080.0, std::string("hvc1"), 13455.737704918032, 1280,
+  };
+  std::string policy_str =
+      "version 0.1\n"
+      "error \"too wide\" width > max_width\n"
+      "error \"missing column\" unknown_column == 3\n"
+      "warn \"hevc\" video_codec_type == \"hvc1\" and "
+      "not (height in range(0, 720))\n"
+      "warn \"low bitrate\" bitrate_bps < 5000000 or width < 1000\n"
+      "warn \"no match\" video_codec_type != \"hvc1\"\n";
+
+  // 2. compile the policy
+  std::shared_ptr<CompiledPolicy> policy =
+      CompiledPolicy::compile(policy_str, keys);
+  ASSERT_NE(nullptr, policy);
+  EXPECT_EQ("0.1", policy->get_version());
+  EXPECT_TRUE(policy->matches_keys(keys));
+  ASSERT_EQ(5, policy->get_rules().size());
+
+  // 3. check the column and literal resolution
+  const auto& code = policy->get_code();
+  const auto& rule0 = policy->get_rules()[0];
+  ASSERT_EQ(rule0.begin + 1, rule0.end);
+  EXPECT_EQ(PolicyOpcode::kCompare, code[rule0.begin].opcode);
+  EXPECT_EQ(0, code[rule0.begin].slot);
+  EXPECT_EQ(4, code[rule0.begin].rhs_slot);
+  const auto& rule1 = policy->get_rules()[1];
+  ASSERT_EQ(rule1.begin + 1, rule1.end);
+  EXPECT_EQ(PolicyOpcode::kFalse, code[rule1.begin].opcode);
+  const auto& rule3 = policy->get_rules()[3];
+  EXPECT_EQ(PolicyOpcode::kCompare, code[rule3.begin].opcode);
+  EXPECT_TRUE(code[rule3.begin].rhs_number_valid);
+  EXPECT_EQ(5000000.0, code[rule3.begin].rhs_number);
+  EXPECT_EQ(PolicyOpcode::kJumpIfTrue, code[rule3.begin + 1].opcode);
+  EXPECT_EQ(rule3.end, code[rule3.begin + 1].target);
+
+  // 4. check the referenced columns (missing ones are not reported)
+  std::set<std::string> expected_columns = {
+      "width", "height", "video_codec_type", "bitrate_bps", "max_width"};
+  EXPECT_EQ(expected_columns, policy->get_referenced_columns());
+  std::set<std::string> columns;
+  EXPECT_EQ(0, policy_columns("error \"a\" height < 10 or unknown == 1",
+                              keys, &columns));
+  EXPECT_EQ(std::set<std::string>({"height"}), columns);
+
+  // 5. evaluate the policy
+  std::list<std::string> warn_list;
+  std::list<std::string> error_list;
+  policy->evaluate(vals, &warn_list, &error_list);
+  EXPECT_THAT(error_list,
+              ElementsAre(StrEq("too wide (width: 1920.000000)")));
+  EXPECT_THAT(
+      warn_list,
+      ElementsAre(
+          StrEq("hevc (video_codec_type: hvc1, height: 1080.000000)"),
+          StrEq("low bitrate (bitrate_bps: 13455.737705, width: 1920.000000)")));
+
+  // 6. wrong-sized value lists are rejected
+  LiblcvmValList short_vals = {1920.0};
+  EXPECT_THROW(policy->evaluate(short_vals, &warn_list, &error_list),
+               std::runtime_error);
+}
+
+TEST_F(PolicyRunnerTest, TestBatchPolicy) {
+  // 1. set input keys and a batch of vals (crossing 64-row word boundaries)
+  LiblcvmKeyList keys = {
+      "width", "height", "video_codec_type", "bitrate_bps", "max_width",
+  };
+  std::vector<LiblcvmValList> vals_list;
+  const char* codecs[] = {"hvc1", "hev1", "avc1"};
+  for (int i = 0; i < 150; ++i) {
+    vals_list.push_back({
+        640.0 + 10 * i,
+        360.0 + 5 * i,
+        std::string(codecs[i % 3]),
+        1000000.0 * (i % 7),
+        (i % 2 == 0) ? LiblcvmValue(1280) : LiblcvmValue(std::string("none")),
+    });
+  }
+  std::string policy_str =
+      "version 0.2\n"
+      "error \"too wide\" width > max_width\n"
+      "error \"missing column\" unknown_column == 3\n"
+      "warn \"hevc\" video_codec_type == \"hvc1\" and "
+      "not (height in range(0, 720))\n"
+      "warn \"low bitrate\" bitrate_bps < 2000000 or width < 700\n"
+      "warn \"no hev1\" video_codec_type != \"hev1\" and "
+      "(bitrate_bps == 0 or bitrate_bps >= 5000000)\n";
+
+  // 2. run the batch policy
+  std::vector<std::list<std::string>> warn_lists;
+  std::vector<std::list<std::string>> error_lists;
+  std::string version;
+  ASSERT_EQ(0, policy_runner_batch(policy_str, keys, vals_list, &warn_lists,
+                                   &error_lists, &version));
+  EXPECT_EQ("0.2", version);
+  ASSERT_EQ(vals_list.size(), warn_lists.size());
+  ASSERT_EQ(vals_list.size(), error_lists.size());
+
+  // 3. compare against the per-row policy runner
+  for (size_t row = 0; row < vals_list.size(); ++row) {
+    std::list<std::string> warn_list;
+    std::list<std::string> error_list;
+    LiblcvmValList vals = vals_list[row];
+    ASSERT_EQ(0, policy_runner(policy_str, &keys, &vals, &warn_list,
+                               &error_list, &version));
+    EXPECT_EQ(warn_list, warn_lists[row]) << "row: " << row;
+    EXPECT_EQ(error_list, error_lists[row]) << "row: " << row;
+  }
+  EXPECT_THAT(error_lists[100],
+              ElementsAre(StrEq("too wide (width: 1640.000000)")));
+  EXPECT_TRUE(error_lists[101].empty());
+
+  // 4. ill-typed comparisons fail the whole batch
+  std::string bad_policy_str = "error \"bad\" video_codec_type > \"5\"";
+  EXPECT_EQ(1, policy_runner_batch(bad_policy_str, keys, vals_list,
+                                   &warn_lists, &error_lists, &version));
+
+  // 5. ... or only the rows with ill-typed values, as the per-row policy
+  // runner (max_width is a string in the odd rows)
+  std::string mixed_policy_str =
+      "warn \"narrow\" width < 1000\n"
+      "error \"large\" max_width > 1000\n";
+  std::vector<int> row_errors;
+  ASSERT_EQ(0, policy_runner_batch(mixed_policy_str, keys, vals_list,
+                                   &warn_lists, &error_lists, &version,
+                                   &row_errors));
+  ASSERT_EQ(vals_list.size(), row_errors.size());
+  for (size_t row = 0; row < vals_list.size(); ++row) {
+    std::list<std::string> warn_list;
+    std::list<std::string> error_list;
+    LiblcvmValList vals = vals_list[row];
+    int ret = policy_runner(mixed_policy_str, &keys, &vals, &warn_list,
+                            &error_list, &version);
+    EXPECT_EQ(row % 2 == 1, ret != 0) << "row: " << row;
+    EXPECT_EQ(ret != 0, row_errors[row] != 0) << "row: " << row;
+    if (ret == 0) {
+      EXPECT_EQ(warn_list, warn_lists[row]) << "row: " << row;
+      EXPECT_EQ(error_list, error_lists[row]) << "row: " << row;
+    } else {
+      EXPECT_TRUE(warn_lists[row].empty()) << "row: " << row;
+      EXPECT_TRUE(error_lists[row].empty()) << "row: " << row;
+    }
+  }
+  EXPECT_THAT(warn_lists[0], ElementsAre(StrEq("narrow (width: 640.000000)")));
+}
+
+TEST_F(PolicyRunnerTest, TestBinaryPolicy) {
+  // 1. set input keys/vals
+  LiblcvmKeyList keys = {
+      "width", "height", "video_codec_type", "bitrate_bps", "max_width",
+  };
+  LiblcvmValList vals = {
+      1920.0, 1080.0, std::string("hvc1"), 13455.737704918032, 1280,
+  };
+  std::string policy_str =
+      "version 0.3\n"
+      "error \"too wide\" width > max_width\n"
+      "warn \"hevc\" video_codec_type == \"hvc1\" and "
+      "not (height in range(0, 720))\n";
+
+  // 2. compile the policy into a binary policy
+  std::string policy_binary;
+  ASSERT_EQ(0, policy_compile(policy_str, &policy_binary));
+  EXPECT_TRUE(is_policy_binary(policy_binary));
+  EXPECT_FALSE(is_policy_binary(policy_str));
+  EXPECT_EQ(parse_policy_string(policy_str).SerializeAsString(),
+            parse_policy_string(policy_binary).SerializeAsString());
+
+  // 3. the binary policy produces the same results as the text policy
+  std::list<std::string> warn_list;
+  std::list<std::string> error_list;
+  std::string version;
+  ASSERT_EQ(0, policy_runner(policy_binary, &keys, &vals, &warn_list,
+                             &error_list, &version));
+  EXPECT_EQ("0.3", version);
+  EXPECT_THAT(warn_list, ElementsAre(StrEq("hevc (video_codec_type: hvc1, "
+                                           "height: 1080.000000)")));
+  EXPECT_THAT(error_list,
+              ElementsAre(StrEq("too wide (width: 1920.000000)")));
+
+  // 4. invalid policies are not compiled
+  EXPECT_EQ(1, policy_compile("warn \"a\" a ==", &policy_binary));
+  EXPECT_TRUE(policy_binary.empty());
+
+  // 5. corrupted or unknown-version binary policies are rejected
+  ASSERT_EQ(0, policy_compile(policy_str, &policy_binary));
+  std::string truncated = policy_binary.substr(0, policy_binary.size() - 3);
+  EXPECT_EQ(1, policy_runner(truncated, &keys, &vals, &warn_list, &error_list,
+                             &version));
+  std::string bad_version = policy_binary;
+  bad_version[sizeof(kPolicyBinaryMagic) - 1] = kPolicyBinaryFormatVersion + 1;
+  EXPECT_THROW(parse_policy_binary(bad_version), std::runtime_error);
+}
+
+TEST_F(PolicyRunnerTest, TestPolicyPlanner) {
+  // 1. set input keys and a batch of vals (mostly avc1, mostly small)
+  LiblcvmKeyList keys = {"width", "height", "video_codec_type", "bitrate_bps"};
+  std::vector<LiblcvmValList> vals_list;
+  for (int i = 0; i < 200; ++i) {
+    vals_list.push_back({
+        1280.0,
+        (i % 10 == 0) ? 1080.0 : 480.0,
+        std::string((i % 20 == 0) ? "hvc1" : "avc1"),
+        1000000.0 * (i % 5),
+    });
+  }
+  std::string policy_str =
+      "error \"small hevc\" height in range(0, 720) and "
+      "video_codec_type == \"hvc1\"\n"
+      "error \"pinned\" bitrate_bps > 0 and height in range(2000, 3000)\n"
+      "warn \"hevc\" video_codec_type == \"hvc1\"\n";
+  std::shared_ptr<CompiledPolicy> policy =
+      CompiledPolicy::compile(policy_str, keys);
+  const auto& rules = policy->get_rules();
+  ASSERT_EQ(3, rules.size());
+  EXPECT_EQ(4, policy->get_num_operands());
+
+  // 2. without stats, the cheaper operand (numeric range) goes first
+  EXPECT_EQ(PolicyOpcode::kRange, policy->get_code()[rules[0].begin].opcode);
+  // the predicate shared by the first and last rules has a memo slot
+  const PolicyInstruction& shared =
+      policy->get_code()[rules[2].begin];
+  EXPECT_EQ(PolicyOpcode::kCompare, shared.opcode);
+  EXPECT_LE(0, shared.memo);
+
+  // 3. collect stats
+  std::vector<std::list<std::string>> warn_lists;
+  std::vector<std::list<std::string>> error_lists;
+  for (const auto& vals : vals_list) {
+    std::list<std::string> warn_list;
+    std::list<std::string> error_list;
+    policy->evaluate(vals, &warn_list, &error_list);
+    warn_lists.push_back(warn_list);
+    error_lists.push_back(error_list);
+  }
+  EXPECT_EQ(vals_list.size(), policy->get_evaluations());
+  EXPECT_TRUE(policy->needs_replan());
+  // the range (operand 0) is evaluated for every (sampled) row, the codec
+  // check (operand 1) only when the range matches
+  uint64_t range_evaluations = policy->get_operand_stats(0).evaluations;
+  uint64_t range_matches = policy->get_operand_stats(0).matches;
+  EXPECT_LT(0, range_evaluations);
+  EXPECT_GE(vals_list.size(), range_evaluations);
+  EXPECT_NEAR(0.9, static_cast<double>(range_matches) / range_evaluations,
+              0.05);
+  EXPECT_EQ(range_matches, policy->get_operand_stats(1).evaluations);
+
+  // 4. re-plan: the selective codec check goes first, the operands of the
+  // rule with an ordered comparison (which can throw) stay in place
+  std::shared_ptr<CompiledPolicy> replanned = policy->replan();
+  const auto& replanned_rules = replanned->get_rules();
+  const auto& code = replanned->get_code();
+  EXPECT_EQ(PolicyOpcode::kCompare, code[replanned_rules[0].begin].opcode);
+  EXPECT_EQ(2, code[replanned_rules[0].begin].slot);
+  EXPECT_EQ(PolicyOpcode::kCompare, code[replanned_rules[1].begin].opcode);
+  EXPECT_EQ(3, code[replanned_rules[1].begin].slot);
+  EXPECT_EQ(policy->get_evaluations(), replanned->get_evaluations());
+  EXPECT_FALSE(replanned->needs_replan());
+
+  // 5. the re-planned policy produces the same results
+  for (size_t row = 0; row < vals_list.size(); ++row) {
+    std::list<std::string> warn_list;
+    std::list<std::string> error_list;
+    replanned->evaluate(vals_list[row], &warn_list, &error_list);
+    EXPECT_EQ(warn_lists[row], warn_list) << "row: " << row;
+    EXPECT_EQ(error_lists[row], error_list) << "row: " << row;
+  }
+  std::vector<std::list<std::string>> batch_warn_lists;
+  std::vector<std::list<std::string>> batch_error_lists;
+  replanned->evaluate_batch(vals_list, &batch_warn_lists, &batch_error_lists);
+  EXPECT_EQ(warn_lists, batch_warn_lists);
+  EXPECT_EQ(error_lists, batch_error_lists);
+}
+
+TEST_F(PolicyRunnerTest, TestFirstError) {
+  // 1. set input keys/vals
+  LiblcvmKeyList keys = {"width", "height", "video_codec_type"};
+  LiblcvmValList vals = {1920.0, 1080.0, std::string("hvc1")};
+  std::string policy_str =
+      "version 0.4\n"
+      "error \"narrow\" width < 1000\n"
+      "warn \"hevc\" video_codec_type == \"hvc1\"\n"
+      "error \"tall\" height > 720\n"
+      "error \"wide\" width > 1280\n";
+
+  // 2. only the first matching error rule is reported
+  std::shared_ptr<CompiledPolicy> policy =
+      CompiledPolicy::compile(policy_str, keys);
+  EXPECT_EQ(2, policy->first_error(vals));
+  bool passed;
+  std::string first_error;
+  std::string version;
+  ASSERT_EQ(0, policy_check(policy_str, keys, vals, &passed, &first_error,
+                            &version));
+  EXPECT_FALSE(passed);
+  EXPECT_EQ("tall (height: 1080.000000)", first_error);
+  EXPECT_EQ("0.4", version);
+
+  // 3. warn rules do not fail the check
+  LiblcvmValList small_vals = {1280.0, 720.0, std::string("hvc1")};
+  ASSERT_EQ(0, policy_check(policy_str, keys, small_vals, &passed,
+                            &first_error, &version));
+  EXPECT_TRUE(passed);
+  EXPECT_TRUE(first_error.empty());
+
+  // 4. errors-only evaluation (no warn list) skips the warn rules
+  std::list<std::string> error_list;
+  policy->evaluate(vals, nullptr, &error_list);
+  EXPECT_THAT(error_list, ElementsAre(StrEq("tall (height: 1080.000000)"),
+                                      StrEq("wide (width: 1920.000000)")));
+}
 }  // namespace liblcvm
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <range_reader.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace liblcvm {
+
+class RangeReaderTest : public ::testing::Test {
+ public:
+  RangeReaderTest() {}
+  ~RangeReaderTest() override {}
+
+  void SetUp() override {
+    // 64 KB file (byte i is i % 251)
+    infile = (std::filesystem::temp_directory_path() /
+              "liblcvm_range_reader_test.bin")
+                 .string();
+    contents.resize(64 * 1024);
+    for (size_t i = 0; i < contents.size(); ++i) {
+      contents[i] = i % 251;
+    }
+    FILE* fp = fopen(infile.c_str(), "wb");
+    ASSERT_NE(nullptr, fp);
+    fwrite(contents.data(), 1, contents.size(), fp);
+    fclose(fp);
+  }
+  void TearDown() override { std::filesystem::remove(infile); }
+
+  // @brief Check the data of a range against the file contents.
+  void check_range(const RangeReader& reader, size_t index, uint64_t offset,
+                   uint32_t size) {
+    const uint8_t* data = reader.get_data(index);
+    ASSERT_NE(nullptr, data);
+    EXPECT_EQ(std::vector<uint8_t>(contents.begin() + offset,
+                                   contents.begin() + offset + size),
+              std::vector<uint8_t>(data, data + size));
+  }
+
+  std::string infile;
+  std::vector<uint8_t> contents;
+};
+
+TEST_F(RangeReaderTest, TestCoalesce) {
+  // 1. ranges out of order, with small gaps (a single span)
+  RangeReader reader;
+  size_t a = reader.add(1000, 100);
+  size_t b = reader.add(100, 200);
+  size_t c = reader.add(300, 10);
+  size_t d = reader.add(2000, 256);
+  ASSERT_EQ(0, reader.read(infile.c_str()));
+  check_range(reader, a, 1000, 100);
+  check_range(reader, b, 100, 200);
+  check_range(reader, c, 300, 10);
+  check_range(reader, d, 2000, 256);
+  EXPECT_EQ(1u, reader.get_num_reads());
+  EXPECT_EQ(2256u - 100u, reader.get_read_bytes());
+
+  // 2. no gaps allowed (adjacent ranges are still coalesced)
+  reader.clear();
+  a = reader.add(1000, 100);
+  b = reader.add(100, 200);
+  c = reader.add(300, 10);
+  ASSERT_EQ(0, reader.read(infile.c_str(), 0));
+  check_range(reader, a, 1000, 100);
+  check_range(reader, b, 100, 200);
+  check_range(reader, c, 300, 10);
+  EXPECT_EQ(1u + 2u, reader.get_num_reads());
+  EXPECT_EQ(2156u + 310u, reader.get_read_bytes());
+}
+
+TEST_F(RangeReaderTest, TestOverlapAndEndOfFile) {
+  // 1. overlapping ranges, and ranges past the end of the file
+  RangeReader reader;
+  size_t a = reader.add(500, 100);
+  size_t b = reader.add(550, 100);
+  size_t c = reader.add(64 * 1024 - 10, 10);
+  size_t d = reader.add(64 * 1024 - 10, 20);
+  size_t e = reader.add(1 << 20, 10);
+  ASSERT_EQ(0, reader.read(infile.c_str()));
+  check_range(reader, a, 500, 100);
+  check_range(reader, b, 550, 100);
+  check_range(reader, c, 64 * 1024 - 10, 10);
+  EXPECT_EQ(nullptr, reader.get_data(d));
+  EXPECT_EQ(nullptr, reader.get_data(e));
+  EXPECT_EQ(nullptr, reader.get_data(e + 1));
+
+  // 2. missing file
+  EXPECT_NE(0, reader.read("/nonexistent/file.mp4"));
+}
+}  // namespace liblcvm
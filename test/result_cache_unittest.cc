@@ -0,0 +1,201 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <liblcvm.h>  // for various
+#include <result_cache.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace liblcvm {
+
+class ResultCacheTest : public ::testing::Test {
+ public:
+  ResultCacheTest() {}
+  ~ResultCacheTest() override {}
+
+  void SetUp() override {
+    cache_dir = (std::filesystem::temp_directory_path() /
+                 ("liblcvm_result_cache_" +
+                  std::string(::testing::UnitTest::GetInstance()
+                                  ->current_test_info()
+                                  ->name())))
+                    .string();
+    std::filesystem::remove_all(cache_dir);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(cache_dir); }
+
+  std::string cache_dir;
+};
+
+TEST_F(ResultCacheTest, TestKey) {
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+
+  // 1. the moov hash is stable
+  uint64_t hash1;
+  uint64_t hash2;
+  ASSERT_EQ(0, hash_moov_box(infile.c_str(), &hash1));
+  ASSERT_EQ(0, hash_moov_box(infile.c_str(), &hash2));
+  EXPECT_EQ(hash1, hash2);
+  FileIdentity identity;
+  ASSERT_EQ(0, get_file_identity(infile.c_str(), true, &identity));
+  EXPECT_EQ(hash1, identity.moov_hash);
+  EXPECT_EQ(std::filesystem::file_size(infile), identity.size);
+
+  // 2. the key depends on the configuration
+  LiblcvmConfig config;
+  std::string key1;
+  std::string key2;
+  ASSERT_EQ(0, get_result_cache_key(infile.c_str(), config, &key1));
+  ASSERT_EQ(0, get_result_cache_key(infile.c_str(), config, &key2));
+  EXPECT_EQ(key1, key2);
+  config.set_sort_by_pts(false);
+  ASSERT_EQ(0, get_result_cache_key(infile.c_str(), config, &key2));
+  EXPECT_NE(key1, key2);
+
+  // 3. missing files have no key
+  EXPECT_NE(0, get_result_cache_key("/nonexistent/file.mp4", config, &key1));
+}
+
+TEST_F(ResultCacheTest, TestLookupInsert) {
+  LiblcvmKeyList keys = {"infile", "width", "num", "big", "bitrate_bps"};
+  LiblcvmValList vals = {std::string("a.mp4"), 1920, 7u, 1234567890123L,
+                         13455.737704918032};
+  LiblcvmKeyList keys_timing = {"frame_num_orig", "stts", "ctts", "dts",
+                                "pts", "pts_duration", "pts_duration_delta",
+                                "pts_framerate"};
+  LiblcvmTimingList vals_timing = {
+      {0, 512, -512, 0.0, 0.033, 0.033, 0.0, 30.0},
+      {1, 512, 0, 0.033, 0.066, 0.033, 0.0, 30.0},
+  };
+
+  // 1. store two results (one with timing lists)
+  std::shared_ptr<ResultCache> cache = ResultCache::get(cache_dir);
+  ASSERT_NE(nullptr, cache);
+  EXPECT_EQ(cache, ResultCache::get(cache_dir));
+  ASSERT_EQ(0, cache->insert("key1", false, keys, vals, {}, {}));
+  ASSERT_EQ(0,
+            cache->insert("key2", true, keys, vals, keys_timing, vals_timing));
+  EXPECT_EQ(2, cache->size());
+
+  // 2. look them up
+  LiblcvmKeyList out_keys;
+  LiblcvmValList out_vals;
+  LiblcvmKeyList out_keys_timing;
+  LiblcvmTimingList out_vals_timing;
+  EXPECT_FALSE(cache->lookup("key3", false, &out_keys, &out_vals,
+                             &out_keys_timing, &out_vals_timing));
+  // key1 has no timing lists
+  EXPECT_FALSE(cache->lookup("key1", true, &out_keys, &out_vals,
+                             &out_keys_timing, &out_vals_timing));
+  ASSERT_TRUE(cache->lookup("key1", false, &out_keys, &out_vals,
+                            &out_keys_timing, &out_vals_timing));
+  EXPECT_EQ(keys, out_keys);
+  EXPECT_EQ(vals, out_vals);
+  EXPECT_TRUE(out_vals_timing.empty());
+  ASSERT_TRUE(cache->lookup("key2", true, &out_keys, &out_vals,
+                            &out_keys_timing, &out_vals_timing));
+  EXPECT_EQ(vals, out_vals);
+  EXPECT_EQ(keys_timing, out_keys_timing);
+  EXPECT_EQ(vals_timing, out_vals_timing);
+
+  // 3. later records replace earlier ones
+  LiblcvmValList new_vals = vals;
+  new_vals[1] = 1280;
+  ASSERT_EQ(0, cache->insert("key1", false, keys, new_vals, {}, {}));
+  ASSERT_TRUE(cache->lookup("key1", false, &out_keys, &out_vals,
+                            &out_keys_timing, &out_vals_timing));
+  EXPECT_EQ(new_vals, out_vals);
+}
+
+TEST_F(ResultCacheTest, TestTornLog) {
+  LiblcvmKeyList keys = {"infile", "width"};
+  LiblcvmValList vals = {std::string("a.mp4"), 1920};
+
+  // 1. write a log with one record, followed by a torn record
+  std::filesystem::create_directories(cache_dir);
+  std::string other_dir = cache_dir + "/writer";
+  {
+    std::shared_ptr<ResultCache> writer = ResultCache::get(other_dir);
+    ASSERT_NE(nullptr, writer);
+    ASSERT_EQ(0, writer->insert("key1", false, keys, vals, {}, {}));
+  }
+  std::string log = other_dir + "/results.lcvmcache";
+  std::string good_log;
+  {
+    std::ifstream in(log, std::ios::binary);
+    good_log.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+  }
+  std::string reader_dir = cache_dir + "/reader";
+  std::filesystem::create_directories(reader_dir);
+  {
+    std::ofstream out(reader_dir + "/results.lcvmcache", std::ios::binary);
+    out << good_log << good_log.substr(0, good_log.size() / 2);
+  }
+
+  // 2. the torn record is dropped, and new records are readable
+  std::shared_ptr<ResultCache> cache = ResultCache::get(reader_dir);
+  ASSERT_NE(nullptr, cache);
+  EXPECT_EQ(1, cache->size());
+  EXPECT_EQ(good_log.size(),
+            std::filesystem::file_size(reader_dir + "/results.lcvmcache"));
+  ASSERT_EQ(0, cache->insert("key2", false, keys, vals, {}, {}));
+  LiblcvmKeyList out_keys;
+  LiblcvmValList out_vals;
+  LiblcvmKeyList out_keys_timing;
+  LiblcvmTimingList out_vals_timing;
+  EXPECT_TRUE(cache->lookup("key2", false, &out_keys, &out_vals,
+                            &out_keys_timing, &out_vals_timing));
+  EXPECT_EQ(vals, out_vals);
+}
+
+TEST_F(ResultCacheTest, TestParseToLists) {
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+  LiblcvmConfig liblcvm_config;
+  liblcvm_config.set_cache_dir(cache_dir);
+
+  // 1. parse the file (fills up the cache)
+  LiblcvmKeyList keys;
+  LiblcvmValList vals;
+  LiblcvmKeyList keys_timing;
+  LiblcvmTimingList vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &keys, &vals, true,
+                   &keys_timing, &vals_timing));
+  std::shared_ptr<ResultCache> cache = ResultCache::get(cache_dir);
+  ASSERT_NE(nullptr, cache);
+  EXPECT_EQ(1, cache->size());
+
+  // 2. parse it again (cache hits, with and without timing lists)
+  LiblcvmKeyList cached_keys;
+  LiblcvmValList cached_vals;
+  LiblcvmKeyList cached_keys_timing;
+  LiblcvmTimingList cached_vals_timing;
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &cached_keys, &cached_vals,
+                   true, &cached_keys_timing, &cached_vals_timing));
+  EXPECT_EQ(keys, cached_keys);
+  EXPECT_EQ(vals, cached_vals);
+  EXPECT_EQ(keys_timing, cached_keys_timing);
+  EXPECT_EQ(vals_timing, cached_vals_timing);
+  ASSERT_EQ(0, IsobmffFileInformation::parse_to_lists(
+                   infile.c_str(), liblcvm_config, &cached_keys, &cached_vals,
+                   false, &cached_keys_timing, &cached_vals_timing));
+  EXPECT_EQ(vals, cached_vals);
+  EXPECT_TRUE(cached_vals_timing.empty());
+  EXPECT_EQ(1, cache->size());
+
+  // 3. the cache schema uses the same keys as the parsed lists
+  LiblcvmKeyList schema_keys;
+  LiblcvmKeyList schema_keys_timing;
+  IsobmffFileInformation::get_key_lists(&schema_keys, &schema_keys_timing);
+  EXPECT_EQ(keys, schema_keys);
+  EXPECT_EQ(keys_timing, schema_keys_timing);
+}
+}  // namespace liblcvm
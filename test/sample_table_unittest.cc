@@ -0,0 +1,287 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <sample_table.h>
+
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace liblcvm {
+
+class SampleTableTest : public ::testing::Test {
+ public:
+  SampleTableTest() {}
+  ~SampleTableTest() override {}
+};
+
+TEST_F(SampleTableTest, TestStsz) {
+  // 1. uniform size (no per-sample table)
+  SampleSizeTable table;
+  const uint8_t stsz_uniform[] = {0, 0, 0, 0, 0, 0, 0x01, 0x00,
+                                  0, 0, 0x10, 0};
+  ASSERT_EQ(0, table.parse_stsz(stsz_uniform, sizeof(stsz_uniform)));
+  EXPECT_EQ(4096u, table.get_sample_count());
+  EXPECT_EQ(256u, table.get_uniform_size());
+  EXPECT_EQ(256u, table.get_sample_size(4095));
+  EXPECT_EQ(4096u * 256u, table.get_total_size());
+
+  // 2. per-sample sizes
+  const uint8_t stsz[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3,
+                          0, 0, 0, 10, 0, 1, 0, 0, 0, 0, 0, 7};
+  ASSERT_EQ(0, table.parse_stsz(stsz, sizeof(stsz)));
+  EXPECT_EQ(3u, table.get_sample_count());
+  EXPECT_EQ(0u, table.get_uniform_size());
+  EXPECT_EQ(10u, table.get_sample_size(0));
+  EXPECT_EQ(65536u, table.get_sample_size(1));
+  EXPECT_EQ(7u, table.get_sample_size(2));
+  EXPECT_EQ(65553u, table.get_total_size());
+
+  // 3. truncated table
+  EXPECT_NE(0, table.parse_stsz(stsz, sizeof(stsz) - 1));
+  EXPECT_NE(0, table.parse_stsz(stsz, 8));
+}
+
+TEST_F(SampleTableTest, TestStz2) {
+  SampleSizeTable table;
+  // 1. 4-bit fields (odd number of samples)
+  const uint8_t stz2_4[] = {0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 3, 0x12, 0xf0};
+  ASSERT_EQ(0, table.parse_stz2(stz2_4, sizeof(stz2_4)));
+  EXPECT_EQ(3u, table.get_sample_count());
+  EXPECT_EQ(1u, table.get_sample_size(0));
+  EXPECT_EQ(2u, table.get_sample_size(1));
+  EXPECT_EQ(15u, table.get_sample_size(2));
+  EXPECT_EQ(18u, table.get_total_size());
+
+  // 2. 8-bit fields
+  const uint8_t stz2_8[] = {0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 2, 200, 100};
+  ASSERT_EQ(0, table.parse_stz2(stz2_8, sizeof(stz2_8)));
+  EXPECT_EQ(2u, table.get_sample_count());
+  EXPECT_EQ(200u, table.get_sample_size(0));
+  EXPECT_EQ(300u, table.get_total_size());
+
+  // 3. 16-bit fields
+  const uint8_t stz2_16[] = {0, 0, 0, 0, 0,    0,    0, 16,
+                             0, 0, 0, 1, 0x12, 0x34};
+  ASSERT_EQ(0, table.parse_stz2(stz2_16, sizeof(stz2_16)));
+  EXPECT_EQ(0x1234u, table.get_sample_size(0));
+
+  // 4. invalid field size, and truncated table
+  const uint8_t stz2_bad[] = {0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 0};
+  EXPECT_NE(0, table.parse_stz2(stz2_bad, sizeof(stz2_bad)));
+  EXPECT_NE(0, table.parse_stz2(stz2_16, sizeof(stz2_16) - 1));
+}
+
+TEST_F(SampleTableTest, TestChunkOffsetIndex) {
+  // 1. 4 samples of 100 bytes in 3 chunks (2 + 0 + 2 samples), with 64-bit
+  // chunk offsets
+  SampleSizeTable sizes;
+  const uint8_t stsz[] = {0, 0, 0, 0, 0, 0, 0, 100, 0, 0, 0, 4};
+  ASSERT_EQ(0, sizes.parse_stsz(stsz, sizeof(stsz)));
+  const uint8_t stsc[] = {0, 0, 0, 0, 0, 0, 0, 3,  // entry_count
+                          0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1,
+                          0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 1,
+                          0, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0, 1};
+  const uint8_t co64[] = {0, 0, 0, 0, 0, 0, 0, 3,  // entry_count
+                          0, 0, 0, 1, 0, 0, 0, 0,  //
+                          0, 0, 0, 2, 0, 0, 0, 0,  //
+                          0, 0, 0, 3, 0, 0, 0, 0};
+  ChunkOffsetIndex index;
+  ASSERT_EQ(0, index.build(stsc, sizeof(stsc), co64, sizeof(co64), true));
+  EXPECT_EQ(4u, index.get_sample_count());
+  uint64_t offset;
+  ASSERT_EQ(0, index.get_sample_offset(0, sizes, &offset));
+  EXPECT_EQ(0x100000000u, offset);
+  ASSERT_EQ(0, index.get_sample_offset(1, sizes, &offset));
+  EXPECT_EQ(0x100000000u + 100, offset);
+  ASSERT_EQ(0, index.get_sample_offset(2, sizes, &offset));
+  EXPECT_EQ(0x300000000u, offset);
+  ASSERT_EQ(0, index.get_sample_offset(3, sizes, &offset));
+  EXPECT_EQ(0x300000000u + 100, offset);
+  EXPECT_NE(0, index.get_sample_offset(4, sizes, &offset));
+
+  // 2. walk the samples in order (skipping the empty chunk)
+  std::vector<uint64_t> offset_list;
+  ASSERT_EQ(0, index.for_each_sample_offset(
+                   sizes, [&](uint32_t sample_index, uint64_t sample_offset) {
+                     EXPECT_EQ(offset_list.size(), sample_index);
+                     offset_list.push_back(sample_offset);
+                     return 0;
+                   }));
+  EXPECT_THAT(offset_list,
+              ::testing::ElementsAre(0x100000000u, 0x100000000u + 100,
+                                     0x300000000u, 0x300000000u + 100));
+  // a non-zero callback return value stops the walk
+  offset_list.clear();
+  EXPECT_EQ(-2, index.for_each_sample_offset(
+                    sizes, [&](uint32_t sample_index, uint64_t sample_offset) {
+                      offset_list.push_back(sample_offset);
+                      return (sample_index == 1) ? -2 : 0;
+                    }));
+  EXPECT_EQ(2u, offset_list.size());
+
+  // 3. invalid tables
+  const uint8_t stsc_bad[] = {0, 0, 0, 0, 0, 0, 0, 1,
+                              0, 0, 0, 2, 0, 0, 0, 2, 0, 0, 0, 1};
+  EXPECT_NE(0, index.build(stsc_bad, sizeof(stsc_bad), co64, sizeof(co64),
+                           true));
+  EXPECT_NE(0, index.build(stsc, sizeof(stsc), co64, sizeof(co64) - 1, true));
+  EXPECT_NE(0, index.build(stsc, sizeof(stsc) - 1, co64, sizeof(co64), true));
+}
+
+TEST_F(SampleTableTest, TestTimingTables) {
+  // 1. stts: 2 samples of 10, and 1 sample of 20
+  const uint8_t stts[] = {0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 2,
+                          0, 0, 0, 10, 0, 0, 0, 1, 0, 0, 0, 20};
+  std::vector<uint32_t> sample_delta_list;
+  ASSERT_EQ(0, decode_stts(stts, sizeof(stts), 3, &sample_delta_list));
+  EXPECT_THAT(sample_delta_list, ::testing::ElementsAre(10, 10, 20));
+  EXPECT_NE(0, decode_stts(stts, sizeof(stts) - 1, 3, &sample_delta_list));
+  // more samples than the track has
+  EXPECT_NE(0, decode_stts(stts, sizeof(stts), 2, &sample_delta_list));
+
+  // 2. ctts (version 1): 2 samples of 5, and 1 sample of -3
+  const uint8_t ctts[] = {1, 0, 0, 0, 0, 0, 0, 2, 0,    0,    0,    2,
+                          0, 0, 0, 5, 0, 0, 0, 1, 0xff, 0xff, 0xff, 0xfd};
+  std::vector<int32_t> sample_offset_list;
+  int32_t last_sample_offset;
+  ASSERT_EQ(0, decode_ctts(ctts, sizeof(ctts), 3, &sample_offset_list,
+                           &last_sample_offset));
+  EXPECT_THAT(sample_offset_list, ::testing::ElementsAre(5, 5, -3));
+  EXPECT_EQ(-3, last_sample_offset);
+  EXPECT_NE(0,
+            decode_ctts(ctts, 7, 3, &sample_offset_list, &last_sample_offset));
+  EXPECT_NE(0, decode_ctts(ctts, sizeof(ctts), 2, &sample_offset_list,
+                           &last_sample_offset));
+
+  // 3. stss
+  const uint8_t stss[] = {0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 1,
+                          0, 0, 0, 61, 0, 1, 0, 0};
+  std::vector<uint32_t> sample_number_list;
+  ASSERT_EQ(0, decode_stss(stss, sizeof(stss), &sample_number_list));
+  EXPECT_THAT(sample_number_list, ::testing::ElementsAre(1, 61, 65536));
+  EXPECT_NE(0, decode_stss(stss, sizeof(stss) - 4, &sample_number_list));
+
+  // 4. count the tables without decoding them
+  TimingTableView tables;
+  tables.stts = stts;
+  tables.stts_size = sizeof(stts);
+  tables.ctts = ctts;
+  tables.ctts_size = sizeof(ctts);
+  tables.stss = stss;
+  tables.stss_size = sizeof(stss);
+  TimingTableCounts counts;
+  ASSERT_EQ(0, count_timing_tables(tables, &counts));
+  EXPECT_EQ(7u, counts.num_entries);
+  EXPECT_EQ(3u, counts.num_samples);
+  tables.stts_size = sizeof(stts) - 1;
+  EXPECT_NE(0, count_timing_tables(tables, &counts));
+
+  // 5. huge sample counts are counted, not allocated
+  const uint8_t huge_stts[] = {0,    0,    0,    0,    0,    0,    0,    2,
+                               0xff, 0xff, 0xff, 0xff, 0,    0,    0,    1,
+                               0xff, 0xff, 0xff, 0xff, 0,    0,    0,    1};
+  TimingTableView huge_tables;
+  huge_tables.stts = huge_stts;
+  huge_tables.stts_size = sizeof(huge_stts);
+  ASSERT_EQ(0, count_timing_tables(huge_tables, &counts));
+  EXPECT_EQ(2u, counts.num_entries);
+  EXPECT_EQ(2 * 0xffffffffull, counts.num_samples);
+  EXPECT_NE(0, decode_stts(huge_stts, sizeof(huge_stts), 0xffffffffull,
+                           &sample_delta_list));
+
+  // 6. decoding huge sample counts stops with the analysis
+  auto token = std::make_shared<CancellationToken>();
+  token->cancel();
+  AnalysisControl control(token, 0);
+  EXPECT_EQ(kAnalysisCancelled,
+            decode_stts(huge_stts, sizeof(huge_stts), UINT64_MAX,
+                        &sample_delta_list, &control));
+  EXPECT_EQ(0u, sample_delta_list.size());
+}
+
+TEST_F(SampleTableTest, TestMediaFile) {
+  std::string infile = std::string(TEST_MEDIA_DIR) + "/MOV1.MOV";
+
+  // 1. read the video track sample sizes
+  SampleTable table;
+  ASSERT_EQ(0, read_video_sample_table(infile.c_str(), &table));
+  EXPECT_EQ(634u, table.sizes.get_sample_count());
+  EXPECT_EQ(0u, table.sizes.get_uniform_size());
+  EXPECT_EQ(168203u, table.sizes.get_sample_size(0));
+  EXPECT_EQ(119912u, table.sizes.get_sample_size(1));
+  EXPECT_EQ(15740872u, table.sizes.get_total_size());
+
+  // 2. look up sample offsets (stsc runs of 30, 42, and 22 samples per
+  // chunk)
+  uint64_t offset;
+  ASSERT_EQ(0, table.get_sample_offset(0, &offset));
+  EXPECT_EQ(25187u, offset);
+  ASSERT_EQ(0, table.get_sample_offset(1, &offset));
+  EXPECT_EQ(25187u + 168203u, offset);
+  ASSERT_EQ(0, table.get_sample_offset(29, &offset));
+  EXPECT_EQ(1016537u, offset);
+  ASSERT_EQ(0, table.get_sample_offset(30, &offset));
+  EXPECT_EQ(1057685u, offset);
+  ASSERT_EQ(0, table.get_sample_offset(600, &offset));
+  EXPECT_EQ(14856908u, offset);
+  ASSERT_EQ(0, table.get_sample_offset(633, &offset));
+  EXPECT_EQ(15697297u, offset);
+  EXPECT_NE(0, table.get_sample_offset(634, &offset));
+  // the in-order walk matches the lookups
+  uint32_t num_walked = 0;
+  ASSERT_EQ(0, table.for_each_sample_offset(
+                   [&](uint32_t sample_index, uint64_t sample_offset) {
+                     uint64_t expected_offset;
+                     EXPECT_EQ(0, table.get_sample_offset(sample_index,
+                                                          &expected_offset));
+                     EXPECT_EQ(expected_offset, sample_offset);
+                     ++num_walked;
+                     return 0;
+                   }));
+  EXPECT_EQ(634u, num_walked);
+
+  // 3. decode the timing tables in place (634 samples of ~10 units, and a
+  // keyframe every 60 samples)
+  std::vector<uint8_t> moov;
+  ASSERT_EQ(0, read_moov_box(infile.c_str(), &moov));
+  std::vector<TimingTableView> timing_tables;
+  ASSERT_EQ(0, find_video_timing_tables(moov.data(), moov.size(),
+                                        &timing_tables));
+  ASSERT_EQ(1u, timing_tables.size());
+  ASSERT_NE(nullptr, timing_tables[0].stts);
+  EXPECT_EQ(634u, timing_tables[0].sample_count);
+  std::vector<uint32_t> sample_delta_list;
+  ASSERT_EQ(0, decode_stts(timing_tables[0].stts, timing_tables[0].stts_size,
+                           timing_tables[0].sample_count, &sample_delta_list));
+  ASSERT_EQ(634u, sample_delta_list.size());
+  EXPECT_EQ(10u, sample_delta_list[0]);
+  // dts of the last sample
+  EXPECT_EQ(6334u, std::accumulate(sample_delta_list.begin(),
+                                   sample_delta_list.end() - 1, 0u));
+  ASSERT_NE(nullptr, timing_tables[0].stss);
+  std::vector<uint32_t> sample_number_list;
+  ASSERT_EQ(0, decode_stss(timing_tables[0].stss, timing_tables[0].stss_size,
+                           &sample_number_list));
+  EXPECT_THAT(sample_number_list,
+              ::testing::ElementsAre(1, 61, 121, 181, 241, 301, 361, 421, 481,
+                                     541, 601));
+  TimingTableCounts counts;
+  ASSERT_EQ(0, count_timing_tables(timing_tables[0], &counts));
+  EXPECT_EQ(634u, counts.num_samples);
+
+  // 4. a truncated moov box has no sample tables
+  EXPECT_NE(0, parse_video_sample_table(moov.data(), moov.size() / 2, &table));
+  EXPECT_NE(0, read_video_sample_table("/nonexistent/file.mp4", &table));
+
+  // 5. the metadata size of a non-fragmented file is its moov box size
+  uint64_t metadata_size = 0;
+  ASSERT_EQ(0, get_metadata_box_size(infile.c_str(), &metadata_size));
+  EXPECT_EQ(moov.size(), metadata_size);
+  EXPECT_NE(0, get_metadata_box_size("/nonexistent/file.mp4", &metadata_size));
+}
+}  // namespace liblcvm
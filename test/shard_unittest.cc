@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <shard.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace liblcvm {
+
+class ShardTest : public ::testing::Test {
+ public:
+  ShardTest() {}
+  ~ShardTest() override {}
+};
+
+TEST_F(ShardTest, TestShardSpec) {
+  int shard_index = -1;
+  int num_shards = -1;
+  ASSERT_EQ(0, parse_shard_spec("3/8", &shard_index, &num_shards));
+  EXPECT_EQ(3, shard_index);
+  EXPECT_EQ(8, num_shards);
+  ASSERT_EQ(0, parse_shard_spec("0/1", &shard_index, &num_shards));
+  EXPECT_EQ(0, shard_index);
+  EXPECT_EQ(1, num_shards);
+  EXPECT_NE(0, parse_shard_spec("8/8", &shard_index, &num_shards));
+  EXPECT_NE(0, parse_shard_spec("-1/8", &shard_index, &num_shards));
+  EXPECT_NE(0, parse_shard_spec("0/0", &shard_index, &num_shards));
+  EXPECT_NE(0, parse_shard_spec("1", &shard_index, &num_shards));
+  EXPECT_NE(0, parse_shard_spec("1/2x", &shard_index, &num_shards));
+}
+
+TEST_F(ShardTest, TestShardFiles) {
+  // 1. the hash is stable (FNV-1a)
+  EXPECT_EQ(0xcbf29ce484222325ULL, get_shard_hash(""));
+  EXPECT_EQ(0xaf63dc4c8601ec8cULL, get_shard_hash("a"));
+
+  // 2. the shards partition the files
+  std::vector<std::string> infile_list;
+  for (int i = 0; i < 1000; ++i) {
+    infile_list.push_back("/data/file" + std::to_string(i) + ".mp4");
+  }
+  std::vector<std::string> all_files;
+  for (int shard_index = 0; shard_index < 4; ++shard_index) {
+    std::vector<std::string> shard_files =
+        get_shard_files(infile_list, shard_index, 4);
+    // roughly balanced
+    EXPECT_GT(shard_files.size(), 150);
+    all_files.insert(all_files.end(), shard_files.begin(), shard_files.end());
+  }
+  EXPECT_THAT(all_files, ::testing::UnorderedElementsAreArray(infile_list));
+}
+
+TEST_F(ShardTest, TestCheckpoint) {
+  std::filesystem::path checkpoint_file =
+      std::filesystem::path(testing::TempDir()) / "lcvm_shard.checkpoint";
+  std::filesystem::remove(checkpoint_file);
+
+  // 1. a new checkpoint is empty
+  uint64_t output_size = 1;
+  {
+    ShardCheckpoint checkpoint;
+    ASSERT_EQ(0, checkpoint.open(checkpoint_file.string(), 0, &output_size));
+    EXPECT_EQ(0, output_size);
+    EXPECT_EQ(0, checkpoint.size());
+    ASSERT_EQ(0, checkpoint.add("/data/a.mp4", 100));
+    ASSERT_EQ(0, checkpoint.add("/data/new\nline.mp4", 150));
+    ASSERT_EQ(0, checkpoint.add("/data/c.mp4", 200));
+  }
+
+  // 2. a torn last line is dropped
+  FILE* fp = fopen(checkpoint_file.string().c_str(), "ab");
+  ASSERT_NE(nullptr, fp);
+  fputs("250 /data/d.mp", fp);
+  fclose(fp);
+  {
+    ShardCheckpoint checkpoint;
+    ASSERT_EQ(0, checkpoint.open(checkpoint_file.string(), 300, &output_size));
+    EXPECT_EQ(200, output_size);
+    EXPECT_EQ(3, checkpoint.size());
+    EXPECT_TRUE(checkpoint.is_done("/data/a.mp4"));
+    EXPECT_TRUE(checkpoint.is_done("/data/new\nline.mp4"));
+    EXPECT_FALSE(checkpoint.is_done("/data/d.mp4"));
+    ASSERT_EQ(0, checkpoint.add("/data/d.mp4", 250));
+  }
+
+  // 3. lines past the output file size are dropped
+  {
+    ShardCheckpoint checkpoint;
+    ASSERT_EQ(0, checkpoint.open(checkpoint_file.string(), 180, &output_size));
+    EXPECT_EQ(150, output_size);
+    EXPECT_EQ(2, checkpoint.size());
+    EXPECT_FALSE(checkpoint.is_done("/data/c.mp4"));
+  }
+  {
+    ShardCheckpoint checkpoint;
+    ASSERT_EQ(0, checkpoint.open(checkpoint_file.string(), 300, &output_size));
+    EXPECT_EQ(150, output_size);
+  }
+  std::filesystem::remove(checkpoint_file);
+}
+}  // namespace liblcvm
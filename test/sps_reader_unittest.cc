@@ -0,0 +1,641 @@
+/*
+ *  Copyright (c) Meta Platforms, Inc. and its affiliates.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <h264_bitstream_parser.h>
+#include <h264_common.h>
+#include <h264_nal_unit_parser.h>
+#include <h265_bitstream_parser.h>
+#include <h265_common.h>
+#include <h265_nal_unit_parser.h>
+#include <sps_reader.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+// Bit writer used to build synthetic SPS NAL units.
+class BitWriter {
+ public:
+  void write_bits(uint32_t value, int num_bits) {
+    for (int i = num_bits - 1; i >= 0; i--) {
+      bits.push_back((value >> i) & 0x01);
+    }
+  }
+
+  void write_ue(uint32_t value) {
+    uint64_t code = static_cast<uint64_t>(value) + 1;
+    int num_bits = 0;
+    while ((code >> num_bits) > 1) {
+      num_bits++;
+    }
+    write_bits(0, num_bits);
+    write_bits(static_cast<uint32_t>(code), num_bits + 1);
+  }
+
+  void write_se(int32_t value) {
+    write_ue((value > 0) ? (2 * value - 1) : (-2 * value));
+  }
+
+  // @brief Get the NAL unit: the header, followed by the RBSP (with the
+  // trailing bits) after adding the emulation prevention bytes.
+  std::vector<uint8_t> get_nal_unit(const std::vector<uint8_t>& header) {
+    // rbsp_trailing_bits()
+    bits.push_back(true);
+    while (bits.size() % 8 != 0) {
+      bits.push_back(false);
+    }
+    std::vector<uint8_t> nal_unit = header;
+    int zeros = 0;
+    for (size_t i = 0; i < bits.size(); i += 8) {
+      uint8_t byte = 0;
+      for (size_t j = 0; j < 8; j++) {
+        byte = (byte << 1) | bits[i + j];
+      }
+      if ((zeros >= 2) && (byte <= 0x03)) {
+        nal_unit.push_back(0x03);
+        zeros = 0;
+      }
+      nal_unit.push_back(byte);
+      zeros = (byte == 0) ? zeros + 1 : 0;
+    }
+    return nal_unit;
+  }
+
+ private:
+  std::vector<bool> bits;
+};
+
+bool has_emulation_prevention(const std::vector<uint8_t>& nal_unit) {
+  for (size_t i = 2; i < nal_unit.size(); i++) {
+    if ((nal_unit[i - 2] == 0) && (nal_unit[i - 1] == 0) &&
+        (nal_unit[i] == 0x03)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Write a VUI (with everything after the video signal type disabled), and
+// set the colour fields of the expected SPS fields.
+void write_vui(std::mt19937* gen, BitWriter* writer, SpsInfo* expected) {
+  std::uniform_int_distribution<uint32_t> bit(0, 1);
+  std::uniform_int_distribution<uint32_t> byte(0, 255);
+  // aspect_ratio_info_present_flag
+  if (bit(*gen)) {
+    writer->write_bits(1, 1);
+    uint32_t aspect_ratio_idc = bit(*gen) ? 255 : byte(*gen) % 17;
+    writer->write_bits(aspect_ratio_idc, 8);
+    if (aspect_ratio_idc == 255) {
+      // sar_width, sar_height (zero, to get emulation prevention bytes)
+      writer->write_bits(0, 16);
+      writer->write_bits(bit(*gen), 16);
+    }
+  } else {
+    writer->write_bits(0, 1);
+  }
+  // overscan_info_present_flag
+  if (bit(*gen)) {
+    writer->write_bits(1, 1);
+    writer->write_bits(bit(*gen), 1);
+  } else {
+    writer->write_bits(0, 1);
+  }
+  // video_signal_type_present_flag
+  if (bit(*gen)) {
+    writer->write_bits(1, 1);
+    // video_format
+    writer->write_bits(5, 3);
+    uint32_t video_full_range_flag = bit(*gen);
+    writer->write_bits(video_full_range_flag, 1);
+    // colour_description_present_flag
+    if (bit(*gen)) {
+      writer->write_bits(1, 1);
+      expected->colour_primaries = byte(*gen) % 13;
+      expected->transfer_characteristics = byte(*gen) % 19;
+      expected->matrix_coeffs = byte(*gen) % 15;
+      expected->video_full_range_flag = video_full_range_flag;
+      writer->write_bits(expected->colour_primaries, 8);
+      writer->write_bits(expected->transfer_characteristics, 8);
+      writer->write_bits(expected->matrix_coeffs, 8);
+    } else {
+      writer->write_bits(0, 1);
+    }
+  } else {
+    writer->write_bits(0, 1);
+  }
+}
+
+// Write a random H.264 SPS NAL unit.
+std::vector<uint8_t> write_h264_sps(std::mt19937* gen, SpsInfo* expected) {
+  const uint32_t profile_list[] = {66, 77, 88, 100, 110, 122, 244, 44};
+  std::uniform_int_distribution<uint32_t> bit(0, 1);
+  std::uniform_int_distribution<uint32_t> value(0, 255);
+  BitWriter writer;
+  *expected = SpsInfo();
+  uint32_t profile_idc = profile_list[value(*gen) % 8];
+  expected->profile_idc = profile_idc;
+  expected->level_idc = 10 + value(*gen) % 43;
+  writer.write_bits(profile_idc, 8);
+  // constraint_set0_flag..constraint_set5_flag, reserved_zero_2bits
+  writer.write_bits(value(*gen) & 0xfc, 8);
+  writer.write_bits(expected->level_idc, 8);
+  // seq_parameter_set_id
+  writer.write_ue(value(*gen) % 32);
+  if ((profile_idc == 100) || (profile_idc == 110) || (profile_idc == 122) ||
+      (profile_idc == 244) || (profile_idc == 44)) {
+    uint32_t chroma_format_idc = (profile_idc == 244) ? value(*gen) % 4 : 1;
+    writer.write_ue(chroma_format_idc);
+    if (chroma_format_idc == 3) {
+      // separate_colour_plane_flag
+      writer.write_bits(0, 1);
+    }
+    // bit_depth_luma_minus8, bit_depth_chroma_minus8,
+    // qpprime_y_zero_transform_bypass_flag
+    writer.write_ue(value(*gen) % 3);
+    writer.write_ue(value(*gen) % 3);
+    writer.write_bits(0, 1);
+    // seq_scaling_matrix_present_flag
+    uint32_t seq_scaling_matrix_present_flag = bit(*gen);
+    writer.write_bits(seq_scaling_matrix_present_flag, 1);
+    if (seq_scaling_matrix_present_flag) {
+      int num_lists = (chroma_format_idc != 3) ? 8 : 12;
+      for (int i = 0; i < num_lists; i++) {
+        uint32_t seq_scaling_list_present_flag = bit(*gen);
+        writer.write_bits(seq_scaling_list_present_flag, 1);
+        if (!seq_scaling_list_present_flag) {
+          continue;
+        }
+        int32_t last_scale = 8;
+        int32_t next_scale = 8;
+        for (int j = 0; j < ((i < 6) ? 16 : 64); j++) {
+          if (next_scale != 0) {
+            int32_t delta_scale = static_cast<int32_t>(value(*gen) % 17) - 8;
+            writer.write_se(delta_scale);
+            next_scale = (last_scale + delta_scale + 256) % 256;
+          }
+          last_scale = (next_scale == 0) ? last_scale : next_scale;
+        }
+      }
+    }
+  }
+  // log2_max_frame_num_minus4
+  writer.write_ue(value(*gen) % 13);
+  uint32_t pic_order_cnt_type = value(*gen) % 3;
+  writer.write_ue(pic_order_cnt_type);
+  if (pic_order_cnt_type == 0) {
+    // log2_max_pic_order_cnt_lsb_minus4
+    writer.write_ue(value(*gen) % 13);
+  } else if (pic_order_cnt_type == 1) {
+    // delta_pic_order_always_zero_flag, offset_for_non_ref_pic,
+    // offset_for_top_to_bottom_field, num_ref_frames_in_pic_order_cnt_cycle,
+    // offset_for_ref_frame
+    writer.write_bits(bit(*gen), 1);
+    writer.write_se(static_cast<int32_t>(value(*gen)) - 128);
+    writer.write_se(static_cast<int32_t>(value(*gen)) - 128);
+    uint32_t num_ref_frames_in_pic_order_cnt_cycle = value(*gen) % 4;
+    writer.write_ue(num_ref_frames_in_pic_order_cnt_cycle);
+    for (uint32_t i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; i++) {
+      writer.write_se(static_cast<int32_t>(value(*gen)) - 128);
+    }
+  }
+  // max_num_ref_frames, gaps_in_frame_num_value_allowed_flag,
+  // pic_width_in_mbs_minus1, pic_height_in_map_units_minus1
+  writer.write_ue(value(*gen) % 5);
+  writer.write_bits(0, 1);
+  writer.write_ue(value(*gen) % 120);
+  writer.write_ue(value(*gen) % 68);
+  // frame_mbs_only_flag
+  uint32_t frame_mbs_only_flag = bit(*gen);
+  writer.write_bits(frame_mbs_only_flag, 1);
+  if (!frame_mbs_only_flag) {
+    // mb_adaptive_frame_field_flag
+    writer.write_bits(bit(*gen), 1);
+  }
+  // direct_8x8_inference_flag
+  writer.write_bits(1, 1);
+  // frame_cropping_flag
+  uint32_t frame_cropping_flag = bit(*gen);
+  writer.write_bits(frame_cropping_flag, 1);
+  if (frame_cropping_flag) {
+    writer.write_ue(0);
+    writer.write_ue(value(*gen) % 8);
+    writer.write_ue(0);
+    writer.write_ue(value(*gen) % 8);
+  }
+  // vui_parameters_present_flag
+  uint32_t vui_parameters_present_flag = bit(*gen);
+  writer.write_bits(vui_parameters_present_flag, 1);
+  if (vui_parameters_present_flag) {
+    write_vui(gen, &writer, expected);
+    // chroma_loc_info_present_flag, timing_info_present_flag,
+    // nal_hrd_parameters_present_flag, vcl_hrd_parameters_present_flag,
+    // pic_struct_present_flag, bitstream_restriction_flag
+    writer.write_bits(0, 6);
+  }
+  return writer.get_nal_unit({0x67});
+}
+
+// Write a random H.265 SPS NAL unit.
+std::vector<uint8_t> write_h265_sps(std::mt19937* gen, SpsInfo* expected) {
+  std::uniform_int_distribution<uint32_t> bit(0, 1);
+  std::uniform_int_distribution<uint32_t> value(0, 255);
+  BitWriter writer;
+  *expected = SpsInfo();
+  expected->profile_idc = 1 + value(*gen) % 3;
+  expected->level_idc = 30 * (1 + value(*gen) % 6);
+  // sps_video_parameter_set_id, sps_max_sub_layers_minus1,
+  // sps_temporal_id_nesting_flag
+  uint32_t sps_max_sub_layers_minus1 = value(*gen) % 4;
+  writer.write_bits(0, 4);
+  writer.write_bits(sps_max_sub_layers_minus1, 3);
+  writer.write_bits(1, 1);
+  // profile_tier_level(): general_profile_space, general_tier_flag,
+  // general_profile_idc, general_profile_compatibility_flag[32],
+  // general_{progressive,interlaced}_source_flag,
+  // general_{non_packed,frame_only}_constraint_flag, 44 reserved bits,
+  // general_level_idc
+  writer.write_bits(0, 3);
+  writer.write_bits(expected->profile_idc, 5);
+  writer.write_bits(1u << (31 - expected->profile_idc), 32);
+  writer.write_bits(0x9, 4);
+  writer.write_bits(0, 32);
+  writer.write_bits(0, 12);
+  writer.write_bits(expected->level_idc, 8);
+  std::vector<uint32_t> sub_layer_profile_present_flag;
+  std::vector<uint32_t> sub_layer_level_present_flag;
+  for (uint32_t i = 0; i < sps_max_sub_layers_minus1; i++) {
+    sub_layer_profile_present_flag.push_back(bit(*gen));
+    sub_layer_level_present_flag.push_back(bit(*gen));
+    writer.write_bits(sub_layer_profile_present_flag[i], 1);
+    writer.write_bits(sub_layer_level_present_flag[i], 1);
+  }
+  if (sps_max_sub_layers_minus1 > 0) {
+    writer.write_bits(0, 2 * (8 - sps_max_sub_layers_minus1));
+  }
+  for (uint32_t i = 0; i < sps_max_sub_layers_minus1; i++) {
+    if (sub_layer_profile_present_flag[i]) {
+      // sub_layer_profile_space, sub_layer_tier_flag, sub_layer_profile_idc,
+      // sub_layer_profile_compatibility_flag[32], 4 flags, 44 reserved bits
+      writer.write_bits(0, 3);
+      writer.write_bits(expected->profile_idc, 5);
+      writer.write_bits(1u << (31 - expected->profile_idc), 32);
+      writer.write_bits(0x9, 4);
+      writer.write_bits(0, 32);
+      writer.write_bits(0, 12);
+    }
+    if (sub_layer_level_present_flag[i]) {
+      writer.write_bits(expected->level_idc, 8);
+    }
+  }
+  // sps_seq_parameter_set_id, chroma_format_idc
+  writer.write_ue(0);
+  uint32_t chroma_format_idc = bit(*gen) ? 1 : 3;
+  writer.write_ue(chroma_format_idc);
+  if (chroma_format_idc == 3) {
+    // separate_colour_plane_flag
+    writer.write_bits(0, 1);
+  }
+  // pic_width_in_luma_samples, pic_height_in_luma_samples
+  writer.write_ue(1920);
+  writer.write_ue(1080);
+  // conformance_window_flag
+  uint32_t conformance_window_flag = bit(*gen);
+  writer.write_bits(conformance_window_flag, 1);
+  if (conformance_window_flag) {
+    writer.write_ue(0);
+    writer.write_ue(0);
+    writer.write_ue(0);
+    writer.write_ue(4);
+  }
+  // bit_depth_luma_minus8, bit_depth_chroma_minus8,
+  // log2_max_pic_order_cnt_lsb_minus4
+  writer.write_ue((expected->profile_idc == 2) ? 2 : 0);
+  writer.write_ue((expected->profile_idc == 2) ? 2 : 0);
+  uint32_t log2_max_pic_order_cnt_lsb_minus4 = value(*gen) % 13;
+  writer.write_ue(log2_max_pic_order_cnt_lsb_minus4);
+  // sps_sub_layer_ordering_info_present_flag
+  uint32_t sps_sub_layer_ordering_info_present_flag = bit(*gen);
+  writer.write_bits(sps_sub_layer_ordering_info_present_flag, 1);
+  for (uint32_t i = sps_sub_layer_ordering_info_present_flag
+                        ? 0
+                        : sps_max_sub_layers_minus1;
+       i <= sps_max_sub_layers_minus1; i++) {
+    // sps_max_dec_pic_buffering_minus1, sps_max_num_reorder_pics,
+    // sps_max_latency_increase_plus1
+    writer.write_ue(15);
+    writer.write_ue(2);
+    writer.write_ue(0);
+  }
+  // log2_min_luma_coding_block_size_minus3,
+  // log2_diff_max_min_luma_coding_block_size,
+  // log2_min_luma_transform_block_size_minus2,
+  // log2_diff_max_min_luma_transform_block_size,
+  // max_transform_hierarchy_depth_inter, max_transform_hierarchy_depth_intra
+  writer.write_ue(0);
+  writer.write_ue(3);
+  writer.write_ue(0);
+  writer.write_ue(3);
+  writer.write_ue(value(*gen) % 4);
+  writer.write_ue(value(*gen) % 4);
+  // scaling_list_enabled_flag
+  uint32_t scaling_list_enabled_flag = bit(*gen);
+  writer.write_bits(scaling_list_enabled_flag, 1);
+  if (scaling_list_enabled_flag) {
+    // sps_scaling_list_data_present_flag
+    uint32_t sps_scaling_list_data_present_flag = bit(*gen);
+    writer.write_bits(sps_scaling_list_data_present_flag, 1);
+    if (sps_scaling_list_data_present_flag) {
+      for (int size_id = 0; size_id < 4; size_id++) {
+        for (int matrix_id = 0; matrix_id < 6;
+             matrix_id += (size_id == 3) ? 3 : 1) {
+          // scaling_list_pred_mode_flag
+          if (bit(*gen)) {
+            writer.write_bits(1, 1);
+            int coef_num = std::min(64, 1 << (4 + (size_id << 1)));
+            if (size_id > 1) {
+              // scaling_list_dc_coef_minus8
+              writer.write_se(static_cast<int32_t>(value(*gen) % 16) - 7);
+            }
+            // scaling_list_delta_coef (keep the coefficients in range)
+            for (int i = 0; i < coef_num; i++) {
+              writer.write_se((i % 2) ? 1 : -1);
+            }
+          } else {
+            // scaling_list_pred_matrix_id_delta
+            writer.write_bits(0, 1);
+            writer.write_ue(0);
+          }
+        }
+      }
+    }
+  }
+  // amp_enabled_flag, sample_adaptive_offset_enabled_flag
+  writer.write_bits(bit(*gen), 1);
+  writer.write_bits(bit(*gen), 1);
+  // pcm_enabled_flag
+  uint32_t pcm_enabled_flag = bit(*gen);
+  writer.write_bits(pcm_enabled_flag, 1);
+  if (pcm_enabled_flag) {
+    // pcm_sample_bit_depth_luma_minus1, pcm_sample_bit_depth_chroma_minus1,
+    // log2_min_pcm_luma_coding_block_size_minus3,
+    // log2_diff_max_min_pcm_luma_coding_block_size,
+    // pcm_loop_filter_disabled_flag
+    writer.write_bits(7, 4);
+    writer.write_bits(7, 4);
+    writer.write_ue(0);
+    writer.write_ue(1);
+    writer.write_bits(0, 1);
+  }
+  // short-term reference picture sets: explicit sets, or sets predicted
+  // from the previous one with a large negative delta_rps (so no delta POC
+  // is dropped, and every predicted set has one more picture)
+  uint32_t num_short_term_ref_pic_sets = value(*gen) % 5;
+  writer.write_ue(num_short_term_ref_pic_sets);
+  uint32_t num_delta_pocs = 0;
+  for (uint32_t i = 0; i < num_short_term_ref_pic_sets; i++) {
+    uint32_t inter_ref_pic_set_prediction_flag = (i != 0) && bit(*gen);
+    if (i != 0) {
+      writer.write_bits(inter_ref_pic_set_prediction_flag, 1);
+    }
+    if (inter_ref_pic_set_prediction_flag) {
+      // delta_rps_sign, abs_delta_rps_minus1
+      writer.write_bits(1, 1);
+      writer.write_ue(99);
+      for (uint32_t j = 0; j <= num_delta_pocs; j++) {
+        // used_by_curr_pic_flag, use_delta_flag
+        uint32_t used_by_curr_pic_flag = bit(*gen);
+        writer.write_bits(used_by_curr_pic_flag, 1);
+        if (!used_by_curr_pic_flag) {
+          writer.write_bits(1, 1);
+        }
+      }
+      num_delta_pocs++;
+    } else {
+      // num_negative_pics, num_positive_pics, delta_poc_s0_minus1,
+      // used_by_curr_pic_s0_flag, delta_poc_s1_minus1,
+      // used_by_curr_pic_s1_flag
+      uint32_t num_negative_pics = value(*gen) % 4;
+      uint32_t num_positive_pics = value(*gen) % 3;
+      writer.write_ue(num_negative_pics);
+      writer.write_ue(num_positive_pics);
+      for (uint32_t j = 0; j < num_negative_pics + num_positive_pics; j++) {
+        writer.write_ue(value(*gen) % 3);
+        writer.write_bits(bit(*gen), 1);
+      }
+      num_delta_pocs = num_negative_pics + num_positive_pics;
+    }
+  }
+  // long_term_ref_pics_present_flag
+  uint32_t long_term_ref_pics_present_flag = bit(*gen);
+  writer.write_bits(long_term_ref_pics_present_flag, 1);
+  if (long_term_ref_pics_present_flag) {
+    // num_long_term_ref_pics_sps, lt_ref_pic_poc_lsb_sps,
+    // used_by_curr_pic_lt_sps_flag
+    uint32_t num_long_term_ref_pics_sps = value(*gen) % 3;
+    writer.write_ue(num_long_term_ref_pics_sps);
+    for (uint32_t i = 0; i < num_long_term_ref_pics_sps; i++) {
+      writer.write_bits(i + 1, log2_max_pic_order_cnt_lsb_minus4 + 4);
+      writer.write_bits(bit(*gen), 1);
+    }
+  }
+  // sps_temporal_mvp_enabled_flag, strong_intra_smoothing_enabled_flag
+  writer.write_bits(1, 1);
+  writer.write_bits(bit(*gen), 1);
+  // vui_parameters_present_flag
+  uint32_t vui_parameters_present_flag = bit(*gen);
+  writer.write_bits(vui_parameters_present_flag, 1);
+  if (vui_parameters_present_flag) {
+    write_vui(gen, &writer, expected);
+    // chroma_loc_info_present_flag, neutral_chroma_indication_flag,
+    // field_seq_flag, frame_field_info_present_flag,
+    // default_display_window_flag, vui_timing_info_present_flag,
+    // bitstream_restriction_flag
+    writer.write_bits(0, 7);
+  }
+  // sps_extension_present_flag
+  writer.write_bits(0, 1);
+  return writer.get_nal_unit({0x42, 0x01});
+}
+
+// Parse an H.264 SPS with h264nal (the same way liblcvm does).
+int reference_h264_sps(const std::vector<uint8_t>& nal_unit, SpsInfo* info) {
+  h264nal::H264BitstreamParserState bitstream_parser_state;
+  h264nal::ParsingOptions parsing_options;
+  auto nal = h264nal::H264NalUnitParser::ParseNalUnit(
+      nal_unit.data(), nal_unit.size(), &bitstream_parser_state,
+      parsing_options);
+  if ((nal == nullptr) || (nal->nal_unit_payload == nullptr) ||
+      (nal->nal_unit_payload->sps == nullptr) ||
+      (nal->nal_unit_payload->sps->sps_data == nullptr)) {
+    return -1;
+  }
+  const auto& sps_data = nal->nal_unit_payload->sps->sps_data;
+  *info = SpsInfo();
+  if ((sps_data->vui_parameters != nullptr) &&
+      (sps_data->vui_parameters->colour_description_present_flag == 1) &&
+      (sps_data->vui_parameters_present_flag == 1)) {
+    info->colour_primaries = sps_data->vui_parameters->colour_primaries;
+    info->transfer_characteristics =
+        sps_data->vui_parameters->transfer_characteristics;
+    info->matrix_coeffs = sps_data->vui_parameters->matrix_coefficients;
+    info->video_full_range_flag =
+        sps_data->vui_parameters->video_full_range_flag;
+  }
+  info->profile_idc = sps_data->profile_idc;
+  info->level_idc = sps_data->level_idc;
+  h264nal::profileTypeToString(sps_data->profile_type, info->profile_type_str);
+  return 0;
+}
+
+// Parse an H.265 SPS with h265nal (the same way liblcvm does).
+int reference_h265_sps(const std::vector<uint8_t>& nal_unit, SpsInfo* info) {
+  h265nal::H265BitstreamParserState bitstream_parser_state;
+  h265nal::ParsingOptions parsing_options;
+  auto nal = h265nal::H265NalUnitParser::ParseNalUnit(
+      nal_unit.data(), nal_unit.size(), &bitstream_parser_state,
+      parsing_options);
+  if ((nal == nullptr) || (nal->nal_unit_payload == nullptr) ||
+      (nal->nal_unit_payload->sps == nullptr) ||
+      (nal->nal_unit_payload->sps->profile_tier_level == nullptr) ||
+      (nal->nal_unit_payload->sps->profile_tier_level->general == nullptr)) {
+    return -1;
+  }
+  const auto& sps = nal->nal_unit_payload->sps;
+  *info = SpsInfo();
+  if ((sps->vui_parameters != nullptr) &&
+      (sps->vui_parameters_present_flag == 1) &&
+      (sps->vui_parameters->colour_description_present_flag == 1)) {
+    info->colour_primaries = sps->vui_parameters->colour_primaries;
+    info->transfer_characteristics =
+        sps->vui_parameters->transfer_characteristics;
+    info->matrix_coeffs = sps->vui_parameters->matrix_coeffs;
+    info->video_full_range_flag = sps->vui_parameters->video_full_range_flag;
+  }
+  info->profile_idc = sps->profile_tier_level->general->profile_idc;
+  info->level_idc = sps->profile_tier_level->general_level_idc;
+  h265nal::profileTypeToString(sps->profile_tier_level->general->profile_type,
+                               info->profile_type_str);
+  return 0;
+}
+
+void expect_same_sps_info(const SpsInfo& expected, const SpsInfo& actual) {
+  EXPECT_EQ(expected.colour_primaries, actual.colour_primaries);
+  EXPECT_EQ(expected.transfer_characteristics,
+            actual.transfer_characteristics);
+  EXPECT_EQ(expected.matrix_coeffs, actual.matrix_coeffs);
+  EXPECT_EQ(expected.video_full_range_flag, actual.video_full_range_flag);
+  EXPECT_EQ(expected.profile_idc, actual.profile_idc);
+  EXPECT_EQ(expected.level_idc, actual.level_idc);
+  EXPECT_EQ(expected.profile_type_str, actual.profile_type_str);
+}
+
+// SPS of media/MOV1.MOV (hvcC).
+const std::vector<uint8_t> kMov1Sps = {
+    0x42, 0x01, 0x02, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0xb0, 0x00, 0x00,
+    0x03, 0x00, 0x00, 0x03, 0x00, 0x7b, 0x00, 0x00, 0xa0, 0x03, 0xc0, 0x80,
+    0x11, 0x07, 0xcb, 0x88, 0x15, 0xee, 0x45, 0x90, 0x55, 0xc8, 0x24, 0x9f,
+    0xa1, 0x25, 0x53, 0x5a, 0x65, 0x24, 0x9f, 0xa1, 0x25, 0x53, 0x5a, 0x67,
+    0x24, 0x92, 0xe5, 0x53, 0xea, 0x52, 0x4f, 0x92, 0x75, 0x24, 0xfa, 0x9c,
+    0x92, 0x4a, 0xe4, 0x97, 0x25, 0xea, 0x6a, 0x02, 0x02, 0x02, 0x01,
+};
+}  // namespace
+
+namespace liblcvm {
+
+class SpsReaderTest : public ::testing::Test {
+ public:
+  SpsReaderTest() {}
+  ~SpsReaderTest() override {}
+};
+
+TEST_F(SpsReaderTest, TestH265MediaSps) {
+  SpsInfo info;
+  ASSERT_EQ(0, read_h265_sps(kMov1Sps.data(), kMov1Sps.size(), &info));
+  SpsInfo expected;
+  expected.colour_primaries = 1;
+  expected.transfer_characteristics = 1;
+  expected.matrix_coeffs = 1;
+  expected.video_full_range_flag = 0;
+  expected.profile_idc = 1;
+  expected.level_idc = 123;
+  expected.profile_type_str = "Main";
+  expect_same_sps_info(expected, info);
+  SpsInfo reference;
+  ASSERT_EQ(0, reference_h265_sps(kMov1Sps, &reference));
+  expect_same_sps_info(reference, info);
+
+  // an SPS is not accepted as the wrong codec
+  EXPECT_NE(0, read_h264_sps(kMov1Sps.data(), kMov1Sps.size(), &info));
+}
+
+TEST_F(SpsReaderTest, TestH264CrossCheck) {
+  std::mt19937 gen(264);
+  int num_emulation_prevention = 0;
+  for (int i = 0; i < 500; i++) {
+    SpsInfo expected;
+    std::vector<uint8_t> nal_unit = write_h264_sps(&gen, &expected);
+    num_emulation_prevention += has_emulation_prevention(nal_unit) ? 1 : 0;
+    SpsInfo info;
+    ASSERT_EQ(0, read_h264_sps(nal_unit.data(), nal_unit.size(), &info))
+        << "sps: " << i;
+    SpsInfo reference;
+    ASSERT_EQ(0, reference_h264_sps(nal_unit, &reference)) << "sps: " << i;
+    // the profile type names are only known to the reference parser
+    expected.profile_type_str = reference.profile_type_str;
+    expect_same_sps_info(expected, info);
+    expect_same_sps_info(reference, info);
+  }
+  EXPECT_GT(num_emulation_prevention, 0);
+}
+
+TEST_F(SpsReaderTest, TestH265CrossCheck) {
+  std::mt19937 gen(265);
+  int num_emulation_prevention = 0;
+  for (int i = 0; i < 500; i++) {
+    SpsInfo expected;
+    std::vector<uint8_t> nal_unit = write_h265_sps(&gen, &expected);
+    num_emulation_prevention += has_emulation_prevention(nal_unit) ? 1 : 0;
+    SpsInfo info;
+    ASSERT_EQ(0, read_h265_sps(nal_unit.data(), nal_unit.size(), &info))
+        << "sps: " << i;
+    SpsInfo reference;
+    ASSERT_EQ(0, reference_h265_sps(nal_unit, &reference)) << "sps: " << i;
+    expected.profile_type_str = reference.profile_type_str;
+    expect_same_sps_info(expected, info);
+    expect_same_sps_info(reference, info);
+  }
+  EXPECT_GT(num_emulation_prevention, 0);
+}
+
+TEST_F(SpsReaderTest, TestTruncated) {
+  // every prefix of an SPS is either rejected, or read as the full SPS
+  // (when it includes the VUI colour description)
+  std::mt19937 gen(0);
+  std::vector<std::vector<uint8_t>> h264_list;
+  std::vector<std::vector<uint8_t>> h265_list = {kMov1Sps};
+  for (int i = 0; i < 20; i++) {
+    SpsInfo expected;
+    h264_list.push_back(write_h264_sps(&gen, &expected));
+    h265_list.push_back(write_h265_sps(&gen, &expected));
+  }
+  for (int codec = 0; codec < 2; codec++) {
+    auto read_sps = (codec == 0) ? read_h264_sps : read_h265_sps;
+    for (const auto& nal_unit : (codec == 0) ? h264_list : h265_list) {
+      SpsInfo full;
+      ASSERT_EQ(0, read_sps(nal_unit.data(), nal_unit.size(), &full));
+      for (size_t size = 0; size < nal_unit.size(); size++) {
+        // copy the prefix, so reading past it is detected by asan
+        std::vector<uint8_t> prefix(nal_unit.begin(), nal_unit.begin() + size);
+        SpsInfo info;
+        if (read_sps(prefix.data(), prefix.size(), &info) == 0) {
+          expect_same_sps_info(full, info);
+        }
+      }
+    }
+  }
+}
+}  // namespace liblcvm
@@ -7,17 +7,32 @@
 #include <stdlib.h>
 #include <unistd.h>  // for optarg
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
 #include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <list>
 #include <map>
+#include <mutex>
 #include <string>  // for basic_string, string
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#include "analysis_server.h"
+#include "async_analyzer.h"
+#include "batch_pipeline.h"
 #include "config.h"
+#include "directory_watcher.h"
+#include "shard.h"
 #include "liblcvm.h"
 #if ADD_POLICY
-#include "policy_protovisitor.h"
 #endif
 
 extern int optind;
@@ -30,8 +45,40 @@ typedef struct arg_options {
   char* outfile_timestamps;
   bool outfile_timestamps_sort_pts;
   std::vector<std::string> infile_list;
+  char* cache_dir;
+  bool cache_hash_moov;
+  bool moov_cache;
+  bool frozen_frames;
+  bool mmap_input;
+  int jobs;
+  int prefetch_threads;
+  int prefetch_depth;
+  int reorder_depth;
+  bool largest_first;
+  int parallel_timing_threshold;
+  int timing_threads;
+  int timeout_ms;
+  uint64_t max_samples;
+  uint64_t max_table_entries;
+  uint64_t max_moov_size;
+  uint64_t max_memory_bytes;
+  bool budget_summary_only;
+  char* serve_socket;
+  char* client_socket;
+  bool pass_fds;
+  char* watch_dir;
+  int watch_debounce_ms;
+  bool jsonl;
+  int shard_index;
+  int num_shards;
+  char* checkpoint_file;
+  bool merge;
 #if ADD_POLICY
   char* policy_file;
+  bool policy_only;
+  bool rescore;
+  bool policy_compile;
+  bool policy_first_error;
 #endif
 } arg_options;
 
@@ -43,87 +90,191 @@ arg_options DEFAULT_OPTIONS{
     .outfile_timestamps = nullptr,
     .outfile_timestamps_sort_pts = true,
     .infile_list = {},
+    .cache_dir = nullptr,
+    .cache_hash_moov = false,
+    .moov_cache = false,
+    .frozen_frames = false,
+    .mmap_input = false,
+    .jobs = 1,
+    .prefetch_threads = 1,
+    .prefetch_depth = 8,
+    .reorder_depth = 16,
+    .largest_first = false,
+    .parallel_timing_threshold = 0,
+    .timing_threads = 0,
+    .timeout_ms = 0,
+    .max_samples = 0,
+    .max_table_entries = 0,
+    .max_moov_size = 0,
+    .max_memory_bytes = 0,
+    .budget_summary_only = false,
+    .serve_socket = nullptr,
+    .client_socket = nullptr,
+    .pass_fds = false,
+    .watch_dir = nullptr,
+    .watch_debounce_ms = 500,
+    .jsonl = false,
+    .shard_index = 0,
+    .num_shards = 0,
+    .checkpoint_file = nullptr,
+    .merge = false,
 #if ADD_POLICY
     .policy_file = nullptr,
+    .policy_only = false,
+    .rescore = false,
+    .policy_compile = false,
+    .policy_first_error = false,
 #endif
 };
 
-std::string csv_escape(const std::string& value) {
-  bool must_quote = value.find_first_of(",\"\n") != std::string::npos;
-  std::string escaped = value;
-  size_t pos = 0;
-  while ((pos = escaped.find('"', pos)) != std::string::npos) {
-    escaped.insert(pos, "\"");
-    pos += 2;
+// Set the parsing parameters from the command line options.
+void get_liblcvm_config(const arg_options* options,
+                        const std::string& policy_str, bool policy_only,
+                        bool policy_first_error,
+                        LiblcvmConfig* liblcvm_config) {
+  liblcvm_config->set_sort_by_pts(options->outfile_timestamps_sort_pts);
+  liblcvm_config->set_policy(policy_str);
+  liblcvm_config->set_debug(options->debug);
+  // the timestamps need the full timing analysis
+  policy_only = policy_only && !policy_str.empty() &&
+                options->outfile_timestamps == nullptr;
+  liblcvm_config->set_policy_only(policy_only);
+  liblcvm_config->set_policy_first_error(policy_first_error);
+  liblcvm_config->set_moov_cache(options->moov_cache);
+  liblcvm_config->set_frozen_frames(options->frozen_frames);
+  liblcvm_config->set_mmap_input(options->mmap_input);
+  liblcvm_config->set_parallel_timing_threshold(
+      options->parallel_timing_threshold);
+  liblcvm_config->set_parallel_timing_threads(options->timing_threads);
+  liblcvm_config->set_timeout_ms(options->timeout_ms);
+  liblcvm_config->set_max_samples(options->max_samples);
+  liblcvm_config->set_max_table_entries(options->max_table_entries);
+  liblcvm_config->set_max_moov_size(options->max_moov_size);
+  liblcvm_config->set_max_memory_bytes(options->max_memory_bytes);
+  liblcvm_config->set_budget_summary_only(options->budget_summary_only);
+  if (options->cache_dir != nullptr) {
+    liblcvm_config->set_cache_dir(options->cache_dir);
+    liblcvm_config->set_cache_hash_moov(options->cache_hash_moov);
   }
-  if (must_quote) {
-    escaped = "\"" + escaped + "\"";
+}
+
+// Get the output columns of a result.
+std::vector<size_t> get_output_columns(const LiblcvmKeyList& keys,
+                                       const LiblcvmValList& vals,
+                                       bool policy_only) {
+  // in policy-only mode, only the file name and the policy results are valid
+  static const std::vector<std::string> policy_only_keys = {
+      "infile", "policy_version", "warn_list", "error_list"};
+  std::vector<size_t> columns;
+  for (size_t i = 0; i < keys.size() && i < vals.size(); ++i) {
+    if (!policy_only ||
+        std::find(policy_only_keys.begin(), policy_only_keys.end(),
+                  keys[i]) != policy_only_keys.end()) {
+      columns.push_back(i);
+    }
   }
-  return escaped;
+  return columns;
 }
 
 int parse_files(std::vector<std::string>& infile_list, char* outfile,
-                char* outfile_timestamps, bool outfile_timestamps_sort_pts,
-                int debug, const std::string& policy_str) {
+                char* outfile_timestamps, const char* checkpoint_file,
+                const LiblcvmConfig& liblcvm_config,
+                const BatchPipelineConfig& pipeline_config) {
   // 1. open outfile
   FILE* outfp;
+  ShardCheckpoint checkpoint;
+  uint64_t output_size = 0;
   if (outfile == nullptr || (strlen(outfile) == 1 && outfile[0] == '-')) {
     outfp = stdout;
+    checkpoint_file = nullptr;
   } else {
-    outfp = fopen(outfile, "wb");
+    // with a checkpoint, resume the outfile after its last completed row
+    outfp = fopen(outfile, (checkpoint_file != nullptr) ? "ab" : "wb");
     if (outfp == nullptr) {
       fprintf(stderr, "Could not open output file: \"%s\"\n", outfile);
       return -1;
     }
+    if (checkpoint_file != nullptr &&
+        (fseeko(outfp, 0, SEEK_END) != 0 ||
+         checkpoint.open(checkpoint_file, ftello(outfp), &output_size) != 0 ||
+         ftruncate(fileno(outfp), output_size) != 0)) {
+      fprintf(stderr, "Could not open checkpoint file: \"%s\"\n",
+              checkpoint_file);
+      fclose(outfp);
+      return -1;
+    }
   }
 
-  // 2. set parsing parameters
-  auto liblcvm_config = std::make_unique<LiblcvmConfig>();
-  liblcvm_config->set_sort_by_pts(outfile_timestamps_sort_pts);
-  liblcvm_config->set_policy(policy_str);
-  liblcvm_config->set_debug(debug);
+  // 2. get the parsing parameters
+  bool calculate_timestamps = outfile_timestamps != nullptr;
+  bool policy_only = liblcvm_config.get_policy_only();
+  // skip the files completed before a restart
+  std::vector<std::string> remaining_list;
+  if (checkpoint.size() > 0) {
+    for (const auto& infile : infile_list) {
+      if (!checkpoint.is_done(infile)) {
+        remaining_list.push_back(infile);
+      }
+    }
+    if (liblcvm_config.get_debug() > 0) {
+      printf("Resuming: %zu files done, %zu files left\n", checkpoint.size(),
+             remaining_list.size());
+    }
+  }
 
-  // 3. parse the input files
-  bool printed_csv_header = false;
+  // 3. parse the input files (through a prefetch/compute/write pipeline,
+  // which writes the rows in input order)
+  bool printed_csv_header = output_size > 0;
   LiblcvmKeyList keys_timing;
   std::map<std::string, LiblcvmTimingList> vals_timing_map;
-  bool calculate_timestamps = outfile_timestamps != nullptr;
-  for (const auto& infile : infile_list) {
-    LiblcvmKeyList keys;
-    LiblcvmValList vals;
-    LiblcvmKeyList pkeys_timing;
-    LiblcvmTimingList vals_timing;
-    if (IsobmffFileInformation::parse_to_lists(
-            infile.c_str(), *liblcvm_config, &keys, &vals, calculate_timestamps,
-            &keys_timing, &vals_timing)) {
+  auto write_result = [&](BatchResult& result) {
+    const std::string& infile = result.infile;
+    const LiblcvmKeyList& keys = result.keys;
+    const LiblcvmValList& vals = result.vals;
+    if (result.ret != 0) {
       fprintf(stderr, "error: IsobmffFileInformation::parse_to_map() in %s\n",
               infile.c_str());
-      continue;
+      return;
+    }
+    if (calculate_timestamps && keys_timing.empty()) {
+      keys_timing = result.keys_timing;
     }
+    // select the output columns
+    std::vector<size_t> columns = get_output_columns(keys, vals, policy_only);
+
     // write CSV header
     if (!printed_csv_header) {
-      for (size_t i = 0; i < keys.size(); ++i) {
-        fprintf(outfp, "%s%s", keys[i].c_str(),
-                (i + 1 < keys.size()) ? "," : "\n");
+      for (size_t i = 0; i < columns.size(); ++i) {
+        fprintf(outfp, "%s%s", keys[columns[i]].c_str(),
+                (i + 1 < columns.size()) ? "," : "\n");
       }
       printed_csv_header = true;
     }
 
     // write CSV rows
-    for (size_t i = 0; i < vals.size(); ++i) {
+    for (size_t i = 0; i < columns.size(); ++i) {
       std::string value;
-      if (liblcvmvalue_to_string(vals[i], &value) != 0) {
+      if (liblcvmvalue_to_string(vals[columns[i]], &value) != 0) {
         value = "ERROR";
       }
       fprintf(outfp, "%s%s", csv_escape(value).c_str(),
-              (i + 1 < vals.size()) ? "," : "\n");
+              (i + 1 < columns.size()) ? "," : "\n");
+    }
+
+    // record the file once its row is in the outfile
+    if (checkpoint_file != nullptr &&
+        (fflush(outfp) != 0 || checkpoint.add(infile, ftello(outfp)) != 0)) {
+      fprintf(stderr, "error: cannot checkpoint %s\n", infile.c_str());
     }
 
     // capture outfile timestamps
     if (calculate_timestamps) {
-      vals_timing_map.emplace(infile, vals_timing);
+      vals_timing_map.emplace(infile, std::move(result.vals_timing));
     }
-  }
+  };
+  run_batch_pipeline((checkpoint.size() > 0) ? remaining_list : infile_list,
+                     liblcvm_config, calculate_timestamps, pipeline_config,
+                     write_result);
 
   // 4. dump outfile timestamps
   if (calculate_timestamps) {
@@ -190,6 +341,514 @@ int parse_files(std::vector<std::string>& infile_list, char* outfile,
   return 0;
 }
 
+// Read a CSV row (as written by parse_files()).
+//
+// @return int: 0 if a row was read, 1 at the end of the file, -1 if the file
+// ends in the middle of the row (the partial row is returned).
+int read_csv_row(FILE* infp, std::vector<std::string>* row) {
+  row->clear();
+  std::string field;
+  bool quoted = false;
+  int c;
+  while ((c = fgetc(infp)) != EOF) {
+    if (quoted) {
+      if (c != '"') {
+        field += static_cast<char>(c);
+        continue;
+      }
+      int next = fgetc(infp);
+      if (next == '"') {
+        // escaped quote
+        field += '"';
+        continue;
+      }
+      quoted = false;
+      if (next == EOF) {
+        break;
+      }
+      c = next;
+    }
+    if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      row->push_back(field);
+      field.clear();
+    } else if (c == '\n') {
+      row->push_back(field);
+      return 0;
+    } else if (c != '\r') {
+      field += static_cast<char>(c);
+    }
+  }
+  if (!field.empty() || !row->empty()) {
+    row->push_back(field);
+    return -1;
+  }
+  return 1;
+}
+
+// Merge the CSV outputs of several shards, and validate them: all the
+// files must have the same header, and every row must be complete, and
+// have a new infile.
+int merge_files(const std::vector<std::string>& infile_list, char* outfile,
+                int debug) {
+  // 1. open outfile
+  FILE* outfp;
+  if (outfile == nullptr || (strlen(outfile) == 1 && outfile[0] == '-')) {
+    outfp = stdout;
+  } else {
+    outfp = fopen(outfile, "wb");
+    if (outfp == nullptr) {
+      fprintf(stderr, "Could not open output file: \"%s\"\n", outfile);
+      return -1;
+    }
+  }
+
+  // 2. copy the valid rows
+  int ret = 0;
+  std::vector<std::string> header;
+  size_t infile_column = SIZE_MAX;
+  // infile_hashes: Hashes of the infiles already merged (hashes instead of
+  // names keep the memory low for millions of rows)
+  std::unordered_set<uint64_t> infile_hashes;
+  size_t num_rows = 0;
+  for (const auto& infile : infile_list) {
+    FILE* infp = fopen(infile.c_str(), "rb");
+    if (infp == nullptr) {
+      fprintf(stderr, "error: cannot read CSV file %s\n", infile.c_str());
+      ret = -1;
+      continue;
+    }
+    // 2.1. check the header (shards without results have empty outputs)
+    std::vector<std::string> row;
+    int row_ret = read_csv_row(infp, &row);
+    if (row_ret == 0 && header.empty()) {
+      header = row;
+      infile_column =
+          std::find(header.begin(), header.end(), "infile") - header.begin();
+      for (size_t i = 0; i < header.size(); ++i) {
+        fprintf(outfp, "%s%s", csv_escape(header[i]).c_str(),
+                (i + 1 < header.size()) ? "," : "\n");
+      }
+    } else if (row_ret == 0 && row != header) {
+      fprintf(stderr, "error: different CSV header in %s\n", infile.c_str());
+      ret = -1;
+      row_ret = 1;
+    } else if (row_ret < 0) {
+      fprintf(stderr, "error: truncated CSV header in %s\n", infile.c_str());
+      ret = -1;
+    }
+
+    // 2.2. check and copy the rows
+    for (size_t line = 2; row_ret == 0; ++line) {
+      row_ret = read_csv_row(infp, &row);
+      if (row_ret == 1) {
+        break;
+      }
+      if (row_ret < 0 || row.size() != header.size()) {
+        fprintf(stderr, "error: %s row in %s:%zu\n",
+                (row_ret < 0) ? "truncated" : "invalid", infile.c_str(), line);
+        ret = -1;
+        continue;
+      }
+      if (infile_column < row.size() &&
+          !infile_hashes.insert(get_shard_hash(row[infile_column])).second) {
+        fprintf(stderr, "error: duplicate infile %s in %s:%zu\n",
+                row[infile_column].c_str(), infile.c_str(), line);
+        ret = -1;
+        continue;
+      }
+      for (size_t i = 0; i < row.size(); ++i) {
+        fprintf(outfp, "%s%s", csv_escape(row[i]).c_str(),
+                (i + 1 < row.size()) ? "," : "\n");
+      }
+      ++num_rows;
+    }
+    fclose(infp);
+  }
+  if (debug > 0) {
+    printf("Merged %zu rows from %zu files\n", num_rows, infile_list.size());
+  }
+
+  if (outfp != stdout) {
+    fclose(outfp);
+  }
+  return ret;
+}
+
+#if ADD_POLICY
+// Parse a CSV file (as written by parse_files()) into rows of fields.
+int read_csv(const std::string& infile,
+             std::vector<std::vector<std::string>>* rows) {
+  FILE* infp = fopen(infile.c_str(), "rb");
+  if (infp == nullptr) {
+    fprintf(stderr, "Could not open input file: \"%s\"\n", infile.c_str());
+    return -1;
+  }
+  rows->clear();
+  std::vector<std::string> row;
+  int ret;
+  while ((ret = read_csv_row(infp, &row)) != 1) {
+    rows->push_back(row);
+    if (ret < 0) {
+      break;
+    }
+  }
+  fclose(infp);
+  return 0;
+}
+
+// Convert a CSV field back into a value (int, double, or string).
+LiblcvmValue csv_field_to_value(const std::string& field) {
+  if (!field.empty()) {
+    char* endptr;
+    errno = 0;
+    long int lval = strtol(field.c_str(), &endptr, 10);
+    if (*endptr == '\0' && errno == 0 && lval >= INT_MIN && lval <= INT_MAX) {
+      return static_cast<int>(lval);
+    }
+    double dval = strtod(field.c_str(), &endptr);
+    if (*endptr == '\0') {
+      return dval;
+    }
+  }
+  return field;
+}
+
+std::string join_messages(const std::list<std::string>& messages) {
+  std::string out;
+  for (const auto& message : messages) {
+    out += (out.empty() ? "" : ";") + message;
+  }
+  return out;
+}
+
+// Re-score the CSV outputs of previous runs against a new policy, without
+// re-parsing the media files.
+int rescore_files(std::vector<std::string>& infile_list, char* outfile,
+                  int debug, const std::string& policy_str) {
+  // 1. open outfile
+  FILE* outfp;
+  if (outfile == nullptr || (strlen(outfile) == 1 && outfile[0] == '-')) {
+    outfp = stdout;
+  } else {
+    outfp = fopen(outfile, "wb");
+    if (outfp == nullptr) {
+      fprintf(stderr, "Could not open output file: \"%s\"\n", outfile);
+      return -1;
+    }
+  }
+
+  int ret = 0;
+  bool printed_csv_header = false;
+  const std::vector<std::string> policy_keys = {"policy_version", "warn_list",
+                                                "error_list"};
+  // keys: Output columns (the non-policy columns of the first file).
+  LiblcvmKeyList keys;
+  for (const auto& infile : infile_list) {
+    // 2. read the CSV file, dropping the old policy columns
+    std::vector<std::vector<std::string>> rows;
+    if (read_csv(infile, &rows) != 0 || rows.empty()) {
+      fprintf(stderr, "error: cannot read CSV file %s\n", infile.c_str());
+      continue;
+    }
+    std::vector<size_t> file_columns;
+    LiblcvmKeyList file_keys;
+    for (size_t i = 0; i < rows[0].size(); ++i) {
+      if (std::find(policy_keys.begin(), policy_keys.end(), rows[0][i]) ==
+          policy_keys.end()) {
+        file_columns.push_back(i);
+        file_keys.push_back(rows[0][i]);
+      }
+    }
+    // 2.1. map the columns to the ones of the first file, by name (files
+    // written by different lcvm versions may order them differently)
+    if (keys.empty()) {
+      keys = file_keys;
+    }
+    std::vector<size_t> column_map;
+    if (get_column_map(keys, file_keys, &column_map) != 0) {
+      fprintf(stderr, "error: columns of %s do not match the ones of %s\n",
+              infile.c_str(), infile_list[0].c_str());
+      ret = -1;
+      continue;
+    }
+    std::vector<size_t> columns;
+    for (size_t i : column_map) {
+      columns.push_back(file_columns[i]);
+    }
+    std::vector<LiblcvmValList> vals_list;
+    for (size_t r = 1; r < rows.size(); ++r) {
+      LiblcvmValList vals;
+      for (size_t i : columns) {
+        vals.push_back(
+            csv_field_to_value((i < rows[r].size()) ? rows[r][i] : ""));
+      }
+      vals_list.push_back(std::move(vals));
+    }
+    if (debug > 0) {
+      fprintf(stderr, "rescoring %zu rows from %s\n", vals_list.size(),
+              infile.c_str());
+    }
+
+    // 3. run the policy over the full batch
+    std::vector<std::list<std::string>> warn_lists;
+    std::vector<std::list<std::string>> error_lists;
+    std::string version;
+    std::vector<int> row_errors;
+    if (policy_runner_batch(policy_str, keys, vals_list, &warn_lists,
+                            &error_lists, &version, &row_errors) != 0) {
+      fprintf(stderr, "error: policy evaluation failed for %s\n",
+              infile.c_str());
+      ret = -1;
+      continue;
+    }
+
+    // 4. write CSV header
+    if (!printed_csv_header) {
+      for (const auto& key : keys) {
+        fprintf(outfp, "%s,", key.c_str());
+      }
+      fprintf(outfp, "%s,%s,%s\n", policy_keys[0].c_str(),
+              policy_keys[1].c_str(), policy_keys[2].c_str());
+      printed_csv_header = true;
+    }
+
+    // 5. write CSV rows (keeping the original field text). Rows that cannot
+    // be evaluated are dropped, as the files whose policy fails in a normal
+    // run.
+    for (size_t r = 1; r < rows.size(); ++r) {
+      if (row_errors[r - 1] != 0) {
+        fprintf(stderr, "error: policy evaluation failed for row %zu of %s\n",
+                r, infile.c_str());
+        ret = -1;
+        continue;
+      }
+      for (size_t i : columns) {
+        std::string value = (i < rows[r].size()) ? rows[r][i] : "";
+        fprintf(outfp, "%s,", csv_escape(value).c_str());
+      }
+      fprintf(outfp, "%s,%s,%s\n", csv_escape(version).c_str(),
+              csv_escape(join_messages(warn_lists[r - 1])).c_str(),
+              csv_escape(join_messages(error_lists[r - 1])).c_str());
+    }
+  }
+
+  if (outfp != stdout) {
+    fclose(outfp);
+  }
+  return ret;
+}
+#endif
+
+// server: Running analysis server (for the signal handlers).
+AnalysisServer* server = nullptr;
+
+void stop_server(int /* signum */) {
+  if (server != nullptr) {
+    server->stop();
+  }
+}
+
+// Serve analysis requests until SIGINT or SIGTERM.
+int serve_requests(const char* socket_path,
+                   const LiblcvmConfig& liblcvm_config, int jobs, int debug) {
+  AnalysisServer analysis_server(liblcvm_config, jobs);
+  server = &analysis_server;
+  signal(SIGINT, stop_server);
+  signal(SIGTERM, stop_server);
+  if (debug > 0) {
+    printf("Serving on %s\n", socket_path);
+  }
+  int ret = analysis_server.serve(socket_path);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  server = nullptr;
+  if (ret != 0) {
+    fprintf(stderr, "Could not serve on socket: \"%s\"\n", socket_path);
+  }
+  return ret;
+}
+
+// Send the files to an analysis server, and write its results (in
+// completion order) as a CSV file.
+int send_requests(const char* socket_path,
+                  const std::vector<std::string>& infile_list, bool pass_fds,
+                  char* outfile) {
+  // 1. open outfile
+  FILE* outfp;
+  if (outfile == nullptr || (strlen(outfile) == 1 && outfile[0] == '-')) {
+    outfp = stdout;
+  } else {
+    outfp = fopen(outfile, "wb");
+    if (outfp == nullptr) {
+      fprintf(stderr, "Could not open output file: \"%s\"\n", outfile);
+      return -1;
+    }
+  }
+
+  // 2. write the responses
+  bool printed_csv_header = false;
+  auto write_response = [&](const std::string& response) {
+    // the first line is "<request number>,<error code>"
+    size_t status_end = response.find('\n');
+    size_t number = 0;
+    int ret = -1;
+    if (sscanf(response.c_str(), "%zu,%i", &number, &ret) != 2 ||
+        status_end == std::string::npos) {
+      fprintf(stderr, "error: invalid server response\n");
+      return;
+    }
+    if (ret != 0) {
+      fprintf(stderr, "error: IsobmffFileInformation::parse_to_map() in %s\n",
+              (number < infile_list.size()) ? infile_list[number].c_str()
+                                            : "?");
+      return;
+    }
+    size_t header_end = response.find('\n', status_end + 1);
+    if (header_end == std::string::npos) {
+      fprintf(stderr, "error: invalid server response\n");
+      return;
+    }
+    if (!printed_csv_header) {
+      fprintf(outfp, "%s",
+              response.substr(status_end + 1, header_end - status_end)
+                  .c_str());
+      printed_csv_header = true;
+    }
+    fprintf(outfp, "%s", response.substr(header_end + 1).c_str());
+  };
+  int ret =
+      analysis_client(socket_path, infile_list, pass_fds, write_response);
+  if (ret != 0) {
+    fprintf(stderr, "error: analysis server failed: \"%s\"\n", socket_path);
+  }
+
+  if (outfp != stdout) {
+    fclose(outfp);
+  }
+  return ret;
+}
+
+// watcher: Running directory watcher (for the signal handlers).
+DirectoryWatcher* watcher = nullptr;
+
+void stop_watcher(int /* signum */) {
+  if (watcher != nullptr) {
+    watcher->stop();
+  }
+}
+
+// Analyze the media files written to a directory until SIGINT or SIGTERM,
+// and stream their results (in completion order) as CSV or JSON lines.
+int watch_directory(const char* dir, const LiblcvmConfig& liblcvm_config,
+                    int jobs, int debounce_ms, bool jsonl, char* outfile,
+                    int debug) {
+  // 1. open outfile
+  FILE* outfp;
+  if (outfile == nullptr || (strlen(outfile) == 1 && outfile[0] == '-')) {
+    outfp = stdout;
+  } else {
+    outfp = fopen(outfile, "wb");
+    if (outfp == nullptr) {
+      fprintf(stderr, "Could not open output file: \"%s\"\n", outfile);
+      return -1;
+    }
+  }
+
+  // 2. start watching the directory
+  DirectoryWatcher directory_watcher(dir, debounce_ms);
+  if (directory_watcher.start() != 0) {
+    fprintf(stderr, "Could not watch directory: \"%s\"\n", dir);
+    if (outfp != stdout) {
+      fclose(outfp);
+    }
+    return -1;
+  }
+  watcher = &directory_watcher;
+  signal(SIGINT, stop_watcher);
+  signal(SIGTERM, stop_watcher);
+  if (debug > 0) {
+    printf("Watching %s\n", dir);
+  }
+
+  // 3. analyze the reported files, and write each result as it completes
+  bool policy_only = liblcvm_config.get_policy_only();
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t num_running = 0;
+  bool printed_csv_header = false;
+  auto write_result = [&](BatchResult& result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result.ret != 0) {
+      fprintf(stderr, "error: IsobmffFileInformation::parse_to_map() in %s\n",
+              result.infile.c_str());
+    } else {
+      std::vector<size_t> columns =
+          get_output_columns(result.keys, result.vals, policy_only);
+      if (!jsonl && !printed_csv_header) {
+        for (size_t i = 0; i < columns.size(); ++i) {
+          fprintf(outfp, "%s%s", result.keys[columns[i]].c_str(),
+                  (i + 1 < columns.size()) ? "," : "\n");
+        }
+        printed_csv_header = true;
+      }
+      std::string line;
+      for (size_t i = 0; i < columns.size(); ++i) {
+        std::string value;
+        if (jsonl) {
+          if (liblcvmvalue_to_json(result.vals[columns[i]], &value) != 0) {
+            value = "null";
+          }
+          line += ((i == 0) ? "{" : ",") +
+                  json_escape(result.keys[columns[i]]) + ":" + value;
+        } else {
+          if (liblcvmvalue_to_string(result.vals[columns[i]], &value) != 0) {
+            value = "ERROR";
+          }
+          line += ((i == 0) ? "" : ",") + csv_escape(value);
+        }
+      }
+      if (jsonl) {
+        line += columns.empty() ? "{}" : "}";
+      }
+      fprintf(outfp, "%s\n", line.c_str());
+      fflush(outfp);
+    }
+    --num_running;
+    done.notify_all();
+  };
+  // a few queued files per thread keep the threads busy
+  AsyncAnalyzer analyzer(jobs, 4 * std::max(1, jobs));
+  int ret = directory_watcher.run([&](const std::string& path) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++num_running;
+    }
+    // a full queue pushes back on the watcher (the kernel queues the
+    // events meanwhile)
+    while (analyzer.submit(path, liblcvm_config, false, write_result) != 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  watcher = nullptr;
+  if (ret != 0) {
+    fprintf(stderr, "error: cannot watch directory anymore: \"%s\"\n", dir);
+  }
+
+  // 4. wait for the running analyses
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return num_running == 0; });
+  }
+  if (outfp != stdout) {
+    fclose(outfp);
+  }
+  return ret;
+}
+
 void usage(char* name) {
   fprintf(stderr, "usage: %s [options] <infile(s)>\n", name);
   fprintf(stderr, "where options are:\n");
@@ -198,12 +857,116 @@ void usage(char* name) {
   fprintf(stderr, "\t-q:\t\tZero debug verbosity\n");
   fprintf(stderr, "\t--runs <nruns>:\t\tRun the analysis multiple times [%i]\n",
           DEFAULT_OPTIONS.nruns);
+  fprintf(stderr, "\t-j <jobs>:\t\tNumber of analysis threads [%i]\n",
+          DEFAULT_OPTIONS.jobs);
+  fprintf(stderr,
+          "\t--prefetch-threads <n>:\t\tNumber of moov prefetch threads "
+          "[%i]\n",
+          DEFAULT_OPTIONS.prefetch_threads);
+  fprintf(stderr,
+          "\t--prefetch-depth <n>:\t\tNumber of files prefetched ahead "
+          "[%i]\n",
+          DEFAULT_OPTIONS.prefetch_depth);
+  fprintf(stderr,
+          "\t--reorder-depth <n>:\t\tLargest number of files in the "
+          "pipeline (at least -j + prefetch threads + prefetch depth) [%i]\n",
+          DEFAULT_OPTIONS.reorder_depth);
+  fprintf(stderr,
+          "\t--largest-first:\t\tAnalyze the largest files of the reorder "
+          "window first (rows are still written in input order)\n");
+  fprintf(stderr,
+          "\t--parallel-timing-threshold <frames>:\t\tDerive the timing "
+          "statistics in parallel for files with at least <frames> frames "
+          "(0 to disable) [%i]\n",
+          DEFAULT_OPTIONS.parallel_timing_threshold);
+  fprintf(stderr,
+          "\t--timing-threads <n>:\t\tNumber of threads for the parallel "
+          "timing statistics (0 for the number of hardware threads) [%i]\n",
+          DEFAULT_OPTIONS.timing_threads);
+  fprintf(stderr,
+          "\t--timeout <ms>:\t\tPer-file analysis timeout (0 for no "
+          "timeout) [%i]\n",
+          DEFAULT_OPTIONS.timeout_ms);
+  fprintf(stderr,
+          "\t--max-samples <n>:\t\tLargest number of video samples per "
+          "file (0 for no limit) [%" PRIu64 "]\n",
+          DEFAULT_OPTIONS.max_samples);
+  fprintf(stderr,
+          "\t--max-table-entries <n>:\t\tLargest number of timing table "
+          "entries per file (0 for no limit) [%" PRIu64 "]\n",
+          DEFAULT_OPTIONS.max_table_entries);
+  fprintf(stderr,
+          "\t--max-moov-size <bytes>:\t\tLargest moov (and moof) size per "
+          "file (0 for no limit) [%" PRIu64 "]\n",
+          DEFAULT_OPTIONS.max_moov_size);
+  fprintf(stderr,
+          "\t--max-memory <bytes>:\t\tLargest estimated heap use per file "
+          "(0 for no limit) [%" PRIu64 "]\n",
+          DEFAULT_OPTIONS.max_memory_bytes);
+  fprintf(stderr,
+          "\t--budget-summary-only:\t\tOnly output the summary values of "
+          "the files with sample tables over the budget (instead of "
+          "failing)\n");
+  fprintf(stderr,
+          "\t--serve <socket>:\t\tServe analysis requests on a Unix "
+          "socket (until SIGINT/SIGTERM)\n");
+  fprintf(stderr,
+          "\t--client <socket>:\t\tSend the infiles to an analysis "
+          "server\n");
+  fprintf(stderr,
+          "\t--pass-fds:\t\tSend open file descriptors to the analysis "
+          "server (instead of file names)\n");
+  fprintf(stderr,
+          "\t--watch <dir>:\t\tAnalyze the media files written to (or "
+          "moved into) a directory, until SIGINT/SIGTERM\n");
+  fprintf(stderr,
+          "\t--watch-debounce <ms>:\t\tOnly analyze a watched file after "
+          "this quiet time [%i]\n",
+          DEFAULT_OPTIONS.watch_debounce_ms);
+  fprintf(stderr,
+          "\t--jsonl:\t\tWrite the watched file results as JSON lines "
+          "(instead of CSV)\n");
+  fprintf(stderr,
+          "\t--shard <i>/<n>:\t\tOnly analyze the infiles of shard i (out "
+          "of n, partitioned by a hash of the path)\n");
+  fprintf(stderr,
+          "\t--checkpoint <file>:\t\tRecord the completed infiles, and "
+          "resume the outfile from it after a restart\n");
+  fprintf(stderr,
+          "\t--merge:\t\tInfiles are lcvm CSV outputs (e.g. of the "
+          "shards) to validate and concatenate\n");
 #if ADD_POLICY
   fprintf(stderr, "\t-p policy file:\t\tSpecify policy file to be parsed\n");
   fprintf(stderr,
           "\t--policy policy file:\t\tSpecify policy file to be parsed\n");
+  fprintf(stderr,
+          "\t--rescore:\t\tInfiles are lcvm CSV outputs to re-score "
+          "against the policy\n");
+  fprintf(stderr,
+          "\t--policy-only:\t\tOnly output the policy results (only runs "
+          "the analysis the policy needs)\n");
+  fprintf(stderr,
+          "\t--policy-compile:\t\tWrite the policy file as a binary "
+          "policy to the outfile, and exit\n");
+  fprintf(stderr,
+          "\t--policy-first-error:\t\tOnly run the policy error rules, "
+          "and stop at the first match\n");
 #endif
   fprintf(stderr, "\t-o outfile:\t\tSelect outfile\n");
+  fprintf(stderr,
+          "\t--cache-dir <dir>:\t\tReuse the results of unchanged files "
+          "(result cache directory)\n");
+  fprintf(stderr,
+          "\t--cache-hash-moov:\t\tAlso key the result cache on a hash of "
+          "the moov box\n");
+  fprintf(stderr,
+          "\t--moov-cache:\t\tReuse the analysis of files with identical "
+          "moov boxes\n");
+  fprintf(stderr,
+          "\t--frozen-frames:\t\tDetect frozen (repeated) video frames\n");
+  fprintf(stderr,
+          "\t--mmap:\t\tRead the moov box from a memory mapping of the "
+          "file\n");
   fprintf(stderr,
           "\t--outfile-timestamps outfile_timestamps:\t\tSelect outfile to "
           "dump timestamps\n");
@@ -221,9 +984,52 @@ enum {
   SORT_PTS_OPTION,
   NO_SORT_PTS_OPTION,
   RUNS_OPTION,
+  PREFETCH_THREADS_OPTION,
+  PREFETCH_DEPTH_OPTION,
+  REORDER_DEPTH_OPTION,
+  LARGEST_FIRST_OPTION,
+  PARALLEL_TIMING_THRESHOLD_OPTION,
+  TIMING_THREADS_OPTION,
+  TIMEOUT_OPTION,
+  MAX_SAMPLES_OPTION,
+  MAX_TABLE_ENTRIES_OPTION,
+  MAX_MOOV_SIZE_OPTION,
+  MAX_MEMORY_OPTION,
+  BUDGET_SUMMARY_ONLY_OPTION,
+  SERVE_OPTION,
+  CLIENT_OPTION,
+  PASS_FDS_OPTION,
+  WATCH_OPTION,
+  WATCH_DEBOUNCE_OPTION,
+  JSONL_OPTION,
+  SHARD_OPTION,
+  CHECKPOINT_OPTION,
+  MERGE_OPTION,
   VERSION_OPTION,
+  CACHE_DIR_OPTION,
+  CACHE_HASH_MOOV_OPTION,
+  MOOV_CACHE_OPTION,
+  FROZEN_FRAMES_OPTION,
+  MMAP_OPTION,
+#if ADD_POLICY
+  RESCORE_OPTION,
+  POLICY_ONLY_OPTION,
+  POLICY_COMPILE_OPTION,
+  POLICY_FIRST_ERROR_OPTION,
+#endif
 };
 
+// Parse a (non-negative) budget limit option value.
+uint64_t parse_budget_limit(const char* name, const char* arg) {
+  char* endptr;
+  uint64_t limit = strtoull(arg, &endptr, 0);
+  if (*arg == '-' || *endptr != '\0') {
+    fprintf(stderr, "error: invalid %s parameter: %s\n", name, arg);
+    exit(-1);
+  }
+  return limit;
+}
+
 arg_options* parse_args(int argc, char** argv) {
   int c;
   static arg_options options;
@@ -238,9 +1044,14 @@ arg_options* parse_args(int argc, char** argv) {
   static struct option longopts[] = {
       // matching options to short options
       {"debug", no_argument, nullptr, 'd'},
+      {"jobs", required_argument, nullptr, 'j'},
       {"outfile", required_argument, nullptr, 'o'},
 #if ADD_POLICY
       {"policy", required_argument, nullptr, 'p'},
+      {"rescore", no_argument, nullptr, RESCORE_OPTION},
+      {"policy-only", no_argument, nullptr, POLICY_ONLY_OPTION},
+      {"policy-compile", no_argument, nullptr, POLICY_COMPILE_OPTION},
+      {"policy-first-error", no_argument, nullptr, POLICY_FIRST_ERROR_OPTION},
 #endif
       {"outfile-timestamps", required_argument, nullptr,
        OUTFILE_TIMESTAMPS_OPTION},
@@ -248,6 +1059,36 @@ arg_options* parse_args(int argc, char** argv) {
       {"no-sort-pts", no_argument, nullptr, NO_SORT_PTS_OPTION},
       // options without a short option
       {"runs", required_argument, nullptr, RUNS_OPTION},
+      {"prefetch-threads", required_argument, nullptr,
+       PREFETCH_THREADS_OPTION},
+      {"prefetch-depth", required_argument, nullptr, PREFETCH_DEPTH_OPTION},
+      {"reorder-depth", required_argument, nullptr, REORDER_DEPTH_OPTION},
+      {"largest-first", no_argument, nullptr, LARGEST_FIRST_OPTION},
+      {"parallel-timing-threshold", required_argument, nullptr,
+       PARALLEL_TIMING_THRESHOLD_OPTION},
+      {"timing-threads", required_argument, nullptr, TIMING_THREADS_OPTION},
+      {"timeout", required_argument, nullptr, TIMEOUT_OPTION},
+      {"max-samples", required_argument, nullptr, MAX_SAMPLES_OPTION},
+      {"max-table-entries", required_argument, nullptr,
+       MAX_TABLE_ENTRIES_OPTION},
+      {"max-moov-size", required_argument, nullptr, MAX_MOOV_SIZE_OPTION},
+      {"max-memory", required_argument, nullptr, MAX_MEMORY_OPTION},
+      {"budget-summary-only", no_argument, nullptr,
+       BUDGET_SUMMARY_ONLY_OPTION},
+      {"serve", required_argument, nullptr, SERVE_OPTION},
+      {"client", required_argument, nullptr, CLIENT_OPTION},
+      {"pass-fds", no_argument, nullptr, PASS_FDS_OPTION},
+      {"watch", required_argument, nullptr, WATCH_OPTION},
+      {"watch-debounce", required_argument, nullptr, WATCH_DEBOUNCE_OPTION},
+      {"jsonl", no_argument, nullptr, JSONL_OPTION},
+      {"shard", required_argument, nullptr, SHARD_OPTION},
+      {"checkpoint", required_argument, nullptr, CHECKPOINT_OPTION},
+      {"merge", no_argument, nullptr, MERGE_OPTION},
+      {"cache-dir", required_argument, nullptr, CACHE_DIR_OPTION},
+      {"cache-hash-moov", no_argument, nullptr, CACHE_HASH_MOOV_OPTION},
+      {"moov-cache", no_argument, nullptr, MOOV_CACHE_OPTION},
+      {"frozen-frames", no_argument, nullptr, FROZEN_FRAMES_OPTION},
+      {"mmap", no_argument, nullptr, MMAP_OPTION},
       {"quiet", no_argument, nullptr, QUIET_OPTION},
       {"version", no_argument, NULL, VERSION_OPTION},
       {"help", no_argument, nullptr, HELP_OPTION},
@@ -256,9 +1097,9 @@ arg_options* parse_args(int argc, char** argv) {
   // parse arguments
   while (true) {
 #if ADD_POLICY
-    c = getopt_long(argc, argv, "do:hp:", longopts, &optindex);
+    c = getopt_long(argc, argv, "dj:o:hp:", longopts, &optindex);
 #else
-    c = getopt_long(argc, argv, "do:h", longopts, &optindex);
+    c = getopt_long(argc, argv, "dj:o:h", longopts, &optindex);
 #endif
     if (c == -1) {
       break;
@@ -284,6 +1125,22 @@ arg_options* parse_args(int argc, char** argv) {
       case 'p':
         options.policy_file = optarg;
         break;
+
+      case RESCORE_OPTION:
+        options.rescore = true;
+        break;
+
+      case POLICY_ONLY_OPTION:
+        options.policy_only = true;
+        break;
+
+      case POLICY_COMPILE_OPTION:
+        options.policy_compile = true;
+        break;
+
+      case POLICY_FIRST_ERROR_OPTION:
+        options.policy_first_error = true;
+        break;
 #endif
 
       case OUTFILE_TIMESTAMPS_OPTION:
@@ -311,6 +1168,166 @@ arg_options* parse_args(int argc, char** argv) {
         }
       } break;
 
+      case 'j': {
+        char* endptr;
+        options.jobs = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.jobs < 1) {
+          fprintf(stderr, "error: invalid --jobs parameter: %s\n", optarg);
+          exit(-1);
+        }
+      } break;
+
+      case PREFETCH_THREADS_OPTION: {
+        char* endptr;
+        options.prefetch_threads = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.prefetch_threads < 1) {
+          fprintf(stderr, "error: invalid --prefetch-threads parameter: %s\n",
+                  optarg);
+          exit(-1);
+        }
+      } break;
+
+      case PREFETCH_DEPTH_OPTION: {
+        char* endptr;
+        options.prefetch_depth = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.prefetch_depth < 1) {
+          fprintf(stderr, "error: invalid --prefetch-depth parameter: %s\n",
+                  optarg);
+          exit(-1);
+        }
+      } break;
+
+      case REORDER_DEPTH_OPTION: {
+        char* endptr;
+        options.reorder_depth = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.reorder_depth < 1) {
+          fprintf(stderr, "error: invalid --reorder-depth parameter: %s\n",
+                  optarg);
+          exit(-1);
+        }
+      } break;
+
+      case LARGEST_FIRST_OPTION:
+        options.largest_first = true;
+        break;
+
+      case PARALLEL_TIMING_THRESHOLD_OPTION: {
+        char* endptr;
+        options.parallel_timing_threshold = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.parallel_timing_threshold < 0) {
+          fprintf(stderr,
+                  "error: invalid --parallel-timing-threshold parameter: %s\n",
+                  optarg);
+          exit(-1);
+        }
+      } break;
+
+      case TIMING_THREADS_OPTION: {
+        char* endptr;
+        options.timing_threads = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.timing_threads < 0) {
+          fprintf(stderr, "error: invalid --timing-threads parameter: %s\n",
+                  optarg);
+          exit(-1);
+        }
+      } break;
+
+      case TIMEOUT_OPTION: {
+        char* endptr;
+        options.timeout_ms = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.timeout_ms < 0) {
+          fprintf(stderr, "error: invalid --timeout parameter: %s\n", optarg);
+          exit(-1);
+        }
+      } break;
+
+      case MAX_SAMPLES_OPTION:
+        options.max_samples = parse_budget_limit("--max-samples", optarg);
+        break;
+
+      case MAX_TABLE_ENTRIES_OPTION:
+        options.max_table_entries =
+            parse_budget_limit("--max-table-entries", optarg);
+        break;
+
+      case MAX_MOOV_SIZE_OPTION:
+        options.max_moov_size = parse_budget_limit("--max-moov-size", optarg);
+        break;
+
+      case MAX_MEMORY_OPTION:
+        options.max_memory_bytes = parse_budget_limit("--max-memory", optarg);
+        break;
+
+      case BUDGET_SUMMARY_ONLY_OPTION:
+        options.budget_summary_only = true;
+        break;
+
+      case SERVE_OPTION:
+        options.serve_socket = optarg;
+        break;
+
+      case CLIENT_OPTION:
+        options.client_socket = optarg;
+        break;
+
+      case PASS_FDS_OPTION:
+        options.pass_fds = true;
+        break;
+
+      case WATCH_OPTION:
+        options.watch_dir = optarg;
+        break;
+
+      case WATCH_DEBOUNCE_OPTION: {
+        char* endptr;
+        options.watch_debounce_ms = strtol(optarg, &endptr, 0);
+        if (*endptr != '\0' || options.watch_debounce_ms < 0) {
+          fprintf(stderr, "error: invalid --watch-debounce parameter: %s\n",
+                  optarg);
+          exit(-1);
+        }
+      } break;
+
+      case JSONL_OPTION:
+        options.jsonl = true;
+        break;
+
+      case SHARD_OPTION:
+        if (parse_shard_spec(optarg, &options.shard_index,
+                             &options.num_shards) != 0) {
+          fprintf(stderr, "error: invalid --shard parameter: %s\n", optarg);
+          exit(-1);
+        }
+        break;
+
+      case CHECKPOINT_OPTION:
+        options.checkpoint_file = optarg;
+        break;
+
+      case MERGE_OPTION:
+        options.merge = true;
+        break;
+
+      case CACHE_DIR_OPTION:
+        options.cache_dir = optarg;
+        break;
+
+      case CACHE_HASH_MOOV_OPTION:
+        options.cache_hash_moov = true;
+        break;
+
+      case MOOV_CACHE_OPTION:
+        options.moov_cache = true;
+        break;
+
+      case FROZEN_FRAMES_OPTION:
+        options.frozen_frames = true;
+        break;
+
+      case MMAP_OPTION:
+        options.mmap_input = true;
+        break;
+
       case HELP_OPTION:
       case 'h':
         usage(argv[0]);
@@ -347,10 +1364,15 @@ int main(int argc, char** argv) {
     exit(-1);
   }
 
+  if (options->merge) {
+    return merge_files(options->infile_list, options->outfile,
+                       options->debug);
+  }
+
   std::string policy_str;
 #if ADD_POLICY
   if (options->policy_file) {
-    FILE* pf = fopen(options->policy_file, "r");
+    FILE* pf = fopen(options->policy_file, "rb");
     if (!pf) {
       fprintf(stderr, "Could not open policy file: %s\n", options->policy_file);
       exit(-1);
@@ -367,10 +1389,91 @@ int main(int argc, char** argv) {
   }
 #endif
 
+#if ADD_POLICY
+  if (options->policy_compile) {
+    if (policy_str.empty() || options->outfile == nullptr) {
+      fprintf(stderr,
+              "error: --policy-compile requires a policy file and an "
+              "outfile\n");
+      exit(-1);
+    }
+    std::string policy_binary;
+    if (policy_compile(policy_str, &policy_binary) != 0) {
+      fprintf(stderr, "error: invalid policy file: %s\n",
+              options->policy_file);
+      exit(-1);
+    }
+    FILE* outfp = fopen(options->outfile, "wb");
+    if (!outfp) {
+      fprintf(stderr, "Could not open output file: \"%s\"\n", options->outfile);
+      exit(-1);
+    }
+    fwrite(policy_binary.data(), 1, policy_binary.size(), outfp);
+    fclose(outfp);
+    if (options->debug > 0) {
+      printf("Wrote binary policy (%zu bytes)\n", policy_binary.size());
+    }
+    return 0;
+  }
+
+  if (options->rescore) {
+    if (policy_str.empty()) {
+      fprintf(stderr, "error: --rescore requires a policy file\n");
+      exit(-1);
+    }
+    int ret = 0;
+    for (int i = 0; i < options->nruns; ++i) {
+      ret = rescore_files(options->infile_list, options->outfile,
+                          options->debug, policy_str);
+    }
+    return ret;
+  }
+#endif
+
+  bool policy_only = false;
+  bool policy_first_error = false;
+#if ADD_POLICY
+  policy_only = options->policy_only;
+  policy_first_error = options->policy_first_error;
+#endif
+  BatchPipelineConfig pipeline_config;
+  pipeline_config.compute_threads = options->jobs;
+  pipeline_config.prefetch_threads = options->prefetch_threads;
+  pipeline_config.prefetch_depth = options->prefetch_depth;
+  pipeline_config.reorder_depth = options->reorder_depth;
+  pipeline_config.largest_first = options->largest_first;
+  LiblcvmConfig liblcvm_config;
+  get_liblcvm_config(options, policy_str, policy_only, policy_first_error,
+                     &liblcvm_config);
+  if (options->serve_socket != nullptr) {
+    return serve_requests(options->serve_socket, liblcvm_config,
+                          options->jobs, options->debug);
+  }
+  if (options->watch_dir != nullptr) {
+    return watch_directory(options->watch_dir, liblcvm_config, options->jobs,
+                           options->watch_debounce_ms, options->jsonl,
+                           options->outfile, options->debug);
+  }
+  if (options->client_socket != nullptr) {
+    return send_requests(options->client_socket, options->infile_list,
+                         options->pass_fds, options->outfile);
+  }
+  if (options->checkpoint_file != nullptr &&
+      (options->outfile == nullptr || strcmp(options->outfile, "-") == 0 ||
+       options->outfile_timestamps != nullptr)) {
+    fprintf(stderr,
+            "error: --checkpoint requires an outfile (and no "
+            "--outfile-timestamps)\n");
+    exit(-1);
+  }
+  if (options->num_shards > 0) {
+    options->infile_list = get_shard_files(
+        options->infile_list, options->shard_index, options->num_shards);
+  }
   for (int i = 0; i < options->nruns; ++i) {
-    parse_files(
-        options->infile_list, options->outfile, options->outfile_timestamps,
-        options->outfile_timestamps_sort_pts, options->debug, policy_str);
+    parse_files(options->infile_list, options->outfile,
+                options->outfile_timestamps, options->checkpoint_file,
+                liblcvm_config, pipeline_config);
   }
   return 0;
 }